@@ -192,6 +192,12 @@ struct kdb_fullresync_result_t {
 };
 typedef struct kdb_fullresync_result_t kdb_fullresync_result_t;
 
+struct kdb_wait_t {
+	kdb_last_t lastentry;
+	uint32_t timeout;
+};
+typedef struct kdb_wait_t kdb_wait_t;
+
 #define KRB5_IPROP_PROG 100423
 #define KRB5_IPROP_VERS 1
 
@@ -208,6 +214,9 @@ extern  kdb_fullresync_result_t * iprop_full_resync_1_svc(void *, struct svc_req
 #define IPROP_FULL_RESYNC_EXT 3
 extern	kdb_fullresync_result_t * iprop_full_resync_ext_1(uint32_t *, CLIENT *);
 extern	kdb_fullresync_result_t * iprop_full_resync_ext_1_svc(uint32_t *, struct svc_req *);
+#define IPROP_GET_UPDATES_WAIT 4
+extern	kdb_incr_result_t * iprop_get_updates_wait_1(kdb_wait_t *, CLIENT *);
+extern	kdb_incr_result_t * iprop_get_updates_wait_1_svc(kdb_wait_t *, struct svc_req *);
 extern int krb5_iprop_prog_1_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
 
 #else /* K&R C */
@@ -223,6 +232,9 @@ extern  kdb_fullresync_result_t * iprop_full_resync_1_svc();
 #define IPROP_FULL_RESYNC_EXT 3
 extern  kdb_fullresync_result_t * iprop_full_resync_ext_1(uint32_t *, CLIENT *);
 extern  kdb_fullresync_result_t * iprop_full_resync_ext_1_svc(uint32_t *, struct svc_req *);
+#define IPROP_GET_UPDATES_WAIT 4
+extern  kdb_incr_result_t * iprop_get_updates_wait_1();
+extern  kdb_incr_result_t * iprop_get_updates_wait_1_svc();
 extern int krb5_iprop_prog_1_freeresult ();
 #endif /* K&R C */
 
@@ -246,6 +258,7 @@ extern  bool_t xdr_update_status_t (XDR *, update_status_t*);
 extern  bool_t xdr_kdb_last_t (XDR *, kdb_last_t*);
 extern  bool_t xdr_kdb_incr_result_t (XDR *, kdb_incr_result_t*);
 extern  bool_t xdr_kdb_fullresync_result_t (XDR *, kdb_fullresync_result_t*);
+extern  bool_t xdr_kdb_wait_t (XDR *, kdb_wait_t*);
 
 #else /* K&R C */
 extern bool_t xdr_utf8str_t ();
@@ -265,6 +278,7 @@ extern bool_t xdr_update_status_t ();
 extern bool_t xdr_kdb_last_t ();
 extern bool_t xdr_kdb_incr_result_t ();
 extern bool_t xdr_kdb_fullresync_result_t ();
+extern bool_t xdr_kdb_wait_t ();
 
 #endif /* K&R C */
 
@@ -225,6 +225,7 @@ typedef INT64_TYPE krb5_int64;
 #define KRB5_CONF_IPROP_SLAVE_POLL            "iprop_slave_poll"
 #define KRB5_CONF_IPROP_LOGFILE               "iprop_logfile"
 #define KRB5_CONF_IPROP_RESYNC_TIMEOUT        "iprop_resync_timeout"
+#define KRB5_CONF_IPROP_SYNC_DELAY            "iprop_sync_delay"
 #define KRB5_CONF_K5LOGIN_AUTHORITATIVE       "k5login_authoritative"
 #define KRB5_CONF_K5LOGIN_DIRECTORY           "k5login_directory"
 #define KRB5_CONF_KADMIND_PORT                "kadmind_port"
@@ -232,7 +233,12 @@ typedef INT64_TYPE krb5_int64;
 #define KRB5_CONF_KDC                         "kdc"
 #define KRB5_CONF_KDCDEFAULTS                 "kdcdefaults"
 #define KRB5_CONF_KDC_PORTS                   "kdc_ports"
+#define KRB5_CONF_KDC_PRINCIPAL_CACHE_SIZE    "kdc_principal_cache_size"
+#define KRB5_CONF_KDC_STATS_FILE              "kdc_stats_file"
 #define KRB5_CONF_KDC_TCP_PORTS               "kdc_tcp_ports"
+#define KRB5_CONF_KDC_TCP_LISTEN_BACKLOG      "kdc_tcp_listen_backlog"
+#define KRB5_CONF_KDC_REUSEPORT               "kdc_reuseport"
+#define KRB5_CONF_KDC_UDP_BATCH_SIZE          "kdc_udp_batch_size"
 #define KRB5_CONF_MAX_DGRAM_REPLY_SIZE        "kdc_max_dgram_reply_size"
 #define KRB5_CONF_KDC_DEFAULT_OPTIONS         "kdc_default_options"
 #define KRB5_CONF_KDC_TIMESYNC                "kdc_timesync"
@@ -247,6 +253,7 @@ typedef INT64_TYPE krb5_int64;
 #define KRB5_CONF_LDAP_SERVERS                "ldap_servers"
 #define KRB5_CONF_LDAP_SERVICE_PASSWORD_FILE  "ldap_service_password_file"
 #define KRB5_CONF_LIBDEFAULTS                 "libdefaults"
+#define KRB5_CONF_LOCKOUT_WRITE_DELAY         "lockout_write_delay"
 #define KRB5_CONF_LOGGING                     "logging"
 #define KRB5_CONF_MASTER_KEY_NAME             "master_key_name"
 #define KRB5_CONF_MASTER_KEY_TYPE             "master_key_type"
@@ -261,6 +268,7 @@ typedef INT64_TYPE krb5_int64;
 #define KRB5_CONF_PLUGIN_BASE_DIR             "plugin_base_dir"
 #define KRB5_CONF_PREFERRED_PREAUTH_TYPES     "preferred_preauth_types"
 #define KRB5_CONF_PROXIABLE                   "proxiable"
+#define KRB5_CONF_RCACHE_SYNC                 "rcache_sync"
 #define KRB5_CONF_RDNS                        "rdns"
 #define KRB5_CONF_REALMS                      "realms"
 #define KRB5_CONF_REALM_TRY_DOMAINS           "realm_try_domains"
@@ -672,6 +672,74 @@ krb5_error_code krb5_db_check_allowed_to_delegate(krb5_context kcontext,
                                                   const krb5_db_entry *server,
                                                   krb5_const_principal proxy);
 
+/*
+ * Begin and end a bulk load of the database.  Between the two calls,
+ * krb5_db_put_principal does not write update log entries; instead the update
+ * log is reset by krb5_db_end_bulk_load, so that slaves receive a full
+ * resync.
+ */
+krb5_error_code krb5_db_begin_bulk_load(krb5_context kcontext);
+krb5_error_code krb5_db_end_bulk_load(krb5_context kcontext);
+
+/*
+ * Write any deferred lockout changes which would otherwise still be unwritten
+ * at time deadline beyond the module's configured delay.  The KDC calls this
+ * periodically, so that changes are written even if no further requests
+ * arrive.
+ */
+krb5_error_code krb5_db_flush_lockout(krb5_context kcontext,
+                                      krb5_timestamp deadline);
+
+/*
+ * Deferred lockout updates, for database modules which can delay writing
+ * changes to the fail_auth_count, last_failed, and last_success fields of
+ * principal entries.  A queue is not thread-safe.
+ */
+typedef struct _krb5_db_lockout_queue krb5_db_lockout_queue;
+
+/*
+ * Callback for krb5_db_lockout_queue_flush().  Read the entry for princ from
+ * the database, call krb5_db_lockout_queue_apply() on it, and write it back.
+ * Return KRB5_KDB_NOENTRY if princ no longer exists.
+ */
+typedef krb5_error_code
+(*krb5_db_lockout_write_fn)(krb5_context kcontext, krb5_const_principal princ,
+                            krb5_db_lockout_queue *queue, void *data);
+
+/* Create a queue whose changes should be written after at most max_delay
+ * seconds. */
+krb5_error_code krb5_db_lockout_queue_create(krb5_context kcontext,
+                                             krb5_deltat max_delay,
+                                             krb5_db_lockout_queue **queue_out);
+
+/* Free queue, discarding any changes not yet written. */
+void krb5_db_lockout_queue_free(krb5_context kcontext,
+                                krb5_db_lockout_queue *queue);
+
+/* Apply the queued changes for entry's principal to its lockout fields. */
+void krb5_db_lockout_queue_apply(krb5_context kcontext,
+                                 krb5_db_lockout_queue *queue,
+                                 krb5_db_entry *entry);
+
+/* Queue the lockout field changes from before to after, which are copies of
+ * the same principal entry with queued changes already applied. */
+krb5_error_code krb5_db_lockout_queue_add(krb5_context kcontext,
+                                          krb5_db_lockout_queue *queue,
+                                          const krb5_db_entry *before,
+                                          const krb5_db_entry *after,
+                                          krb5_timestamp stamp);
+
+/* Return true if the queued changes should be written as of now. */
+krb5_boolean krb5_db_lockout_queue_due(krb5_db_lockout_queue *queue,
+                                       krb5_timestamp now);
+
+/* Write all queued changes using write_fn, oldest first.  Changes are removed
+ * from the queue as they are written. */
+krb5_error_code krb5_db_lockout_queue_flush(krb5_context kcontext,
+                                            krb5_db_lockout_queue *queue,
+                                            krb5_db_lockout_write_fn write_fn,
+                                            void *data);
+
 /* default functions. Should not be directly called */
 /*
  *   Default functions prototype
@@ -786,6 +854,24 @@ krb5_dbe_free_strings(krb5_context, krb5_string_attr *, int count);
 void
 krb5_dbe_free_string(krb5_context, char *);
 
+/*
+ * Encode entry into the byte-order-independent record format used by the db2
+ * module and by binary dump files.  Free content->data when done.
+ */
+krb5_error_code
+krb5_encode_princ_entry(krb5_context context, krb5_data *content,
+                        krb5_db_entry *entry);
+
+/* Decode a record produced by krb5_encode_princ_entry().  Free *entry with
+ * krb5_dbe_free() when done. */
+krb5_error_code
+krb5_decode_princ_entry(krb5_context context, krb5_data *content,
+                        krb5_db_entry **entry);
+
+/* Free an entry allocated by krb5_decode_princ_entry(). */
+void
+krb5_dbe_free(krb5_context context, krb5_db_entry *entry);
+
 #define KRB5_KDB_DEF_FLAGS      0
 
 #define KDB_MAX_DB_NAME                 128
@@ -1328,6 +1414,38 @@ typedef struct _kdb_vftabl {
                                                  krb5_const_principal client,
                                                  const krb5_db_entry *server,
                                                  krb5_const_principal proxy);
+
+    /* End of minor version 0. */
+
+    /*
+     * Optional: Prepare the module for a large number of put_principal calls
+     * (such as during kdb5_util load), by acquiring any locks or resources
+     * which would otherwise be acquired and released for each call.  The
+     * module is free to trade durability for speed until end_bulk_load is
+     * called.
+     */
+    krb5_error_code (*begin_bulk_load)(krb5_context kcontext);
+
+    /*
+     * Optional: Finish a bulk load begun with begin_bulk_load, flushing any
+     * buffered changes and releasing the resources acquired for the load.
+     * This method is called whether or not the load was successful.
+     */
+    krb5_error_code (*end_bulk_load)(krb5_context kcontext);
+
+    /* End of minor version 1. */
+
+    /*
+     * Optional: Write any lockout changes which the module has deferred (see
+     * audit_as_req) and which would be older than the module's configured
+     * delay at time deadline.  The KDC calls this method from its event loop
+     * about once a second, from the same thread which makes the module's
+     * other calls for kcontext.
+     */
+    krb5_error_code (*flush_lockout)(krb5_context kcontext,
+                                     krb5_timestamp deadline);
+
+    /* End of minor version 2. */
 } kdb_vftabl;
 
 #endif /* !defined(_WIN32) */
@@ -96,6 +96,8 @@ extern void ulog_free_entries(kdb_incr_update_t *updates, int no_of_updates);
 extern krb5_error_code ulog_set_role(krb5_context ctx, iprop_role role);
 
 extern krb5_error_code ulog_lock(krb5_context ctx, int mode);
+extern void ulog_set_sync_delay(krb5_context ctx, int msec);
+extern krb5_error_code ulog_flush(krb5_context ctx);
 
 typedef struct kdb_hlog {
     uint32_t        kdb_hmagic;     /* Log header magic # */
@@ -125,6 +127,9 @@ typedef struct _kdb_log_context {
     kdb_hlog_t      *ulog;
     uint32_t        ulogentries;
     int             ulogfd;
+    int             sync_delay;     /* Max msec to defer syncing updates */
+    krb5_boolean    sync_pending;   /* Some entries may not be on disk */
+    kdbe_time_t     pending_since;  /* When sync_pending was set */
 } kdb_log_context;
 
 #ifdef  __cplusplus
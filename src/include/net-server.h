@@ -41,6 +41,9 @@ void init_addr(krb5_fulladdr *, struct sockaddr *);
 
 /* exported from net-server.c */
 verto_ctx *loop_init(verto_ev_type types);
+void loop_set_tcp_listen_backlog(int backlog);
+krb5_error_code loop_set_reuseport(int value);
+krb5_error_code loop_set_udp_batch_size(int n);
 krb5_error_code loop_add_udp_port(int port);
 krb5_error_code loop_add_tcp_port(int port);
 krb5_error_code loop_add_rpc_service(int port, u_long prognum, u_long versnum,
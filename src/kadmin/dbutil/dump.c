@@ -29,6 +29,7 @@
  */
 
 #include <stdio.h>
+#include <ctype.h>
 #include <k5-int.h>
 #include <kadm5/admin.h>
 #include <kadm5/server_internal.h>
@@ -66,7 +67,7 @@ krb5_kvno new_mkvno;
 
 typedef krb5_error_code (*dump_func)(krb5_context context,
                                      krb5_db_entry *entry, const char *name,
-                                     FILE *fp, int flags);
+                                     struct k5buf *buf, int flags);
 typedef int (*load_func)(krb5_context context, const char *dumpfile, FILE *fp,
                          int flags, int *linenop);
 
@@ -76,11 +77,14 @@ typedef struct _dump_version {
     int updateonly;
     int iprop;
     int ipropx;
+    int binary;
     dump_func dump_princ;
     osa_adb_iter_policy_func dump_policy;
     load_func load_record;
 } dump_version;
 
+struct dump_pool;
+
 struct dump_args {
     FILE *ofile;
     krb5_context context;
@@ -88,6 +92,10 @@ struct dump_args {
     int nnames;
     int flags;
     dump_version *dump;
+    struct dump_pool *pool;     /* Formatting threads, if any */
+    uint64_t offset;            /* Bytes written (binary dumps only) */
+    struct k5buf index;         /* Record index (binary dumps only) */
+    uint32_t nrecords;          /* Records in index */
 };
 
 /* External data */
@@ -294,16 +302,38 @@ name_matches(char *name, struct dump_args *args)
 
 /* Output "-1" if len is 0; otherwise output len bytes of data in hex. */
 static void
-dump_octets_or_minus1(FILE *fp, unsigned char *data, size_t len)
+dump_octets_or_minus1(struct k5buf *buf, unsigned char *data, size_t len)
 {
-    if (len > 0) {
-        for (; len > 0; len--)
-            fprintf(fp, "%02x", *data++);
-    } else {
-        fprintf(fp, "-1");
+    static const char hexdigits[] = "0123456789abcdef";
+    char hex[256];
+    size_t n;
+
+    if (len == 0) {
+        krb5int_buf_add(buf, "-1");
+        return;
+    }
+    while (len > 0) {
+        for (n = 0; n < sizeof(hex) && len > 0; len--) {
+            hex[n++] = hexdigits[*data >> 4];
+            hex[n++] = hexdigits[*data++ & 0xf];
+        }
+        krb5int_buf_add_len(buf, hex, n);
     }
 }
 
+/* Write the contents of buf to fp. */
+static krb5_error_code
+write_buf(FILE *fp, struct k5buf *buf)
+{
+    ssize_t len = krb5int_buf_len(buf);
+
+    if (len < 0)
+        return ENOMEM;
+    if (fwrite(krb5int_buf_data(buf), 1, len, fp) != (size_t)len)
+        return errno;
+    return 0;
+}
+
 /*
  * Dump TL data; common to principals and policies.
  *
@@ -312,14 +342,14 @@ dump_octets_or_minus1(FILE *fp, unsigned char *data, size_t len)
  * support policies.
  */
 static void
-dump_tl_data(FILE *ofile, krb5_tl_data *tlp, krb5_boolean filter_kadm)
+dump_tl_data(struct k5buf *buf, krb5_tl_data *tlp, krb5_boolean filter_kadm)
 {
     for (; tlp != NULL; tlp = tlp->tl_data_next) {
         if (tlp->tl_data_type == KRB5_TL_KADM_DATA && filter_kadm)
             continue;
-        fprintf(ofile, "\t%d\t%d\t", (int)tlp->tl_data_type,
-                (int)tlp->tl_data_length);
-        dump_octets_or_minus1(ofile, tlp->tl_data_contents,
+        krb5int_buf_add_fmt(buf, "\t%d\t%d\t", (int)tlp->tl_data_type,
+                            (int)tlp->tl_data_length);
+        dump_octets_or_minus1(buf, tlp->tl_data_contents,
                               tlp->tl_data_length);
     }
 }
@@ -328,7 +358,8 @@ dump_tl_data(FILE *ofile, krb5_tl_data *tlp, krb5_boolean filter_kadm)
  * is false. */
 static krb5_error_code
 k5beta7_common(krb5_context context, krb5_db_entry *entry,
-               const char *name, FILE *fp, int flags, krb5_boolean kadm)
+               const char *name, struct k5buf *buf, int flags,
+               krb5_boolean kadm)
 {
     krb5_tl_data *tlp;
     krb5_key_data *kdata;
@@ -367,39 +398,40 @@ k5beta7_common(krb5_context context, krb5_db_entry *entry,
     }
 
     /* Write out header. */
-    fprintf(fp, "princ\t%d\t%lu\t%d\t%d\t%d\t%s\t", (int)entry->len,
-            (unsigned long)strlen(name), counter, (int)entry->n_key_data,
-            (int)entry->e_length, name);
-    fprintf(fp, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d", entry->attributes,
-            entry->max_life, entry->max_renewable_life, entry->expiration,
-            entry->pw_expiration,
-            (flags & FLAG_OMIT_NRA) ? 0 : entry->last_success,
-            (flags & FLAG_OMIT_NRA) ? 0 : entry->last_failed,
-            (flags & FLAG_OMIT_NRA) ? 0 : entry->fail_auth_count);
+    krb5int_buf_add_fmt(buf, "princ\t%d\t%lu\t%d\t%d\t%d\t%s\t",
+                        (int)entry->len, (unsigned long)strlen(name), counter,
+                        (int)entry->n_key_data, (int)entry->e_length, name);
+    krb5int_buf_add_fmt(buf, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d",
+                        entry->attributes, entry->max_life,
+                        entry->max_renewable_life, entry->expiration,
+                        entry->pw_expiration,
+                        (flags & FLAG_OMIT_NRA) ? 0 : entry->last_success,
+                        (flags & FLAG_OMIT_NRA) ? 0 : entry->last_failed,
+                        (flags & FLAG_OMIT_NRA) ? 0 : entry->fail_auth_count);
 
     /* Write out tagged data. */
-    dump_tl_data(fp, entry->tl_data, !kadm);
-    fprintf(fp, "\t");
+    dump_tl_data(buf, entry->tl_data, !kadm);
+    krb5int_buf_add(buf, "\t");
 
     /* Write out key data. */
     for (counter = 0; counter < entry->n_key_data; counter++) {
         kdata = &entry->key_data[counter];
-        fprintf(fp, "%d\t%d\t", (int)kdata->key_data_ver,
-                (int)kdata->key_data_kvno);
+        krb5int_buf_add_fmt(buf, "%d\t%d\t", (int)kdata->key_data_ver,
+                            (int)kdata->key_data_kvno);
         for (i = 0; i < kdata->key_data_ver; i++) {
-            fprintf(fp, "%d\t%d\t", kdata->key_data_type[i],
-                    kdata->key_data_length[i]);
-            dump_octets_or_minus1(fp, kdata->key_data_contents[i],
+            krb5int_buf_add_fmt(buf, "%d\t%d\t", kdata->key_data_type[i],
+                                kdata->key_data_length[i]);
+            dump_octets_or_minus1(buf, kdata->key_data_contents[i],
                                   kdata->key_data_length[i]);
-            fprintf(fp, "\t");
+            krb5int_buf_add(buf, "\t");
         }
     }
 
     /* Write out extra data. */
-    dump_octets_or_minus1(fp, entry->e_data, entry->e_length);
+    dump_octets_or_minus1(buf, entry->e_data, entry->e_length);
 
     /* Write trailer. */
-    fprintf(fp, ";\n");
+    krb5int_buf_add(buf, ";\n");
 
     if (flags & FLAG_VERBOSE)
         fprintf(stderr, "%s\n", name);
@@ -410,16 +442,16 @@ k5beta7_common(krb5_context context, krb5_db_entry *entry,
 /* Output a dump record in krb5b7 format. */
 static krb5_error_code
 dump_k5beta7_princ(krb5_context context, krb5_db_entry *entry,
-                   const char *name, FILE *fp, int flags)
+                   const char *name, struct k5buf *buf, int flags)
 {
-    return k5beta7_common(context, entry, name, fp, flags, FALSE);
+    return k5beta7_common(context, entry, name, buf, flags, FALSE);
 }
 
 static krb5_error_code
 dump_k5beta7_princ_withpolicy(krb5_context context, krb5_db_entry *entry,
-                              const char *name, FILE *fp, int flags)
+                              const char *name, struct k5buf *buf, int flags)
 {
-    return k5beta7_common(context, entry, name, fp, flags, TRUE);
+    return k5beta7_common(context, entry, name, buf, flags, TRUE);
 }
 
 static void
@@ -448,35 +480,242 @@ static void
 dump_r1_11_policy(void *data, osa_policy_ent_t entry)
 {
     struct dump_args *arg = data;
+    struct k5buf buf;
+
+    krb5int_buf_init_dynamic(&buf);
+    krb5int_buf_add_fmt(&buf,
+                        "policy\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t"
+                        "%d\t%d\t%d\t%s\t%d", entry->name,
+                        entry->pw_min_life, entry->pw_max_life,
+                        entry->pw_min_length, entry->pw_min_classes,
+                        entry->pw_history_num, 0, entry->pw_max_fail,
+                        entry->pw_failcnt_interval,
+                        entry->pw_lockout_duration, entry->attributes,
+                        entry->max_life, entry->max_renewable_life,
+                        entry->allowed_keysalts ?
+                        entry->allowed_keysalts : "-", entry->n_tl_data);
+
+    dump_tl_data(&buf, entry->tl_data, FALSE);
+    krb5int_buf_add(&buf, "\n");
+    if (write_buf(arg->ofile, &buf) != 0) {
+        fprintf(stderr, _("%s: error writing policy %s\n"), progname,
+                entry->name);
+        exit_status++;
+    }
+    krb5int_free_buf(&buf);
+}
+
+/*
+ * A binary dump is the header line followed by records, each consisting of a
+ * four-byte type, a four-byte payload length, the payload, and the CRC-32
+ * checksum of the payload.  Integers are big-endian.  Principal payloads use
+ * the krb5_encode_princ_entry() encoding.  The principal and policy records
+ * are followed by an index record giving the type, file offset, and name of
+ * each of them, and then by an end record giving the offset of the index
+ * record and the number of records it lists.  A dump with no end record has
+ * been truncated.
+ */
+
+#define BINARY_PRINC    1
+#define BINARY_POLICY   2
+#define BINARY_INDEX    3
+#define BINARY_END      4
+
+#define BINARY_HEADER_LEN 8
+#define BINARY_CKSUM_LEN 4
+
+/*
+ * Maximum payload length of a principal or policy record.  Real principal
+ * entries are a few kilobytes at most; the limit keeps a corrupt length field
+ * from making the loader allocate gigabytes before the checksum is checked.
+ * Index records are limited by the size of the records they describe, and end
+ * records have a fixed length.
+ */
+#define BINARY_MAX_PAYLOAD (16 * 1024 * 1024)
+#define BINARY_END_LEN 12
+
+/* Compute the CRC-32 checksum of len bytes of data into cksum_out. */
+static krb5_error_code
+binary_cksum(krb5_context context, const void *data, size_t len,
+             unsigned char cksum_out[BINARY_CKSUM_LEN])
+{
+    krb5_error_code ret;
+    krb5_data d = make_data((void *)data, len);
+    krb5_checksum cksum;
+
+    ret = krb5_c_make_checksum(context, CKSUMTYPE_CRC32, NULL, 0, &d,
+                               &cksum);
+    if (ret)
+        return ret;
+    if (cksum.length == BINARY_CKSUM_LEN)
+        memcpy(cksum_out, cksum.contents, BINARY_CKSUM_LEN);
+    else
+        ret = KRB5_BAD_MSIZE;
+    krb5_free_checksum_contents(context, &cksum);
+    return ret;
+}
 
-    fprintf(arg->ofile, "policy\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t"
-            "%d\t%d\t%d\t%s\t%d", entry->name, entry->pw_min_life,
-            entry->pw_max_life, entry->pw_min_length, entry->pw_min_classes,
-            entry->pw_history_num, 0, entry->pw_max_fail,
-            entry->pw_failcnt_interval, entry->pw_lockout_duration,
-            entry->attributes, entry->max_life, entry->max_renewable_life,
-            entry->allowed_keysalts ? entry->allowed_keysalts : "-",
-            entry->n_tl_data);
+static void
+add_u32(struct k5buf *buf, uint32_t val)
+{
+    unsigned char b[4];
 
-    dump_tl_data(arg->ofile, entry->tl_data, FALSE);
-    fprintf(arg->ofile, "\n");
+    store_32_be(val, b);
+    krb5int_buf_add_len(buf, (char *)b, 4);
 }
 
 static void
-print_key_data(FILE *f, krb5_key_data *kd)
+add_counted(struct k5buf *buf, const void *data, size_t len)
+{
+    add_u32(buf, len);
+    krb5int_buf_add_len(buf, data, len);
+}
+
+/* Write a binary dump record with the given type and payload.  If name is not
+ * NULL, add the record to the index. */
+static krb5_error_code
+write_binary_record(struct dump_args *args, uint32_t type, const char *name,
+                    const void *data, size_t len)
+{
+    krb5_error_code ret;
+    unsigned char head[BINARY_HEADER_LEN], cksum[BINARY_CKSUM_LEN], ent[12];
+
+    if ((type == BINARY_PRINC || type == BINARY_POLICY) &&
+        len > BINARY_MAX_PAYLOAD)
+        return EFBIG;
+    ret = binary_cksum(args->context, data, len, cksum);
+    if (ret)
+        return ret;
+    store_32_be(type, head);
+    store_32_be(len, head + 4);
+    if (fwrite(head, 1, sizeof(head), args->ofile) != sizeof(head) ||
+        fwrite(data, 1, len, args->ofile) != len ||
+        fwrite(cksum, 1, sizeof(cksum), args->ofile) != sizeof(cksum))
+        return errno;
+
+    if (name != NULL) {
+        store_32_be(type, ent);
+        store_64_be(args->offset, ent + 4);
+        krb5int_buf_add_len(&args->index, (char *)ent, sizeof(ent));
+        add_counted(&args->index, name, strlen(name));
+        args->nrecords++;
+    }
+    args->offset += sizeof(head) + len + sizeof(cksum);
+    return 0;
+}
+
+/* Write the contents of buf as a binary dump record. */
+static krb5_error_code
+write_binary_buf(struct dump_args *args, uint32_t type, const char *name,
+                 struct k5buf *buf)
+{
+    ssize_t len = krb5int_buf_len(buf);
+
+    if (len < 0)
+        return ENOMEM;
+    return write_binary_record(args, type, name, krb5int_buf_data(buf), len);
+}
+
+/* Output the payload of a binary dump principal record. */
+static krb5_error_code
+dump_binary_princ(krb5_context context, krb5_db_entry *entry,
+                  const char *name, struct k5buf *buf, int flags)
+{
+    krb5_error_code ret;
+    krb5_data data;
+
+    ret = krb5_encode_princ_entry(context, &data, entry);
+    if (ret)
+        return ret;
+    krb5int_buf_add_len(buf, data.data, data.length);
+    free(data.data);
+
+    if (flags & FLAG_VERBOSE)
+        fprintf(stderr, "%s\n", name);
+    return 0;
+}
+
+/* Output a binary dump policy record. */
+static void
+dump_binary_policy(void *data, osa_policy_ent_t entry)
+{
+    struct dump_args *arg = data;
+    struct k5buf buf;
+    krb5_tl_data *tl;
+    const char *ks = entry->allowed_keysalts;
+
+    krb5int_buf_init_dynamic(&buf);
+    add_counted(&buf, entry->name, strlen(entry->name));
+    add_u32(&buf, entry->pw_min_life);
+    add_u32(&buf, entry->pw_max_life);
+    add_u32(&buf, entry->pw_min_length);
+    add_u32(&buf, entry->pw_min_classes);
+    add_u32(&buf, entry->pw_history_num);
+    add_u32(&buf, entry->pw_max_fail);
+    add_u32(&buf, entry->pw_failcnt_interval);
+    add_u32(&buf, entry->pw_lockout_duration);
+    add_u32(&buf, entry->attributes);
+    add_u32(&buf, entry->max_life);
+    add_u32(&buf, entry->max_renewable_life);
+    add_counted(&buf, ks, (ks == NULL) ? 0 : strlen(ks));
+    add_u32(&buf, entry->n_tl_data);
+    for (tl = entry->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        add_u32(&buf, tl->tl_data_type);
+        add_counted(&buf, tl->tl_data_contents, tl->tl_data_length);
+    }
+
+    if (write_binary_buf(arg, BINARY_POLICY, entry->name, &buf) != 0) {
+        fprintf(stderr, _("%s: error writing policy %s\n"), progname,
+                entry->name);
+        exit_status++;
+    } else if (arg->flags & FLAG_VERBOSE) {
+        fprintf(stderr, "%s\n", entry->name);
+    }
+    krb5int_free_buf(&buf);
+}
+
+/* Write the index and end records of a binary dump. */
+static krb5_error_code
+finish_binary_dump(struct dump_args *args)
+{
+    krb5_error_code ret;
+    struct k5buf buf;
+    uint64_t index_offset = args->offset;
+    unsigned char end[BINARY_END_LEN];
+    ssize_t len;
+
+    krb5int_buf_init_dynamic(&buf);
+    add_u32(&buf, args->nrecords);
+    len = krb5int_buf_len(&args->index);
+    if (len > 0)
+        krb5int_buf_add_len(&buf, krb5int_buf_data(&args->index), len);
+    ret = (len < 0) ? ENOMEM : write_binary_buf(args, BINARY_INDEX, NULL,
+                                                &buf);
+    krb5int_free_buf(&buf);
+    if (ret)
+        return ret;
+
+    store_64_be(index_offset, end);
+    store_32_be(args->nrecords, end + 8);
+    return write_binary_record(args, BINARY_END, NULL, end, sizeof(end));
+}
+
+static void
+print_key_data(struct k5buf *buf, krb5_key_data *kd)
 {
     int c;
 
-    fprintf(f, "%d\t%d\t", kd->key_data_type[0], kd->key_data_length[0]);
+    krb5int_buf_add_fmt(buf, "%d\t%d\t", kd->key_data_type[0],
+                        kd->key_data_length[0]);
     for (c = 0; c < kd->key_data_length[0]; c++)
-        fprintf(f, "%02x ", kd->key_data_contents[0][c]);
+        krb5int_buf_add_fmt(buf, "%02x ", kd->key_data_contents[0][c]);
 }
 
 /* Output osa_adb_princ_ent data in a printable serialized format, suitable for
  * ovsec_adm_import consumption. */
 static krb5_error_code
 dump_ov_princ(krb5_context context, krb5_db_entry *entry, const char *name,
-              FILE *fp, int flags)
+              struct k5buf *buf, int flags)
 {
     char *princstr;
     unsigned int x;
@@ -501,13 +740,14 @@ dump_ov_princ(krb5_context context, krb5_db_entry *entry, const char *name,
     xdr_destroy(&xdrs);
 
     krb5_unparse_name(context, entry->princ, &princstr);
-    fprintf(fp, "princ\t%s\t", princstr);
+    krb5int_buf_add_fmt(buf, "princ\t%s\t", princstr);
     if (adb.policy == NULL)
-        fputc('\t', fp);
+        krb5int_buf_add(buf, "\t");
     else
-        fprintf(fp, "%s\t", adb.policy);
-    fprintf(fp, "%lx\t%d\t%d\t%d", adb.aux_attributes, adb.old_key_len,
-            adb.old_key_next, adb.admin_history_kvno);
+        krb5int_buf_add_fmt(buf, "%s\t", adb.policy);
+    krb5int_buf_add_fmt(buf, "%lx\t%d\t%d\t%d", adb.aux_attributes,
+                        adb.old_key_len, adb.old_key_next,
+                        adb.admin_history_kvno);
 
     for (x = 0; x < adb.old_key_len; x++) {
         foundcrc = 0;
@@ -523,8 +763,8 @@ dump_ov_princ(krb5_context context, krb5_db_entry *entry, const char *name,
             }
             foundcrc++;
 
-            fputc('\t', fp);
-            print_key_data(fp, key_data);
+            krb5int_buf_add(buf, "\t");
+            print_key_data(buf, key_data);
         }
         if (!foundcrc) {
             fprintf(stderr, _("Warning!  No DES-CBC-CRC key for principal %s, "
@@ -533,16 +773,328 @@ dump_ov_princ(krb5_context context, krb5_db_entry *entry, const char *name,
         }
     }
 
-    fputc('\n', fp);
+    krb5int_buf_add(buf, "\n");
     free(princstr);
     return 0;
 }
 
+#ifdef ENABLE_THREADS
+
+/*
+ * Parallel dump.  The iterator callback copies each principal entry into the
+ * next slot of a ring of jobs, and a pool of threads formats the queued
+ * entries into per-job buffers.  The iterator thread writes the buffers out in
+ * iteration order before reusing their slots, so the output is the same as for
+ * a single-threaded dump.  Only formats which need nothing from the context
+ * are formatted in parallel.
+ */
+
+#define JOBS_PER_THREAD 64
+
+struct dump_job {
+    krb5_db_entry *entry;
+    char *name;
+    struct k5buf buf;
+    krb5_error_code ret;
+    krb5_boolean done;          /* Protected by pool lock */
+};
+
+struct dump_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   /* Signaled when a job is queued */
+    pthread_cond_t done_cond;   /* Signaled when a job is formatted */
+    struct dump_args *args;
+    struct dump_job *jobs;
+    size_t njobs;
+    unsigned long queued;       /* Protected by lock */
+    unsigned long taken;        /* Protected by lock */
+    unsigned long written;      /* Only used by the iterator thread */
+    krb5_boolean stop;          /* Protected by lock */
+    pthread_t *threads;
+    int nthreads;
+};
+
+/* Make a copy of in which can be freed with krb5_db_free_principal(). */
+static krb5_error_code
+copy_entry(krb5_context context, krb5_db_entry *in, krb5_db_entry **out)
+{
+    krb5_error_code ret;
+    krb5_db_entry *ent;
+    krb5_tl_data *tl, **tlp;
+    krb5_key_data *kd;
+    int i, j;
+
+    *out = NULL;
+    ent = krb5_db_alloc(context, NULL, sizeof(*ent));
+    if (ent == NULL)
+        return ENOMEM;
+    *ent = *in;
+    ent->e_data = NULL;
+    ent->princ = NULL;
+    ent->tl_data = NULL;
+    ent->key_data = NULL;
+    ent->n_key_data = 0;
+
+    ret = ENOMEM;
+    if (in->e_length > 0) {
+        ent->e_data = malloc(in->e_length);
+        if (ent->e_data == NULL)
+            goto cleanup;
+        memcpy(ent->e_data, in->e_data, in->e_length);
+    }
+
+    ret = krb5_copy_principal(context, in->princ, &ent->princ);
+    if (ret)
+        goto cleanup;
+
+    ret = ENOMEM;
+    tlp = &ent->tl_data;
+    for (tl = in->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        *tlp = calloc(1, sizeof(**tlp));
+        if (*tlp == NULL)
+            goto cleanup;
+        (*tlp)->tl_data_type = tl->tl_data_type;
+        (*tlp)->tl_data_length = tl->tl_data_length;
+        if (tl->tl_data_length > 0) {
+            (*tlp)->tl_data_contents = malloc(tl->tl_data_length);
+            if ((*tlp)->tl_data_contents == NULL)
+                goto cleanup;
+            memcpy((*tlp)->tl_data_contents, tl->tl_data_contents,
+                   tl->tl_data_length);
+        }
+        tlp = &(*tlp)->tl_data_next;
+    }
+
+    if (in->n_key_data > 0) {
+        ent->key_data = calloc(in->n_key_data, sizeof(*kd));
+        if (ent->key_data == NULL)
+            goto cleanup;
+        for (i = 0; i < in->n_key_data; i++) {
+            kd = &ent->key_data[i];
+            *kd = in->key_data[i];
+            memset(kd->key_data_contents, 0, sizeof(kd->key_data_contents));
+            ent->n_key_data++;
+            for (j = 0; j < kd->key_data_ver; j++) {
+                if (kd->key_data_length[j] == 0)
+                    continue;
+                kd->key_data_contents[j] = malloc(kd->key_data_length[j]);
+                if (kd->key_data_contents[j] == NULL)
+                    goto cleanup;
+                memcpy(kd->key_data_contents[j],
+                       in->key_data[i].key_data_contents[j],
+                       kd->key_data_length[j]);
+            }
+        }
+    }
+
+    *out = ent;
+    ent = NULL;
+    ret = 0;
+
+cleanup:
+    krb5_db_free_principal(context, ent);
+    return ret;
+}
+
+static void *
+dump_thread(void *ptr)
+{
+    struct dump_pool *pool = ptr;
+    struct dump_args *args = pool->args;
+    struct dump_job *job;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->taken == pool->queued)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->taken == pool->queued)
+            break;
+        job = &pool->jobs[pool->taken++ % pool->njobs];
+        pthread_mutex_unlock(&pool->lock);
+
+        job->ret = args->dump->dump_princ(NULL, job->entry, job->name,
+                                          &job->buf, args->flags);
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = TRUE;
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void
+free_job(krb5_context context, struct dump_job *job)
+{
+    krb5_db_free_principal(context, job->entry);
+    free(job->name);
+    krb5int_free_buf(&job->buf);
+    job->entry = NULL;
+    job->name = NULL;
+    job->done = FALSE;
+}
+
+/* Wait for the oldest unwritten job to be formatted, and write it out. */
+static krb5_error_code
+write_next_job(struct dump_pool *pool)
+{
+    struct dump_job *job = &pool->jobs[pool->written % pool->njobs];
+    krb5_error_code ret;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    ret = job->ret;
+    if (ret == 0)
+        ret = write_buf(pool->args->ofile, &job->buf);
+    free_job(pool->args->context, job);
+    pool->written++;
+    return ret;
+}
+
+/* Queue a copy of entry to be formatted, taking ownership of name. */
+static krb5_error_code
+queue_job(struct dump_pool *pool, krb5_db_entry *entry, char *name)
+{
+    krb5_error_code ret;
+    struct dump_job *job;
+
+    if (pool->queued - pool->written == pool->njobs) {
+        ret = write_next_job(pool);
+        if (ret) {
+            free(name);
+            return ret;
+        }
+    }
+
+    job = &pool->jobs[pool->queued % pool->njobs];
+    ret = copy_entry(pool->args->context, entry, &job->entry);
+    if (ret) {
+        free(name);
+        return ret;
+    }
+    job->name = name;
+    krb5int_buf_init_dynamic(&job->buf);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* Stop the threads in pool and free it. */
+static void
+stop_pool(struct dump_pool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    for (; pool->written < pool->queued; pool->written++)
+        free_job(pool->args->context, &pool->jobs[pool->written %
+                                                  pool->njobs]);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->jobs);
+    free(pool->threads);
+    free(pool);
+}
+
+/* Write out all queued jobs, then stop the threads in pool and free it. */
+static krb5_error_code
+finish_pool(struct dump_pool *pool)
+{
+    krb5_error_code ret = 0;
+
+    while (ret == 0 && pool->written < pool->queued)
+        ret = write_next_job(pool);
+    stop_pool(pool);
+    return ret;
+}
+
+/* Start nthreads threads to format principal entries for args. */
+static krb5_error_code
+start_pool(struct dump_args *args, int nthreads, struct dump_pool **pool_out)
+{
+    struct dump_pool *pool;
+
+    *pool_out = NULL;
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return ENOMEM;
+    pool->args = args;
+    pool->njobs = nthreads * JOBS_PER_THREAD;
+    pool->jobs = calloc(pool->njobs, sizeof(*pool->jobs));
+    pool->threads = calloc(nthreads, sizeof(*pool->threads));
+    if (pool->jobs == NULL || pool->threads == NULL) {
+        free(pool->jobs);
+        free(pool->threads);
+        free(pool);
+        return ENOMEM;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (; pool->nthreads < nthreads; pool->nthreads++) {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, dump_thread,
+                           pool) != 0) {
+            stop_pool(pool);
+            return EAGAIN;
+        }
+    }
+    *pool_out = pool;
+    return 0;
+}
+
+#else /* ENABLE_THREADS */
+
+struct dump_pool {
+    int dummy;
+};
+
+static krb5_error_code
+queue_job(struct dump_pool *pool, krb5_db_entry *entry, char *name)
+{
+    abort();
+}
+
+static void
+stop_pool(struct dump_pool *pool)
+{
+}
+
+static krb5_error_code
+finish_pool(struct dump_pool *pool)
+{
+    return 0;
+}
+
+/* Without thread support, always dump serially. */
+static krb5_error_code
+start_pool(struct dump_args *args, int nthreads, struct dump_pool **pool_out)
+{
+    *pool_out = NULL;
+    return 0;
+}
+
+#endif /* ENABLE_THREADS */
+
 static krb5_error_code
 dump_iterator(void *ptr, krb5_db_entry *entry)
 {
     krb5_error_code ret;
     struct dump_args *args = ptr;
+    struct k5buf buf;
     char *name;
 
     ret = krb5_unparse_name(args->context, entry->princ, &name);
@@ -565,8 +1117,17 @@ dump_iterator(void *ptr, krb5_db_entry *entry)
     if (args->nnames > 0 && !name_matches(name, args))
         goto cleanup;
 
-    ret = args->dump->dump_princ(args->context, entry, name, args->ofile,
+    if (args->pool != NULL)
+        return queue_job(args->pool, entry, name);
+
+    krb5int_buf_init_dynamic(&buf);
+    ret = args->dump->dump_princ(args->context, entry, name, &buf,
                                  args->flags);
+    if (ret == 0 && args->dump->binary)
+        ret = write_binary_buf(args, BINARY_PRINC, name, &buf);
+    else if (ret == 0)
+        ret = write_buf(args->ofile, &buf);
+    krb5int_free_buf(&buf);
 
 cleanup:
     free(name);
@@ -598,16 +1159,41 @@ read_string(FILE *f, char *buf, int len, int *lp)
     return 0;
 }
 
-/* Read a string of two-character representations of bytes. */
+/* Return the value of the hex digit c, or -1 if it is not a hex digit. */
+static inline int
+hexval(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Read a string of two-character representations of bytes.  Like a
+ * fscanf("%02x") for each byte, skip leading whitespace before each one. */
 static int
 read_octet_string(FILE *f, unsigned char *buf, int len)
 {
-    int c, i;
+    int c, hi, lo, i;
 
     for (i = 0; i < len; i++) {
-        if (fscanf(f, "%02x", &c) != 1)
+        do {
+            c = getc(f);
+        } while (c != EOF && isspace(c));
+        hi = hexval(c);
+        if (hi < 0)
             return 1;
-        buf[i] = c;
+        c = getc(f);
+        lo = hexval(c);
+        if (lo < 0) {
+            ungetc(c, f);
+            buf[i] = hi;
+        } else {
+            buf[i] = (hi << 4) | lo;
+        }
     }
     return 0;
 }
@@ -697,6 +1283,202 @@ process_tl_data(const char *fname, FILE *filep, int lineno,
     return 0;
 }
 
+#ifdef ENABLE_THREADS
+
+/*
+ * Pipelined load.  A parser thread reads the dump while the main thread stores
+ * the parsed principal entries, so that parsing overlaps with database writes.
+ * Only the main thread uses the krb5 context: the parser thread runs with a
+ * null context, allocates entries with calloc(), and leaves principal names
+ * unparsed.  The main thread moves each entry into memory allocated by the
+ * database module before storing it.  A policy is handed to the main thread
+ * once it has stored every queued entry, and the parser waits for the result.
+ */
+
+#define LOAD_QUEUE_SIZE 1024
+
+struct load_item {
+    krb5_db_entry *entry;
+    char *name;
+};
+
+struct load_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* Signaled on any change to the fields below */
+    struct load_item items[LOAD_QUEUE_SIZE];
+    unsigned long head, tail;   /* Items from head to tail are queued */
+    osa_policy_ent_t policy;    /* Policy waiting to be stored, if any */
+    int policy_result;          /* Result of storing the last policy */
+    krb5_boolean done;          /* The parser thread has finished */
+    krb5_boolean failed;        /* An entry could not be stored */
+    int parse_result;           /* restore_dump() result in the parser */
+
+    /* Arguments for the parser thread. */
+    char *dumpfile;
+    FILE *f;
+    int flags;
+    dump_version *dump;
+};
+
+/* The pipeline for the current load, if it is pipelined. */
+static struct load_pipe *load_pipe;
+
+#endif /* ENABLE_THREADS */
+
+/* Allocate an empty principal entry for a dump record.  In a pipelined load
+ * the parser thread cannot use the context, so use calloc(). */
+static krb5_db_entry *
+alloc_princ(krb5_context context)
+{
+    krb5_db_entry *entry;
+
+#ifdef ENABLE_THREADS
+    if (load_pipe != NULL)
+        return calloc(1, sizeof(*entry));
+#endif
+    entry = krb5_db_alloc(context, NULL, sizeof(*entry));
+    if (entry != NULL)
+        memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+/* Free an entry allocated with calloc() by the parser thread of a pipelined
+ * load.  Its principal is never set. */
+static void
+free_parsed_princ(krb5_db_entry *entry)
+{
+    krb5_tl_data *tl, *tl_next;
+    krb5_key_data *kd;
+    int i, j;
+
+    if (entry == NULL)
+        return;
+    for (tl = entry->tl_data; tl != NULL; tl = tl_next) {
+        tl_next = tl->tl_data_next;
+        free(tl->tl_data_contents);
+        free(tl);
+    }
+    if (entry->key_data != NULL) {
+        for (i = 0; i < entry->n_key_data; i++) {
+            kd = &entry->key_data[i];
+            for (j = 0; j < KRB5_KDB_V1_KEY_DATA_ARRAY; j++) {
+                if (kd->key_data_contents[j] != NULL) {
+                    zap(kd->key_data_contents[j], kd->key_data_length[j]);
+                    free(kd->key_data_contents[j]);
+                }
+            }
+        }
+        free(entry->key_data);
+    }
+    free(entry->e_data);
+    free(entry);
+}
+
+/* Free an entry allocated with alloc_princ(). */
+static void
+free_princ(krb5_context context, krb5_db_entry *entry)
+{
+#ifdef ENABLE_THREADS
+    if (load_pipe != NULL) {
+        free_parsed_princ(entry);
+        return;
+    }
+#endif
+    krb5_db_free_principal(context, entry);
+}
+
+/* Parse name into entry's principal and add entry to the database.  Return 0
+ * on success, 1 on failure. */
+static int
+put_princ(krb5_context context, krb5_db_entry *entry, const char *name,
+          int flags)
+{
+    krb5_error_code ret;
+
+    ret = krb5_parse_name(context, name, &entry->princ);
+    if (ret) {
+        com_err(progname, ret, _("while parsing name %s"), name);
+        return 1;
+    }
+    ret = krb5_db_put_principal(context, entry);
+    if (ret) {
+        com_err(progname, ret, _("while storing %s"), name);
+        return 1;
+    }
+    if (flags & FLAG_VERBOSE)
+        fprintf(stderr, "%s\n", name);
+    return 0;
+}
+
+/* Add *entry with the unparsed principal name *name to the database, or queue
+ * it to be added by the main thread (taking ownership of *entry and *name) if
+ * the load is pipelined.  Return 0 on success, 1 on failure. */
+static int
+store_princ(krb5_context context, krb5_db_entry **entry, char **name,
+            int flags)
+{
+#ifdef ENABLE_THREADS
+    struct load_pipe *lp = load_pipe;
+    struct load_item *item;
+
+    if (lp != NULL) {
+        pthread_mutex_lock(&lp->lock);
+        while (!lp->failed && lp->tail - lp->head == LOAD_QUEUE_SIZE)
+            pthread_cond_wait(&lp->cond, &lp->lock);
+        if (lp->failed) {
+            pthread_mutex_unlock(&lp->lock);
+            return 1;
+        }
+        item = &lp->items[lp->tail++ % LOAD_QUEUE_SIZE];
+        item->entry = *entry;
+        item->name = *name;
+        *entry = NULL;
+        *name = NULL;
+        pthread_cond_broadcast(&lp->cond);
+        pthread_mutex_unlock(&lp->lock);
+        return 0;
+    }
+#endif
+    return put_princ(context, *entry, *name, flags);
+}
+
+/* Create or replace a policy.  Return 0 on success, 1 on failure. */
+static int
+put_policy(krb5_context context, osa_policy_ent_t rec)
+{
+    krb5_error_code ret;
+
+    ret = krb5_db_create_policy(context, rec);
+    if (ret)
+        ret = krb5_db_put_policy(context, rec);
+    if (ret)
+        com_err(progname, ret, _("while creating policy"));
+    return ret ? 1 : 0;
+}
+
+/* Create or replace a policy, or have the main thread do so if the load is
+ * pipelined.  Return 0 on success, 1 on failure. */
+static int
+store_policy(krb5_context context, osa_policy_ent_t rec)
+{
+#ifdef ENABLE_THREADS
+    struct load_pipe *lp = load_pipe;
+    int result;
+
+    if (lp != NULL) {
+        pthread_mutex_lock(&lp->lock);
+        lp->policy = rec;
+        pthread_cond_broadcast(&lp->cond);
+        while (lp->policy != NULL)
+            pthread_cond_wait(&lp->cond, &lp->lock);
+        result = lp->policy_result;
+        pthread_mutex_unlock(&lp->lock);
+        return result;
+    }
+#endif
+    return put_policy(context, rec);
+}
+
 /* Read a beta 7 entry and add it to the database.  Return -1 for end of file,
  * 0 for success and 1 for failure. */
 static int
@@ -710,12 +1492,10 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
     char *name = NULL;
     krb5_key_data *kp = NULL, *kd;
     krb5_tl_data *tl;
-    krb5_error_code ret;
 
-    dbentry = krb5_db_alloc(context, NULL, sizeof(*dbentry));
+    dbentry = alloc_princ(context);
     if (dbentry == NULL)
         return 1;
-    memset(dbentry, 0, sizeof(*dbentry));
     (*linenop)++;
     nread = fscanf(filep, "%u\t%u\t%u\t%u\t%u\t", &u1, &u2, &u3, &u4, &u5);
     if (nread == EOF) {
@@ -750,16 +1530,11 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
         kp = NULL;
     }
 
-    /* Read in and parse the principal name */
+    /* Read in the principal name; store_princ() will parse it. */
     if (read_string(filep, name, u2, linenop)) {
         load_err(fname, *linenop, _("cannot read name string"));
         goto fail;
     }
-    ret = krb5_parse_name(context, name, &dbentry->princ);
-    if (ret) {
-        com_err(progname, ret, _("while parsing name %s"), name);
-        goto fail;
-    }
 
     /* Get the fixed principal attributes */
     nread = fscanf(filep, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t",
@@ -852,20 +1627,15 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
     /* Finally, find the end of the record. */
     read_record_end(filep, fname, *linenop);
 
-    ret = krb5_db_put_principal(context, dbentry);
-    if (ret) {
-        com_err(progname, ret, _("while storing %s"), name);
+    if (store_princ(context, &dbentry, &name, flags))
         goto fail;
-    }
-
-    if (flags & FLAG_VERBOSE)
-        fprintf(stderr, "%s\n", name);
     retval = 0;
 
 cleanup:
     free(kp);
     free(name);
-    krb5_db_free_principal(context, dbentry);
+    if (dbentry != NULL)
+        free_princ(context, dbentry);
     return retval;
 
 fail:
@@ -880,7 +1650,7 @@ process_k5beta7_policy(krb5_context context, const char *fname, FILE *filep,
     osa_policy_ent_rec rec;
     char namebuf[1024];
     unsigned int refcnt;
-    int nread, ret;
+    int nread;
 
     memset(&rec, 0, sizeof(rec));
 
@@ -897,13 +1667,8 @@ process_k5beta7_policy(krb5_context context, const char *fname, FILE *filep,
         return 1;
     }
 
-    ret = krb5_db_create_policy(context, &rec);
-    if (ret)
-        ret = krb5_db_put_policy(context, &rec);
-    if (ret) {
-        com_err(progname, ret, _("while creating policy"));
+    if (store_policy(context, &rec))
         return 1;
-    }
     if (flags & FLAG_VERBOSE)
         fprintf(stderr, _("created policy %s\n"), rec.name);
 
@@ -917,7 +1682,7 @@ process_r1_8_policy(krb5_context context, const char *fname, FILE *filep,
     osa_policy_ent_rec rec;
     char namebuf[1024];
     unsigned int refcnt;
-    int nread, ret;
+    int nread;
 
     memset(&rec, 0, sizeof(rec));
 
@@ -936,13 +1701,8 @@ process_r1_8_policy(krb5_context context, const char *fname, FILE *filep,
         return 1;
     }
 
-    ret = krb5_db_create_policy(context, &rec);
-    if (ret)
-        ret = krb5_db_put_policy(context, &rec);
-    if (ret) {
-        com_err(progname, ret, _("while creating policy"));
+    if (store_policy(context, &rec))
         return 1;
-    }
     if (flags & FLAG_VERBOSE)
         fprintf(stderr, "created policy %s\n", rec.name);
 
@@ -994,13 +1754,9 @@ process_r1_11_policy(krb5_context context, const char *fname, FILE *filep,
     if (ret)
         goto cleanup;
 
-    ret = krb5_db_create_policy(context, &rec);
+    ret = store_policy(context, &rec);
     if (ret)
-        ret = krb5_db_put_policy(context, &rec);
-    if (ret) {
-        com_err(progname, ret, _("while creating policy"));
         goto cleanup;
-    }
     if (flags & FLAG_VERBOSE)
         fprintf(stderr, "created policy %s\n", rec.name);
 
@@ -1013,8 +1769,11 @@ cleanup:
     return ret ? 1 : 0;
 }
 
+/* Set when the load reads an explicit end record. */
+static krb5_boolean end_record_seen;
+
 /* Read a record which is tagged with "princ" or "policy", calling princfn
- * or policyfn as appropriate. */
+ * or policyfn as appropriate.  An "End" record ends the dump. */
 static int
 process_tagged(krb5_context context, const char *fname, FILE *filep, int flags,
                int *linenop, load_func princfn, load_func policyfn)
@@ -1031,8 +1790,11 @@ process_tagged(krb5_context context, const char *fname, FILE *filep, int flags,
         return (*princfn)(context, fname, filep, flags, linenop);
     if (strcmp(rectype, "policy") == 0)
         return (*policyfn)(context, fname, filep, flags, linenop);
-    if (strcmp(rectype, "End") == 0)  /* Only expected for OV format */
+    if (strcmp(rectype, "End") == 0) {
+        /* Ends OV dumps and dumps streamed by kpropd. */
+        end_record_seen = TRUE;
         return -1;
+    }
 
     fprintf(stderr, _("unknown record type \"%s\"\n"), rectype);
     return 1;
@@ -1070,12 +1832,333 @@ process_r1_11_record(krb5_context context, const char *fname, FILE *filep,
                           process_k5beta7_princ, process_r1_11_policy);
 }
 
+/* State carried between records while loading a binary dump. */
+struct binary_load {
+    uint64_t offset;            /* File offset of the next record */
+    struct k5buf seen;          /* Type and offset of each indexed record */
+    uint32_t nseen;
+    krb5_boolean have_index;
+    uint64_t index_offset;
+};
+
+static struct binary_load binload;
+
+/* Prepare to load a binary dump whose header line was hlen bytes long. */
+static void
+start_binary_load(size_t hlen)
+{
+    memset(&binload, 0, sizeof(binload));
+    binload.offset = hlen;
+    krb5int_buf_init_dynamic(&binload.seen);
+}
+
+static void
+end_binary_load(void)
+{
+    krb5int_free_buf(&binload.seen);
+}
+
+struct bincursor {
+    const unsigned char *ptr;
+    size_t len;
+    krb5_boolean bad;           /* Set if we tried to read past the end */
+};
+
+static const unsigned char *
+get_bytes(struct bincursor *c, size_t len)
+{
+    const unsigned char *p = c->ptr;
+
+    if (c->bad || c->len < len) {
+        c->bad = TRUE;
+        return NULL;
+    }
+    c->ptr += len;
+    c->len -= len;
+    return p;
+}
+
+static uint32_t
+get_u32(struct bincursor *c)
+{
+    const unsigned char *p = get_bytes(c, 4);
+
+    return (p == NULL) ? 0 : load_32_be(p);
+}
+
+static uint64_t
+get_u64(struct bincursor *c)
+{
+    const unsigned char *p = get_bytes(c, 8);
+
+    return (p == NULL) ? 0 : load_64_be(p);
+}
+
+/* Read a counted byte string into a newly allocated null-terminated string,
+ * setting *len_out to its length if len_out is not NULL.  Return NULL if the
+ * cursor is exhausted or allocation fails. */
+static char *
+get_counted(struct bincursor *c, size_t *len_out)
+{
+    const unsigned char *p;
+    uint32_t len;
+    char *str;
+
+    len = get_u32(c);
+    p = get_bytes(c, len);
+    if (p == NULL)
+        return NULL;
+    str = malloc(len + 1);
+    if (str == NULL) {
+        c->bad = TRUE;
+        return NULL;
+    }
+    memcpy(str, p, len);
+    str[len] = '\0';
+    if (len_out != NULL)
+        *len_out = len;
+    return str;
+}
+
+/* Decode and store a binary dump policy payload.  Return 0 on success, 1 on
+ * failure. */
+static int
+load_binary_policy(krb5_context context, const unsigned char *data,
+                   size_t len, int flags)
+{
+    struct bincursor c = { data, len, FALSE };
+    osa_policy_ent_rec rec;
+    krb5_tl_data *tl, **tlp;
+    size_t slen = 0;
+    int i, ret = 1;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.name = get_counted(&c, NULL);
+    rec.pw_min_life = get_u32(&c);
+    rec.pw_max_life = get_u32(&c);
+    rec.pw_min_length = get_u32(&c);
+    rec.pw_min_classes = get_u32(&c);
+    rec.pw_history_num = get_u32(&c);
+    rec.pw_max_fail = get_u32(&c);
+    rec.pw_failcnt_interval = get_u32(&c);
+    rec.pw_lockout_duration = get_u32(&c);
+    rec.attributes = get_u32(&c);
+    rec.max_life = get_u32(&c);
+    rec.max_renewable_life = get_u32(&c);
+    rec.allowed_keysalts = get_counted(&c, &slen);
+    if (rec.allowed_keysalts != NULL && slen == 0) {
+        free(rec.allowed_keysalts);
+        rec.allowed_keysalts = NULL;
+    }
+    rec.n_tl_data = get_u32(&c);
+    tlp = &rec.tl_data;
+    for (i = 0; !c.bad && i < rec.n_tl_data; i++) {
+        *tlp = calloc(1, sizeof(**tlp));
+        if (*tlp == NULL)
+            goto cleanup;
+        (*tlp)->tl_data_type = get_u32(&c);
+        (*tlp)->tl_data_contents = (krb5_octet *)get_counted(&c, &slen);
+        (*tlp)->tl_data_length = slen;
+        tlp = &(*tlp)->tl_data_next;
+    }
+    if (c.bad || c.len != 0 || rec.name == NULL || rec.n_tl_data < 0) {
+        fprintf(stderr, _("%s: cannot parse binary policy record\n"),
+                progname);
+        goto cleanup;
+    }
+
+    ret = store_policy(context, &rec);
+    if (ret == 0 && (flags & FLAG_VERBOSE))
+        fprintf(stderr, _("created policy %s\n"), rec.name);
+
+cleanup:
+    while (rec.tl_data != NULL) {
+        tl = rec.tl_data->tl_data_next;
+        free(rec.tl_data->tl_data_contents);
+        free(rec.tl_data);
+        rec.tl_data = tl;
+    }
+    free(rec.name);
+    free(rec.allowed_keysalts);
+    return ret;
+}
+
+/* Decode and store a binary dump principal payload.  Return 0 on success, 1
+ * on failure. */
+static int
+load_binary_princ(krb5_context context, unsigned char *data, size_t len,
+                  int flags)
+{
+    krb5_error_code ret;
+    krb5_data d = make_data(data, len);
+    krb5_db_entry *entry;
+    char *name;
+
+    ret = krb5_decode_princ_entry(context, &d, &entry);
+    if (ret) {
+        com_err(progname, ret, _("while decoding principal record"));
+        return 1;
+    }
+    ret = krb5_unparse_name(context, entry->princ, &name);
+    if (ret) {
+        com_err(progname, ret, _("while unparsing principal name"));
+        krb5_dbe_free(context, entry);
+        return 1;
+    }
+    ret = krb5_db_put_principal(context, entry);
+    if (ret)
+        com_err(progname, ret, _("while storing %s"), name);
+    else if (flags & FLAG_VERBOSE)
+        fprintf(stderr, "%s\n", name);
+    free(name);
+    krb5_dbe_free(context, entry);
+    return ret ? 1 : 0;
+}
+
+/* Note that a principal or policy record begins at the current offset. */
+static void
+note_binary_record(uint32_t type)
+{
+    unsigned char ent[12];
+
+    store_32_be(type, ent);
+    store_64_be(binload.offset, ent + 4);
+    krb5int_buf_add_len(&binload.seen, (char *)ent, sizeof(ent));
+    binload.nseen++;
+}
+
+/* Check a binary dump index payload against the records we have read.
+ * Return 0 if it matches, 1 if not. */
+static int
+check_binary_index(const unsigned char *data, size_t len)
+{
+    struct bincursor c = { data, len, FALSE };
+    const unsigned char *seen;
+    uint32_t count, i, type, namelen;
+    uint64_t offset;
+
+    seen = (unsigned char *)krb5int_buf_data(&binload.seen);
+    count = get_u32(&c);
+    if (seen == NULL || c.bad || count != binload.nseen)
+        return 1;
+    for (i = 0; i < count; i++, seen += 12) {
+        type = get_u32(&c);
+        offset = get_u64(&c);
+        namelen = get_u32(&c);
+        (void)get_bytes(&c, namelen);
+        if (c.bad || type != load_32_be(seen) ||
+            offset != load_64_be(seen + 4))
+            return 1;
+    }
+    return c.len != 0;
+}
+
+/* Return the largest acceptable payload length for a binary record of the
+ * given type.  Every name in the index also appears in an earlier record, so
+ * the index cannot be larger than a count plus an entry header per record
+ * plus the records read so far. */
+static uint64_t
+binary_max_len(uint32_t type)
+{
+    switch (type) {
+    case BINARY_PRINC:
+    case BINARY_POLICY:
+        return BINARY_MAX_PAYLOAD;
+    case BINARY_INDEX:
+        return 4 + (uint64_t)binload.nseen * 16 + binload.offset;
+    case BINARY_END:
+        return BINARY_END_LEN;
+    default:
+        return 0;
+    }
+}
+
+/* Read and process one binary dump record.  Return -1 after reading the end
+ * record, 0 for success, and 1 for failure. */
+static int
+process_binary_record(krb5_context context, const char *fname, FILE *filep,
+                      int flags, int *linenop)
+{
+    unsigned char head[BINARY_HEADER_LEN], cksum[BINARY_CKSUM_LEN];
+    unsigned char expected[BINARY_CKSUM_LEN], *data = NULL;
+    uint32_t type, len;
+    int ret = 1;
+
+    (*linenop)++;
+    if (fread(head, 1, sizeof(head), filep) != sizeof(head)) {
+        load_err(fname, *linenop, _("dump is truncated"));
+        return 1;
+    }
+    type = load_32_be(head);
+    len = load_32_be(head + 4);
+    if (len > binary_max_len(type)) {
+        load_err(fname, *linenop, _("record length is too large"));
+        return 1;
+    }
+    if (len > 0) {
+        data = malloc(len);
+        if (data == NULL) {
+            com_err(progname, ENOMEM, _("while reading dump record"));
+            return 1;
+        }
+    }
+    if (fread(data, 1, len, filep) != len ||
+        fread(cksum, 1, sizeof(cksum), filep) != sizeof(cksum)) {
+        load_err(fname, *linenop, _("dump is truncated"));
+        goto cleanup;
+    }
+    if (binary_cksum(context, data, len, expected) != 0 ||
+        memcmp(cksum, expected, sizeof(cksum)) != 0) {
+        load_err(fname, *linenop, _("record checksum is incorrect"));
+        goto cleanup;
+    }
+
+    switch (type) {
+    case BINARY_PRINC:
+        note_binary_record(type);
+        ret = load_binary_princ(context, data, len, flags);
+        break;
+    case BINARY_POLICY:
+        note_binary_record(type);
+        ret = load_binary_policy(context, data, len, flags);
+        break;
+    case BINARY_INDEX:
+        if (binload.have_index || check_binary_index(data, len) != 0) {
+            load_err(fname, *linenop, _("dump index is incorrect"));
+            break;
+        }
+        binload.have_index = TRUE;
+        binload.index_offset = binload.offset;
+        ret = 0;
+        break;
+    case BINARY_END:
+        if (!binload.have_index || len != BINARY_END_LEN ||
+            load_64_be(data) != binload.index_offset ||
+            load_32_be(data + 8) != binload.nseen) {
+            load_err(fname, *linenop, _("dump end record is incorrect"));
+            break;
+        }
+        end_record_seen = TRUE;
+        ret = -1;
+        break;
+    default:
+        load_err(fname, *linenop, _("unknown record type"));
+        break;
+    }
+    binload.offset += sizeof(head) + len + sizeof(cksum);
+
+cleanup:
+    free(data);
+    return ret;
+}
+
 dump_version beta7_version = {
     "Kerberos version 5",
     "kdb5_util load_dump version 4\n",
     0,
     0,
     0,
+    0,
     dump_k5beta7_princ,
     dump_k5beta7_policy,
     process_k5beta7_record,
@@ -1086,6 +2169,7 @@ dump_version ov_version = {
     1,
     0,
     0,
+    0,
     dump_ov_princ,
     dump_k5beta7_policy,
     process_ov_record
@@ -1096,6 +2180,7 @@ dump_version r1_3_version = {
     0,
     0,
     0,
+    0,
     dump_k5beta7_princ_withpolicy,
     dump_k5beta7_policy,
     process_k5beta7_record,
@@ -1106,6 +2191,7 @@ dump_version r1_8_version = {
     0,
     0,
     0,
+    0,
     dump_k5beta7_princ_withpolicy,
     dump_r1_8_policy,
     process_r1_8_record,
@@ -1116,16 +2202,29 @@ dump_version r1_11_version = {
     0,
     0,
     0,
+    0,
     dump_k5beta7_princ_withpolicy,
     dump_r1_11_policy,
     process_r1_11_record,
 };
+dump_version binary_version = {
+    "Kerberos binary",
+    "kdb5_util binary_dump version 1\n",
+    0,
+    0,
+    0,
+    1,
+    dump_binary_princ,
+    dump_binary_policy,
+    process_binary_record,
+};
 dump_version iprop_version = {
     "Kerberos iprop version",
     "iprop",
     0,
     1,
     0,
+    0,
     dump_k5beta7_princ_withpolicy,
     dump_k5beta7_policy,
     process_k5beta7_record,
@@ -1136,6 +2235,7 @@ dump_version ipropx_1_version = {
     0,
     1,
     1,
+    0,
     dump_k5beta7_princ_withpolicy,
     dump_r1_11_policy,
     process_r1_11_record,
@@ -1232,7 +2332,7 @@ dump_db(int argc, char **argv)
     char *ofile = NULL, *tmpofile = NULL, *new_mkey_file = NULL;
     krb5_error_code ret, retval;
     dump_version *dump;
-    int aindex, conditional = 0, ok_fd = -1;
+    int aindex, conditional = 0, ok_fd = -1, nthreads = 1;
     bool_t dump_sno = FALSE;
     kdb_log_context *log_ctx;
     unsigned int ipropx_version = IPROPX_VERSION_0;
@@ -1241,6 +2341,10 @@ dump_db(int argc, char **argv)
     /* Parse the arguments. */
     dump = &r1_11_version;
     args.flags = 0;
+    args.pool = NULL;
+    args.offset = 0;
+    args.nrecords = 0;
+    krb5int_buf_init_dynamic(&args.index);
     mkey_convert = 0;
     log_ctx = util_context->kdblog_context;
 
@@ -1256,6 +2360,8 @@ dump_db(int argc, char **argv)
             dump = &r1_3_version;
         } else if (!strcmp(argv[aindex], "-r18")) {
             dump = &r1_8_version;
+        } else if (!strcmp(argv[aindex], "-binary")) {
+            dump = &binary_version;
         } else if (!strncmp(argv[aindex], "-i", 2)) {
             if (log_ctx && log_ctx->iproprole) {
                 /* ipropx_version is the maximum version acceptable. */
@@ -1280,6 +2386,10 @@ dump_db(int argc, char **argv)
             args.flags |= FLAG_VERBOSE;
         } else if (!strcmp(argv[aindex], "-mkey_convert")) {
             mkey_convert = 1;
+        } else if (!strcmp(argv[aindex], "-threads") && aindex + 1 < argc) {
+            nthreads = atoi(argv[++aindex]);
+            if (nthreads < 1)
+                usage();
         } else if (!strcmp(argv[aindex], "-new_mkey_file")) {
             new_mkey_file = argv[++aindex];
             mkey_convert = 1;
@@ -1399,6 +2509,7 @@ dump_db(int argc, char **argv)
     args.context = util_context;
     args.dump = dump;
     fprintf(args.ofile, "%s", dump->header);
+    args.offset = strlen(dump->header);
 
     /* We grab the lock twice (once again in the iterator call), but that's ok
      * since krb5_db_lock handles recursive locks. */
@@ -1419,7 +2530,21 @@ dump_db(int argc, char **argv)
     if (dump->header[strlen(dump->header)-1] != '\n')
         fputc('\n', args.ofile);
 
+    /* The OV format needs the context to format principals, and binary
+     * records are written as they are encoded so they can be indexed. */
+    if (nthreads > 1 && dump->dump_princ != dump_ov_princ && !dump->binary) {
+        ret = start_pool(&args, nthreads, &args.pool);
+        if (ret) {
+            com_err(progname, ret, _("while starting dump threads"));
+            goto error;
+        }
+    }
+
     ret = krb5_db_iterate(util_context, NULL, dump_iterator, &args);
+    if (ret == 0 && args.pool != NULL) {
+        ret = finish_pool(args.pool);
+        args.pool = NULL;
+    }
     if (ret) {
         com_err(progname, ret, _("performing %s dump"), dump->name);
         goto error;
@@ -1433,6 +2558,15 @@ dump_db(int argc, char **argv)
         }
     }
 
+    if (dump->binary) {
+        ret = finish_binary_dump(&args);
+        if (ret) {
+            com_err(progname, ret, _("performing %s dump"), dump->name);
+            goto error;
+        }
+    }
+    krb5int_free_buf(&args.index);
+
     if (f != stdout) {
         fclose(f);
         finish_ofile(ofile, &tmpofile);
@@ -1441,6 +2575,8 @@ dump_db(int argc, char **argv)
     return;
 
 error:
+    stop_pool(args.pool);
+    krb5int_free_buf(&args.index);
     krb5_db_unlock(util_context);
     if (tmpofile != NULL)
         unlink(tmpofile);
@@ -1466,6 +2602,124 @@ restore_dump(krb5_context context, char *dumpfile, FILE *f, int flags,
     return 0;
 }
 
+#ifdef ENABLE_THREADS
+
+static void *
+parser_thread(void *ptr)
+{
+    struct load_pipe *lp = ptr;
+    int result;
+
+    result = restore_dump(NULL, lp->dumpfile, lp->f, lp->flags, lp->dump);
+
+    pthread_mutex_lock(&lp->lock);
+    lp->parse_result = result;
+    lp->done = TRUE;
+    pthread_cond_broadcast(&lp->cond);
+    pthread_mutex_unlock(&lp->lock);
+    return NULL;
+}
+
+/* Move an entry parsed by the parser thread into memory allocated by the
+ * database module, and store it.  Return 0 on success, 1 on failure. */
+static int
+put_parsed_princ(krb5_context context, struct load_item *item, int flags)
+{
+    krb5_db_entry *entry;
+    int result;
+
+    entry = krb5_db_alloc(context, NULL, sizeof(*entry));
+    if (entry == NULL) {
+        com_err(progname, ENOMEM, _("while storing %s"), item->name);
+        return 1;
+    }
+    *entry = *item->entry;
+    free(item->entry);
+    item->entry = NULL;
+    result = put_princ(context, entry, item->name, flags);
+    krb5_db_free_principal(context, entry);
+    return result;
+}
+
+/* Restore the database from a dump file, parsing the dump in a separate
+ * thread from the one storing the principal entries. */
+static int
+restore_dump_pipelined(krb5_context context, char *dumpfile, FILE *f,
+                       int flags, dump_version *dump)
+{
+    struct load_pipe *lp;
+    struct load_item item;
+    osa_policy_ent_t policy;
+    pthread_t tid;
+    krb5_boolean failed;
+    int result;
+
+    lp = calloc(1, sizeof(*lp));
+    if (lp == NULL) {
+        com_err(progname, ENOMEM, _("while starting load thread"));
+        return 1;
+    }
+    pthread_mutex_init(&lp->lock, NULL);
+    pthread_cond_init(&lp->cond, NULL);
+    lp->dumpfile = dumpfile;
+    lp->f = f;
+    lp->flags = flags;
+    lp->dump = dump;
+    load_pipe = lp;
+    if (pthread_create(&tid, NULL, parser_thread, lp) != 0) {
+        load_pipe = NULL;
+        pthread_cond_destroy(&lp->cond);
+        pthread_mutex_destroy(&lp->lock);
+        free(lp);
+        return restore_dump(context, dumpfile, f, flags, dump);
+    }
+
+    pthread_mutex_lock(&lp->lock);
+    for (;;) {
+        while (lp->head == lp->tail && lp->policy == NULL && !lp->done)
+            pthread_cond_wait(&lp->cond, &lp->lock);
+        failed = lp->failed;
+        if (lp->head != lp->tail) {
+            item = lp->items[lp->head++ % LOAD_QUEUE_SIZE];
+            pthread_cond_broadcast(&lp->cond);
+            pthread_mutex_unlock(&lp->lock);
+
+            /* After a failure, just discard the remaining entries. */
+            if (!failed)
+                failed = put_parsed_princ(context, &item, flags);
+            free_parsed_princ(item.entry);
+            free(item.name);
+
+            pthread_mutex_lock(&lp->lock);
+            lp->failed = failed;
+            pthread_cond_broadcast(&lp->cond);
+        } else if (lp->policy != NULL) {
+            /* The parser is waiting for the result; every entry queued
+             * before the policy has been stored. */
+            policy = lp->policy;
+            pthread_mutex_unlock(&lp->lock);
+            result = failed ? 1 : put_policy(context, policy);
+            pthread_mutex_lock(&lp->lock);
+            lp->policy = NULL;
+            lp->policy_result = result;
+            pthread_cond_broadcast(&lp->cond);
+        } else {
+            break;
+        }
+    }
+    result = lp->failed ? 1 : lp->parse_result;
+    pthread_mutex_unlock(&lp->lock);
+
+    pthread_join(tid, NULL);
+    load_pipe = NULL;
+    pthread_cond_destroy(&lp->cond);
+    pthread_mutex_destroy(&lp->lock);
+    free(lp);
+    return result;
+}
+
+#endif /* ENABLE_THREADS */
+
 /*
  * Usage: load_db [-ov] [-b7] [-r13] [-verbose] [-update] [-hash]
  *                filename
@@ -1479,7 +2733,7 @@ load_db(int argc, char **argv)
     extern int optind;
     char *dumpfile = NULL, *dbname, buf[BUFSIZ];
     dump_version *load = NULL;
-    int flags = 0, aindex;
+    int flags = 0, aindex, nthreads = 1, result;
     kdb_log_context *log_ctx;
     krb5_boolean add_update = TRUE, db_locked = FALSE, temp_db_created = FALSE;
     uint32_t caller = FKCOMMAND, last_sno, last_seconds, last_useconds;
@@ -1498,6 +2752,8 @@ load_db(int argc, char **argv)
             load = &r1_3_version;
         } else if (!strcmp(argv[aindex], "-r18")){
             load = &r1_8_version;
+        } else if (!strcmp(argv[aindex], "-binary")) {
+            load = &binary_version;
         } else if (!strcmp(argv[aindex], "-i")) {
             if (log_ctx && log_ctx->iproprole) {
                 load = &iprop_version;
@@ -1511,6 +2767,10 @@ load_db(int argc, char **argv)
             flags |= FLAG_VERBOSE;
         } else if (!strcmp(argv[aindex], "-update")){
             flags |= FLAG_UPDATE;
+        } else if (!strcmp(argv[aindex], "-threads") && aindex + 1 < argc) {
+            nthreads = atoi(argv[++aindex]);
+            if (nthreads < 1)
+                usage();
         } else if (!strcmp(argv[aindex], "-hash")) {
             if (!add_db_arg("hash=true")) {
                 com_err(progname, ENOMEM, _("while parsing options"));
@@ -1522,9 +2782,10 @@ load_db(int argc, char **argv)
     }
     if (argc - aindex != 1)
         usage();
-    dumpfile = argv[aindex];
+    if (strcmp(argv[aindex], "-") != 0)
+        dumpfile = argv[aindex];
 
-    /* Open the dumpfile. */
+    /* Open the dumpfile, or read from standard input if it is "-". */
     if (dumpfile != NULL) {
         f = fopen(dumpfile, "r");
         if (f == NULL) {
@@ -1559,6 +2820,8 @@ load_db(int argc, char **argv)
             load = &r1_8_version;
         } else if (strcmp(buf, r1_11_version.header) == 0) {
             load = &r1_11_version;
+        } else if (strcmp(buf, binary_version.header) == 0) {
+            load = &binary_version;
         } else if (strncmp(buf, ov_version.header,
                            strlen(ov_version.header)) == 0) {
             load = &ov_version;
@@ -1666,8 +2929,39 @@ load_db(int argc, char **argv)
         }
     }
 
-    if (restore_dump(util_context, dumpfile ? dumpfile : _("standard input"),
-                     f, flags, load)) {
+    /* Let the module hold its locks and buffer writes across the load. */
+    ret = krb5_db_begin_bulk_load(util_context);
+    if (ret) {
+        com_err(progname, ret, _("while starting database load"));
+        goto error;
+    }
+
+    if (load->binary)
+        start_binary_load(strlen(buf));
+#ifdef ENABLE_THREADS
+    if (nthreads > 1 && load->load_record != process_ov_record &&
+        !load->binary)
+        result = restore_dump_pipelined(util_context, dumpfile, f, flags,
+                                        load);
+    else
+#endif
+        result = restore_dump(util_context, dumpfile, f, flags, load);
+    /* kpropd streams a dump through standard input and appends an end record
+     * only once it has received the whole dump.  Without one, the input may
+     * have been cut short, so don't make it live. */
+    if (!result && f == stdin && !end_record_seen) {
+        fprintf(stderr, _("%s: %s ended without an end record\n"), progname,
+                dumpfile);
+        result = 1;
+    }
+    if (load->binary)
+        end_binary_load();
+    ret = krb5_db_end_bulk_load(util_context);
+    if (ret && !result) {
+        com_err(progname, ret, _("while finishing database load"));
+        goto error;
+    }
+    if (result) {
         fprintf(stderr, _("%s: %s restore failed\n"), progname, load->name);
         goto error;
     }
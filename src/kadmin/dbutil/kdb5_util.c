@@ -85,11 +85,12 @@ void usage()
               "\tcreate  [-s]\n"
               "\tdestroy [-f]\n"
               "\tstash   [-f keyfile]\n"
-              "\tdump    [-old|-ov|-b6|-b7|-r13|-r18] [-verbose]\n"
+              "\tdump    [-old|-ov|-b6|-b7|-r13|-r18|-binary] [-verbose]\n"
               "\t        [-mkey_convert] [-new_mkey_file mkey_file]\n"
-              "\t        [-rev] [-recurse] [filename [princs...]]\n"
-              "\tload    [-old|-ov|-b6|-b7|-r13|-r18] [-verbose] [-update] "
-              "filename\n"
+              "\t        [-rev] [-recurse] [-threads count]\n"
+              "\t        [filename [princs...]]\n"
+              "\tload    [-old|-ov|-b6|-b7|-r13|-r18|-binary] [-verbose] [-update]\n"
+              "\t        [-threads count] filename\n"
               "\tark     [-e etype_list] principal\n"
               "\tadd_mkey [-e etype] [-s]\n"
               "\tuse_mkey kvno [time]\n"
@@ -11,10 +11,11 @@
 #include <stdlib.h> /* getenv, exit */
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/resource.h> /* rlimit */
 #include <syslog.h>
 
-#include "k5-platform.h"
+#include "k5-int.h"
 #include <kadm5/admin.h>
 #include <kadm5/kadm_rpc.h>
 #include <kadm5/server_internal.h>
@@ -57,6 +58,34 @@ static char *reply_unknown_str	= "<UNKNOWN_CODE>";
 #define	LOG_UNAUTH  _("Unauthorized request: %s, client=%s, service=%s, addr=%s")
 #define	LOG_DONE    _("Request: %s, %s, %s, client=%s, service=%s, addr=%s")
 
+/* The longest a slave may ask us to hold a get_updates_wait request. */
+#define	MAX_WAIT_TIME		300
+
+/* How often to check the ulog while requests are waiting (milliseconds). */
+#define	WAIT_CHECK_INTERVAL	100
+
+/*
+ * A get_updates_wait request whose reply is deferred until the ulog
+ * changes or its timeout passes.  The transport is only used while its
+ * socket is still registered and is the same socket (by inode) as when the
+ * request was received; gssrpc closes the socket when it destroys the
+ * transport.
+ */
+struct waiter {
+    SVCXPRT *xprt;
+    int fd;
+    ino_t ino;
+    kdb_last_t last;
+    time_t deadline;
+    char *client_name;
+    char *service_name;
+    struct waiter *next;
+};
+
+static struct waiter *waiters;
+static verto_ctx *loop_ctx;
+static verto_ev *wait_ev;
+
 #ifdef	DPRINT
 #undef	DPRINT
 #endif
@@ -134,15 +163,204 @@ buf_to_string(gss_buffer_desc *b)
     return s;
 }
 
-kdb_incr_result_t *
-iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+static void
+log_updates(char *whoami, kdb_last_t *arg, kdb_incr_result_t *ret, int kret,
+	    char *client_name, char *service_name, const char *addr)
+{
+    char obuf[256] = {0};
+
+    if (ret->ret == UPDATE_OK) {
+	(void) snprintf(obuf, sizeof (obuf),
+			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=%lu"),
+			replystr(ret->ret),
+			(unsigned long)arg->last_sno,
+			(unsigned long)ret->lastentry.last_sno);
+    } else {
+	(void) snprintf(obuf, sizeof (obuf),
+			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=N/A"),
+			replystr(ret->ret),
+			(unsigned long)arg->last_sno);
+    }
+
+    DPRINT("%s: request %s %s\n\tclprinc=`%s'\n\tsvcprinc=`%s'\n",
+	   whoami, obuf,
+	   ((kret == 0) ? "success" : error_message(kret)),
+	   client_name, service_name);
+
+    krb5_klog_syslog(LOG_NOTICE,
+		     _("Request: %s, %s, %s, client=%s, service=%s, addr=%s"),
+		     whoami,
+		     obuf,
+		     ((kret == 0) ? "success" : error_message(kret)),
+		     client_name, service_name, addr);
+}
+
+static void
+free_waiter(struct waiter *w)
+{
+    free(w->client_name);
+    free(w->service_name);
+    free(w);
+}
+
+/* Return true if w's transport has not been destroyed. */
+static int
+waiter_alive(struct waiter *w)
+{
+    struct stat st;
+
+    return FD_ISSET(w->fd, &svc_fdset) && fstat(w->fd, &st) == 0 &&
+	st.st_ino == w->ino;
+}
+
+/* Return true if the ulog has changed since w's request was received. */
+static int
+ulog_changed(struct waiter *w)
+{
+    kadm5_server_handle_t handle = global_server_handle;
+    kdb_log_context *log_ctx = handle->context->kdblog_context;
+    kdb_hlog_t *ulog;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL)
+	return 1;
+    ulog = log_ctx->ulog;
+    return ulog->kdb_last_sno != w->last.last_sno ||
+	ulog->kdb_last_time.seconds != w->last.last_time.seconds ||
+	ulog->kdb_last_time.useconds != w->last.last_time.useconds;
+}
+
+/* Send the deferred reply for w. */
+static void
+reply_waiter(struct waiter *w)
+{
+    kdb_incr_result_t ret;
+    kadm5_server_handle_t handle = global_server_handle;
+    char *whoami = "iprop_get_updates_wait_1";
+    int kret;
+
+    memset(&ret, 0, sizeof(ret));
+    ret.ret = UPDATE_ERROR;
+    kret = ulog_get_entries(handle->context, w->last, &ret);
+    log_updates(whoami, &w->last, &ret, kret, w->client_name,
+		w->service_name, inet_ntoa(w->xprt->xp_raddr.sin_addr));
+    if (nofork)
+	debprret(whoami, ret.ret, ret.lastentry.last_sno);
+
+    if (!svc_sendreply(w->xprt, xdr_kdb_incr_result_t, (caddr_t)&ret)) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("RPC svc_sendreply failed (%s)"),
+			 whoami);
+	svcerr_systemerr(w->xprt);
+    }
+    if (ret.ret == UPDATE_OK) {
+	ulog_free_entries(ret.updates.kdb_ulog_t_val,
+			  ret.updates.kdb_ulog_t_len);
+    }
+}
+
+/* Reply to waiting requests whose slaves have updates to fetch or whose
+ * timeouts have passed, and discard those whose connections are gone. */
+static void
+check_waiters(verto_ctx *ctx, verto_ev *ev)
+{
+    struct waiter *w, **wp;
+    time_t now = time(NULL);
+    int alive;
+
+    wp = &waiters;
+    while (*wp != NULL) {
+	w = *wp;
+	alive = waiter_alive(w);
+	if (alive && !ulog_changed(w) && now < w->deadline) {
+	    wp = &w->next;
+	    continue;
+	}
+	*wp = w->next;
+	if (alive)
+	    reply_waiter(w);
+	free_waiter(w);
+    }
+
+    if (waiters == NULL && wait_ev != NULL) {
+	verto_del(wait_ev);
+	wait_ev = NULL;
+    }
+}
+
+/* Discard any waiting request from xprt, which has sent a new request. */
+static void
+remove_waiter(SVCXPRT *xprt)
+{
+    struct waiter *w, **wp;
+
+    for (wp = &waiters; *wp != NULL; wp = &(*wp)->next) {
+	w = *wp;
+	if (w->xprt == xprt) {
+	    *wp = w->next;
+	    free_waiter(w);
+	    return;
+	}
+    }
+}
+
+/*
+ * Defer the reply to a get_updates_wait request for up to timeout seconds.
+ * Only RPCSEC_GSS transports keep their auth state after the request is
+ * dispatched, so requests using other flavors are answered immediately.
+ * On success, the waiter owns client_name and service_name.
+ */
+static int
+add_waiter(struct svc_req *rqstp, kdb_last_t *last, uint32_t timeout,
+	   char *client_name, char *service_name)
+{
+    struct waiter *w;
+    struct stat st;
+    int fd = rqstp->rq_xprt->xp_sock;
+
+    if (loop_ctx == NULL || rqstp->rq_cred.oa_flavor != RPCSEC_GSS ||
+	fstat(fd, &st) != 0)
+	return -1;
+    if (wait_ev == NULL) {
+	wait_ev = verto_add_timeout(loop_ctx, VERTO_EV_FLAG_PERSIST,
+				    check_waiters, WAIT_CHECK_INTERVAL);
+	if (wait_ev == NULL)
+	    return -1;
+    }
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+	return -1;
+    if (timeout > MAX_WAIT_TIME)
+	timeout = MAX_WAIT_TIME;
+    w->xprt = rqstp->rq_xprt;
+    w->fd = fd;
+    w->ino = st.st_ino;
+    w->last = *last;
+    w->deadline = time(NULL) + timeout;
+    w->client_name = client_name;
+    w->service_name = service_name;
+    w->next = waiters;
+    waiters = w;
+    return 0;
+}
+
+void
+ipropd_set_loop(verto_ctx *ctx)
+{
+    loop_ctx = ctx;
+}
+
+/*
+ * Look up updates for a slave.  If there are none and timeout is nonzero,
+ * defer the reply and return NULL.
+ */
+static kdb_incr_result_t *
+get_updates(char *whoami, kdb_last_t *arg, uint32_t timeout,
+	    struct svc_req *rqstp)
 {
     static kdb_incr_result_t ret;
-    char *whoami = "iprop_get_updates_1";
     int kret;
     kadm5_server_handle_t handle = global_server_handle;
     char *client_name = 0, *service_name = 0;
-    char obuf[256] = {0};
 
     /* default return code */
     ret.ret = UPDATE_ERROR;
@@ -199,31 +417,15 @@ iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
 
     kret = ulog_get_entries(handle->context, *arg, &ret);
 
-    if (ret.ret == UPDATE_OK) {
-	(void) snprintf(obuf, sizeof (obuf),
-			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=%lu"),
-			replystr(ret.ret),
-			(unsigned long)arg->last_sno,
-			(unsigned long)ret.lastentry.last_sno);
-    } else {
-	(void) snprintf(obuf, sizeof (obuf),
-			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=N/A"),
-			replystr(ret.ret),
-			(unsigned long)arg->last_sno);
+    if (kret == 0 && ret.ret == UPDATE_NIL && timeout > 0 &&
+	add_waiter(rqstp, arg, timeout, client_name, service_name) == 0) {
+	DPRINT("%s: waiting up to %lu seconds for updates\n", whoami,
+	       (unsigned long)timeout);
+	return NULL;
     }
 
-    DPRINT("%s: request %s %s\n\tclprinc=`%s'\n\tsvcprinc=`%s'\n",
-	   whoami, obuf,
-	   ((kret == 0) ? "success" : error_message(kret)),
-	   client_name, service_name);
-
-    krb5_klog_syslog(LOG_NOTICE,
-		     _("Request: %s, %s, %s, client=%s, service=%s, addr=%s"),
-		     whoami,
-		     obuf,
-		     ((kret == 0) ? "success" : error_message(kret)),
-		     client_name, service_name,
-		     client_addr(rqstp));
+    log_updates(whoami, arg, &ret, kret, client_name, service_name,
+		client_addr(rqstp));
 
 out:
     if (nofork)
@@ -233,6 +435,19 @@ out:
     return (&ret);
 }
 
+kdb_incr_result_t *
+iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+{
+    return get_updates("iprop_get_updates_1", arg, 0, rqstp);
+}
+
+kdb_incr_result_t *
+iprop_get_updates_wait_1_svc(kdb_wait_t *arg, struct svc_req *rqstp)
+{
+    return get_updates("iprop_get_updates_wait_1", &arg->lastentry,
+		       arg->timeout, rqstp);
+}
+
 
 /*
  * Given a client princ (foo/fqdn@R), copy (in arg cl) the fqdn substring.
@@ -547,6 +762,7 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 {
     union {
 	kdb_last_t iprop_get_updates_1_arg;
+	kdb_wait_t iprop_get_updates_wait_1_arg;
     } argument;
     char *result;
     bool_t (*_xdr_argument)(), (*_xdr_result)();
@@ -562,6 +778,9 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	return;
     }
 
+    /* A slave with a deferred request has given up on it. */
+    remove_waiter(transp);
+
     switch (rqstp->rq_proc) {
     case NULLPROC:
 	(void) svc_sendreply(transp, xdr_void,
@@ -586,6 +805,12 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	local = (char *(*)()) iprop_full_resync_ext_1_svc;
 	break;
 
+    case IPROP_GET_UPDATES_WAIT:
+	_xdr_argument = xdr_kdb_wait_t;
+	_xdr_result = xdr_kdb_incr_result_t;
+	local = (char *(*)()) iprop_get_updates_wait_1_svc;
+	break;
+
     default:
 	krb5_klog_syslog(LOG_ERR,
 			 _("RPC unknown request: %d (%s)"),
@@ -618,7 +843,8 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	exit(1);
     }
 
-    if (rqstp->rq_proc == IPROP_GET_UPDATES) {
+    if ((rqstp->rq_proc == IPROP_GET_UPDATES ||
+	 rqstp->rq_proc == IPROP_GET_UPDATES_WAIT) && result != NULL) {
 	/* LINTED */
 	kdb_incr_result_t *r = (kdb_incr_result_t *)result;
 
@@ -65,6 +65,10 @@ void log_badauth(OM_uint32 major, OM_uint32 minor,
 void
 krb5_iprop_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
 
+/* Set the event loop used to time deferred get_updates_wait replies. */
+void
+ipropd_set_loop(verto_ctx *ctx);
+
 kadm5_ret_t
 kiprop_get_adm_host_srv_name(krb5_context,
                              const char *,
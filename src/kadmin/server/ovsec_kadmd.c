@@ -203,6 +203,19 @@ static krb5_context context;
 
 static krb5_context hctx;
 
+/* Sync update log entries whose syncs have been deferred for group commit. */
+static void
+flush_ulog(verto_ctx *vctx, verto_ev *ev)
+{
+    krb5_error_code ret;
+
+    ret = ulog_flush(hctx);
+    if (ret) {
+        krb5_klog_syslog(LOG_ERR, _("%s while syncing update log"),
+                         error_message(ret));
+    }
+}
+
 int nofork = 0;
 char *kdb5_util = KPROPD_DEFAULT_KDB5_UTIL;
 char *kprop = KPROPD_DEFAULT_KPROP;
@@ -579,7 +592,22 @@ kterr:
             krb5_klog_close(context);
             exit(1);
         }
-
+        ipropd_set_loop(ctx);
+
+        /* Coalesce update log syncs, flushing them at least this often. */
+        if (params.iprop_sync_delay > 0) {
+            ulog_set_sync_delay(hctx, params.iprop_sync_delay);
+            if (verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST, flush_ulog,
+                                  params.iprop_sync_delay) == NULL) {
+                fprintf(stderr, _("%s: cannot create update log sync timer\n"),
+                        whoami);
+                krb5_klog_syslog(LOG_ERR,
+                                 _("Cannot create update log sync timer"));
+                loop_free(ctx);
+                krb5_klog_close(context);
+                exit(1);
+            }
+        }
 
         if (nofork)
             fprintf(stderr,
@@ -662,6 +690,7 @@ kterr:
 
     verto_run(ctx);
     krb5_klog_syslog(LOG_INFO, _("finished, exiting"));
+    (void)ulog_flush(hctx);
 
     /* Clean up memory, etc */
     svcauth_gssapi_unset_names();
@@ -32,6 +32,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include "k5-queue.h"
 
 static krb5_int32 last_usec = 0, last_os_random = 0;
 
@@ -45,6 +48,8 @@ struct dispatch_state {
     int is_tcp;
     kdc_realm_t *active_realm;
     krb5_context kdc_err_context;
+    enum kdc_stats_timer stats_timer;
+    krb5_ui_8 stats_start;
 };
 
 static void
@@ -76,6 +81,8 @@ finish_dispatch_cache(void *arg, krb5_error_code code, krb5_data *response)
     struct dispatch_state *state = arg;
     krb5_context kdc_err_context = state->kdc_err_context;
 
+    kdc_stats_end(state->stats_timer, state->stats_start);
+
 #ifndef NOCACHE
     /* Remove the null cache entry unless we actually want to discard this
      * request. */
@@ -118,13 +125,68 @@ reseed_random(krb5_context kdc_err_context)
     }
 }
 
+/* Decode and process the request in state, using the realm data in handle.
+ * The lookaside cache has already been checked. */
+static void
+process_request(struct server_handle *handle, struct dispatch_state *state,
+                const krb5_fulladdr *from, verto_ctx *vctx)
+{
+    krb5_error_code retval;
+    krb5_kdc_req *as_req;
+    krb5_data *pkt = state->request, *response = NULL;
+    krb5_context kdc_err_context = handle->kdc_err_context;
+    krb5_ui_8 decode_start;
+
+    state->kdc_err_context = kdc_err_context;
+    state->stats_start = kdc_stats_begin();
+
+    /* try TGS_REQ first; they are more common! */
+
+    if (krb5_is_tgs_req(pkt)) {
+        state->stats_timer = KDC_STATS_TGS_REQ;
+        retval = process_tgs_req(handle, pkt, from, &response);
+    } else if (krb5_is_as_req(pkt)) {
+        state->stats_timer = KDC_STATS_AS_REQ;
+        decode_start = kdc_stats_begin();
+        retval = decode_krb5_as_req(pkt, &as_req);
+        kdc_stats_end(KDC_STATS_DECODE, decode_start);
+        if (!retval) {
+            /*
+             * setup_server_realm() sets up the global realm-specific data
+             * pointer.
+             * process_as_req frees the request if it is called
+             */
+            state->active_realm = setup_server_realm(handle, as_req->server);
+            if (state->active_realm != NULL) {
+                process_as_req(as_req, pkt, from, state->active_realm, vctx,
+                               finish_dispatch_cache, state);
+                return;
+            } else {
+                retval = KRB5KDC_ERR_WRONG_REALM;
+                krb5_free_kdc_req(kdc_err_context, as_req);
+            }
+        }
+    } else {
+        state->stats_start = 0;
+        retval = KRB5KRB_AP_ERR_MSG_TYPE;
+    }
+
+    /* Requests which fail here have not been logged or counted. */
+    if (retval)
+        kdc_stats_count_result(retval);
+    finish_dispatch_cache(state, retval, response);
+}
+
+static krb5_boolean threads_active(void);
+static void thread_dispatch(struct dispatch_state *state,
+                            const krb5_fulladdr *from);
+
 void
 dispatch(void *cb, struct sockaddr *local_saddr,
          const krb5_fulladdr *from, krb5_data *pkt, int is_tcp,
          verto_ctx *vctx, loop_respond_fn respond, void *arg)
 {
     krb5_error_code retval;
-    krb5_kdc_req *as_req;
     krb5_data *response = NULL;
     struct dispatch_state *state;
     struct server_handle *handle = cb;
@@ -150,6 +212,8 @@ dispatch(void *cb, struct sockaddr *local_saddr,
         const char *name = 0;
         char buf[46];
 
+        kdc_stats_count_lookaside(TRUE);
+
         name = inet_ntop (ADDRTYPE2FAMILY (from->address->addrtype),
                           from->address->contents, buf, sizeof (buf));
         if (name == 0)
@@ -168,39 +232,402 @@ dispatch(void *cb, struct sockaddr *local_saddr,
         return;
     }
 
+    kdc_stats_count_lookaside(FALSE);
+
     /* Insert a NULL entry into the lookaside to indicate that this request
      * is currently being processed. */
     kdc_insert_lookaside(kdc_err_context, pkt, NULL);
 #endif
     reseed_random(kdc_err_context);
 
-    /* try TGS_REQ first; they are more common! */
+    if (threads_active())
+        thread_dispatch(state, from);
+    else
+        process_request(handle, state, from, vctx);
+}
 
-    if (krb5_is_tgs_req(pkt)) {
-        retval = process_tgs_req(handle, pkt, from, &response);
-    } else if (krb5_is_as_req(pkt)) {
-        if (!(retval = decode_krb5_as_req(pkt, &as_req))) {
-            /*
-             * setup_server_realm() sets up the global realm-specific data
-             * pointer.
-             * process_as_req frees the request if it is called
-             */
-            state->active_realm = setup_server_realm(handle, as_req->server);
-            if (state->active_realm != NULL) {
-                process_as_req(as_req, pkt, from, state->active_realm, vctx,
-                               finish_dispatch_cache, state);
-                return;
-            } else {
-                retval = KRB5KDC_ERR_WRONG_REALM;
-                krb5_free_kdc_req(kdc_err_context, as_req);
-            }
+/* How often to check for deferred lockout changes which are due, in
+ * seconds. */
+#define LOCKOUT_FLUSH_INTERVAL 1
+
+/* Timer callback: write the deferred lockout changes for each realm of the
+ * handle which would otherwise exceed the configured delay before the next
+ * check. */
+static void
+flush_lockout(verto_ctx *ctx, verto_ev *ev)
+{
+    struct server_handle *handle = verto_get_private(ev);
+    krb5_context context;
+    krb5_timestamp now;
+    krb5_error_code ret;
+    int i;
+
+    for (i = 0; i < handle->kdc_numrealms; i++) {
+        context = handle->kdc_realmlist[i]->realm_context;
+        if (krb5_timeofday(context, &now) != 0)
+            continue;
+        ret = krb5_db_flush_lockout(context, now + LOCKOUT_FLUSH_INTERVAL);
+        if (ret)
+            kdc_err(context, ret, _("while writing deferred lockout changes"));
+    }
+}
+
+/*
+ * Periodically write the deferred lockout changes of the realms in handle
+ * from the event loop ctx, so that they are written within the configured
+ * delay even if no more requests arrive.  ctx must be the loop which
+ * processes requests for handle, since database contexts are not shared
+ * between threads.
+ */
+krb5_error_code
+kdc_add_lockout_timer(verto_ctx *ctx, struct server_handle *handle)
+{
+    verto_ev *ev;
+
+    ev = verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST, flush_lockout,
+                           LOCKOUT_FLUSH_INTERVAL * 1000);
+    if (ev == NULL)
+        return ENOMEM;
+    verto_set_private(ev, handle, NULL);
+    return 0;
+}
+
+#ifdef ENABLE_THREADS
+
+/*
+ * Worker thread pool.  When worker threads are configured, the main loop
+ * thread checks the lookaside cache for each request as usual and then hands
+ * the request to the least busy of a fixed set of worker threads.  Each
+ * worker has its own server handle (with its own realm contexts and database
+ * handles) and its own event loop, so asynchronous preauth processing works
+ * as it does in the main thread.  The main thread owns the network
+ * connections, so completed requests are passed back to it through a pipe.
+ */
+
+struct thread_job {
+    TAILQ_ENTRY(thread_job) links;
+    struct kdc_thread *worker;
+    struct dispatch_state *state;
+    const krb5_fulladdr *from;
+    loop_respond_fn respond;
+    void *arg;
+    krb5_error_code code;
+    krb5_data *response;
+};
+
+TAILQ_HEAD(job_queue, thread_job);
+
+struct kdc_thread {
+    pthread_t tid;
+    struct server_handle *handle;
+    verto_ctx *vctx;
+    int pipe[2];                /* Wakes up the worker for new jobs */
+    struct job_queue jobs;      /* Protected by pool_lock */
+    krb5_boolean stop;          /* Protected by pool_lock */
+    int outstanding;            /* Only used by the main thread */
+    int index;
+};
+
+static k5_mutex_t pool_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct kdc_thread *pool;
+static int pool_size;
+static struct job_queue done_jobs; /* Protected by pool_lock */
+static int done_pipe[2] = { -1, -1 };
+
+static krb5_boolean
+threads_active()
+{
+    return pool != NULL;
+}
+
+/* Create a non-blocking close-on-exec pipe. */
+static krb5_error_code
+make_pipe(int fds[2])
+{
+    int i;
+
+    if (pipe(fds) != 0)
+        return errno;
+    for (i = 0; i < 2; i++) {
+        set_cloexec_fd(fds[i]);
+        if (fcntl(fds[i], F_SETFL, O_NONBLOCK) != 0)
+            return errno;
+    }
+    return 0;
+}
+
+static void
+close_pipe(int fds[2])
+{
+    if (fds[0] != -1)
+        close(fds[0]);
+    if (fds[1] != -1)
+        close(fds[1]);
+    fds[0] = fds[1] = -1;
+}
+
+/* Wake up the reader of a pipe.  If the pipe is full, the reader is already
+ * due to wake up, so ignore write failures. */
+static void
+wake(int fd)
+{
+    char c = 0;
+
+    (void)write(fd, &c, 1);
+}
+
+/* Read and discard all pending wakeup bytes from a pipe. */
+static void
+drain(int fd)
+{
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/* Respond callback for requests processed by a worker thread; runs in the
+ * worker.  Queue the job for the main thread. */
+static void
+thread_respond(void *arg, krb5_error_code code, krb5_data *response)
+{
+    struct thread_job *job = arg;
+
+    job->code = code;
+    job->response = response;
+    if (k5_mutex_lock(&pool_lock) != 0)
+        abort();
+    TAILQ_INSERT_TAIL(&done_jobs, job, links);
+    k5_mutex_unlock(&pool_lock);
+    wake(done_pipe[1]);
+}
+
+/* Main loop callback: send the responses for completed jobs. */
+static void
+process_done_jobs(verto_ctx *ctx, verto_ev *ev)
+{
+    struct job_queue jobs;
+    struct thread_job *job, *next;
+
+    drain(done_pipe[0]);
+    TAILQ_INIT(&jobs);
+    if (k5_mutex_lock(&pool_lock) != 0)
+        return;
+    TAILQ_CONCAT(&jobs, &done_jobs, links);
+    k5_mutex_unlock(&pool_lock);
+
+    TAILQ_FOREACH_SAFE(job, &jobs, links, next) {
+        job->worker->outstanding--;
+        (*job->respond)(job->arg, job->code, job->response);
+        free(job);
+    }
+}
+
+/* Worker loop callback: process newly queued jobs. */
+static void
+process_new_jobs(verto_ctx *ctx, verto_ev *ev)
+{
+    struct kdc_thread *worker = verto_get_private(ev);
+    struct job_queue jobs;
+    struct thread_job *job, *next;
+    krb5_boolean stop;
+
+    drain(worker->pipe[0]);
+    TAILQ_INIT(&jobs);
+    if (k5_mutex_lock(&pool_lock) != 0)
+        return;
+    TAILQ_CONCAT(&jobs, &worker->jobs, links);
+    stop = worker->stop;
+    k5_mutex_unlock(&pool_lock);
+
+    if (stop) {
+        verto_break(ctx);
+        return;
+    }
+    TAILQ_FOREACH_SAFE(job, &jobs, links, next) {
+        process_request(worker->handle, job->state, job->from,
+                        worker->vctx);
+    }
+}
+
+/* Queue state for processing by the least busy worker thread. */
+static void
+thread_dispatch(struct dispatch_state *state, const krb5_fulladdr *from)
+{
+    struct thread_job *job;
+    struct kdc_thread *worker;
+    int i;
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        finish_dispatch_cache(state, ENOMEM, NULL);
+        return;
+    }
+    worker = &pool[0];
+    for (i = 1; i < pool_size; i++) {
+        if (pool[i].outstanding < worker->outstanding)
+            worker = &pool[i];
+    }
+    job->worker = worker;
+    job->state = state;
+    job->from = from;
+    job->respond = state->respond;
+    job->arg = state->arg;
+    state->respond = thread_respond;
+    state->arg = job;
+
+    if (k5_mutex_lock(&pool_lock) != 0) {
+        state->respond = job->respond;
+        state->arg = job->arg;
+        free(job);
+        finish_dispatch_cache(state, KRB5KDC_ERR_DISCARD, NULL);
+        return;
+    }
+    TAILQ_INSERT_TAIL(&worker->jobs, job, links);
+    k5_mutex_unlock(&pool_lock);
+    worker->outstanding++;
+    wake(worker->pipe[1]);
+}
+
+static void *
+thread_main(void *arg)
+{
+    struct kdc_thread *worker = arg;
+    sigset_t set;
+
+    /* Leave signal handling to the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    kdc_stats_attach_thread(worker->index);
+    verto_run(worker->vctx);
+    return NULL;
+}
+
+/*
+ * Start num worker threads, using the server handles in handles (which must
+ * remain valid until kdc_stop_threads() is called).  ctx is the main loop,
+ * which will be used to send responses.
+ */
+krb5_error_code
+kdc_start_threads(verto_ctx *ctx, struct server_handle *handles, int num)
+{
+    krb5_error_code ret;
+    struct kdc_thread *threads, *worker;
+    verto_ev *ev;
+    int i;
+
+    ret = k5_mutex_finish_init(&pool_lock);
+    if (ret)
+        return ret;
+    TAILQ_INIT(&done_jobs);
+    ret = make_pipe(done_pipe);
+    if (ret)
+        return ret;
+    if (verto_add_io(ctx, VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ,
+                     process_done_jobs, done_pipe[0]) == NULL)
+        return ENOMEM;
+
+    threads = calloc(num, sizeof(*threads));
+    if (threads == NULL)
+        return ENOMEM;
+    for (i = 0; i < num; i++) {
+        worker = &threads[i];
+        worker->handle = &handles[i];
+        worker->index = i;
+        worker->pipe[0] = worker->pipe[1] = -1;
+        TAILQ_INIT(&worker->jobs);
+    }
+    for (i = 0; i < num; i++) {
+        worker = &threads[i];
+        ret = make_pipe(worker->pipe);
+        if (ret)
+            goto error;
+        worker->vctx = verto_new(NULL, VERTO_EV_TYPE_IO);
+        if (worker->vctx == NULL) {
+            ret = ENOMEM;
+            goto error;
         }
-    } else
-        retval = KRB5KRB_AP_ERR_MSG_TYPE;
+        ev = verto_add_io(worker->vctx,
+                          VERTO_EV_FLAG_PERSIST | VERTO_EV_FLAG_IO_READ,
+                          process_new_jobs, worker->pipe[0]);
+        if (ev == NULL) {
+            ret = ENOMEM;
+            goto error;
+        }
+        verto_set_private(ev, worker, NULL);
+        ret = kdc_add_lockout_timer(worker->vctx, worker->handle);
+        if (ret)
+            goto error;
+        ret = pthread_create(&worker->tid, NULL, thread_main, worker);
+        if (ret)
+            goto error;
+    }
+    pool = threads;
+    pool_size = num;
+    return 0;
 
-    finish_dispatch_cache(state, retval, response);
+error:
+    /* Clean up the partially created worker and stop the running ones. */
+    if (threads[i].vctx != NULL)
+        verto_free(threads[i].vctx);
+    close_pipe(threads[i].pipe);
+    pool = threads;
+    pool_size = i;
+    kdc_stop_threads();
+    return ret;
+}
+
+/* Stop and join the worker threads. */
+void
+kdc_stop_threads()
+{
+    struct kdc_thread *worker;
+    int i;
+
+    if (pool == NULL)
+        return;
+    for (i = 0; i < pool_size; i++) {
+        worker = &pool[i];
+        if (k5_mutex_lock(&pool_lock) == 0) {
+            worker->stop = TRUE;
+            k5_mutex_unlock(&pool_lock);
+        }
+        wake(worker->pipe[1]);
+        pthread_join(worker->tid, NULL);
+        verto_free(worker->vctx);
+        close_pipe(worker->pipe);
+    }
+    free(pool);
+    pool = NULL;
+    pool_size = 0;
+}
+
+#else /* ENABLE_THREADS */
+
+static krb5_boolean
+threads_active()
+{
+    return FALSE;
 }
 
+static void
+thread_dispatch(struct dispatch_state *state, const krb5_fulladdr *from)
+{
+    abort();
+}
+
+krb5_error_code
+kdc_start_threads(verto_ctx *ctx, struct server_handle *handles, int num)
+{
+    return ENOTSUP;
+}
+
+void
+kdc_stop_threads()
+{
+}
+
+#endif /* ENABLE_THREADS */
+
 static krb5_error_code
 make_too_big_error(kdc_realm_t *kdc_active_realm, krb5_data **out)
 {
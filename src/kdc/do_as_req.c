@@ -97,7 +97,8 @@ struct as_req_state {
     krb5_enc_tkt_part enc_tkt_reply;
     krb5_enc_kdc_rep_part reply_encpart;
     krb5_ticket ticket_reply;
-    krb5_keyblock server_keyblock;
+    krb5_key server_tkt_key;
+    krb5_keyblock server_keyblock;      /* Borrowed from server_tkt_key */
     krb5_keyblock client_keyblock;
     krb5_db_entry *client;
     krb5_db_entry *server;
@@ -137,6 +138,7 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     loop_respond_fn oldrespond;
     void *oldarg;
     kdc_realm_t *kdc_active_realm = state->active_realm;
+    krb5_ui_8 stats_start;
 
     assert(state);
     oldrespond = state->respond;
@@ -172,13 +174,12 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
      *
      *  server_keyblock is later used to generate auth data signatures
      */
-    if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                             server_key,
-                                             &state->server_keyblock,
-                                             NULL))) {
+    if ((errcode = kdc_get_key(kdc_active_realm, server_key, -1,
+                               &state->server_tkt_key))) {
         state->status = "DECRYPT_SERVER_KEY";
         goto egress;
     }
+    state->server_keyblock = state->server_tkt_key->keyblock;
 
     /*
      * Find the appropriate client key.  We search in the order specified
@@ -204,10 +205,8 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     state->rock.client_key = client_key;
 
     /* convert client.key_data into a real key */
-    if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                             client_key,
-                                             &state->client_keyblock,
-                                             NULL))) {
+    if ((errcode = kdc_get_keyblock(kdc_active_realm, client_key, -1,
+                                    &state->client_keyblock))) {
         state->status = "DECRYPT_CLIENT_KEY";
         goto egress;
     }
@@ -268,8 +267,10 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
         goto egress;
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, &state->server_keyblock,
-                                    &state->ticket_reply);
+    stats_start = kdc_stats_begin();
+    errcode = kdc_encrypt_tkt_part(kdc_context, state->server_tkt_key,
+                                   &state->ticket_reply);
+    kdc_stats_end(KDC_STATS_TKT_ENCRYPT, stats_start);
     if (errcode) {
         state->status = "ENCRYPTING_TICKET";
         goto egress;
@@ -302,10 +303,12 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
         goto egress;
     }
 
+    stats_start = kdc_stats_begin();
     errcode = krb5_encode_kdc_rep(kdc_context, KRB5_AS_REP,
                                   &state->reply_encpart, 0,
                                   as_encrypting_key,
                                   &state->reply, &response);
+    kdc_stats_end(KDC_STATS_ENCODE, stats_start);
     state->reply.enc_part.kvno = client_key->key_data_kvno;
     if (errcode) {
         state->status = "ENCODE_KDC_REP";
@@ -363,8 +366,7 @@ egress:
     if (state->enc_tkt_reply.authorization_data != NULL)
         krb5_free_authdata(kdc_context,
                            state->enc_tkt_reply.authorization_data);
-    if (state->server_keyblock.contents != NULL)
-        krb5_free_keyblock_contents(kdc_context, &state->server_keyblock);
+    krb5_k_free_key(kdc_context, state->server_tkt_key);
     if (state->client_keyblock.contents != NULL)
         krb5_free_keyblock_contents(kdc_context, &state->client_keyblock);
     if (state->reply.padata != NULL)
@@ -542,8 +544,8 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     if (include_pac_p(kdc_context, state->request)) {
         setflag(state->c_flags, KRB5_KDB_FLAG_INCLUDE_PAC);
     }
-    errcode = krb5_db_get_principal(kdc_context, state->request->client,
-                                    state->c_flags, &state->client);
+    errcode = kdc_get_principal(kdc_context, state->request->client,
+                                state->c_flags, &state->client);
     if (errcode == KRB5_KDB_CANTLOCK_DB)
         errcode = KRB5KDC_ERR_SVC_UNAVAILABLE;
     if (errcode == KRB5_KDB_NOENTRY) {
@@ -575,8 +577,8 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     if (isflagset(state->request->kdc_options, KDC_OPT_CANONICALIZE)) {
         setflag(s_flags, KRB5_KDB_FLAG_CANONICALIZE);
     }
-    errcode = krb5_db_get_principal(kdc_context, state->request->server,
-                                    s_flags, &state->server);
+    errcode = kdc_get_principal(kdc_context, state->request->server,
+                                s_flags, &state->server);
     if (errcode == KRB5_KDB_CANTLOCK_DB)
         errcode = KRB5KDC_ERR_SVC_UNAVAILABLE;
     if (errcode == KRB5_KDB_NOENTRY) {
@@ -114,6 +114,7 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
     int newtransited = 0;
     krb5_error_code retval = 0;
     krb5_keyblock encrypting_key;
+    krb5_key server_k = NULL;
     krb5_timestamp kdc_time, authtime = 0;
     krb5_keyblock session_key;
     krb5_timestamp rtime;
@@ -137,6 +138,7 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
     krb5_data scratch;
     krb5_pa_data **e_data = NULL;
     kdc_realm_t *kdc_active_realm = NULL;
+    krb5_ui_8 stats_start;
 
     reply.padata = 0; /* For cleanup handler */
     reply_encpart.enc_padata = 0;
@@ -144,7 +146,9 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
 
     session_key.contents = NULL;
 
+    stats_start = kdc_stats_begin();
     retval = decode_krb5_tgs_req(pkt, &request);
+    kdc_stats_end(KDC_STATS_DECODE, stats_start);
     if (retval)
         return retval;
     if (request->msg_type != KRB5_TGS_REQ) {
@@ -514,12 +518,12 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
          * Convert server.key into a real key
          * (it may be encrypted in the database)
          */
-        if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                                 server_key, &encrypting_key,
-                                                 NULL))) {
+        if ((errcode = kdc_get_key(kdc_active_realm, server_key, -1,
+                                   &server_k))) {
             status = "DECRYPT_SERVER_KEY";
             goto cleanup;
         }
+        encrypting_key = server_k->keyblock;
     }
 
     if (isflagset(c_flags, KRB5_KDB_FLAG_CONSTRAINED_DELEGATION)) {
@@ -547,8 +551,8 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
 
             assert(client == NULL); /* should not have been set already */
 
-            errcode = krb5_db_get_principal(kdc_context, subject_tkt->client,
-                                            c_flags, &client);
+            errcode = kdc_get_principal(kdc_context, subject_tkt->client,
+                                        c_flags, &client);
         }
     }
 
@@ -677,10 +681,14 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
         ticket_kvno = server_key->key_data_kvno;
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, &encrypting_key,
-                                    &ticket_reply);
-    if (!isflagset(request->kdc_options, KDC_OPT_ENC_TKT_IN_SKEY))
-        krb5_free_keyblock_contents(kdc_context, &encrypting_key);
+    stats_start = kdc_stats_begin();
+    if (server_k != NULL) {
+        errcode = kdc_encrypt_tkt_part(kdc_context, server_k, &ticket_reply);
+    } else {
+        errcode = krb5_encrypt_tkt_part(kdc_context, &encrypting_key,
+                                        &ticket_reply);
+    }
+    kdc_stats_end(KDC_STATS_TKT_ENCRYPT, stats_start);
     if (errcode) {
         status = "TKT_ENCRYPT";
         goto cleanup;
@@ -753,10 +761,12 @@ process_tgs_req(struct server_handle *handle, krb5_data *pkt,
         goto cleanup;
     }
 
+    stats_start = kdc_stats_begin();
     errcode = krb5_encode_kdc_rep(kdc_context, KRB5_TGS_REP, &reply_encpart,
                                   subkey ? 1 : 0,
                                   reply_key,
                                   &reply, response);
+    kdc_stats_end(KDC_STATS_ENCODE, stats_start);
     if (errcode) {
         status = "ENCODE_KDC_REP";
     } else {
@@ -826,6 +836,7 @@ cleanup:
         krb5_free_keyblock(kdc_context, subkey);
     if (tgskey != NULL)
         krb5_free_keyblock(kdc_context, tgskey);
+    krb5_k_free_key(kdc_context, server_k);
     if (reply.padata)
         krb5_free_pa_data(kdc_context, reply.padata);
     if (reply_encpart.enc_padata)
@@ -923,7 +934,7 @@ decrypt_2ndtkt(kdc_realm_t *kdc_active_realm, krb5_kdc_req *req,
         return 0;
 
     stkt = req->second_ticket[0];
-    retval = kdc_get_server_key(kdc_context, stkt,
+    retval = kdc_get_server_key(kdc_active_realm, stkt,
                                 flags,
                                 TRUE, /* match_enctype */
                                 &server,
@@ -1179,7 +1190,7 @@ db_get_svc_princ(krb5_context ctx, krb5_principal princ,
 {
     krb5_error_code ret;
 
-    ret = krb5_db_get_principal(ctx, princ, flags, server);
+    ret = kdc_get_principal(ctx, princ, flags, server);
     if (ret == KRB5_KDB_CANTLOCK_DB)
         ret = KRB5KDC_ERR_SVC_UNAVAILABLE;
     if (ret != 0) {
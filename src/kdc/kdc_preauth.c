@@ -480,8 +480,8 @@ client_keys(krb5_context context, krb5_kdcpreauth_rock rock,
         if (krb5_dbe_find_enctype(context, client, request->ktype[i],
                                   -1, 0, &entry_key) != 0)
             continue;
-        if (krb5_dbe_decrypt_key_data(context, NULL, entry_key,
-                                      &key, NULL) != 0)
+        if (kdc_get_keyblock(rock->rstate->realm_data, entry_key, -1,
+                             &key) != 0)
             continue;
         keys[k++] = key;
     }
@@ -915,6 +915,8 @@ struct padata_state {
 
     krb5_pa_data ***e_data_out;
     krb5_boolean *typed_e_data_out;
+
+    krb5_ui_8 stats_start;
 };
 
 static void
@@ -926,6 +928,7 @@ finish_check_padata(struct padata_state *state, krb5_error_code code)
     assert(state);
     oldrespond = state->respond;
     oldarg = state->arg;
+    kdc_stats_end(KDC_STATS_PREAUTH, state->stats_start);
 
     if (!state->pa_ok) {
         /* Return any saved preauth e-data. */
@@ -1152,6 +1155,7 @@ check_padata(krb5_context context, krb5_kdcpreauth_rock rock,
     state->e_data_out = e_data;
     state->typed_e_data_out = typed_e_data;
     state->realm = rock->rstate->realm_data;
+    state->stats_start = kdc_stats_begin();
 
 #ifdef DEBUG
     krb5_klog_syslog (LOG_DEBUG, "checking padata");
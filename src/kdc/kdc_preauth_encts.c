@@ -51,7 +51,7 @@ enc_ts_verify(krb5_context context, krb5_data *req_pkt, krb5_kdc_req *request,
     krb5_data                   scratch;
     krb5_data                   enc_ts_data;
     krb5_enc_data               *enc_data = 0;
-    krb5_keyblock               key;
+    krb5_key                    key;
     krb5_key_data *             client_key;
     krb5_int32                  start;
     krb5_timestamp              timenow;
@@ -77,15 +77,13 @@ enc_ts_verify(krb5_context context, krb5_data *req_pkt, krb5_kdc_req *request,
                                               -1, 0, &client_key)))
             goto cleanup;
 
-        if ((retval = krb5_dbe_decrypt_key_data(context, NULL, client_key,
-                                                &key, NULL)))
+        if ((retval = kdc_get_key(rock->rstate->realm_data, client_key,
+                                  enc_data->enctype, &key)))
             goto cleanup;
 
-        key.enctype = enc_data->enctype;
-
-        retval = krb5_c_decrypt(context, &key, KRB5_KEYUSAGE_AS_REQ_PA_ENC_TS,
-                                0, enc_data, &enc_ts_data);
-        krb5_free_keyblock_contents(context, &key);
+        retval = krb5_k_decrypt(context, key, KRB5_KEYUSAGE_AS_REQ_PA_ENC_TS,
+                                NULL, enc_data, &enc_ts_data);
+        krb5_k_free_key(context, key);
         if (retval == 0)
             break;
         else
@@ -0,0 +1,210 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/kdc_stats.c - KDC request statistics */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* See kdc_stats.h for a description of the statistics file. */
+
+#include "k5-int.h"
+#include "kdc_stats.h"
+#include <sys/mman.h>
+
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+
+static struct kdc_stats_header *stats_header;
+static size_t stats_size;
+static int stats_nthreads;
+static int stats_proc;
+
+#ifdef ENABLE_THREADS
+static pthread_key_t slot_key;
+#define get_slot() ((struct kdc_stats_slot *)pthread_getspecific(slot_key))
+#define set_slot(s) ((void)pthread_setspecific(slot_key, s))
+#else
+static struct kdc_stats_slot *current_slot;
+#define get_slot() current_slot
+#define set_slot(s) (current_slot = (s))
+#endif
+
+static inline krb5_ui_8
+now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (krb5_ui_8)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+krb5_error_code
+kdc_init_stats(const char *path, int nprocs, int nthreads)
+{
+    krb5_error_code ret;
+    size_t nslots = (size_t)nprocs * (nthreads + 1);
+    size_t size = sizeof(*stats_header) +
+        nslots * sizeof(struct kdc_stats_slot);
+    void *map;
+    int fd;
+
+    if (path == NULL)
+        return 0;
+
+    /* Replace any existing file rather than writing through it, so that a
+     * symlink at path cannot direct the KDC to overwrite some other file.
+     * O_EXCL fails on an existing symlink even without O_NOFOLLOW. */
+    if (unlink(path) != 0 && errno != ENOENT)
+        return errno;
+    fd = THREEPARAMOPEN(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd == -1)
+        return errno;
+    if (ftruncate(fd, size) != 0) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ret = errno;
+    close(fd);
+    if (map == MAP_FAILED)
+        return ret;
+
+#ifdef ENABLE_THREADS
+    ret = pthread_key_create(&slot_key, NULL);
+    if (ret) {
+        munmap(map, size);
+        return ret;
+    }
+#endif
+
+    stats_header = map;
+    stats_size = size;
+    stats_nthreads = nthreads;
+    stats_header->magic = KDC_STATS_MAGIC;
+    stats_header->version = KDC_STATS_VERSION;
+    stats_header->nslots = nslots;
+    stats_header->slot_size = sizeof(struct kdc_stats_slot);
+    stats_header->start_time = time(NULL);
+    return 0;
+}
+
+static struct kdc_stats_slot *
+slot_at(int index)
+{
+    return (struct kdc_stats_slot *)(stats_header + 1) + index;
+}
+
+void
+kdc_stats_attach(int proc)
+{
+    if (stats_header == NULL)
+        return;
+    stats_proc = proc;
+    set_slot(slot_at(proc * (stats_nthreads + 1)));
+}
+
+void
+kdc_stats_attach_thread(int thread)
+{
+    if (stats_header == NULL)
+        return;
+    set_slot(slot_at(stats_proc * (stats_nthreads + 1) + thread + 1));
+}
+
+krb5_ui_8
+kdc_stats_begin(void)
+{
+    return (stats_header != NULL && get_slot() != NULL) ? now_usec() : 0;
+}
+
+void
+kdc_stats_end(enum kdc_stats_timer timer, krb5_ui_8 start)
+{
+    struct kdc_stats_slot *slot;
+    struct kdc_stats_timing *t;
+    krb5_ui_8 usec;
+    int b;
+
+    if (start == 0)
+        return;
+    slot = get_slot();
+    if (slot == NULL)
+        return;
+    usec = now_usec();
+    usec = (usec > start) ? usec - start : 0;
+
+    t = &slot->timers[timer];
+    t->count++;
+    t->total_usec += usec;
+    if (usec > t->max_usec)
+        t->max_usec = usec;
+    for (b = 0; b < KDC_STATS_NBUCKETS - 1 && usec >= ((krb5_ui_8)1 << b); b++);
+    t->buckets[b]++;
+}
+
+void
+kdc_stats_count_result(krb5_error_code code)
+{
+    struct kdc_stats_slot *slot;
+
+    if (stats_header == NULL || (slot = get_slot()) == NULL)
+        return;
+    if (code != 0)
+        code -= ERROR_TABLE_BASE_krb5;
+    if (code >= 0 && code < KDC_STATS_NERRORS)
+        slot->errors[code]++;
+    else
+        slot->other_errors++;
+}
+
+void
+kdc_stats_count_lookaside(krb5_boolean hit)
+{
+    struct kdc_stats_slot *slot;
+
+    if (stats_header == NULL || (slot = get_slot()) == NULL)
+        return;
+    slot->lookaside_calls++;
+    if (hit)
+        slot->lookaside_hits++;
+}
+
+void
+kdc_free_stats(void)
+{
+    if (stats_header == NULL)
+        return;
+    munmap(stats_header, stats_size);
+    stats_header = NULL;
+#ifdef ENABLE_THREADS
+    pthread_key_delete(slot_key);
+#endif
+}
@@ -0,0 +1,132 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/kdc_stats.h - KDC request statistics segment */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * If kdc_stats_file is set in [kdcdefaults], the KDC maintains request
+ * counters and latency histograms in that file, which it maps into memory
+ * shared by all of its worker processes.  The file contains a header followed
+ * by one slot per KDC thread (the main thread and any worker threads of each
+ * worker process).  Each slot is only written by its own thread, so no
+ * locking is needed; readers such as kdcstats sum the slots, and may see
+ * slightly inconsistent values while the KDC is running.
+ */
+
+#ifndef KDC_STATS_H
+#define KDC_STATS_H
+
+#include "k5-int.h"
+
+#define KDC_STATS_MAGIC 0x4b445354      /* "KDST" */
+#define KDC_STATS_VERSION 1
+
+/* Timed phases of request processing.  Phases may nest (for instance, a
+ * preauth mechanism decrypts keys), so their times are not additive. */
+enum kdc_stats_timer {
+    KDC_STATS_AS_REQ,           /* AS requests, from decoding to reply */
+    KDC_STATS_TGS_REQ,          /* TGS requests, from decoding to reply */
+    KDC_STATS_DECODE,           /* Decoding AS and TGS requests */
+    KDC_STATS_DB_LOOKUP,        /* Principal lookups, including cache hits */
+    KDC_STATS_PREAUTH,          /* Verifying AS request padata */
+    KDC_STATS_KEY_DECRYPT,      /* Getting decrypted principal keys */
+    KDC_STATS_TKT_ENCRYPT,      /* Encrypting tickets */
+    KDC_STATS_ENCODE,           /* Encoding and encrypting replies */
+    KDC_STATS_NTIMERS
+};
+
+/* Histogram bucket i counts durations of less than 2^i microseconds, except
+ * that the last bucket counts all longer durations. */
+#define KDC_STATS_NBUCKETS 24
+
+/* Requests are counted by the protocol error code of their result (0 for
+ * success); codes outside this range are counted as other_errors. */
+#define KDC_STATS_NERRORS 128
+
+struct kdc_stats_timing {
+    krb5_ui_8 count;
+    krb5_ui_8 total_usec;
+    krb5_ui_8 max_usec;
+    krb5_ui_8 buckets[KDC_STATS_NBUCKETS];
+};
+
+struct kdc_stats_slot {
+    krb5_ui_8 lookaside_calls;
+    krb5_ui_8 lookaside_hits;
+    krb5_ui_8 errors[KDC_STATS_NERRORS];
+    krb5_ui_8 other_errors;
+    struct kdc_stats_timing timers[KDC_STATS_NTIMERS];
+};
+
+struct kdc_stats_header {
+    krb5_ui_4 magic;
+    krb5_ui_4 version;
+    krb5_ui_4 nslots;
+    krb5_ui_4 slot_size;        /* sizeof(struct kdc_stats_slot) */
+    krb5_ui_8 start_time;       /* When the KDC started */
+    /* nslots slots follow. */
+};
+
+/* Create and map the statistics file for nprocs processes with nthreads
+ * worker threads each.  If path is NULL, statistics are not kept. */
+krb5_error_code
+kdc_init_stats(const char *path, int nprocs, int nthreads);
+
+/* Use the statistics slot for process proc for the calling thread, which is
+ * the main thread of the process. */
+void
+kdc_stats_attach(int proc);
+
+/* Use the statistics slot for worker thread number thread (starting at 0) of
+ * the current process for the calling thread. */
+void
+kdc_stats_attach_thread(int thread);
+
+/* Return a start time for kdc_stats_end(), or 0 if statistics are not being
+ * kept. */
+krb5_ui_8
+kdc_stats_begin(void);
+
+/* Record the time since start for a phase. */
+void
+kdc_stats_end(enum kdc_stats_timer timer, krb5_ui_8 start);
+
+/* Count a request with the given result code. */
+void
+kdc_stats_count_result(krb5_error_code code);
+
+/* Count a lookaside cache check. */
+void
+kdc_stats_count_lookaside(krb5_boolean hit);
+
+void
+kdc_free_stats(void);
+
+#endif /* KDC_STATS_H */
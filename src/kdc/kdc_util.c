@@ -74,7 +74,7 @@ static krb5_error_code kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
                                      krb5_db_entry **server,
                                      krb5_keyblock **tgskey,
                                      krb5_ticket **ticket);
-static krb5_error_code find_server_key(krb5_context,
+static krb5_error_code find_server_key(kdc_realm_t *,
                                        krb5_db_entry *, krb5_enctype,
                                        krb5_kvno, krb5_keyblock **,
                                        krb5_kvno *);
@@ -389,7 +389,7 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
         match_enctype = 0;
     }
 
-    retval = kdc_get_server_key(kdc_context,
+    retval = kdc_get_server_key(kdc_active_realm,
                                 apreq->ticket, 0, match_enctype, server, NULL,
                                 NULL);
     if (retval)
@@ -399,7 +399,7 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
     kvno = apreq->ticket->enc_part.kvno;
     do {
         krb5_free_keyblock(kdc_context, *tgskey);
-        retval = find_server_key(kdc_context,
+        retval = find_server_key(kdc_active_realm,
                                  *server, search_enctype, kvno, tgskey, &kvno);
         if (retval)
             continue;
@@ -429,7 +429,7 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
  * This is also used by do_tgs_req() for u2u auth.
  */
 krb5_error_code
-kdc_get_server_key(krb5_context context,
+kdc_get_server_key(kdc_realm_t *kdc_active_realm,
                    krb5_ticket *ticket, unsigned int flags,
                    krb5_boolean match_enctype, krb5_db_entry **server_ptr,
                    krb5_keyblock **key, krb5_kvno *kvno)
@@ -446,11 +446,10 @@ kdc_get_server_key(krb5_context context,
 
     *server_ptr = NULL;
 
-    retval = krb5_db_get_principal(context, ticket->server, flags,
-                                   &server);
+    retval = kdc_get_principal(kdc_context, ticket->server, flags, &server);
     if (retval == KRB5_KDB_NOENTRY) {
         char *sname;
-        if (!krb5_unparse_name(context, ticket->server, &sname)) {
+        if (!krb5_unparse_name(kdc_context, ticket->server, &sname)) {
             limit_string(sname);
             krb5_klog_syslog(LOG_ERR,
                              _("TGS_REQ: UNKNOWN SERVER: server='%s'"), sname);
@@ -466,8 +465,8 @@ kdc_get_server_key(krb5_context context,
     }
 
     if (key) {
-        retval = find_server_key(context, server, search_enctype, search_kvno,
-                                 key, kvno);
+        retval = find_server_key(kdc_active_realm, server, search_enctype,
+                                 search_kvno, key, kvno);
         if (retval)
             goto errout;
     }
@@ -476,7 +475,7 @@ kdc_get_server_key(krb5_context context,
     return 0;
 
 errout:
-    krb5_db_free_principal(context, server);
+    krb5_db_free_principal(kdc_context, server);
     return retval;
 }
 
@@ -486,7 +485,7 @@ errout:
  */
 static
 krb5_error_code
-find_server_key(krb5_context context,
+find_server_key(kdc_realm_t *kdc_active_realm,
                 krb5_db_entry *server, krb5_enctype enctype, krb5_kvno kvno,
                 krb5_keyblock **key_out, krb5_kvno *kvno_out)
 {
@@ -495,37 +494,66 @@ find_server_key(krb5_context context,
     krb5_keyblock       * key;
 
     *key_out = NULL;
-    retval = krb5_dbe_find_enctype(context, server, enctype, -1,
+    retval = krb5_dbe_find_enctype(kdc_context, server, enctype, -1,
                                    kvno ? (krb5_int32)kvno : -1, &server_key);
     if (retval)
         return retval;
     if (!server_key)
         return KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN;
-    if ((key = (krb5_keyblock *)malloc(sizeof *key)) == NULL)
-        return ENOMEM;
-    retval = krb5_dbe_decrypt_key_data(context, NULL, server_key,
-                                       key, NULL);
-    if (retval)
-        goto errout;
     if (enctype != -1) {
         krb5_boolean similar;
-        retval = krb5_c_enctype_compare(context, enctype, key->enctype,
+        retval = krb5_c_enctype_compare(kdc_context, enctype,
+                                        server_key->key_data_type[0],
                                         &similar);
         if (retval)
-            goto errout;
-        if (!similar) {
-            retval = KRB5_KDB_NO_PERMITTED_KEY;
-            goto errout;
-        }
-        key->enctype = enctype;
+            return retval;
+        if (!similar)
+            return KRB5_KDB_NO_PERMITTED_KEY;
+    }
+    if ((key = (krb5_keyblock *)malloc(sizeof *key)) == NULL)
+        return ENOMEM;
+    retval = kdc_get_keyblock(kdc_active_realm, server_key, enctype, key);
+    if (retval) {
+        free(key);
+        return retval;
     }
     *key_out = key;
-    key = NULL;
     if (kvno_out)
         *kvno_out = server_key->key_data_kvno;
-errout:
-    krb5_free_keyblock(context, key);
-    return retval;
+    return 0;
+}
+
+/* Encrypt ticket->enc_part2 into ticket->enc_part using key, as
+ * krb5_encrypt_tkt_part() does, but reusing any derived keys cached in key. */
+krb5_error_code
+kdc_encrypt_tkt_part(krb5_context context, krb5_key key, krb5_ticket *ticket)
+{
+    krb5_error_code ret;
+    krb5_data *der_enc_tkt;
+    krb5_enc_data *enc = &ticket->enc_part;
+    size_t enclen;
+
+    ret = encode_krb5_enc_tkt_part(ticket->enc_part2, &der_enc_tkt);
+    if (ret)
+        return ret;
+    ret = krb5_c_encrypt_length(context, krb5_k_key_enctype(context, key),
+                                der_enc_tkt->length, &enclen);
+    if (ret)
+        goto cleanup;
+    ret = alloc_data(&enc->ciphertext, enclen);
+    if (ret)
+        goto cleanup;
+    ret = krb5_k_encrypt(context, key, KRB5_KEYUSAGE_KDC_REP_TICKET, NULL,
+                         der_enc_tkt, enc);
+    if (ret) {
+        free(enc->ciphertext.data);
+        enc->ciphertext.data = NULL;
+    }
+
+cleanup:
+    zapfree(der_enc_tkt->data, der_enc_tkt->length);
+    free(der_enc_tkt);
+    return ret;
 }
 
 /* This probably wants to be updated if you support last_req stuff */
@@ -1478,9 +1506,9 @@ kdc_process_s4u2self_req(kdc_realm_t *kdc_active_realm,
         krb5_db_entry no_server;
         krb5_pa_data **e_data = NULL;
 
-        code = krb5_db_get_principal(kdc_context,
-                                     (*s4u_x509_user)->user_id.user,
-                                     KRB5_KDB_FLAG_INCLUDE_PAC, &princ);
+        code = kdc_get_principal(kdc_context,
+                                 (*s4u_x509_user)->user_id.user,
+                                 KRB5_KDB_FLAG_INCLUDE_PAC, &princ);
         if (code == KRB5_KDB_NOENTRY) {
             *status = "UNKNOWN_S4U2SELF_PRINCIPAL";
             return KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN;
@@ -1632,6 +1660,8 @@ log_as_req(krb5_context context, const krb5_fulladdr *from,
     const char *cname2 = cname ? cname : "<unknown client>";
     const char *sname2 = sname ? sname : "<unknown server>";
 
+    kdc_stats_count_result(errcode);
+
     fromstring = inet_ntop(ADDRTYPE2FAMILY (from->address->addrtype),
                            from->address->contents,
                            fromstringbuf, sizeof(fromstringbuf));
@@ -1699,6 +1729,8 @@ log_tgs_req(krb5_context ctx, const krb5_fulladdr *from,
     char *cname = NULL, *sname = NULL, *altcname = NULL;
     char *logcname = NULL, *logsname = NULL, *logaltcname = NULL;
 
+    kdc_stats_count_result(errcode);
+
     fromstring = inet_ntop(ADDRTYPE2FAMILY(from->address->addrtype),
                            from->address->contents,
                            fromstringbuf, sizeof(fromstringbuf));
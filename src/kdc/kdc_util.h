@@ -35,6 +35,7 @@
 #include "net-server.h"
 #include "realm_data.h"
 #include "reqstate.h"
+#include "kdc_stats.h"
 
 krb5_error_code check_hot_list (krb5_ticket *);
 krb5_boolean is_local_principal(kdc_realm_t *kdc_active_realm,
@@ -71,10 +72,13 @@ kdc_process_tgs_req (kdc_realm_t *, krb5_kdc_req *,
                      krb5_pa_data **pa_tgs_req);
 
 krb5_error_code
-kdc_get_server_key (krb5_context, krb5_ticket *, unsigned int,
+kdc_get_server_key (kdc_realm_t *, krb5_ticket *, unsigned int,
                     krb5_boolean match_enctype,
                     krb5_db_entry **, krb5_keyblock **, krb5_kvno *);
 
+krb5_error_code
+kdc_encrypt_tkt_part(krb5_context context, krb5_key key, krb5_ticket *ticket);
+
 int
 validate_as_request (kdc_realm_t *, krb5_kdc_req *, krb5_db_entry,
                      krb5_db_entry, krb5_timestamp,
@@ -129,6 +133,15 @@ dispatch (void *,
           loop_respond_fn,
           void *);
 
+krb5_error_code
+kdc_start_threads(verto_ctx *ctx, struct server_handle *handles, int num);
+
+void
+kdc_stop_threads(void);
+
+krb5_error_code
+kdc_add_lockout_timer(verto_ctx *ctx, struct server_handle *handle);
+
 void
 kdc_err(krb5_context call_context, errcode_t code, const char *fmt, ...)
 #if !defined(__cplusplus) && (__GNUC__ > 2)
@@ -221,12 +234,32 @@ handle_authdata (krb5_context context,
                  krb5_enc_tkt_part *enc_tkt_reply);
 
 /* replay.c */
-krb5_error_code kdc_init_lookaside(krb5_context context);
+krb5_error_code kdc_init_lookaside(krb5_context context, krb5_boolean shared);
 krb5_boolean kdc_check_lookaside (krb5_context, krb5_data *, krb5_data **);
 void kdc_insert_lookaside (krb5_context, krb5_data *, krb5_data *);
 void kdc_remove_lookaside (krb5_context kcontext, krb5_data *);
+void kdc_log_lookaside_stats(void);
 void kdc_free_lookaside(krb5_context);
 
+/* princ_cache.c */
+#define DEFAULT_PRINC_CACHE_SIZE (4 * 1024 * 1024)
+krb5_error_code kdc_init_princ_cache(size_t size);
+krb5_error_code kdc_get_principal(krb5_context context,
+                                  krb5_const_principal search_for,
+                                  unsigned int flags, krb5_db_entry **entry);
+void kdc_log_princ_cache_stats(void);
+void kdc_free_princ_cache(krb5_context);
+
+/* key_cache.c */
+krb5_error_code kdc_get_key(kdc_realm_t *kdc_active_realm,
+                            const krb5_key_data *key_data,
+                            krb5_enctype enctype, krb5_key *key_out);
+krb5_error_code kdc_get_keyblock(kdc_realm_t *kdc_active_realm,
+                                 const krb5_key_data *key_data,
+                                 krb5_enctype enctype,
+                                 krb5_keyblock *keyblock_out);
+void kdc_free_key_cache(kdc_realm_t *kdc_active_realm);
+
 /* kdc_util.c */
 void reset_for_hangup(void *);
 
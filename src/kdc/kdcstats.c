@@ -0,0 +1,220 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/kdcstats.c - Display KDC request statistics */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Read the statistics file maintained by krb5kdc (see kdc_stats.h) and
+ * display the totals for all of the KDC's processes and threads.
+ */
+
+#include "k5-int.h"
+#include "kdc_stats.h"
+#include "adm_proto.h"
+#include <sys/mman.h>
+#include <locale.h>
+
+static const char *timer_names[KDC_STATS_NTIMERS] = {
+    "AS-REQ", "TGS-REQ", "decode", "db-lookup", "preauth", "key-decrypt",
+    "tkt-encrypt", "encode"
+};
+
+static char *progname;
+
+static void
+usage()
+{
+    fprintf(stderr, _("Usage: %s [statsfile]\n"), progname);
+    exit(1);
+}
+
+/* Return the configured statistics file name from kdc.conf, or NULL. */
+static char *
+config_stats_file()
+{
+    krb5_pointer aprof;
+    const char *hierarchy[3];
+    char *path;
+
+    if (krb5_aprof_init(DEFAULT_KDC_PROFILE, KDC_PROFILE_ENV, &aprof))
+        return NULL;
+    hierarchy[0] = KRB5_CONF_KDCDEFAULTS;
+    hierarchy[1] = KRB5_CONF_KDC_STATS_FILE;
+    hierarchy[2] = NULL;
+    if (krb5_aprof_get_string(aprof, hierarchy, TRUE, &path))
+        path = NULL;
+    krb5_aprof_finish(aprof);
+    return path;
+}
+
+/* Add the counters in slot to total. */
+static void
+add_slot(struct kdc_stats_slot *total, const struct kdc_stats_slot *slot)
+{
+    struct kdc_stats_timing *t;
+    const struct kdc_stats_timing *st;
+    int i, b;
+
+    total->lookaside_calls += slot->lookaside_calls;
+    total->lookaside_hits += slot->lookaside_hits;
+    for (i = 0; i < KDC_STATS_NERRORS; i++)
+        total->errors[i] += slot->errors[i];
+    total->other_errors += slot->other_errors;
+    for (i = 0; i < KDC_STATS_NTIMERS; i++) {
+        t = &total->timers[i];
+        st = &slot->timers[i];
+        t->count += st->count;
+        t->total_usec += st->total_usec;
+        if (st->max_usec > t->max_usec)
+            t->max_usec = st->max_usec;
+        for (b = 0; b < KDC_STATS_NBUCKETS; b++)
+            t->buckets[b] += st->buckets[b];
+    }
+}
+
+/* Return an upper bound on the q-th quantile of the durations in t. */
+static unsigned long long
+quantile(const struct kdc_stats_timing *t, double q)
+{
+    krb5_ui_8 n = 0;
+    int b;
+
+    for (b = 0; b < KDC_STATS_NBUCKETS - 1; b++) {
+        n += t->buckets[b];
+        if (n >= q * t->count)
+            return ((krb5_ui_8)1 << b < t->max_usec) ? (krb5_ui_8)1 << b :
+                t->max_usec;
+    }
+    return t->max_usec;
+}
+
+static void
+display(const struct kdc_stats_header *hdr, const struct kdc_stats_slot *s)
+{
+    const struct kdc_stats_timing *t;
+    time_t start = hdr->start_time;
+    int i;
+
+    printf(_("KDC statistics since %s"), ctime(&start));
+    printf(_("Lookaside cache: %llu requests, %llu hits\n"),
+           (unsigned long long)s->lookaside_calls,
+           (unsigned long long)s->lookaside_hits);
+
+    printf(_("\nRequest results:\n"));
+    for (i = 0; i < KDC_STATS_NERRORS; i++) {
+        if (s->errors[i] == 0)
+            continue;
+        if (i == 0) {
+            printf("%12llu  %s\n", (unsigned long long)s->errors[i],
+                   _("Success"));
+        } else {
+            printf("%12llu  %s (%d)\n", (unsigned long long)s->errors[i],
+                   error_message(ERROR_TABLE_BASE_krb5 + i), i);
+        }
+    }
+    if (s->other_errors != 0) {
+        printf("%12llu  %s\n", (unsigned long long)s->other_errors,
+               _("Other errors"));
+    }
+
+    printf(_("\nTimes (microseconds):\n"));
+    printf("%-12s %12s %10s %10s %10s %10s %10s\n", "", _("count"),
+           _("mean"), _("median"), _("90%"), _("99%"), _("max"));
+    for (i = 0; i < KDC_STATS_NTIMERS; i++) {
+        t = &s->timers[i];
+        printf("%-12s %12llu %10llu %10llu %10llu %10llu %10llu\n",
+               timer_names[i], (unsigned long long)t->count,
+               (unsigned long long)(t->count ? t->total_usec / t->count : 0),
+               quantile(t, 0.5), quantile(t, 0.9), quantile(t, 0.99),
+               (unsigned long long)t->max_usec);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct kdc_stats_header hdr;
+    struct kdc_stats_slot total;
+    const struct kdc_stats_slot *slots;
+    struct stat sb;
+    char *path;
+    void *map;
+    unsigned int i;
+    int fd;
+
+    setlocale(LC_ALL, "");
+    progname = (strrchr(argv[0], '/') != NULL) ? strrchr(argv[0], '/') + 1 :
+        argv[0];
+    if (argc > 2)
+        usage();
+    path = (argc == 2) ? argv[1] : config_stats_file();
+    if (path == NULL) {
+        fprintf(stderr, _("%s: no statistics file is configured\n"),
+                progname);
+        exit(1);
+    }
+    initialize_krb5_error_table();
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &sb) != 0) {
+        fprintf(stderr, _("%s: cannot open %s: %s\n"), progname, path,
+                strerror(errno));
+        exit(1);
+    }
+    if ((size_t)sb.st_size < sizeof(hdr) ||
+        read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != KDC_STATS_MAGIC || hdr.version != KDC_STATS_VERSION ||
+        hdr.slot_size != sizeof(struct kdc_stats_slot) ||
+        (size_t)sb.st_size < sizeof(hdr) + (size_t)hdr.nslots *
+        sizeof(struct kdc_stats_slot)) {
+        fprintf(stderr, _("%s: %s is not a KDC statistics file\n"), progname,
+                path);
+        exit(1);
+    }
+
+    /* Map the file rather than reading it, so that we get a nearly
+     * consistent snapshot of each slot while the KDC is running. */
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, _("%s: cannot map %s: %s\n"), progname, path,
+                strerror(errno));
+        exit(1);
+    }
+    close(fd);
+
+    memset(&total, 0, sizeof(total));
+    slots = (struct kdc_stats_slot *)((struct kdc_stats_header *)map + 1);
+    for (i = 0; i < hdr.nslots; i++)
+        add_slot(&total, &slots[i]);
+    display(&hdr, &total);
+    munmap(map, sb.st_size);
+    return 0;
+}
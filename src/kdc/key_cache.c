@@ -0,0 +1,191 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/key_cache.c - Cache of decrypted principal keys for the KDC */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decrypting a principal key from the database costs a decryption with the
+ * master key (including deriving the master key's encryption and integrity
+ * keys), and using the resulting keyblock with the krb5_c_* functions costs
+ * another key derivation and key schedule setup for every operation.  This
+ * module keeps recently used keys as krb5_key objects, so that both the
+ * decrypted key and its cached derived keys are reused across requests.
+ *
+ * The cache is indexed by the encrypted key data itself, which identifies the
+ * principal key, its kvno and enctype, and the master key version it is
+ * encrypted in, so a key change in the database is never masked by a cached
+ * entry.  The cache is a small direct-mapped table; a new key simply replaces
+ * the key occupying its slot.
+ *
+ * krb5_key objects are not safe for concurrent use, so each realm structure
+ * has its own cache and is only used by one thread at a time.
+ */
+
+#include "k5-int.h"
+#include "kdc_util.h"
+
+#ifndef KEY_CACHE_SIZE
+#define KEY_CACHE_SIZE 256
+#endif
+
+struct key_cache_slot {
+    krb5_enctype enctype;       /* Enctype requested by the caller, or -1 */
+    krb5_data enc_key;          /* Encrypted key data */
+    krb5_key key;
+};
+
+struct kdc_key_cache {
+    struct key_cache_slot slots[KEY_CACHE_SIZE];
+};
+
+/* Return the cache slot for enc_key with the requested enctype. */
+static unsigned int
+slot_index(const krb5_data *enc_key, krb5_enctype enctype)
+{
+    const unsigned char *p = (unsigned char *)enc_key->data;
+    krb5_ui_4 h = 2166136261U ^ (krb5_ui_4)enctype;
+    unsigned int i;
+
+    for (i = 0; i < enc_key->length; i++)
+        h = (h ^ p[i]) * 16777619;
+    return h % KEY_CACHE_SIZE;
+}
+
+static void
+clear_slot(krb5_context context, struct key_cache_slot *slot)
+{
+    krb5_k_free_key(context, slot->key);
+    krb5_free_data_contents(context, &slot->enc_key);
+    slot->key = NULL;
+}
+
+static krb5_error_code
+get_key(kdc_realm_t *kdc_active_realm, const krb5_key_data *key_data,
+        krb5_enctype enctype, krb5_key *key_out)
+{
+    krb5_error_code ret;
+    struct kdc_key_cache *cache = kdc_active_realm->realm_keycache;
+    struct key_cache_slot *slot;
+    krb5_keyblock keyblock;
+    krb5_key key;
+    krb5_data enc_key = make_data(key_data->key_data_contents[0],
+                                  key_data->key_data_length[0]);
+
+    *key_out = NULL;
+    if (cache == NULL) {
+        cache = k5alloc(sizeof(*cache), &ret);
+        if (cache == NULL)
+            return ret;
+        kdc_active_realm->realm_keycache = cache;
+    }
+
+    slot = &cache->slots[slot_index(&enc_key, enctype)];
+    if (slot->key != NULL && slot->enctype == enctype &&
+        data_eq(slot->enc_key, enc_key)) {
+        krb5_k_reference_key(kdc_context, slot->key);
+        *key_out = slot->key;
+        return 0;
+    }
+
+    memset(&keyblock, 0, sizeof(keyblock));
+    ret = krb5_dbe_decrypt_key_data(kdc_context, NULL, key_data, &keyblock,
+                                    NULL);
+    if (ret)
+        return ret;
+    if (enctype != -1)
+        keyblock.enctype = enctype;
+    ret = krb5_k_create_key(kdc_context, &keyblock, &key);
+    krb5_free_keyblock_contents(kdc_context, &keyblock);
+    if (ret)
+        return ret;
+
+    /* Replace the slot's previous key.  If we can't, just don't cache. */
+    clear_slot(kdc_context, slot);
+    if (alloc_data(&slot->enc_key, enc_key.length) == 0) {
+        memcpy(slot->enc_key.data, enc_key.data, enc_key.length);
+        slot->enctype = enctype;
+        krb5_k_reference_key(kdc_context, key);
+        slot->key = key;
+    }
+    *key_out = key;
+    return 0;
+}
+
+/*
+ * Set *key_out to a key object for key_data, decrypting it with the realm's
+ * master key if it is not in the realm's key cache.  If enctype is not -1,
+ * use it as the key's enctype instead of the stored one; the caller must have
+ * checked that the two are similar.  The caller must free *key_out with
+ * krb5_k_free_key().
+ */
+krb5_error_code
+kdc_get_key(kdc_realm_t *kdc_active_realm, const krb5_key_data *key_data,
+            krb5_enctype enctype, krb5_key *key_out)
+{
+    krb5_error_code ret;
+    krb5_ui_8 start = kdc_stats_begin();
+
+    ret = get_key(kdc_active_realm, key_data, enctype, key_out);
+    kdc_stats_end(KDC_STATS_KEY_DECRYPT, start);
+    return ret;
+}
+
+/* Like kdc_get_key(), but fill in *keyblock_out with a copy of the key's
+ * keyblock, to be freed with krb5_free_keyblock_contents(). */
+krb5_error_code
+kdc_get_keyblock(kdc_realm_t *kdc_active_realm, const krb5_key_data *key_data,
+                 krb5_enctype enctype, krb5_keyblock *keyblock_out)
+{
+    krb5_error_code ret;
+    krb5_key key;
+
+    ret = kdc_get_key(kdc_active_realm, key_data, enctype, &key);
+    if (ret)
+        return ret;
+    ret = krb5_copy_keyblock_contents(kdc_context, &key->keyblock,
+                                      keyblock_out);
+    krb5_k_free_key(kdc_context, key);
+    return ret;
+}
+
+/* Free the realm's key cache. */
+void
+kdc_free_key_cache(kdc_realm_t *kdc_active_realm)
+{
+    struct kdc_key_cache *cache = kdc_active_realm->realm_keycache;
+    int i;
+
+    if (cache == NULL)
+        return;
+    for (i = 0; i < KEY_CACHE_SIZE; i++)
+        clear_slot(kdc_context, &cache->slots[i]);
+    free(cache);
+    kdc_active_realm->realm_keycache = NULL;
+}
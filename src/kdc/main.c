@@ -54,13 +54,21 @@ static void usage (char *);
 
 static krb5_error_code setup_sam (void);
 
-static void initialize_realms (krb5_context, int, char **);
+static void initialize_realms (krb5_context, int, char **,
+                               struct server_handle *,
+                               struct server_handle *);
 
 static void finish_realms (void);
 
 static int nofork = 0;
 static int workers = 0;
+static int threads = 0;
 static int time_offset = 0;
+static krb5_int32 tcp_listen_backlog = 5;
+static krb5_boolean reuseport = FALSE;
+static krb5_int32 udp_batch_size = 1;
+static krb5_int32 princ_cache_size = DEFAULT_PRINC_CACHE_SIZE;
+static char *stats_file = NULL;
 static const char *pid_file = NULL;
 static int rkey_init_done = 0;
 static volatile int signal_received = 0;
@@ -76,6 +84,10 @@ static const char *kdc_progname;
  */
 static struct server_handle shandle;
 
+/* Server handles for worker threads, each with its own realm contexts. */
+static struct server_handle *thread_handles;
+static int num_thread_handles;
+
 /*
  * We use krb5_klog_init to set up a com_err callback to log error
  * messages.  The callback also pulls the error message out of the
@@ -85,17 +97,42 @@ static struct server_handle shandle;
  * error message state from the call context is copied into the
  * context known by krb5_klog.  call_context can be NULL if the error
  * code did not come from a krb5 library function.
+ *
+ * Worker threads share the global context, so err_lock is held while
+ * the message is copied into it and while the klog callback reads it.
+ * The callback is wrapped by locked_com_err_proc so that plain com_err
+ * calls take the lock too.
  */
+static k5_mutex_t err_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static et_old_error_hook_func klog_hook;
+
+static void
+locked_com_err_proc(const char *whoami, errcode_t code, const char *fmt,
+                    va_list ap)
+{
+    if (k5_mutex_lock(&err_lock) != 0)
+        return;
+    klog_hook(whoami, code, fmt, ap);
+    k5_mutex_unlock(&err_lock);
+}
+
 void
 kdc_err(krb5_context call_context, errcode_t code, const char *fmt, ...)
 {
     va_list ap;
 
+    if (k5_mutex_lock(&err_lock) != 0)
+        return;
     if (call_context)
         krb5_copy_error_message(shandle.kdc_err_context, call_context);
     va_start(ap, fmt);
-    com_err_va(kdc_progname, code, fmt, ap);
+    /* Call the klog callback directly, since its wrapper takes err_lock. */
+    if (klog_hook != NULL)
+        klog_hook(kdc_progname, code, fmt, ap);
+    else
+        com_err_va(kdc_progname, code, fmt, ap);
     va_end(ap);
+    k5_mutex_unlock(&err_lock);
 }
 
 /*
@@ -156,6 +193,7 @@ finish_realm(kdc_realm_t *rdp)
     if (rdp->realm_no_referral)
         free(rdp->realm_no_referral);
     if (rdp->realm_context) {
+        kdc_free_key_cache(rdp);
         if (rdp->realm_mprinc)
             krb5_free_principal(rdp->realm_context, rdp->realm_mprinc);
         if (rdp->realm_mkey.length && rdp->realm_mkey.contents) {
@@ -194,7 +232,8 @@ combine(const char *val1, const char *val2, char **val_out)
 
 /*
  * Initialize a realm control structure from the alternate profile or from
- * the specified defaults.
+ * the specified defaults.  If mkey is not NULL, use it as the master key
+ * instead of reading the stash file or prompting.
  *
  * After we're complete here, the essence of the realm is embodied in the
  * realm data and we should be all set to begin operation for that realm.
@@ -203,7 +242,8 @@ static krb5_error_code
 init_realm(kdc_realm_t *rdp, krb5_pointer aprof, char *realm, char *def_mpname,
            krb5_enctype def_enctype, char *def_udp_ports, char *def_tcp_ports,
            krb5_boolean def_manual, krb5_boolean def_restrict_anon,
-           char **db_args, char *no_referral, char *hostbased)
+           char **db_args, char *no_referral, char *hostbased,
+           const krb5_keyblock *mkey)
 {
     krb5_error_code     kret;
     krb5_boolean        manual;
@@ -351,10 +391,15 @@ init_realm(kdc_realm_t *rdp, krb5_pointer aprof, char *realm, char *def_mpname,
     /*
      * Get the master key (note, may not be the most current mkey).
      */
-    if ((kret = krb5_db_fetch_mkey(rdp->realm_context, rdp->realm_mprinc,
-                                   rdp->realm_mkey.enctype, manual,
-                                   FALSE, rdp->realm_stash,
-                                   &mkvno, NULL, &rdp->realm_mkey))) {
+    if (mkey != NULL) {
+        if ((kret = krb5_copy_keyblock_contents(rdp->realm_context, mkey,
+                                                &rdp->realm_mkey)))
+            goto whoops;
+    } else if ((kret = krb5_db_fetch_mkey(rdp->realm_context,
+                                          rdp->realm_mprinc,
+                                          rdp->realm_mkey.enctype, manual,
+                                          FALSE, rdp->realm_stash,
+                                          &mkvno, NULL, &rdp->realm_mkey))) {
         kdc_err(rdp->realm_context, kret,
                 _("while fetching master key %s for realm %s"),
                 rdp->realm_mpname, realm);
@@ -524,6 +569,7 @@ create_workers(verto_ctx *ctx, int num)
                 exit(0);
 
             /* Return control to main() in the new worker process. */
+            kdc_stats_attach(i);
             free(pids);
             return 0;
         }
@@ -591,7 +637,7 @@ usage(char *name)
             _("usage: %s [-x db_args]* [-d dbpathname] [-r dbrealmname]\n"
               "\t\t[-R replaycachename] [-m] [-k masterenctype]\n"
               "\t\t[-M masterkeyname] [-p port] [-P pid_file]\n"
-              "\t\t[-n] [-w numworkers] [/]\n\n"
+              "\t\t[-n] [-w numworkers] [-t numthreads] [/]\n\n"
               "where,\n"
               "\t[-x db_args]* - Any number of database specific arguments.\n"
               "\t\t\tLook at each database module documentation for "
@@ -601,8 +647,27 @@ usage(char *name)
 }
 
 
+/* Return the master key of the realm named realm in handle, or NULL if handle
+ * is NULL or does not serve that realm. */
+static const krb5_keyblock *
+find_mkey(struct server_handle *handle, char *realm)
+{
+    kdc_realm_t *rdp;
+
+    if (handle == NULL)
+        return NULL;
+    rdp = find_realm_data(handle, realm, (krb5_ui_4) strlen(realm));
+    return (rdp == NULL) ? NULL : &rdp->realm_mkey;
+}
+
+/*
+ * Initialize the realms of handle according to the command-line arguments.
+ * If parent is not NULL, take each realm's master key from the corresponding
+ * realm in parent.
+ */
 static void
-initialize_realms(krb5_context kcontext, int argc, char **argv)
+initialize_realms(krb5_context kcontext, int argc, char **argv,
+                  struct server_handle *handle, struct server_handle *parent)
 {
     int                 c;
     char                *db_name = (char *) NULL;
@@ -636,6 +701,22 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
         hierarchy[1] = KRB5_CONF_MAX_DGRAM_REPLY_SIZE;
         if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &max_dgram_reply_size))
             max_dgram_reply_size = MAX_DGRAM_SIZE;
+        hierarchy[1] = KRB5_CONF_KDC_TCP_LISTEN_BACKLOG;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &tcp_listen_backlog))
+            tcp_listen_backlog = 5;
+        hierarchy[1] = KRB5_CONF_KDC_REUSEPORT;
+        if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &reuseport))
+            reuseport = FALSE;
+        hierarchy[1] = KRB5_CONF_KDC_UDP_BATCH_SIZE;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &udp_batch_size))
+            udp_batch_size = 1;
+        hierarchy[1] = KRB5_CONF_KDC_PRINCIPAL_CACHE_SIZE;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &princ_cache_size))
+            princ_cache_size = DEFAULT_PRINC_CACHE_SIZE;
+        hierarchy[1] = KRB5_CONF_KDC_STATS_FILE;
+        free(stats_file);
+        if (krb5_aprof_get_string(aprof, hierarchy, TRUE, &stats_file))
+            stats_file = NULL;
         hierarchy[1] = KRB5_CONF_RESTRICT_ANONYMOUS_TO_TGT;
         if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &def_restrict_anon))
             def_restrict_anon = FALSE;
@@ -664,9 +745,11 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
 
     /*
      * Loop through the option list.  Each time we encounter a realm name,
-     * use the previously scanned options to fill in for defaults.
+     * use the previously scanned options to fill in for defaults.  We may
+     * be called more than once, so start from the beginning.
      */
-    while ((c = getopt(argc, argv, "x:r:d:mM:k:R:e:P:p:s:nw:4:T:X3")) != -1) {
+    optind = 1;
+    while ((c = getopt(argc, argv, "x:r:d:mM:k:R:e:P:p:s:nw:t:4:T:X3")) != -1) {
         switch(c) {
         case 'x':
             db_args_size++;
@@ -686,21 +769,22 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
             break;
 
         case 'r':                       /* realm name for db */
-            if (!find_realm_data(&shandle, optarg, (krb5_ui_4) strlen(optarg))) {
+            if (!find_realm_data(handle, optarg, (krb5_ui_4) strlen(optarg))) {
                 if ((rdatap = (kdc_realm_t *) malloc(sizeof(kdc_realm_t)))) {
                     retval = init_realm(rdatap, aprof, optarg, mkey_name,
                                         menctype, default_udp_ports,
                                         default_tcp_ports, manual,
                                         def_restrict_anon, db_args,
-                                        no_referral, hostbased);
+                                        no_referral, hostbased,
+                                        find_mkey(parent, optarg));
                     if (retval) {
                         fprintf(stderr, _("%s: cannot initialize realm %s - "
                                           "see log file for details\n"),
                                 argv[0], optarg);
                         exit(1);
                     }
-                    shandle.kdc_realmlist[shandle.kdc_numrealms] = rdatap;
-                    shandle.kdc_numrealms++;
+                    handle->kdc_realmlist[handle->kdc_numrealms] = rdatap;
+                    handle->kdc_numrealms++;
                     free(db_args), db_args=NULL, db_args_size = 0;
                 }
                 else
@@ -754,6 +838,11 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
             if (workers <= 0)
                 usage(argv[0]);
             break;
+        case 't':                       /* create worker threads */
+            threads = atoi(optarg);
+            if (threads <= 0)
+                usage(argv[0]);
+            break;
         case 'k':                       /* enctype for master key */
             if (krb5_string_to_enctype(optarg, &menctype))
                 com_err(argv[0], 0, _("invalid enctype %s"), optarg);
@@ -795,7 +884,7 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
     /*
      * Check to see if we processed any realms.
      */
-    if (shandle.kdc_numrealms == 0) {
+    if (handle->kdc_numrealms == 0) {
         /* no realm specified, use default realm */
         if ((retval = krb5_get_default_realm(kcontext, &lrealm))) {
             com_err(argv[0], retval,
@@ -809,14 +898,14 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
             retval = init_realm(rdatap, aprof, lrealm, mkey_name, menctype,
                                 default_udp_ports, default_tcp_ports, manual,
                                 def_restrict_anon, db_args, no_referral,
-                                hostbased);
+                                hostbased, find_mkey(parent, lrealm));
             if (retval) {
                 fprintf(stderr, _("%s: cannot initialize realm %s - see log "
                                   "file for details\n"), argv[0], lrealm);
                 exit(1);
             }
-            shandle.kdc_realmlist[0] = rdatap;
-            shandle.kdc_numrealms++;
+            handle->kdc_realmlist[0] = rdatap;
+            handle->kdc_numrealms++;
         }
         krb5_free_default_realm(kcontext, lrealm);
     }
@@ -854,6 +943,58 @@ write_pid_file(const char *path)
     return 0;
 }
 
+/*
+ * Create num worker threads, each with its own server handle whose realms
+ * share the master keys of the realms in shandle.
+ */
+static krb5_error_code
+create_threads(verto_ctx *ctx, krb5_context kcontext, int num, int argc,
+               char **argv)
+{
+    krb5_error_code retval;
+    struct server_handle *handle;
+
+    krb5_klog_syslog(LOG_INFO, _("creating %d worker threads"), num);
+    thread_handles = calloc(num, sizeof(*thread_handles));
+    if (thread_handles == NULL)
+        return ENOMEM;
+    for (num_thread_handles = 0; num_thread_handles < num;
+         num_thread_handles++) {
+        handle = &thread_handles[num_thread_handles];
+        handle->kdc_realmlist = calloc(KRB5_KDC_MAX_REALMS,
+                                       sizeof(kdc_realm_t *));
+        if (handle->kdc_realmlist == NULL)
+            return ENOMEM;
+        retval = krb5int_init_context_kdc(&handle->kdc_err_context);
+        if (retval) {
+            free(handle->kdc_realmlist);
+            return retval;
+        }
+        initialize_realms(kcontext, argc, argv, handle, &shandle);
+    }
+    return kdc_start_threads(ctx, thread_handles, num);
+}
+
+/* Stop the worker threads and release their server handles. */
+static void
+finish_threads()
+{
+    struct server_handle *handle;
+    int i, j;
+
+    kdc_stop_threads();
+    for (i = 0; i < num_thread_handles; i++) {
+        handle = &thread_handles[i];
+        for (j = 0; j < handle->kdc_numrealms; j++)
+            finish_realm(handle->kdc_realmlist[j]);
+        free(handle->kdc_realmlist);
+        krb5_free_context(handle->kdc_err_context);
+    }
+    free(thread_handles);
+    thread_handles = NULL;
+    num_thread_handles = 0;
+}
+
 static void
 finish_realms()
 {
@@ -898,6 +1039,7 @@ int main(int argc, char **argv)
     krb5_context        kcontext;
     verto_ctx *ctx;
     int errout = 0;
+    krb5_boolean worker_sockets = FALSE;
     int i;
 
     setlocale(LC_ALL, "");
@@ -924,7 +1066,15 @@ int main(int argc, char **argv)
         com_err(argv[0], retval, _("while initializing krb5"));
         exit(1);
     }
+    retval = k5_mutex_finish_init(&err_lock);
+    if (retval) {
+        com_err(argv[0], retval, _("while initializing error lock"));
+        exit(1);
+    }
     krb5_klog_init(kcontext, "kdc", argv[0], 1);
+    klog_hook = set_com_err_hook(locked_com_err_proc);
+    if (klog_hook == NULL)
+        (void)reset_com_err_hook();
     shandle.kdc_err_context = kcontext;
     kdc_progname = argv[0];
     /* N.B.: After this point, com_err sends output to the KDC log
@@ -937,10 +1087,10 @@ int main(int argc, char **argv)
     /*
      * Scan through the argument list
      */
-    initialize_realms(kcontext, argc, argv);
+    initialize_realms(kcontext, argc, argv, &shandle, NULL);
 
 #ifndef NOCACHE
-    retval = kdc_init_lookaside(kcontext);
+    retval = kdc_init_lookaside(kcontext, workers > 0);
     if (retval) {
         kdc_err(kcontext, retval, _("while initializing lookaside cache"));
         finish_realms();
@@ -948,6 +1098,22 @@ int main(int argc, char **argv)
     }
 #endif
 
+    retval = kdc_init_princ_cache(max(princ_cache_size, 0));
+    if (retval) {
+        kdc_err(kcontext, retval, _("while initializing principal cache"));
+        finish_realms();
+        return 1;
+    }
+
+    retval = kdc_init_stats(stats_file, max(workers, 1), threads);
+    if (retval) {
+        kdc_err(kcontext, retval, _("while initializing statistics file %s"),
+                stats_file);
+        finish_realms();
+        return 1;
+    }
+    kdc_stats_attach(0);
+
     ctx = loop_init(VERTO_EV_TYPE_NONE);
     if (!ctx) {
         kdc_err(kcontext, ENOMEM, _("while creating main loop"));
@@ -997,6 +1163,28 @@ int main(int argc, char **argv)
         }
     }
 
+    loop_set_tcp_listen_backlog(tcp_listen_backlog);
+    retval = loop_set_udp_batch_size(udp_batch_size);
+    if (retval) {
+        kdc_err(kcontext, retval, _("while enabling batched UDP processing; "
+                                    "continuing without it"));
+    }
+
+    /*
+     * If requested, let each worker process bind its own listener sockets
+     * with SO_REUSEPORT, so that the kernel distributes incoming packets and
+     * connections among the workers instead of waking all of them.
+     */
+    if (workers > 0 && reuseport) {
+        retval = loop_set_reuseport(1);
+        if (retval) {
+            kdc_err(kcontext, retval, _("while enabling SO_REUSEPORT; "
+                                        "workers will share sockets"));
+        } else {
+            worker_sockets = TRUE;
+        }
+    }
+
     /*
      * Setup network listeners.  Disallow network reconfig in response to
      * routing socket messages if we're using worker processes, since the
@@ -1044,14 +1232,42 @@ int main(int argc, char **argv)
             return 1;
         }
         /* We get here only in a worker child process; re-initialize realms. */
-        initialize_realms(kcontext, argc, argv);
+        initialize_realms(kcontext, argc, argv, &shandle, NULL);
+        if (worker_sockets) {
+            /* Replace the inherited listener sockets with our own.  The
+             * supervisor closes its copies once all workers are forked. */
+            retval = loop_setup_network(ctx, &shandle, kdc_progname);
+            if (retval)
+                goto net_init_error;
+        }
+    }
+    if (threads > 0) {
+        retval = create_threads(ctx, kcontext, threads, argc, argv);
+        if (retval) {
+            kdc_err(kcontext, retval, _("while creating worker threads"));
+            finish_threads();
+            finish_realms();
+            return 1;
+        }
+    }
+    retval = kdc_add_lockout_timer(ctx, &shandle);
+    if (retval) {
+        kdc_err(kcontext, retval, _("while creating lockout timer"));
+        finish_threads();
+        finish_realms();
+        return 1;
     }
     krb5_klog_syslog(LOG_INFO, _("commencing operation"));
     if (nofork)
         fprintf(stderr, _("%s: starting...\n"), kdc_progname);
 
     verto_run(ctx);
+    finish_threads();
     loop_free(ctx);
+#ifndef NOCACHE
+    kdc_log_lookaside_stats();
+#endif
+    kdc_log_princ_cache_stats();
     krb5_klog_syslog(LOG_INFO, _("shutting down"));
     unload_preauth_plugins(kcontext);
     unload_authdata_plugins(kcontext);
@@ -1062,6 +1278,9 @@ int main(int argc, char **argv)
 #ifndef NOCACHE
     kdc_free_lookaside(kcontext);
 #endif
+    kdc_free_princ_cache(kcontext);
+    kdc_free_stats();
+    free(stats_file);
     krb5_free_context(kcontext);
     return errout;
 }
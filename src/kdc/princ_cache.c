@@ -0,0 +1,435 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/princ_cache.c - Cache of decoded principal entries for the KDC */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The KDC looks up the same few principal entries (the local TGS principal
+ * above all) for nearly every request.  This module keeps copies of recently
+ * used entries, so that a repeated lookup costs a hash probe and a copy
+ * instead of a database read and decode.
+ *
+ * Each cached entry records the database age (as reported by krb5_db_get_age)
+ * at the time it was read, and is only used while the database age is
+ * unchanged.  The db2 module advances the age on every modification of the
+ * database, including those made by kadmind, kdb5_util, and kpropd on behalf
+ * of incremental propagation, so any change invalidates every cached entry
+ * for that database.  An entry is only cached if it was read in a later
+ * second than the database age, so database modules without a meaningful age
+ * (such as LDAP, which reports the current time) never populate the cache.
+ *
+ * The cache is shared by all worker threads and bounded by an approximate
+ * memory size; the least recently used entries are discarded first.  Callers
+ * always receive their own copy of an entry, to be freed with
+ * krb5_db_free_principal() as usual.
+ */
+
+#include "k5-int.h"
+#include "k5-queue.h"
+#include "kdc_util.h"
+#include "adm_proto.h"
+#include <syslog.h>
+
+#ifndef PRINC_CACHE_HASH_SIZE
+#define PRINC_CACHE_HASH_SIZE 4096
+#endif
+
+struct cache_entry {
+    LIST_ENTRY(cache_entry) bucket_links;
+    TAILQ_ENTRY(cache_entry) lru_links;
+    char *realm;                /* Realm of the database searched */
+    krb5_principal search_for;  /* Name searched for */
+    unsigned int flags;         /* Lookup flags */
+    time_t age;                 /* Database age when the entry was read */
+    size_t size;
+    krb5_db_entry *entry;
+};
+
+LIST_HEAD(cache_entry_list, cache_entry);
+TAILQ_HEAD(cache_entry_queue, cache_entry);
+
+static k5_mutex_t cache_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct cache_entry_list hash_table[PRINC_CACHE_HASH_SIZE];
+static struct cache_entry_queue lru_queue;
+
+static size_t max_size;
+static size_t total_size;
+static int num_entries;
+static unsigned long lookups, hits, invalidations, evictions;
+
+/* Mix len bytes of data into the FNV-1a hash h. */
+static krb5_ui_4
+hash_bytes(krb5_ui_4 h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * 16777619;
+    return h;
+}
+
+/* Return the hash bucket for a lookup of princ with flags in realm. */
+static krb5_ui_4
+lookup_hash(const char *realm, krb5_const_principal princ, unsigned int flags)
+{
+    krb5_ui_4 h = 2166136261U;
+    krb5_int32 i;
+
+    h = hash_bytes(h, realm, strlen(realm) + 1);
+    h = hash_bytes(h, &flags, sizeof(flags));
+    h = hash_bytes(h, &princ->type, sizeof(princ->type));
+    h = hash_bytes(h, princ->realm.data, princ->realm.length);
+    for (i = 0; i < princ->length; i++) {
+        h = hash_bytes(h, &princ->data[i].length,
+                       sizeof(princ->data[i].length));
+        h = hash_bytes(h, princ->data[i].data, princ->data[i].length);
+    }
+    return h % PRINC_CACHE_HASH_SIZE;
+}
+
+/* Return the rough memory footprint of a cache entry for ent. */
+static size_t
+entry_size(krb5_const_principal search_for, const krb5_db_entry *ent)
+{
+    size_t size = sizeof(struct cache_entry) + sizeof(*ent) + ent->e_length;
+    krb5_tl_data *tl;
+    krb5_int32 i;
+    int j;
+
+    for (i = 0; i < search_for->length; i++)
+        size += sizeof(krb5_data) + search_for->data[i].length;
+    for (i = 0; i < ent->princ->length; i++)
+        size += sizeof(krb5_data) + ent->princ->data[i].length;
+    for (tl = ent->tl_data; tl != NULL; tl = tl->tl_data_next)
+        size += sizeof(*tl) + tl->tl_data_length;
+    for (i = 0; i < ent->n_key_data; i++) {
+        size += sizeof(krb5_key_data);
+        for (j = 0; j < ent->key_data[i].key_data_ver; j++)
+            size += ent->key_data[i].key_data_length[j];
+    }
+    return size;
+}
+
+/*
+ * Free an entry allocated by copy_entry().  This frees the same fields in the
+ * same way as the database modules' free_principal methods, but does not
+ * require a context with an open database.
+ */
+static void
+free_entry(krb5_context context, krb5_db_entry *ent)
+{
+    krb5_tl_data *tl, *next;
+    krb5_int16 i;
+    int j;
+
+    if (ent == NULL)
+        return;
+    free(ent->e_data);
+    krb5_free_principal(context, ent->princ);
+    for (tl = ent->tl_data; tl != NULL; tl = next) {
+        next = tl->tl_data_next;
+        free(tl->tl_data_contents);
+        free(tl);
+    }
+    for (i = 0; i < ent->n_key_data; i++) {
+        for (j = 0; j < ent->key_data[i].key_data_ver; j++) {
+            zapfree(ent->key_data[i].key_data_contents[j],
+                    ent->key_data[i].key_data_length[j]);
+        }
+    }
+    free(ent->key_data);
+    free(ent);
+}
+
+/* Make a copy of in which can be freed with krb5_db_free_principal(). */
+static krb5_error_code
+copy_entry(krb5_context context, const krb5_db_entry *in,
+           krb5_db_entry **out)
+{
+    krb5_error_code ret;
+    krb5_db_entry *ent;
+    krb5_tl_data *tl, **tlp;
+    krb5_key_data *kd;
+    krb5_int16 i;
+    int j;
+
+    *out = NULL;
+    ent = k5alloc(sizeof(*ent), &ret);
+    if (ent == NULL)
+        return ret;
+    *ent = *in;
+    ent->e_data = NULL;
+    ent->princ = NULL;
+    ent->tl_data = NULL;
+    ent->key_data = NULL;
+    ent->n_key_data = 0;
+
+    if (in->e_length > 0) {
+        ent->e_data = k5alloc(in->e_length, &ret);
+        if (ent->e_data == NULL)
+            goto cleanup;
+        memcpy(ent->e_data, in->e_data, in->e_length);
+    }
+
+    ret = krb5_copy_principal(context, in->princ, &ent->princ);
+    if (ret)
+        goto cleanup;
+
+    tlp = &ent->tl_data;
+    for (tl = in->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        *tlp = k5alloc(sizeof(**tlp), &ret);
+        if (*tlp == NULL)
+            goto cleanup;
+        (*tlp)->tl_data_type = tl->tl_data_type;
+        (*tlp)->tl_data_contents = k5alloc(tl->tl_data_length, &ret);
+        if ((*tlp)->tl_data_contents == NULL)
+            goto cleanup;
+        memcpy((*tlp)->tl_data_contents, tl->tl_data_contents,
+               tl->tl_data_length);
+        (*tlp)->tl_data_length = tl->tl_data_length;
+        tlp = &(*tlp)->tl_data_next;
+    }
+
+    if (in->n_key_data > 0) {
+        ent->key_data = k5alloc(in->n_key_data * sizeof(*kd), &ret);
+        if (ent->key_data == NULL)
+            goto cleanup;
+        for (i = 0; i < in->n_key_data; i++) {
+            /* Count the key data before copying its contents, so that a
+             * partial copy is freed correctly. */
+            kd = &ent->key_data[i];
+            kd->key_data_ver = in->key_data[i].key_data_ver;
+            kd->key_data_kvno = in->key_data[i].key_data_kvno;
+            ent->n_key_data++;
+            for (j = 0; j < in->key_data[i].key_data_ver; j++) {
+                kd->key_data_type[j] = in->key_data[i].key_data_type[j];
+                if (in->key_data[i].key_data_length[j] == 0)
+                    continue;
+                kd->key_data_contents[j] =
+                    k5alloc(in->key_data[i].key_data_length[j], &ret);
+                if (kd->key_data_contents[j] == NULL)
+                    goto cleanup;
+                memcpy(kd->key_data_contents[j],
+                       in->key_data[i].key_data_contents[j],
+                       in->key_data[i].key_data_length[j]);
+                kd->key_data_length[j] = in->key_data[i].key_data_length[j];
+            }
+        }
+    }
+
+    *out = ent;
+    ent = NULL;
+
+cleanup:
+    free_entry(context, ent);
+    return ret;
+}
+
+/* Return the cache entry for a lookup, or NULL if there is none.  The cache
+ * lock must be held. */
+static struct cache_entry *
+find_entry(krb5_context context, krb5_ui_4 hash, const char *realm,
+           krb5_const_principal search_for, unsigned int flags)
+{
+    struct cache_entry *e;
+
+    LIST_FOREACH(e, &hash_table[hash], bucket_links) {
+        if (e->flags == flags && strcmp(e->realm, realm) == 0 &&
+            e->search_for->type == search_for->type &&
+            krb5_principal_compare(context, e->search_for, search_for))
+            return e;
+    }
+    return NULL;
+}
+
+static void
+free_cache_entry(krb5_context context, struct cache_entry *e)
+{
+    free_entry(context, e->entry);
+    krb5_free_principal(context, e->search_for);
+    free(e->realm);
+    free(e);
+}
+
+/* Remove e from the cache and free it.  The cache lock must be held. */
+static void
+discard_entry(krb5_context context, struct cache_entry *e)
+{
+    total_size -= e->size;
+    num_entries--;
+    LIST_REMOVE(e, bucket_links);
+    TAILQ_REMOVE(&lru_queue, e, lru_links);
+    free_cache_entry(context, e);
+}
+
+/* Add a copy of ent, read from the database of realm at the given age, to the
+ * cache.  Ignore any errors, since the cache is only an optimization. */
+static void
+insert_entry(krb5_context context, krb5_ui_4 hash, const char *realm,
+             krb5_const_principal search_for, unsigned int flags, time_t age,
+             const krb5_db_entry *ent)
+{
+    struct cache_entry *e, *old;
+    size_t size = entry_size(search_for, ent);
+
+    if (size > max_size)
+        return;
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL)
+        return;
+    e->flags = flags;
+    e->age = age;
+    e->size = size;
+    e->realm = strdup(realm);
+    if (e->realm == NULL ||
+        krb5_copy_principal(context, search_for, &e->search_for) != 0 ||
+        copy_entry(context, ent, &e->entry) != 0 ||
+        k5_mutex_lock(&cache_lock) != 0) {
+        free_cache_entry(context, e);
+        return;
+    }
+
+    /* Another thread may have cached the same lookup in the meantime. */
+    old = find_entry(context, hash, realm, search_for, flags);
+    if (old != NULL)
+        discard_entry(context, old);
+    while (total_size + size > max_size) {
+        evictions++;
+        discard_entry(context, TAILQ_LAST(&lru_queue, cache_entry_queue));
+    }
+    LIST_INSERT_HEAD(&hash_table[hash], e, bucket_links);
+    TAILQ_INSERT_HEAD(&lru_queue, e, lru_links);
+    total_size += size;
+    num_entries++;
+    k5_mutex_unlock(&cache_lock);
+}
+
+/* Initialize the principal cache with a maximum size of size bytes.  A size
+ * of zero disables the cache. */
+krb5_error_code
+kdc_init_princ_cache(size_t size)
+{
+    krb5_error_code ret;
+    int i;
+
+    ret = k5_mutex_finish_init(&cache_lock);
+    if (ret)
+        return ret;
+    for (i = 0; i < PRINC_CACHE_HASH_SIZE; i++)
+        LIST_INIT(&hash_table[i]);
+    TAILQ_INIT(&lru_queue);
+    max_size = size;
+    return 0;
+}
+
+static krb5_error_code
+get_principal(krb5_context context, krb5_const_principal search_for,
+              unsigned int flags, krb5_db_entry **entry)
+{
+    krb5_error_code ret;
+    struct cache_entry *e;
+    const char *realm = context->default_realm;
+    krb5_ui_4 hash;
+    time_t age, now;
+
+    *entry = NULL;
+    if (max_size == 0 || realm == NULL ||
+        krb5_db_get_age(context, NULL, &age) != 0 || age == -1)
+        return krb5_db_get_principal(context, search_for, flags, entry);
+
+    hash = lookup_hash(realm, search_for, flags);
+    ret = k5_mutex_lock(&cache_lock);
+    if (ret)
+        return ret;
+    lookups++;
+    e = find_entry(context, hash, realm, search_for, flags);
+    if (e != NULL && e->age == age) {
+        hits++;
+        TAILQ_REMOVE(&lru_queue, e, lru_links);
+        TAILQ_INSERT_HEAD(&lru_queue, e, lru_links);
+        ret = copy_entry(context, e->entry, entry);
+        k5_mutex_unlock(&cache_lock);
+        return ret;
+    } else if (e != NULL) {
+        invalidations++;
+        discard_entry(context, e);
+    }
+    k5_mutex_unlock(&cache_lock);
+
+    /* Note the time before reading, so that we do not cache entries from a
+     * database which reports the current time as its age. */
+    now = time(NULL);
+    ret = krb5_db_get_principal(context, search_for, flags, entry);
+    if (ret)
+        return ret;
+    if (now > age)
+        insert_entry(context, hash, realm, search_for, flags, age, *entry);
+    return 0;
+}
+
+/*
+ * Look up search_for in the database of context's default realm, as
+ * krb5_db_get_principal() does, using a cached copy of the entry if the
+ * database has not changed since it was read.
+ */
+krb5_error_code
+kdc_get_principal(krb5_context context, krb5_const_principal search_for,
+                  unsigned int flags, krb5_db_entry **entry)
+{
+    krb5_error_code ret;
+    krb5_ui_8 start = kdc_stats_begin();
+
+    ret = get_principal(context, search_for, flags, entry);
+    kdc_stats_end(KDC_STATS_DB_LOOKUP, start);
+    return ret;
+}
+
+/* Log the principal cache statistics. */
+void
+kdc_log_princ_cache_stats(void)
+{
+    if (max_size == 0)
+        return;
+    krb5_klog_syslog(LOG_INFO, _("principal cache: %lu lookups, %lu hits, "
+                                 "%lu invalidated, %lu evicted, %d entries "
+                                 "(%lu bytes)"), lookups, hits, invalidations,
+                     evictions, num_entries, (unsigned long)total_size);
+}
+
+/* Free all entries in the principal cache. */
+void
+kdc_free_princ_cache(krb5_context context)
+{
+    struct cache_entry *e, *next;
+
+    TAILQ_FOREACH_SAFE(e, &lru_queue, lru_links, next)
+        discard_entry(context, e);
+}
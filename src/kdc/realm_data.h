@@ -66,6 +66,7 @@ typedef struct __kdc_realm_data {
      */
     char                *realm_ports;   /* Per-realm KDC UDP port */
     char                *realm_tcp_ports; /* Per-realm KDC TCP port */
+    struct kdc_key_cache *realm_keycache; /* Decrypted key cache */
     /*
      * Per-realm parameters.
      */
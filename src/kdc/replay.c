@@ -28,6 +28,9 @@
 #include "k5-queue.h"
 #include "kdc_util.h"
 #include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+#include <sys/mman.h>
 
 #ifndef NOCACHE
 
@@ -50,6 +53,8 @@ struct entry {
 LIST_HEAD(entry_list, entry);
 TAILQ_HEAD(entry_queue, entry);
 
+/* The lookaside cache is shared by the main loop and any worker threads. */
+static k5_mutex_t lookaside_lock = K5_MUTEX_PARTIAL_INITIALIZER;
 static struct entry_list hash_table[LOOKASIDE_HASH_SIZE];
 static struct entry_queue expiration_queue;
 
@@ -136,13 +141,317 @@ find_entry(krb5_data *req_packet)
     return NULL;
 }
 
-/* Initialize the lookaside cache structures and randomize the hash seed. */
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+#if defined(ENABLE_THREADS) && defined(_POSIX_THREAD_PROCESS_SHARED) && \
+    defined(MAP_ANON)
+#define SHARED_LOOKASIDE
+
+/*
+ * When the KDC runs worker processes, the lookaside cache lives in an
+ * anonymous shared mapping created before the workers are forked, so that a
+ * retransmission handled by a different worker still finds the original
+ * request.  The mapping is divided into SHM_STRIPES stripes, each with its own
+ * process-shared mutex, hash buckets, and arena; a request is assigned to a
+ * stripe by the low bits of its hash.  Each arena is used as a ring buffer of
+ * variable-length entries, oldest first, so it also serves as the stripe's
+ * expiration queue.  Entries removed before they reach the head of the ring
+ * are unlinked from their bucket and their space is reclaimed when the head
+ * passes them.
+ */
+
+#define SHM_STRIPES     64
+#define SHM_BUCKETS     (LOOKASIDE_HASH_SIZE / SHM_STRIPES)
+#define SHM_ARENA_SIZE  (LOOKASIDE_MAX_SIZE / SHM_STRIPES)
+#define SHM_ALIGN(n)    (((n) + 7) & ~(size_t)7)
+
+struct shm_entry {
+    krb5_ui_4 next;             /* Arena offset + 1 of next bucket entry */
+    krb5_ui_4 size;             /* Arena space used by this entry */
+    krb5_ui_4 hash;
+    krb5_timestamp timein;
+    pid_t pid;                  /* Process which inserted the entry */
+    int num_hits;
+    krb5_boolean live;          /* False once unlinked from its bucket */
+    krb5_boolean has_reply;
+    unsigned int req_len;
+    unsigned int reply_len;
+    /* The request and reply packets follow. */
+};
+
+struct shm_stripe {
+    pthread_mutex_t lock;
+    size_t head;                /* Offset of the oldest entry */
+    size_t tail;                /* Offset of the next new entry */
+    size_t wrap;                /* End of the used space above head */
+    int num_entries;            /* Entries in the arena, live or not */
+    int calls;
+    int hits;
+    int cross_hits;             /* Hits on another process's entries */
+    int max_hits_per_entry;
+    krb5_ui_4 buckets[SHM_BUCKETS];
+    krb5_ui_8 arena[SHM_ARENA_SIZE / sizeof(krb5_ui_8)];
+};
+
+/* Non-null if the cache is shared between worker processes. */
+static struct shm_stripe *shm_stripes;
+
+static inline struct shm_entry *
+shm_entry_at(struct shm_stripe *s, size_t off)
+{
+    return (struct shm_entry *)((unsigned char *)s->arena + off);
+}
+
+/* Return the stripe for a request with the given hash. */
+static inline struct shm_stripe *
+shm_stripe(krb5_ui_4 hash)
+{
+    return &shm_stripes[hash % SHM_STRIPES];
+}
+
+/* Unlink the entry e at offset off in s from its hash bucket. */
+static void
+shm_unlink_entry(struct shm_stripe *s, struct shm_entry *e, size_t off)
+{
+    krb5_ui_4 *link = &s->buckets[e->hash / SHM_STRIPES];
+
+    while (*link != 0) {
+        if (*link == off + 1) {
+            *link = e->next;
+            break;
+        }
+        link = &shm_entry_at(s, *link - 1)->next;
+    }
+    e->live = FALSE;
+}
+
+/* Discard the oldest entry in s. */
+static void
+shm_evict(struct shm_stripe *s)
+{
+    struct shm_entry *e = shm_entry_at(s, s->head);
+
+    if (e->live) {
+        s->max_hits_per_entry = max(s->max_hits_per_entry, e->num_hits);
+        shm_unlink_entry(s, e, s->head);
+    }
+    s->head += e->size;
+    if (--s->num_entries == 0) {
+        s->head = s->tail = 0;
+        s->wrap = SHM_ARENA_SIZE;
+    } else if (s->head == s->wrap) {
+        s->head = 0;
+        s->wrap = SHM_ARENA_SIZE;
+    }
+}
+
+/* Allocate size bytes (at most SHM_ARENA_SIZE) in the arena of s, evicting
+ * the oldest entries as necessary, and return the offset. */
+static size_t
+shm_alloc(struct shm_stripe *s, size_t size)
+{
+    size_t off;
+
+    for (;;) {
+        if (s->num_entries == 0 || s->tail > s->head) {
+            /* The used space is contiguous; allocate above it if we can, or
+             * else wrap around to the start of the arena. */
+            if (s->tail + size <= SHM_ARENA_SIZE)
+                break;
+            s->wrap = s->tail;
+            s->tail = 0;
+        } else if (s->tail + size <= s->head) {
+            break;
+        } else {
+            shm_evict(s);
+        }
+    }
+    off = s->tail;
+    s->tail += size;
+    s->num_entries++;
+    return off;
+}
+
+/* Return the entry for req_packet in s, or NULL if there isn't one.  Set
+ * *off_out to the entry's arena offset. */
+static struct shm_entry *
+shm_find(struct shm_stripe *s, krb5_ui_4 hash, const krb5_data *req_packet,
+         size_t *off_out)
+{
+    krb5_ui_4 link;
+    struct shm_entry *e;
+
+    for (link = s->buckets[hash / SHM_STRIPES]; link != 0; link = e->next) {
+        e = shm_entry_at(s, link - 1);
+        if (e->req_len == req_packet->length &&
+            memcmp(e + 1, req_packet->data, req_packet->length) == 0) {
+            *off_out = link - 1;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Map and initialize the shared cache stripes. */
+static krb5_error_code
+shm_init(void)
+{
+    void *ptr;
+    pthread_mutexattr_t attr;
+    size_t len = SHM_STRIPES * sizeof(struct shm_stripe);
+    int i, ret;
+
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1,
+               0);
+    if (ptr == MAP_FAILED)
+        return errno;
+
+    ret = pthread_mutexattr_init(&attr);
+    if (ret)
+        goto error;
+    ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    shm_stripes = ptr;
+    for (i = 0; i < SHM_STRIPES && !ret; i++) {
+        ret = pthread_mutex_init(&shm_stripes[i].lock, &attr);
+        shm_stripes[i].wrap = SHM_ARENA_SIZE;
+    }
+    pthread_mutexattr_destroy(&attr);
+    if (ret)
+        goto error;
+    return 0;
+
+error:
+    shm_stripes = NULL;
+    munmap(ptr, len);
+    return ret;
+}
+
+static krb5_boolean
+shm_check(krb5_context kcontext, krb5_data *req_packet,
+          krb5_data **reply_packet_out)
+{
+    krb5_ui_4 hash = murmurhash3(req_packet);
+    struct shm_stripe *s = shm_stripe(hash);
+    struct shm_entry *e;
+    krb5_data reply;
+    krb5_boolean found = FALSE;
+    size_t off;
+
+    if (pthread_mutex_lock(&s->lock) != 0)
+        return FALSE;
+    s->calls++;
+
+    e = shm_find(s, hash, req_packet, &off);
+    if (e != NULL) {
+        e->num_hits++;
+        s->hits++;
+        if (e->pid != getpid())
+            s->cross_hits++;
+        /* Leave *reply_packet_out as NULL for an in-progress entry. */
+        found = TRUE;
+        if (e->has_reply) {
+            reply = make_data((unsigned char *)(e + 1) + e->req_len,
+                              e->reply_len);
+            found = (krb5_copy_data(kcontext, &reply, reply_packet_out) == 0);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+static void
+shm_insert(krb5_context kcontext, krb5_data *req_packet,
+           krb5_data *reply_packet)
+{
+    krb5_ui_4 hash = murmurhash3(req_packet);
+    struct shm_stripe *s = shm_stripe(hash);
+    struct shm_entry *e;
+    krb5_ui_4 *bucket = &s->buckets[hash / SHM_STRIPES];
+    krb5_timestamp timenow;
+    unsigned int reply_len = (reply_packet == NULL) ? 0 : reply_packet->length;
+    size_t off, esize;
+
+    esize = SHM_ALIGN(sizeof(*e) + req_packet->length + reply_len);
+    if (esize > SHM_ARENA_SIZE)
+        return;
+    if (krb5_timeofday(kcontext, &timenow))
+        return;
+
+    if (pthread_mutex_lock(&s->lock) != 0)
+        return;
+
+    /* Purge stale and removed entries from the head of the ring. */
+    while (s->num_entries > 0) {
+        e = shm_entry_at(s, s->head);
+        if (e->live && !STALE(e, timenow))
+            break;
+        shm_evict(s);
+    }
+
+    off = shm_alloc(s, esize);
+    e = shm_entry_at(s, off);
+    e->size = esize;
+    e->hash = hash;
+    e->timein = timenow;
+    e->pid = getpid();
+    e->num_hits = 0;
+    e->live = TRUE;
+    e->has_reply = (reply_packet != NULL);
+    e->req_len = req_packet->length;
+    e->reply_len = reply_len;
+    memcpy(e + 1, req_packet->data, req_packet->length);
+    if (reply_len > 0) {
+        memcpy((unsigned char *)(e + 1) + e->req_len, reply_packet->data,
+               reply_len);
+    }
+    e->next = *bucket;
+    *bucket = off + 1;
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void
+shm_remove(krb5_data *req_packet)
+{
+    krb5_ui_4 hash = murmurhash3(req_packet);
+    struct shm_stripe *s = shm_stripe(hash);
+    struct shm_entry *e;
+    size_t off;
+
+    if (pthread_mutex_lock(&s->lock) != 0)
+        return;
+    e = shm_find(s, hash, req_packet, &off);
+    if (e != NULL)
+        shm_unlink_entry(s, e, off);
+    pthread_mutex_unlock(&s->lock);
+}
+
+#endif /* SHARED_LOOKASIDE */
+
+/*
+ * Initialize the lookaside cache structures and randomize the hash seed.  If
+ * shared is true, place the cache in memory which will be shared with worker
+ * processes forked after this call, if the platform supports it.
+ */
 krb5_error_code
-kdc_init_lookaside(krb5_context context)
+kdc_init_lookaside(krb5_context context, krb5_boolean shared)
 {
+    krb5_error_code ret;
     krb5_data d = make_data(&seed, sizeof(seed));
     int i;
 
+    ret = k5_mutex_finish_init(&lookaside_lock);
+    if (ret)
+        return ret;
+#ifdef SHARED_LOOKASIDE
+    if (shared) {
+        ret = shm_init();
+        if (ret)
+            return ret;
+    }
+#endif
     for (i = 0; i < LOOKASIDE_HASH_SIZE; i++)
         LIST_INIT(&hash_table[i]);
     TAILQ_INIT(&expiration_queue);
@@ -155,9 +464,19 @@ kdc_remove_lookaside(krb5_context kcontext, krb5_data *req_packet)
 {
     struct entry *e;
 
+#ifdef SHARED_LOOKASIDE
+    if (shm_stripes != NULL) {
+        shm_remove(req_packet);
+        return;
+    }
+#endif
+
+    if (k5_mutex_lock(&lookaside_lock) != 0)
+        return;
     e = find_entry(req_packet);
     if (e != NULL)
         discard_entry(kcontext, e);
+    k5_mutex_unlock(&lookaside_lock);
 }
 
 /* Return true and fill in reply_packet_out if req_packet is in the lookaside
@@ -167,18 +486,31 @@ kdc_check_lookaside(krb5_context kcontext, krb5_data *req_packet,
                     krb5_data **reply_packet_out)
 {
     struct entry *e;
+    krb5_boolean found = FALSE;
 
     *reply_packet_out = NULL;
-    calls++;
+#ifdef SHARED_LOOKASIDE
+    if (shm_stripes != NULL)
+        return shm_check(kcontext, req_packet, reply_packet_out);
+#endif
 
-    e = find_entry(req_packet);
-    if (e == NULL)
+    if (k5_mutex_lock(&lookaside_lock) != 0)
         return FALSE;
+    calls++;
 
-    e->num_hits++;
-    hits++;
-    return (krb5_copy_data(kcontext, &e->reply_packet,
-                           reply_packet_out) == 0);
+    e = find_entry(req_packet);
+    if (e != NULL) {
+        e->num_hits++;
+        hits++;
+        /* Leave *reply_packet_out as NULL for an in-progress entry. */
+        found = TRUE;
+        if (e->reply_packet.length > 0) {
+            found = (krb5_copy_data(kcontext, &e->reply_packet,
+                                    reply_packet_out) == 0);
+        }
+    }
+    k5_mutex_unlock(&lookaside_lock);
+    return found;
 }
 
 /* Insert a request and reply into the lookaside cache.  Assumes it's not
@@ -192,9 +524,19 @@ kdc_insert_lookaside(krb5_context kcontext, krb5_data *req_packet,
     krb5_ui_4 hash = murmurhash3(req_packet);
     size_t esize = entry_size(req_packet, reply_packet);
 
+#ifdef SHARED_LOOKASIDE
+    if (shm_stripes != NULL) {
+        shm_insert(kcontext, req_packet, reply_packet);
+        return;
+    }
+#endif
+
     if (krb5_timeofday(kcontext, &timenow))
         return;
 
+    if (k5_mutex_lock(&lookaside_lock) != 0)
+        return;
+
     /* Purge stale entries and limit the total size of the entries. */
     TAILQ_FOREACH_SAFE(e, &expiration_queue, expire_links, next) {
         if (!STALE(e, timenow) && total_size + esize <= LOOKASIDE_MAX_SIZE)
@@ -206,25 +548,54 @@ kdc_insert_lookaside(krb5_context kcontext, krb5_data *req_packet,
     /* Create a new entry for this request and reply. */
     e = calloc(1, sizeof(*e));
     if (e == NULL)
-        return;
+        goto cleanup;
     e->timein = timenow;
     if (krb5int_copy_data_contents(kcontext, req_packet, &e->req_packet)) {
         free(e);
-        return;
+        goto cleanup;
     }
     if (reply_packet != NULL &&
         krb5int_copy_data_contents(kcontext, reply_packet,
                                    &e->reply_packet)) {
         krb5_free_data_contents(kcontext, &e->req_packet);
         free(e);
-        return;
+        goto cleanup;
     }
 
     TAILQ_INSERT_TAIL(&expiration_queue, e, expire_links);
     LIST_INSERT_HEAD(&hash_table[hash], e, bucket_links);
     num_entries++;
     total_size += esize;
-    return;
+
+cleanup:
+    k5_mutex_unlock(&lookaside_lock);
+}
+
+/* Log the lookaside cache hit statistics. */
+void
+kdc_log_lookaside_stats(void)
+{
+#ifdef SHARED_LOOKASIDE
+    int i, scalls = 0, shits = 0, cross_hits = 0, smax = 0;
+
+    if (shm_stripes != NULL) {
+        /* The counters are only approximate without the stripe locks. */
+        for (i = 0; i < SHM_STRIPES; i++) {
+            scalls += shm_stripes[i].calls;
+            shits += shm_stripes[i].hits;
+            cross_hits += shm_stripes[i].cross_hits;
+            smax = max(smax, shm_stripes[i].max_hits_per_entry);
+        }
+        krb5_klog_syslog(LOG_INFO, _("lookaside cache: %d requests, %d hits "
+                                     "(%d from other workers), max %d hits "
+                                     "per entry"),
+                         scalls, shits, cross_hits, smax);
+        return;
+    }
+#endif
+    krb5_klog_syslog(LOG_INFO, _("lookaside cache: %d requests, %d hits, "
+                                 "max %d hits per entry"),
+                     calls, hits, max_hits_per_entry);
 }
 
 /* Free all entries in the lookaside cache. */
@@ -233,6 +604,12 @@ kdc_free_lookaside(krb5_context kcontext)
 {
     struct entry *e, *next;
 
+#ifdef SHARED_LOOKASIDE
+    if (shm_stripes != NULL) {
+        munmap(shm_stripes, SHM_STRIPES * sizeof(struct shm_stripe));
+        shm_stripes = NULL;
+    }
+#endif
     TAILQ_FOREACH_SAFE(e, &expiration_queue, expire_links, next) {
         discard_entry(kcontext, e);
     }
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+from k5test import *
+import re
+import time
+
+# Return the principal cache statistics logged by the last KDC to exit.
+def cache_stats(realm):
+    f = open(os.path.join(realm.testdir, 'kdc.log'))
+    log = f.read()
+    f.close()
+    pat = r'principal cache: (\d+) lookups, (\d+) hits, (\d+) invalidated'
+    matches = re.findall(pat, log)
+    if not matches:
+        fail('No principal cache statistics in KDC log')
+    return [int(n) for n in matches[-1]]
+
+# Entries are only cached once the database age (the lock file
+# timestamp, which is advanced past the current time by bursts of
+# updates) is in the past.
+def wait_for_db_age(realm):
+    lockfile = os.path.join(realm.testdir, 'db.ok')
+    while int(time.time()) <= int(os.stat(lockfile).st_mtime):
+        time.sleep(0.5)
+
+# Get a fresh TGT and a service ticket, so that the KDC looks up the
+# client, TGS, and service principals, and check that the service
+# ticket can be decrypted with the keytab.
+def get_tickets(realm, expected_code=0):
+    realm.kinit(realm.user_princ, password('user'))
+    return realm.run([kvno, '-k', realm.keytab, realm.host_princ],
+                     expected_code=expected_code)
+
+realm = K5Realm(start_kdc=False, get_creds=False)
+
+wait_for_db_age(realm)
+realm.start_kdc()
+get_tickets(realm)
+get_tickets(realm)
+
+# A change to the database must be seen by the next request, and the
+# new key must be used.
+realm.run_kadminl('ktadd -k %s %s' % (realm.keytab, realm.host_princ))
+output = get_tickets(realm)
+if 'kvno = 2' not in output:
+    fail('KDC used a stale cached entry after a key change')
+realm.run_kadminl('modprinc -allow_svr ' + realm.host_princ)
+get_tickets(realm, expected_code=1)
+realm.stop_kdc()
+
+lookups, hits, invalidated = cache_stats(realm)
+if hits == 0:
+    fail('Principal cache was not used')
+if invalidated == 0:
+    fail('Principal cache entries were not invalidated')
+
+# With threads, the cache is shared between workers.
+realm.run_kadminl('modprinc +allow_svr ' + realm.host_princ)
+wait_for_db_age(realm)
+realm.start_kdc(['-t', '4'])
+for i in range(4):
+    get_tickets(realm)
+realm.stop_kdc()
+lookups, hits, invalidated = cache_stats(realm)
+if hits == 0:
+    fail('Principal cache was not used with worker threads')
+
+# Setting the size to 0 disables the cache.
+conf = {'kdcdefaults': {'kdc_principal_cache_size': '0'}}
+nocache_env = realm.special_env('nocache', True, kdc_conf=conf)
+realm.start_kdc(env=nocache_env)
+get_tickets(realm)
+realm.stop_kdc()
+f = open(os.path.join(realm.testdir, 'kdc.log'))
+log = f.read()
+f.close()
+if log.count('principal cache:') != 2:
+    fail('Disabled principal cache logged statistics')
+
+success('KDC principal cache')
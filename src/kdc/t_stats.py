@@ -0,0 +1,69 @@
+#!/usr/bin/python
+from k5test import *
+import re
+
+conf = {'kdcdefaults': {'kdc_stats_file': '$testdir/kdc.stats'}}
+realm = K5Realm(kdc_conf=conf, start_kdc=False)
+statsfile = os.path.join(realm.testdir, 'kdc.stats')
+
+# Return the kdcstats output for the statistics file.
+def stats(realm):
+    return realm.run(['./kdcstats', statsfile])
+
+# Return the request count for the timer name in the kdcstats output.
+def timer_count(output, name):
+    m = re.search(r'^%s +(\d+) ' % name, output, re.MULTILINE)
+    if not m:
+        fail('No %s line in kdcstats output' % name)
+    return int(m.group(1))
+
+# Get a TGT and a service ticket, and fail once for an unknown client.
+def get_tickets(realm):
+    realm.kinit(realm.user_princ, password('user'))
+    realm.run([kvno, realm.host_princ])
+    realm.run([kinit, 'nonexistent'], expected_code=1)
+
+realm.start_kdc()
+get_tickets(realm)
+output = stats(realm)
+if timer_count(output, 'AS-REQ') < 2 or timer_count(output, 'TGS-REQ') < 1:
+    fail('Requests were not counted')
+if timer_count(output, 'db-lookup') == 0 or timer_count(output, 'encode') == 0:
+    fail('Request phases were not timed')
+if 'Success' not in output or 'not found in Kerberos database (6)' not in output:
+    fail('Request results were not counted')
+realm.stop_kdc()
+
+# The KDC reinitializes the file when it starts, and counts the
+# requests handled by all worker processes and threads.
+realm.start_kdc(['-w', '2', '-t', '2'])
+for i in range(4):
+    get_tickets(realm)
+output = stats(realm)
+if timer_count(output, 'AS-REQ') != 8 or timer_count(output, 'TGS-REQ') != 4:
+    fail('Requests handled by workers were not counted')
+realm.stop_kdc()
+
+# kdcstats finds the file through kdc.conf by default.
+output = realm.run(['./kdcstats'])
+if timer_count(output, 'TGS-REQ') != 4:
+    fail('kdcstats did not read the configured statistics file')
+
+realm.run(['./kdcstats', realm.keytab], expected_code=1)
+
+# The KDC replaces a symlink at the statistics file path instead of
+# writing through it.
+victim = os.path.join(realm.testdir, 'victim')
+f = open(victim, 'w')
+f.write('unchanged\n')
+f.close()
+os.remove(statsfile)
+os.symlink(victim, statsfile)
+realm.start_kdc()
+realm.stop_kdc()
+if os.path.islink(statsfile):
+    fail('KDC did not replace symlink at statistics file path')
+if open(victim).read() != 'unchanged\n':
+    fail('KDC wrote through symlink at statistics file path')
+
+success('KDC statistics')
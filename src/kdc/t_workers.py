@@ -1,8 +1,62 @@
 #!/usr/bin/python
 from k5test import *
 
+# Return the number of batched UDP listener sockets logged so far.
+def batched_listeners(realm):
+    f = open(os.path.join(realm.testdir, 'kdc.log'))
+    log = f.read()
+    f.close()
+    return log.count('(batched)')
+
 realm = K5Realm(start_kdc=False, create_host=False)
 realm.start_kdc(['-w', '3'])
 realm.kinit(realm.user_princ, password('user'))
 realm.klist(realm.user_princ)
-success('KDC worker processes')
+realm.stop_kdc()
+
+# Exercise worker threads, with and without worker processes.
+realm.start_kdc(['-t', '4'])
+realm.kinit(realm.user_princ, password('user'))
+realm.klist(realm.user_princ)
+realm.run([kvno, realm.user_princ])
+realm.kinit(realm.user_princ, 'wrongpw', expected_code=1)
+realm.stop_kdc()
+
+realm.start_kdc(['-w', '2', '-t', '2'])
+realm.kinit(realm.user_princ, password('user'))
+realm.klist(realm.user_princ)
+realm.stop_kdc()
+
+# Exercise per-worker listener sockets and a larger TCP listen backlog.
+# Force TCP for one request so that both socket types are used.
+conf = {'kdcdefaults': {'kdc_reuseport': 'true',
+                        'kdc_tcp_listen_backlog': '64'}}
+reuseport_env = realm.special_env('reuseport', True, kdc_conf=conf)
+tcp_conf = {'libdefaults': {'udp_preference_limit': '1'}}
+tcp_env = realm.special_env('tcp', False, krb5_conf=tcp_conf)
+realm.start_kdc(['-w', '3'], env=reuseport_env)
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.user_princ])
+realm.kinit(realm.user_princ, password('user'), env=tcp_env)
+realm.klist(realm.user_princ)
+realm.stop_kdc()
+
+# Exercise batched UDP receives and replies, with and without threads.
+conf = {'kdcdefaults': {'kdc_udp_batch_size': '16'}}
+batch_env = realm.special_env('batch', True, kdc_conf=conf)
+if batched_listeners(realm) != 0:
+    fail('UDP listeners were batched without kdc_udp_batch_size')
+realm.start_kdc(env=batch_env)
+# recvmmsg() and sendmmsg() are always available on Linux, so make sure
+# the batched path is really in use there.
+if sys.platform.startswith('linux') and batched_listeners(realm) == 0:
+    fail('kdc_udp_batch_size did not enable batched UDP processing')
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.user_princ])
+realm.kinit(realm.user_princ, 'wrongpw', expected_code=1)
+realm.stop_kdc()
+realm.start_kdc(['-t', '2'], env=batch_env)
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.user_princ])
+
+success('KDC worker processes, threads, and socket options')
@@ -23,6 +23,7 @@
  * or implied warranty.
  */
 
+#define _GNU_SOURCE /* For recvmmsg() and sendmmsg() */
 #include "k5-int.h"
 #include "adm_proto.h"
 #include <sys/ioctl.h>
@@ -66,6 +67,21 @@
 static int tcp_or_rpc_data_counter;
 static int max_tcp_or_rpc_data_connections = 45;
 
+/* Listener socket options; see loop_set_tcp_listen_backlog() and
+ * loop_set_reuseport(). */
+static int tcp_listen_backlog = 5;
+static int use_reuseport = 0;
+
+/* Maximum number of UDP packets to receive per wakeup; see
+ * loop_set_udp_batch_size(). */
+#define MAX_UDP_BATCH 64
+#if defined(CMSG_SPACE) && defined(HAVE_STRUCT_CMSGHDR) &&      \
+    (defined(IP_PKTINFO) || defined(IPV6_PKTINFO)) &&           \
+    defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#define USE_UDP_BATCH
+#endif
+static int udp_batch_size = 1;
+
 /* Misc utility routines.  */
 static void
 set_sa_port(struct sockaddr *addr, int port)
@@ -104,6 +120,14 @@ setreuseaddr(int sock, int value)
     return setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
 }
 
+#ifdef SO_REUSEPORT
+static int
+setreuseport(int sock, int value)
+{
+    return setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
+}
+#endif
+
 #if defined(IPV6_V6ONLY)
 static int
 setv6only(int sock, int value)
@@ -211,6 +235,11 @@ struct connection {
     /* RPC-specific fields */
     SVCXPRT *transp;
     int rpc_force_close;
+
+#ifdef USE_UDP_BATCH
+    /* Receive states for batched UDP reads, refilled as they are used. */
+    struct udp_dispatch_state **udp_states;
+#endif
 };
 
 
@@ -323,6 +352,36 @@ loop_setup_signals(verto_ctx *ctx, void *handle, void (*reset)())
     return 0;
 }
 
+void
+loop_set_tcp_listen_backlog(int backlog)
+{
+    tcp_listen_backlog = (backlog > 0) ? backlog : 5;
+}
+
+krb5_error_code
+loop_set_reuseport(int value)
+{
+#ifdef SO_REUSEPORT
+    use_reuseport = value;
+    return 0;
+#else
+    return value ? ENOTSUP : 0;
+#endif
+}
+
+krb5_error_code
+loop_set_udp_batch_size(int n)
+{
+    if (n > MAX_UDP_BATCH)
+        n = MAX_UDP_BATCH;
+#ifdef USE_UDP_BATCH
+    udp_batch_size = (n > 1) ? n : 1;
+    return 0;
+#else
+    return (n > 1) ? ENOTSUP : 0;
+#endif
+}
+
 krb5_error_code
 loop_add_udp_port(int port)
 {
@@ -413,6 +472,15 @@ free_connection(struct connection *conn)
         free(conn->buffer);
     if (conn->type == CONN_RPC_LISTENER && conn->transp != NULL)
         svc_destroy(conn->transp);
+#ifdef USE_UDP_BATCH
+    if (conn->udp_states != NULL) {
+        int i;
+
+        for (i = 0; i < udp_batch_size; i++)
+            free(conn->udp_states[i]);
+        free(conn->udp_states);
+    }
+#endif
     free(conn);
 }
 
@@ -565,8 +633,9 @@ add_tcp_read_fd(struct socksetup *data, int sock)
 
 /*
  * Create a socket and bind it to addr.  Ensure the socket will work with
- * select().  Set the socket cloexec, reuseaddr, and if applicable v6-only.
- * Does not call listen().  Returns -1 on failure after logging an error.
+ * select().  Set the socket cloexec, reuseaddr, and if applicable v6-only
+ * and reuseport.  Does not call listen().  Returns -1 on failure after
+ * logging an error.
  */
 static int
 create_server_socket(struct socksetup *data, struct sockaddr *addr, int type)
@@ -596,6 +665,16 @@ create_server_socket(struct socksetup *data, struct sockaddr *addr, int type)
                 _("Cannot enable SO_REUSEADDR on fd %d"), sock);
     }
 
+#ifdef SO_REUSEPORT
+    if (use_reuseport && setreuseport(sock, 1) < 0) {
+        data->retval = errno;
+        com_err(data->prog, errno,
+                _("Cannot enable SO_REUSEPORT on fd %d"), sock);
+        close(sock);
+        return -1;
+    }
+#endif
+
     if (addr->sa_family == AF_INET6) {
 #ifdef IPV6_V6ONLY
         if (setv6only(sock, 1))
@@ -694,7 +773,7 @@ setup_a_tcp_listener(struct socksetup *data, struct sockaddr *addr)
     sock = create_server_socket(data, addr, SOCK_STREAM);
     if (sock == -1)
         return -1;
-    if (listen(sock, 5) < 0) {
+    if (listen(sock, tcp_listen_backlog) < 0) {
         com_err(data->prog, errno,
                 _("Cannot listen on TCP server socket on %s"), paddr(addr));
         close(sock);
@@ -840,6 +919,7 @@ setup_rpc_listener_ports(struct socksetup *data)
 
 #if defined(CMSG_SPACE) && defined(HAVE_STRUCT_CMSGHDR) &&      \
     (defined(IP_PKTINFO) || defined(IPV6_PKTINFO))
+
 union pktinfo {
 #ifdef HAVE_STRUCT_IN6_PKTINFO
     struct in6_pktinfo pi6;
@@ -923,9 +1003,10 @@ setup_udp_port_1(struct socksetup *data, struct sockaddr *addr,
                 return 1;
             }
         }
-        krb5_klog_syslog(LOG_INFO, _("listening on fd %d: udp %s%s"), sock,
+        krb5_klog_syslog(LOG_INFO, _("listening on fd %d: udp %s%s%s"), sock,
                          paddr((struct sockaddr *)addr),
-                         pktinfo ? " (pktinfo)" : "");
+                         pktinfo ? " (pktinfo)" : "",
+                         (udp_batch_size > 1) ? " (batched)" : "");
         if (add_udp_fd (data, sock, pktinfo) == 0) {
             close(sock);
             return 1;
@@ -1306,56 +1387,21 @@ union aux_addressing_info {
     int ipv6_ifindex;
 };
 
-static int
-recv_from_to(int s, void *buf, size_t len, int flags,
-             struct sockaddr *from, socklen_t *fromlen,
-             struct sockaddr *to, socklen_t *tolen,
-             union aux_addressing_info *auxaddr)
+#if (defined(IP_PKTINFO) || defined(IPV6_PKTINFO)) && defined(CMSG_SPACE)
+/* Set *to and *tolen to the destination address found in the control
+ * messages of msg, or set *tolen to 0 if msg has no such information. */
+static void
+get_dest_addr(struct msghdr *msg, struct sockaddr *to, socklen_t *tolen,
+              union aux_addressing_info *auxaddr)
 {
-#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
-    if (to && tolen) {
-        /* Clobber with something recognizeable in case we try to use
-           the address.  */
-        memset(to, 0x40, *tolen);
-        *tolen = 0;
-    }
-
-    return recvfrom(s, buf, len, flags, from, fromlen);
-#else
-    int r;
-    struct iovec iov;
-    char cmsg[CMSG_SPACE(sizeof(union pktinfo))];
     struct cmsghdr *cmsgptr;
-    struct msghdr msg;
-
-    if (!to || !tolen)
-        return recvfrom(s, buf, len, flags, from, fromlen);
-
-    /* Clobber with something recognizeable in case we can't extract
-       the address but try to use it anyways.  */
-    memset(to, 0x40, *tolen);
-
-    iov.iov_base = buf;
-    iov.iov_len = len;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = from;
-    msg.msg_namelen = *fromlen;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = cmsg;
-    msg.msg_controllen = sizeof(cmsg);
-
-    r = recvmsg(s, &msg, flags);
-    if (r < 0)
-        return r;
-    *fromlen = msg.msg_namelen;
 
     /* On Darwin (and presumably all *BSD with KAME stacks),
        CMSG_FIRSTHDR doesn't check for a non-zero controllen.  RFC
        3542 recommends making this check, even though the (new) spec
        for CMSG_FIRSTHDR says it's supposed to do the check.  */
-    if (msg.msg_controllen) {
-        cmsgptr = CMSG_FIRSTHDR(&msg);
+    if (msg->msg_controllen) {
+        cmsgptr = CMSG_FIRSTHDR(msg);
         while (cmsgptr) {
 #ifdef IP_PKTINFO
             if (cmsgptr->cmsg_level == IPPROTO_IP
@@ -1367,7 +1413,7 @@ recv_from_to(int s, void *buf, size_t len, int flags,
                 ((struct sockaddr_in *)to)->sin_addr = pktinfo->ipi_addr;
                 ((struct sockaddr_in *)to)->sin_family = AF_INET;
                 *tolen = sizeof(struct sockaddr_in);
-                return r;
+                return;
             }
 #endif
 #if defined(IPV6_PKTINFO) && defined(HAVE_STRUCT_IN6_PKTINFO)
@@ -1381,60 +1427,54 @@ recv_from_to(int s, void *buf, size_t len, int flags,
                 ((struct sockaddr_in6 *)to)->sin6_family = AF_INET6;
                 *tolen = sizeof(struct sockaddr_in6);
                 auxaddr->ipv6_ifindex = pktinfo->ipi6_ifindex;
-                return r;
+                return;
             }
 #endif
-            cmsgptr = CMSG_NXTHDR(&msg, cmsgptr);
+            cmsgptr = CMSG_NXTHDR(msg, cmsgptr);
         }
     }
     /* No info about destination addr was available.  */
     *tolen = 0;
-    return r;
-#endif
 }
 
-static int
-send_to_from(int s, void *buf, size_t len, int flags,
-             const struct sockaddr *to, socklen_t tolen,
-             const struct sockaddr *from, socklen_t fromlen,
-             union aux_addressing_info *auxaddr)
+/*
+ * Fill in msg and iov to send len bytes of buf to the address to.  If the
+ * local address from is known, add a control message in cbuf (which must
+ * have room for a pktinfo structure) so that the packet is sent from it.
+ */
+static void
+make_send_msg(struct msghdr *msg, struct iovec *iov, char *cbuf,
+              size_t cbuflen, void *buf, size_t len,
+              const struct sockaddr *to, socklen_t tolen,
+              const struct sockaddr *from, socklen_t fromlen,
+              union aux_addressing_info *auxaddr)
 {
-#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
-    return sendto(s, buf, len, flags, to, tolen);
-#else
-    struct iovec iov;
-    struct msghdr msg;
     struct cmsghdr *cmsgptr;
-    char cbuf[CMSG_SPACE(sizeof(union pktinfo))];
 
-    if (from == 0 || fromlen == 0 || from->sa_family != to->sa_family) {
-    use_sendto:
-        return sendto(s, buf, len, flags, to, tolen);
-    }
+    iov->iov_base = buf;
+    iov->iov_len = len;
+    memset(cbuf, 0, cbuflen);
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = (void *) to;
+    msg->msg_namelen = tolen;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
 
-    iov.iov_base = buf;
-    iov.iov_len = len;
-    /* Truncation?  */
-    if (iov.iov_len != len)
-        return EINVAL;
-    memset(cbuf, 0, sizeof(cbuf));
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (void *) to;
-    msg.msg_namelen = tolen;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = cbuf;
+    if (from == 0 || fromlen == 0 || from->sa_family != to->sa_family)
+        return;
+
+    msg->msg_control = cbuf;
     /* CMSG_FIRSTHDR needs a non-zero controllen, or it'll return NULL
        on Linux.  */
-    msg.msg_controllen = sizeof(cbuf);
-    cmsgptr = CMSG_FIRSTHDR(&msg);
-    msg.msg_controllen = 0;
+    msg->msg_controllen = cbuflen;
+    cmsgptr = CMSG_FIRSTHDR(msg);
+    msg->msg_controllen = 0;
 
     switch (from->sa_family) {
 #if defined(IP_PKTINFO)
     case AF_INET:
         if (fromlen != sizeof(struct sockaddr_in))
-            goto use_sendto;
+            break;
         cmsgptr->cmsg_level = IPPROTO_IP;
         cmsgptr->cmsg_type = IP_PKTINFO;
         cmsgptr->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
@@ -1443,13 +1483,13 @@ send_to_from(int s, void *buf, size_t len, int flags,
             const struct sockaddr_in *from4 = (const struct sockaddr_in *)from;
             p->ipi_spec_dst = from4->sin_addr;
         }
-        msg.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
         break;
 #endif
 #if defined(IPV6_PKTINFO) && defined(HAVE_STRUCT_IN6_PKTINFO)
     case AF_INET6:
         if (fromlen != sizeof(struct sockaddr_in6))
-            goto use_sendto;
+            break;
         cmsgptr->cmsg_level = IPPROTO_IPV6;
         cmsgptr->cmsg_type = IPV6_PKTINFO;
         cmsgptr->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
@@ -1470,12 +1510,81 @@ send_to_from(int s, void *buf, size_t len, int flags,
                 p->ipi6_ifindex = auxaddr->ipv6_ifindex;
             /* otherwise, already zero */
         }
-        msg.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
         break;
 #endif
     default:
-        goto use_sendto;
+        break;
     }
+
+    /* If we couldn't use the local address, send as sendto() would. */
+    if (msg->msg_controllen == 0)
+        msg->msg_control = NULL;
+}
+#endif
+
+static int
+recv_from_to(int s, void *buf, size_t len, int flags,
+             struct sockaddr *from, socklen_t *fromlen,
+             struct sockaddr *to, socklen_t *tolen,
+             union aux_addressing_info *auxaddr)
+{
+#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
+    if (to && tolen) {
+        /* Clobber with something recognizeable in case we try to use
+           the address.  */
+        memset(to, 0x40, *tolen);
+        *tolen = 0;
+    }
+
+    return recvfrom(s, buf, len, flags, from, fromlen);
+#else
+    int r;
+    struct iovec iov;
+    char cmsg[CMSG_SPACE(sizeof(union pktinfo))];
+    struct msghdr msg;
+
+    if (!to || !tolen)
+        return recvfrom(s, buf, len, flags, from, fromlen);
+
+    /* Clobber with something recognizeable in case we can't extract
+       the address but try to use it anyways.  */
+    memset(to, 0x40, *tolen);
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = *fromlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg;
+    msg.msg_controllen = sizeof(cmsg);
+
+    r = recvmsg(s, &msg, flags);
+    if (r < 0)
+        return r;
+    *fromlen = msg.msg_namelen;
+    get_dest_addr(&msg, to, tolen, auxaddr);
+    return r;
+#endif
+}
+
+static int
+send_to_from(int s, void *buf, size_t len, int flags,
+             const struct sockaddr *to, socklen_t tolen,
+             const struct sockaddr *from, socklen_t fromlen,
+             union aux_addressing_info *auxaddr)
+{
+#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
+    return sendto(s, buf, len, flags, to, tolen);
+#else
+    struct iovec iov;
+    struct msghdr msg;
+    char cbuf[CMSG_SPACE(sizeof(union pktinfo))];
+
+    make_send_msg(&msg, &iov, cbuf, sizeof(cbuf), buf, len, to, tolen,
+                  from, fromlen, auxaddr);
     return sendmsg(s, &msg, flags);
 #endif
 }
@@ -1495,6 +1604,50 @@ struct udp_dispatch_state {
     char pktbuf[MAX_DGRAM_SIZE];
 };
 
+#ifdef USE_UDP_BATCH
+/*
+ * Replies to a batch of UDP requests received with one recvmmsg() call.
+ * Replies produced while the batch is being dispatched are queued here and
+ * sent with one sendmmsg() call; replies produced later (by asynchronous
+ * request processing) are sent individually.
+ */
+struct udp_batch {
+    int fd;
+    int n;
+    struct udp_dispatch_state *states[MAX_UDP_BATCH];
+    krb5_data *responses[MAX_UDP_BATCH];
+};
+
+/* The batch being dispatched, if any. */
+static struct udp_batch *current_batch;
+#endif
+
+/* Log a failure (with errno value e) to send a reply for state. */
+static void
+log_send_error(struct udp_dispatch_state *state, int e)
+{
+    /* Note that the local address (daddr*) has no port number
+     * info associated with it. */
+    char saddrbuf[NI_MAXHOST], sportbuf[NI_MAXSERV];
+    char daddrbuf[NI_MAXHOST];
+
+    if (getnameinfo((struct sockaddr *)&state->daddr, state->daddr_len,
+                    daddrbuf, sizeof(daddrbuf), 0, 0,
+                    NI_NUMERICHOST) != 0) {
+        strlcpy(daddrbuf, "?", sizeof(daddrbuf));
+    }
+
+    if (getnameinfo((struct sockaddr *)&state->saddr, state->saddr_len,
+                    saddrbuf, sizeof(saddrbuf), sportbuf, sizeof(sportbuf),
+                    NI_NUMERICHOST|NI_NUMERICSERV) != 0) {
+        strlcpy(saddrbuf, "?", sizeof(saddrbuf));
+        strlcpy(sportbuf, "?", sizeof(sportbuf));
+    }
+
+    com_err(state->prog, e, _("while sending reply to %s/%s from %s"),
+            saddrbuf, sportbuf, daddrbuf);
+}
+
 static void
 process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
 {
@@ -1507,33 +1660,23 @@ process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
     if (code || response == NULL)
         goto out;
 
+#ifdef USE_UDP_BATCH
+    if (current_batch != NULL && current_batch->fd == state->port_fd &&
+        current_batch->n < MAX_UDP_BATCH) {
+        current_batch->states[current_batch->n] = state;
+        current_batch->responses[current_batch->n] = response;
+        current_batch->n++;
+        return;
+    }
+#endif
+
     cc = send_to_from(state->port_fd, response->data,
                       (socklen_t) response->length, 0,
                       (struct sockaddr *)&state->saddr, state->saddr_len,
                       (struct sockaddr *)&state->daddr, state->daddr_len,
                       &state->auxaddr);
     if (cc == -1) {
-        /* Note that the local address (daddr*) has no port number
-         * info associated with it. */
-        char saddrbuf[NI_MAXHOST], sportbuf[NI_MAXSERV];
-        char daddrbuf[NI_MAXHOST];
-        int e = errno;
-
-        if (getnameinfo((struct sockaddr *)&state->daddr, state->daddr_len,
-                        daddrbuf, sizeof(daddrbuf), 0, 0,
-                        NI_NUMERICHOST) != 0) {
-            strlcpy(daddrbuf, "?", sizeof(daddrbuf));
-        }
-
-        if (getnameinfo((struct sockaddr *)&state->saddr, state->saddr_len,
-                        saddrbuf, sizeof(saddrbuf), sportbuf, sizeof(sportbuf),
-                        NI_NUMERICHOST|NI_NUMERICSERV) != 0) {
-            strlcpy(saddrbuf, "?", sizeof(saddrbuf));
-            strlcpy(sportbuf, "?", sizeof(sportbuf));
-        }
-
-        com_err(state->prog, e, _("while sending reply to %s/%s from %s"),
-                saddrbuf, sportbuf, daddrbuf);
+        log_send_error(state, errno);
         goto out;
     }
     if ((size_t)cc != response->length) {
@@ -1546,46 +1689,48 @@ out:
     free(state);
 }
 
-static void
-process_packet(verto_ctx *ctx, verto_ev *ev)
+/* Allocate a dispatch state for a packet to be received on fd. */
+static struct udp_dispatch_state *
+new_dispatch_state(struct connection *conn, int fd)
 {
-    int cc;
-    struct connection *conn;
     struct udp_dispatch_state *state;
 
-    conn = verto_get_private(ev);
-
     state = malloc(sizeof(*state));
-    if (!state) {
-        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
-        return;
-    }
+    if (!state)
+        return NULL;
 
     state->handle = conn->handle;
     state->prog = conn->prog;
-    state->port_fd = verto_get_fd(ev);
+    state->port_fd = fd;
     assert(state->port_fd >= 0);
 
     state->saddr_len = sizeof(state->saddr);
     state->daddr_len = sizeof(state->daddr);
     memset(&state->auxaddr, 0, sizeof(state->auxaddr));
-    cc = recv_from_to(state->port_fd, state->pktbuf, sizeof(state->pktbuf), 0,
-                      (struct sockaddr *)&state->saddr, &state->saddr_len,
-                      (struct sockaddr *)&state->daddr, &state->daddr_len,
-                      &state->auxaddr);
-    if (cc == -1) {
-        if (errno != EINTR && errno != EAGAIN
-            /*
-             * This is how Linux indicates that a previous transmission was
-             * refused, e.g., if the client timed out before getting the
-             * response packet.
-             */
-            && errno != ECONNREFUSED
-        )
-            com_err(conn->prog, errno, _("while receiving from network"));
-        free(state);
-        return;
-    }
+    return state;
+}
+
+/* Log an error (with errno value e) from receiving a packet, unless it is an
+ * expected condition. */
+static void
+log_recv_error(struct connection *conn, int e)
+{
+    if (e != EINTR && e != EAGAIN
+        /*
+         * This is how Linux indicates that a previous transmission was
+         * refused, e.g., if the client timed out before getting the
+         * response packet.
+         */
+        && e != ECONNREFUSED
+    )
+        com_err(conn->prog, e, _("while receiving from network"));
+}
+
+/* Dispatch a packet of length cc which has been received into state. */
+static void
+dispatch_packet(verto_ctx *ctx, struct connection *conn,
+                struct udp_dispatch_state *state, int cc)
+{
     if (!cc) { /* zero-length packet? */
         free(state);
         return;
@@ -1624,6 +1769,159 @@ process_packet(verto_ctx *ctx, verto_ev *ev)
              &state->request, 0, ctx, process_packet_response, state);
 }
 
+#ifdef USE_UDP_BATCH
+/* Send the replies queued in batch, and free them and their states. */
+static void
+send_udp_batch(struct udp_batch *batch)
+{
+    struct mmsghdr msgs[MAX_UDP_BATCH];
+    struct iovec iovs[MAX_UDP_BATCH];
+    char cbufs[MAX_UDP_BATCH][CMSG_SPACE(sizeof(union pktinfo))];
+    struct udp_dispatch_state *state;
+    int i, r, sent;
+
+    for (i = 0; i < batch->n; i++) {
+        state = batch->states[i];
+        make_send_msg(&msgs[i].msg_hdr, &iovs[i], cbufs[i], sizeof(cbufs[i]),
+                      batch->responses[i]->data, batch->responses[i]->length,
+                      ss2sa(&state->saddr), state->saddr_len,
+                      ss2sa(&state->daddr), state->daddr_len,
+                      &state->auxaddr);
+    }
+
+    for (sent = 0; sent < batch->n; sent += r) {
+        r = sendmmsg(batch->fd, msgs + sent, batch->n - sent, 0);
+        if (r <= 0) {
+            /* Skip the reply which couldn't be sent. */
+            log_send_error(batch->states[sent], errno);
+            r = 1;
+            continue;
+        }
+        for (i = sent; i < sent + r; i++) {
+            if (msgs[i].msg_len != batch->responses[i]->length) {
+                com_err(batch->states[i]->prog, 0,
+                        _("short reply write %d vs %d\n"),
+                        batch->responses[i]->length, (int)msgs[i].msg_len);
+            }
+        }
+    }
+
+    for (i = 0; i < batch->n; i++) {
+        state = batch->states[i];
+        krb5_free_data(get_context(state->handle), batch->responses[i]);
+        free(state);
+    }
+}
+
+/*
+ * Receive up to udp_batch_size packets from the socket for ev with one system
+ * call, dispatch them, and send the resulting replies with one system call.
+ * The receive states are kept with the connection between wakeups; only
+ * those which receive a packet are handed off to dispatch and replaced.
+ */
+static void
+process_packet_batch(verto_ctx *ctx, verto_ev *ev)
+{
+    struct connection *conn = verto_get_private(ev);
+    struct udp_dispatch_state *state;
+    struct mmsghdr msgs[MAX_UDP_BATCH];
+    struct iovec iovs[MAX_UDP_BATCH];
+    char cbufs[MAX_UDP_BATCH][CMSG_SPACE(sizeof(union pktinfo))];
+    struct udp_batch batch;
+    int fd = verto_get_fd(ev), i, n, nstates;
+
+    if (conn->udp_states == NULL) {
+        conn->udp_states = calloc(udp_batch_size, sizeof(*conn->udp_states));
+        if (conn->udp_states == NULL) {
+            com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+            return;
+        }
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (nstates = 0; nstates < udp_batch_size; nstates++) {
+        state = conn->udp_states[nstates];
+        if (state == NULL) {
+            state = new_dispatch_state(conn, fd);
+            if (state == NULL)
+                break;
+            conn->udp_states[nstates] = state;
+        }
+        iovs[nstates].iov_base = state->pktbuf;
+        iovs[nstates].iov_len = sizeof(state->pktbuf);
+        msgs[nstates].msg_hdr.msg_name = &state->saddr;
+        msgs[nstates].msg_hdr.msg_namelen = sizeof(state->saddr);
+        msgs[nstates].msg_hdr.msg_iov = &iovs[nstates];
+        msgs[nstates].msg_hdr.msg_iovlen = 1;
+        msgs[nstates].msg_hdr.msg_control = cbufs[nstates];
+        msgs[nstates].msg_hdr.msg_controllen = sizeof(cbufs[nstates]);
+    }
+    if (nstates == 0) {
+        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+        return;
+    }
+
+    n = recvmmsg(fd, msgs, nstates, 0, NULL);
+    if (n == -1) {
+        log_recv_error(conn, errno);
+        n = 0;
+    }
+
+    batch.fd = fd;
+    batch.n = 0;
+    current_batch = &batch;
+    for (i = 0; i < n; i++) {
+        /* Dispatch owns this state now; refill its slot on the next
+         * wakeup. */
+        state = conn->udp_states[i];
+        conn->udp_states[i] = NULL;
+        state->saddr_len = msgs[i].msg_hdr.msg_namelen;
+        /* Clobber with something recognizeable in case we can't extract
+           the address but try to use it anyways.  */
+        memset(&state->daddr, 0x40, state->daddr_len);
+        get_dest_addr(&msgs[i].msg_hdr, ss2sa(&state->daddr),
+                      &state->daddr_len, &state->auxaddr);
+        dispatch_packet(ctx, conn, state, msgs[i].msg_len);
+    }
+    current_batch = NULL;
+    send_udp_batch(&batch);
+}
+#endif /* USE_UDP_BATCH */
+
+static void
+process_packet(verto_ctx *ctx, verto_ev *ev)
+{
+    int cc;
+    struct connection *conn;
+    struct udp_dispatch_state *state;
+
+#ifdef USE_UDP_BATCH
+    if (udp_batch_size > 1) {
+        process_packet_batch(ctx, ev);
+        return;
+    }
+#endif
+
+    conn = verto_get_private(ev);
+
+    state = new_dispatch_state(conn, verto_get_fd(ev));
+    if (!state) {
+        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+        return;
+    }
+
+    cc = recv_from_to(state->port_fd, state->pktbuf, sizeof(state->pktbuf), 0,
+                      (struct sockaddr *)&state->saddr, &state->saddr_len,
+                      (struct sockaddr *)&state->daddr, &state->daddr_len,
+                      &state->auxaddr);
+    if (cc == -1) {
+        log_recv_error(conn, errno);
+        free(state);
+        return;
+    }
+    dispatch_packet(ctx, conn, state, cc);
+}
+
 static int
 kill_lru_tcp_or_rpc_connection(void *handle, verto_ev *newev)
 {
@@ -0,0 +1,248 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/aes/aesni.c - AES using the x86 AES-NI instructions */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "aesni.h"
+
+#ifdef AESNI
+
+#include <stdlib.h>
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+#define TARGET __attribute__((target("aes,sse2")))
+
+int
+krb5int_aesni_available(void)
+{
+    static int available = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    /* This races harmlessly if called from multiple threads.  Setting
+     * KRB5_NO_AESNI in the environment selects the portable code, so that the
+     * test suite can exercise it on AES-NI hardware. */
+    if (available == -1) {
+        available = getenv("KRB5_NO_AESNI") == NULL &&
+            __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & bit_AES) && (edx & bit_SSE2);
+    }
+    return available;
+}
+
+/* Compute the next round key from the previous one and the (already
+ * shuffled) output of aeskeygenassist. */
+static inline TARGET __m128i
+expand_step(__m128i key, __m128i assist)
+{
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+/* The round constant must be an immediate, so these are macros. */
+#define EXPAND128(rk, i, rcon)                                          \
+    rk[i] = expand_step(rk[i - 1],                                      \
+                        _mm_shuffle_epi32(                              \
+                            _mm_aeskeygenassist_si128(rk[i - 1], rcon), \
+                            0xff))
+
+#define EXPAND256(rk, i, rcon)                                          \
+    rk[i] = expand_step(rk[i - 2],                                      \
+                        _mm_shuffle_epi32(                              \
+                            _mm_aeskeygenassist_si128(rk[i - 1], rcon), \
+                            0xff));                                     \
+    if (i + 1 < 15)                                                     \
+        rk[i + 1] = expand_step(rk[i - 1],                              \
+                                _mm_shuffle_epi32(                      \
+                                    _mm_aeskeygenassist_si128(rk[i], 0), \
+                                    0xaa))
+
+int TARGET
+krb5int_aesni_set_key(aesni_ctx *ctx, const unsigned char *key,
+                      unsigned int keylen)
+{
+    __m128i rk[15];
+    unsigned int i, nr;
+
+    if (keylen == 16) {
+        nr = 10;
+        rk[0] = _mm_loadu_si128((const __m128i *)key);
+        EXPAND128(rk, 1, 0x01);
+        EXPAND128(rk, 2, 0x02);
+        EXPAND128(rk, 3, 0x04);
+        EXPAND128(rk, 4, 0x08);
+        EXPAND128(rk, 5, 0x10);
+        EXPAND128(rk, 6, 0x20);
+        EXPAND128(rk, 7, 0x40);
+        EXPAND128(rk, 8, 0x80);
+        EXPAND128(rk, 9, 0x1b);
+        EXPAND128(rk, 10, 0x36);
+    } else if (keylen == 32) {
+        nr = 14;
+        rk[0] = _mm_loadu_si128((const __m128i *)key);
+        rk[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+        EXPAND256(rk, 2, 0x01);
+        EXPAND256(rk, 4, 0x02);
+        EXPAND256(rk, 6, 0x04);
+        EXPAND256(rk, 8, 0x08);
+        EXPAND256(rk, 10, 0x10);
+        EXPAND256(rk, 12, 0x20);
+        EXPAND256(rk, 14, 0x40);
+    } else {
+        return -1;
+    }
+
+    /* The decryption schedule is the encryption schedule reversed, with
+     * InvMixColumns applied to the inner round keys. */
+    for (i = 0; i <= nr; i++) {
+        _mm_storeu_si128((__m128i *)(ctx->enc_sched + i * 16), rk[i]);
+        _mm_storeu_si128((__m128i *)(ctx->dec_sched + (nr - i) * 16),
+                         (i == 0 || i == nr) ? rk[i] :
+                         _mm_aesimc_si128(rk[i]));
+    }
+    ctx->n_rnd = nr;
+    return 0;
+}
+
+static inline TARGET __m128i
+encrypt1(const aesni_ctx *ctx, __m128i b)
+{
+    const __m128i *rk = (const __m128i *)ctx->enc_sched;
+    unsigned int i;
+
+    b = _mm_xor_si128(b, _mm_loadu_si128(&rk[0]));
+    for (i = 1; i < ctx->n_rnd; i++)
+        b = _mm_aesenc_si128(b, _mm_loadu_si128(&rk[i]));
+    return _mm_aesenclast_si128(b, _mm_loadu_si128(&rk[i]));
+}
+
+static inline TARGET __m128i
+decrypt1(const aesni_ctx *ctx, __m128i b)
+{
+    const __m128i *rk = (const __m128i *)ctx->dec_sched;
+    unsigned int i;
+
+    b = _mm_xor_si128(b, _mm_loadu_si128(&rk[0]));
+    for (i = 1; i < ctx->n_rnd; i++)
+        b = _mm_aesdec_si128(b, _mm_loadu_si128(&rk[i]));
+    return _mm_aesdeclast_si128(b, _mm_loadu_si128(&rk[i]));
+}
+
+void TARGET
+krb5int_aesni_enc_blk(const aesni_ctx *ctx, const unsigned char *in,
+                      unsigned char *out)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)in);
+
+    _mm_storeu_si128((__m128i *)out, encrypt1(ctx, b));
+}
+
+void TARGET
+krb5int_aesni_dec_blk(const aesni_ctx *ctx, const unsigned char *in,
+                      unsigned char *out)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)in);
+
+    _mm_storeu_si128((__m128i *)out, decrypt1(ctx, b));
+}
+
+void TARGET
+krb5int_aesni_cbc_enc(const aesni_ctx *ctx, unsigned char *iv,
+                      const unsigned char *in, unsigned char *out,
+                      size_t nblocks)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)iv);
+
+    for (; nblocks > 0; nblocks--, in += 16, out += 16) {
+        c = _mm_xor_si128(c, _mm_loadu_si128((const __m128i *)in));
+        c = encrypt1(ctx, c);
+        _mm_storeu_si128((__m128i *)out, c);
+    }
+    _mm_storeu_si128((__m128i *)iv, c);
+}
+
+void TARGET
+krb5int_aesni_cbc_dec(const aesni_ctx *ctx, unsigned char *iv,
+                      const unsigned char *in, unsigned char *out,
+                      size_t nblocks)
+{
+    const __m128i *rk = (const __m128i *)ctx->dec_sched;
+    __m128i prev, c0, c1, c2, c3, b0, b1, b2, b3, k;
+    unsigned int i;
+
+    prev = _mm_loadu_si128((const __m128i *)iv);
+
+    /* Keep four blocks in flight to hide the latency of aesdec. */
+    for (; nblocks >= 4; nblocks -= 4, in += 64, out += 64) {
+        c0 = _mm_loadu_si128((const __m128i *)in);
+        c1 = _mm_loadu_si128((const __m128i *)(in + 16));
+        c2 = _mm_loadu_si128((const __m128i *)(in + 32));
+        c3 = _mm_loadu_si128((const __m128i *)(in + 48));
+        k = _mm_loadu_si128(&rk[0]);
+        b0 = _mm_xor_si128(c0, k);
+        b1 = _mm_xor_si128(c1, k);
+        b2 = _mm_xor_si128(c2, k);
+        b3 = _mm_xor_si128(c3, k);
+        for (i = 1; i < ctx->n_rnd; i++) {
+            k = _mm_loadu_si128(&rk[i]);
+            b0 = _mm_aesdec_si128(b0, k);
+            b1 = _mm_aesdec_si128(b1, k);
+            b2 = _mm_aesdec_si128(b2, k);
+            b3 = _mm_aesdec_si128(b3, k);
+        }
+        k = _mm_loadu_si128(&rk[i]);
+        b0 = _mm_aesdeclast_si128(b0, k);
+        b1 = _mm_aesdeclast_si128(b1, k);
+        b2 = _mm_aesdeclast_si128(b2, k);
+        b3 = _mm_aesdeclast_si128(b3, k);
+        _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b0, prev));
+        _mm_storeu_si128((__m128i *)(out + 16), _mm_xor_si128(b1, c0));
+        _mm_storeu_si128((__m128i *)(out + 32), _mm_xor_si128(b2, c1));
+        _mm_storeu_si128((__m128i *)(out + 48), _mm_xor_si128(b3, c2));
+        prev = c3;
+    }
+
+    for (; nblocks > 0; nblocks--, in += 16, out += 16) {
+        c0 = _mm_loadu_si128((const __m128i *)in);
+        b0 = decrypt1(ctx, c0);
+        _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b0, prev));
+        prev = c0;
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+}
+
+#else /* not AESNI */
+
+/* Avoid an empty translation unit. */
+typedef int aesni_unused;
+
+#endif /* not AESNI */
@@ -0,0 +1,92 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/aes/aesni.h - AES using the x86 AES-NI instructions */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements AES with the AES-NI instructions found in most x86
+ * processors since 2010.  It is compiled only with compilers which support
+ * per-function target attributes, so the rest of the library does not need to
+ * be built for a processor with AES-NI; callers must check
+ * krb5int_aesni_available() before using the other functions.
+ */
+
+#ifndef AESNI_H
+#define AESNI_H
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                       \
+    ((defined(__clang__) &&                                             \
+      (__clang_major__ > 3 ||                                           \
+       (__clang_major__ == 3 && __clang_minor__ >= 8))) ||              \
+     (!defined(__clang__) && defined(__GNUC__) &&                       \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define AESNI 1
+#endif
+
+#ifdef AESNI
+
+#include <stddef.h>
+
+typedef struct {
+    unsigned char enc_sched[15 * 16];   /* Encryption round keys */
+    unsigned char dec_sched[15 * 16];   /* Equivalent inverse cipher keys */
+    unsigned int n_rnd;                 /* 10 or 14; 0 if unset */
+} aesni_ctx;
+
+/* Return true if the processor supports the AES-NI instructions. */
+int krb5int_aesni_available(void);
+
+/* Expand a 16- or 32-byte key into ctx.  Return 0 on success, -1 if the key
+ * length is not supported. */
+int krb5int_aesni_set_key(aesni_ctx *ctx, const unsigned char *key,
+                          unsigned int keylen);
+
+/* Encrypt or decrypt one block.  in and out may be the same. */
+void krb5int_aesni_enc_blk(const aesni_ctx *ctx, const unsigned char *in,
+                           unsigned char *out);
+void krb5int_aesni_dec_blk(const aesni_ctx *ctx, const unsigned char *in,
+                           unsigned char *out);
+
+/*
+ * CBC-encrypt or decrypt nblocks blocks from in to out, using and updating
+ * the 16-byte chaining value iv.  in and out may be the same.  Decryption
+ * processes several blocks at once, since unlike encryption it has no
+ * dependency between blocks.
+ */
+void krb5int_aesni_cbc_enc(const aesni_ctx *ctx, unsigned char *iv,
+                           const unsigned char *in, unsigned char *out,
+                           size_t nblocks);
+void krb5int_aesni_cbc_dec(const aesni_ctx *ctx, unsigned char *iv,
+                           const unsigned char *in, unsigned char *out,
+                           size_t nblocks);
+
+#endif /* AESNI */
+
+#endif /* AESNI_H */
@@ -34,6 +34,22 @@
 #define CRYPTO_MOD_H
 
 #include <aes/aes.h>
+#include <sha1/shs.h>
 #include <sha2/sha2.h>
 
+#define K5_AES_SHA1_STITCH
+#define k5_sha1_ctx SHS_INFO
+#define k5_sha1_init shsInit
+#define k5_sha1_update shsUpdate
+
+static inline void
+k5_sha1_final(unsigned char *out, SHS_INFO *ctx)
+{
+    int i;
+
+    shsFinal(ctx);
+    for (i = 0; i < 5; i++)
+        store_32_be(ctx->digest[i], out + i * 4);
+}
+
 #endif /* CRYPTO_MOD_H */
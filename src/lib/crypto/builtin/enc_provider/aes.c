@@ -26,6 +26,7 @@
 
 #include "crypto_int.h"
 #include "aes.h"
+#include "aesni.h"
 
 #define CHECK_SIZES 0
 
@@ -34,24 +35,49 @@
  * want to mess with the imported AES implementation too much, so
  * we'll just use two copies of its context, one for encryption and
  * one for decryption, and use the #rounds field as a flag for whether
- * we've initialized each half.
+ * we've initialized each half.  If the processor supports AES-NI, we
+ * use a schedule for that instead, and the imported contexts are
+ * never initialized.
  */
 struct aes_key_info_cache {
     aes_ctx enc_ctx, dec_ctx;
+#ifdef AESNI
+    aesni_ctx ni_ctx;
+#endif
 };
 #define CACHE(X) ((struct aes_key_info_cache *)((X)->cache))
 
+#ifdef AESNI
+#define USE_AESNI(c) ((c)->ni_ctx.n_rnd != 0)
+#else
+#define USE_AESNI(c) 0
+#endif
+
 static inline void
-enc(unsigned char *out, const unsigned char *in, aes_ctx *ctx)
+enc(unsigned char *out, const unsigned char *in,
+    struct aes_key_info_cache *cache)
 {
-    if (aes_enc_blk(in, out, ctx) != aes_good)
+#ifdef AESNI
+    if (USE_AESNI(cache)) {
+        krb5int_aesni_enc_blk(&cache->ni_ctx, in, out);
+        return;
+    }
+#endif
+    if (aes_enc_blk(in, out, &cache->enc_ctx) != aes_good)
         abort();
 }
 
 static inline void
-dec(unsigned char *out, const unsigned char *in, aes_ctx *ctx)
+dec(unsigned char *out, const unsigned char *in,
+    struct aes_key_info_cache *cache)
 {
-    if (aes_dec_blk(in, out, ctx) != aes_good)
+#ifdef AESNI
+    if (USE_AESNI(cache)) {
+        krb5int_aesni_dec_blk(&cache->ni_ctx, in, out);
+        return;
+    }
+#endif
+    if (aes_dec_blk(in, out, &cache->dec_ctx) != aes_good)
         abort();
 }
 
@@ -80,27 +106,152 @@ xorblock(unsigned char *out, const unsigned char *in)
     }
 }
 
-krb5_error_code
-krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-                    size_t num_data)
+/* Create key's cache if necessary and initialize the schedule needed for the
+ * given direction. */
+static krb5_error_code
+init_key_cache(krb5_key key, krb5_boolean decrypt)
 {
-    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE];
-    int nblocks = 0, blockno;
-    size_t input_length, i;
-    struct iov_block_state input_pos, output_pos;
+    struct aes_key_info_cache *cache;
 
     if (key->cache == NULL) {
         key->cache = malloc(sizeof(struct aes_key_info_cache));
         if (key->cache == NULL)
             return ENOMEM;
-        CACHE(key)->enc_ctx.n_rnd = CACHE(key)->dec_ctx.n_rnd = 0;
+        cache = CACHE(key);
+        cache->enc_ctx.n_rnd = cache->dec_ctx.n_rnd = 0;
+#ifdef AESNI
+        cache->ni_ctx.n_rnd = 0;
+        if (krb5int_aesni_available()) {
+            (void)krb5int_aesni_set_key(&cache->ni_ctx,
+                                        key->keyblock.contents,
+                                        key->keyblock.length);
+        }
+#endif
     }
-    if (CACHE(key)->enc_ctx.n_rnd == 0) {
+    cache = CACHE(key);
+    if (USE_AESNI(cache))
+        return 0;
+    if (!decrypt && cache->enc_ctx.n_rnd == 0) {
         if (aes_enc_key(key->keyblock.contents, key->keyblock.length,
-                        &CACHE(key)->enc_ctx)
-            != aes_good)
+                        &cache->enc_ctx) != aes_good)
+            abort();
+    }
+    if (decrypt && cache->dec_ctx.n_rnd == 0) {
+        if (aes_dec_key(key->keyblock.contents, key->keyblock.length,
+                        &cache->dec_ctx) != aes_good)
             abort();
     }
+    return 0;
+}
+
+/* CBC-encrypt nblocks contiguous blocks in place, updating iv. */
+static void
+cbc_enc(struct aes_key_info_cache *cache, unsigned char *iv,
+        unsigned char *data, size_t nblocks)
+{
+#ifdef AESNI
+    if (USE_AESNI(cache)) {
+        krb5int_aesni_cbc_enc(&cache->ni_ctx, iv, data, data, nblocks);
+        return;
+    }
+#endif
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        xorblock(iv, data);
+        enc(data, iv, cache);
+        memcpy(iv, data, BLOCK_SIZE);
+    }
+}
+
+/* CBC-decrypt nblocks contiguous blocks in place, updating iv. */
+static void
+cbc_dec(struct aes_key_info_cache *cache, unsigned char *iv,
+        unsigned char *data, size_t nblocks)
+{
+    unsigned char tmp[BLOCK_SIZE];
+
+#ifdef AESNI
+    if (USE_AESNI(cache)) {
+        krb5int_aesni_cbc_dec(&cache->ni_ctx, iv, data, data, nblocks);
+        return;
+    }
+#endif
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        memcpy(tmp, data, BLOCK_SIZE);
+        dec(data, data, cache);
+        xorblock(data, iv);
+        memcpy(iv, tmp, BLOCK_SIZE);
+    }
+}
+
+/*
+ * CBC-encrypt or decrypt the next nblocks blocks of data in place.  Whenever
+ * a block lies entirely within one buffer, process it together with the whole
+ * blocks which follow it in that buffer, so that the block cipher code sees
+ * long runs of contiguous data rather than one block at a time.
+ */
+static void
+cbc_iov(struct aes_key_info_cache *cache, unsigned char *iv,
+        krb5_boolean decrypt, const krb5_crypto_iov *data, size_t num_data,
+        size_t nblocks, struct iov_block_state *input_pos,
+        struct iov_block_state *output_pos)
+{
+    unsigned char storage[BLOCK_SIZE], *block;
+    const krb5_crypto_iov *iov;
+    size_t n;
+
+    while (nblocks > 0) {
+        krb5int_c_iov_get_block_nocopy(storage, BLOCK_SIZE, data, num_data,
+                                       input_pos, &block);
+        n = 1;
+        if (block != storage) {
+            iov = &data[input_pos->iov_pos];
+            n += (iov->data.length - input_pos->data_pos) / BLOCK_SIZE;
+            if (n > nblocks)
+                n = nblocks;
+            input_pos->data_pos += (n - 1) * BLOCK_SIZE;
+        }
+
+        if (decrypt)
+            cbc_dec(cache, iv, block, n);
+        else
+            cbc_enc(cache, iv, block, n);
+
+        krb5int_c_iov_put_block_nocopy(data, num_data, storage, BLOCK_SIZE,
+                                       output_pos, block);
+        output_pos->data_pos += (n - 1) * BLOCK_SIZE;
+        nblocks -= n;
+    }
+}
+
+krb5_error_code
+krb5int_aes_cbc_blocks(krb5_key key, krb5_boolean decrypt, unsigned char *iv,
+                       unsigned char *data, size_t nblocks)
+{
+    krb5_error_code ret;
+
+    ret = init_key_cache(key, decrypt);
+    if (ret)
+        return ret;
+    if (decrypt)
+        cbc_dec(CACHE(key), iv, data, nblocks);
+    else
+        cbc_enc(CACHE(key), iv, data, nblocks);
+    return 0;
+}
+
+krb5_error_code
+krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+                    size_t num_data)
+{
+    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE];
+    int nblocks = 0;
+    size_t input_length, i;
+    struct iov_block_state input_pos, output_pos;
+    krb5_error_code ret;
+
+    ret = init_key_cache(key, FALSE);
+    if (ret)
+        return ret;
     if (ivec != NULL)
         memcpy(tmp, ivec->data, BLOCK_SIZE);
     else
@@ -119,25 +270,14 @@ krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
     if (nblocks == 1) {
         krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, CACHE(key));
         krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
     } else if (nblocks > 1) {
         unsigned char blockN2[BLOCK_SIZE];   /* second last */
         unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
-
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            xorblock(tmp, block);
-            enc(block, tmp, &CACHE(key)->enc_ctx);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
-
-            /* Set up for next block.  */
-            memcpy(tmp, block, BLOCK_SIZE);
-        }
+        cbc_iov(CACHE(key), tmp, FALSE, data, num_data, nblocks - 2,
+                &input_pos, &output_pos);
 
         /* Do final CTS step for last two blocks (the second of which
            may or may not be incomplete).  */
@@ -151,13 +291,13 @@ krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 
         /* Encrypt second last block */
         xorblock(tmp, blockN2);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, CACHE(key));
         memcpy(blockN2, tmp2, BLOCK_SIZE); /* blockN2 now contains first block */
         memcpy(tmp, tmp2, BLOCK_SIZE);
 
         /* Encrypt last block */
         xorblock(tmp, blockN1);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, CACHE(key));
         memcpy(blockN1, tmp2, BLOCK_SIZE);
 
         /* Put the last two blocks back into the iovec (reverse order) */
@@ -178,24 +318,17 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
                     size_t num_data)
 {
     unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE], tmp3[BLOCK_SIZE];
-    int nblocks = 0, blockno;
+    int nblocks = 0;
     unsigned int i;
     size_t input_length;
     struct iov_block_state input_pos, output_pos;
+    krb5_error_code ret;
 
     CHECK_SIZES;
 
-    if (key->cache == NULL) {
-        key->cache = malloc(sizeof(struct aes_key_info_cache));
-        if (key->cache == NULL)
-            return ENOMEM;
-        CACHE(key)->enc_ctx.n_rnd = CACHE(key)->dec_ctx.n_rnd = 0;
-    }
-    if (CACHE(key)->dec_ctx.n_rnd == 0) {
-        if (aes_dec_key(key->keyblock.contents, key->keyblock.length,
-                        &CACHE(key)->dec_ctx) != aes_good)
-            abort();
-    }
+    ret = init_key_cache(key, TRUE);
+    if (ret)
+        return ret;
 
     if (ivec != NULL)
         memcpy(tmp, ivec->data, BLOCK_SIZE);
@@ -215,24 +348,14 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
     if (nblocks == 1) {
         krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        dec(tmp2, tmp, &CACHE(key)->dec_ctx);
+        dec(tmp2, tmp, CACHE(key));
         krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
     } else if (nblocks > 1) {
         unsigned char blockN2[BLOCK_SIZE];   /* second last */
         unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
-
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            memcpy(tmp2, block, BLOCK_SIZE);
-            dec(block, block, &CACHE(key)->dec_ctx);
-            xorblock(block, tmp);
-            memcpy(tmp, tmp2, BLOCK_SIZE);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
-        }
+        cbc_iov(CACHE(key), tmp, TRUE, data, num_data, nblocks - 2,
+                &input_pos, &output_pos);
 
         /* Do last two blocks, the second of which (next-to-last block
            of plaintext) may be incomplete.  */
@@ -248,7 +371,7 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
             memcpy(ivec->data, blockN2, BLOCK_SIZE);
 
         /* Decrypt second last block */
-        dec(tmp2, blockN2, &CACHE(key)->dec_ctx);
+        dec(tmp2, blockN2, CACHE(key));
         /* Set tmp2 to last (possibly partial) plaintext block, and
            save it.  */
         xorblock(tmp2, blockN1);
@@ -258,7 +381,7 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
            ciphertext block.  */
         input_length %= BLOCK_SIZE;
         memcpy(tmp2, blockN1, input_length ? input_length : BLOCK_SIZE);
-        dec(tmp3, tmp2, &CACHE(key)->dec_ctx);
+        dec(tmp3, tmp2, CACHE(key));
         xorblock(tmp3, tmp);
         memcpy(blockN1, tmp3, BLOCK_SIZE);
 
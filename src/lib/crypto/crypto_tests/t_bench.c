@@ -0,0 +1,499 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/crypto_tests/t_bench.c - Crypto throughput benchmark */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the throughput of encryption, decryption, checksum, string-to-key,
+ * and PRF operations for each enctype in etypes.c and each checksum type in
+ * cksumtypes.c, so that crypto back ends can be compared and regressions
+ * caught.  This program is not run by "make check"; run it with "make bench"
+ * or directly:
+ *
+ *     ./t_bench [-t msec] [-s size,size,...] [typename ...]
+ *
+ * -t sets the approximate time spent on each measurement (default 200ms), and
+ * -s sets the message sizes to use (default 16,64,256,1024,8192).  If type
+ * names are given, only the named enctypes and checksum types are measured.
+ *
+ * Each line reports operations per second, and for operations over a message,
+ * message bytes per second.  "keysetup" creates a krb5_key from a keyblock,
+ * encrypts one 16-byte message with it (which derives any cached keys and
+ * schedules), and frees it; "c_encrypt" uses a keyblock directly, so it pays
+ * that setup cost on every message.
+ */
+
+#include "k5-int.h"
+#include <sys/time.h>
+
+#ifndef CRYPTO_IMPL
+#define CRYPTO_IMPL "unknown"
+#endif
+
+#define MAX_SIZES 32
+
+/* Enctype and checksum type numbers are scanned over this range to find the
+ * types the library supports. */
+#define MIN_TYPE_NUM -512
+#define MAX_TYPE_NUM 511
+
+/* State used by the operations being measured. */
+struct bench {
+    krb5_enctype enctype;
+    krb5_cksumtype cksumtype;
+    krb5_keyblock keyblock;
+    krb5_key key;               /* NULL for unkeyed checksums */
+    krb5_data plain;            /* Message of the current size */
+    krb5_data block;            /* 16-byte message for keysetup */
+    krb5_enc_data cipher;       /* Encryption of plain */
+    krb5_data output;           /* Decryption output */
+    size_t output_len;
+    krb5_checksum cksum;        /* Checksum of plain */
+    krb5_data prf_out;
+    krb5_crypto_iov iov[4];     /* Stream layout over iov_buf */
+    size_t num_iov;
+    char *iov_buf, *iov_save;
+    size_t iov_len;
+};
+
+typedef void (*bench_fn)(struct bench *b);
+
+static krb5_context ctx = NULL;
+static double duration = 0.2;
+
+static void
+t(krb5_error_code code)
+{
+    if (code != 0) {
+        fprintf(stderr, "Failure: %s\n", krb5_get_error_message(ctx, code));
+        exit(1);
+    }
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Run fn repeatedly for about duration seconds and report the rate.  size is
+ * the number of message bytes processed by each operation, or 0. */
+static void
+measure(struct bench *b, const char *name, const char *op, size_t size,
+        bench_fn fn)
+{
+    double start, elapsed;
+    long count = 0, batch = 1, i;
+    char sizebuf[32];
+
+    /* Run once untimed, so that lazily derived keys are in place. */
+    fn(b);
+
+    start = now();
+    do {
+        for (i = 0; i < batch; i++)
+            fn(b);
+        count += batch;
+        if (batch < 1024)
+            batch *= 2;
+        elapsed = now() - start;
+    } while (elapsed < duration);
+
+    if (size > 0)
+        snprintf(sizebuf, sizeof(sizebuf), "%lu", (unsigned long)size);
+    else
+        strlcpy(sizebuf, "-", sizeof(sizebuf));
+    printf("%-24s %-18s %6s %12.0f ops/s", name, op, sizebuf,
+           count / elapsed);
+    if (size > 0)
+        printf(" %10.2f MB/s", count * (double)size / elapsed / 1000000.0);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void
+op_keysetup(struct bench *b)
+{
+    krb5_key key;
+
+    t(krb5_k_create_key(ctx, &b->keyblock, &key));
+    t(krb5_k_encrypt(ctx, key, 0, NULL, &b->block, &b->cipher));
+    krb5_k_free_key(ctx, key);
+}
+
+static void
+op_string_to_key(struct bench *b)
+{
+    krb5_data pw = string2data("password"), salt = string2data("SALT");
+    krb5_keyblock kb;
+
+    t(krb5_c_string_to_key(ctx, b->enctype, &pw, &salt, &kb));
+    krb5_free_keyblock_contents(ctx, &kb);
+}
+
+static void
+op_encrypt(struct bench *b)
+{
+    t(krb5_k_encrypt(ctx, b->key, 0, NULL, &b->plain, &b->cipher));
+}
+
+static void
+op_decrypt(struct bench *b)
+{
+    b->output.length = b->output_len;
+    t(krb5_k_decrypt(ctx, b->key, 0, NULL, &b->cipher, &b->output));
+}
+
+static void
+op_c_encrypt(struct bench *b)
+{
+    t(krb5_c_encrypt(ctx, &b->keyblock, 0, NULL, &b->plain, &b->cipher));
+}
+
+static void
+op_encrypt_iov(struct bench *b)
+{
+    t(krb5_k_encrypt_iov(ctx, b->key, 0, NULL, b->iov, b->num_iov));
+}
+
+/* Decryption happens in place, so restore the ciphertext each time. */
+static void
+op_decrypt_iov(struct bench *b)
+{
+    memcpy(b->iov_buf, b->iov_save, b->iov_len);
+    t(krb5_k_decrypt_iov(ctx, b->key, 0, NULL, b->iov, b->num_iov));
+}
+
+static void
+op_prf(struct bench *b)
+{
+    t(krb5_k_prf(ctx, b->key, &b->plain, &b->prf_out));
+}
+
+static void
+op_make_checksum(struct bench *b)
+{
+    krb5_checksum cksum;
+
+    t(krb5_k_make_checksum(ctx, b->cksumtype, b->key, 0, &b->plain, &cksum));
+    krb5_free_checksum_contents(ctx, &cksum);
+}
+
+static void
+op_verify_checksum(struct bench *b)
+{
+    krb5_boolean valid;
+
+    t(krb5_k_verify_checksum(ctx, b->key, 0, &b->plain, &b->cksum, &valid));
+    assert(valid);
+}
+
+static void
+op_make_checksum_iov(struct bench *b)
+{
+    t(krb5_k_make_checksum_iov(ctx, b->cksumtype, b->key, 0, b->iov,
+                               b->num_iov));
+}
+
+/* Set up an iov array of the given types over a contiguous buffer, with the
+ * data entry holding a copy of b->plain. */
+static void
+setup_iov(struct bench *b, const krb5_cryptotype *types,
+          const unsigned int *lens, size_t n)
+{
+    size_t i, off;
+
+    b->iov_len = 0;
+    for (i = 0; i < n; i++)
+        b->iov_len += lens[i];
+    b->iov_buf = malloc(b->iov_len);
+    b->iov_save = malloc(b->iov_len);
+    assert(b->iov_buf != NULL && b->iov_save != NULL);
+    for (i = 0, off = 0; i < n; i++) {
+        b->iov[i].flags = types[i];
+        b->iov[i].data = make_data(b->iov_buf + off, lens[i]);
+        if (types[i] == KRB5_CRYPTO_TYPE_DATA)
+            memcpy(b->iov[i].data.data, b->plain.data, lens[i]);
+        off += lens[i];
+    }
+    b->num_iov = n;
+}
+
+static void
+free_iov(struct bench *b)
+{
+    free(b->iov_buf);
+    free(b->iov_save);
+    b->iov_buf = b->iov_save = NULL;
+}
+
+/* Allocate b->plain with the given length. */
+static void
+setup_plain(struct bench *b, size_t size)
+{
+    t(alloc_data(&b->plain, size));
+    memset(b->plain.data, 'x', size);
+}
+
+static void
+bench_enctype(krb5_enctype enctype, const size_t *sizes, size_t nsizes)
+{
+    struct bench b;
+    char name[64];
+    size_t i, len, max_len;
+    krb5_cryptotype types[4] = {
+        KRB5_CRYPTO_TYPE_HEADER, KRB5_CRYPTO_TYPE_DATA,
+        KRB5_CRYPTO_TYPE_PADDING, KRB5_CRYPTO_TYPE_TRAILER
+    };
+    unsigned int lens[4];
+    char blockbuf[16];
+    krb5_boolean have_prf;
+
+    memset(&b, 0, sizeof(b));
+    b.enctype = enctype;
+    t(krb5_enctype_to_name(enctype, FALSE, name, sizeof(name)));
+    t(krb5_c_make_random_key(ctx, enctype, &b.keyblock));
+    t(krb5_k_create_key(ctx, &b.keyblock, &b.key));
+    memset(blockbuf, 'x', sizeof(blockbuf));
+    b.block = make_data(blockbuf, sizeof(blockbuf));
+
+    /* Some enctypes (such as the raw ones) report a PRF length but have no
+     * PRF, so only measure it if a trial call works. */
+    have_prf = (krb5_c_prf_length(ctx, enctype, &len) == 0);
+    if (have_prf) {
+        t(alloc_data(&b.prf_out, len));
+        have_prf = (krb5_k_prf(ctx, b.key, &b.block, &b.prf_out) == 0);
+    }
+
+    /* Size the ciphertext buffer for the largest message. */
+    max_len = 16;
+    for (i = 0; i < nsizes; i++)
+        max_len = (sizes[i] > max_len) ? sizes[i] : max_len;
+    t(krb5_c_encrypt_length(ctx, enctype, max_len, &len));
+    t(alloc_data(&b.cipher.ciphertext, len));
+    b.cipher.enctype = enctype;
+    b.output_len = len;
+    t(alloc_data(&b.output, len));
+
+    measure(&b, name, "keysetup", 0, op_keysetup);
+    measure(&b, name, "string_to_key", 0, op_string_to_key);
+
+    for (i = 0; i < nsizes; i++) {
+        setup_plain(&b, sizes[i]);
+        t(krb5_c_encrypt_length(ctx, enctype, sizes[i], &len));
+        b.cipher.ciphertext.length = len;
+        measure(&b, name, "encrypt", sizes[i], op_encrypt);
+        measure(&b, name, "decrypt", sizes[i], op_decrypt);
+        measure(&b, name, "c_encrypt", sizes[i], op_c_encrypt);
+
+        t(krb5_c_crypto_length(ctx, enctype, KRB5_CRYPTO_TYPE_HEADER,
+                               &lens[0]));
+        lens[1] = sizes[i];
+        t(krb5_c_padding_length(ctx, enctype, sizes[i], &lens[2]));
+        t(krb5_c_crypto_length(ctx, enctype, KRB5_CRYPTO_TYPE_TRAILER,
+                               &lens[3]));
+        setup_iov(&b, types, lens, 4);
+        measure(&b, name, "encrypt_iov", sizes[i], op_encrypt_iov);
+        memcpy(b.iov_save, b.iov_buf, b.iov_len);
+        measure(&b, name, "decrypt_iov", sizes[i], op_decrypt_iov);
+        free_iov(&b);
+
+        if (have_prf)
+            measure(&b, name, "prf", sizes[i], op_prf);
+        krb5_free_data_contents(ctx, &b.plain);
+    }
+
+    krb5_free_data_contents(ctx, &b.prf_out);
+    krb5_free_data_contents(ctx, &b.output);
+    krb5_free_data_contents(ctx, &b.cipher.ciphertext);
+    krb5_k_free_key(ctx, b.key);
+    krb5_free_keyblock_contents(ctx, &b.keyblock);
+}
+
+static void
+bench_cksumtype(krb5_cksumtype cksumtype, krb5_enctype enctype,
+                const size_t *sizes, size_t nsizes)
+{
+    struct bench b;
+    char name[64];
+    size_t i, cklen;
+    krb5_cryptotype types[2] = {
+        KRB5_CRYPTO_TYPE_DATA, KRB5_CRYPTO_TYPE_CHECKSUM
+    };
+    unsigned int lens[2];
+
+    memset(&b, 0, sizeof(b));
+    b.cksumtype = cksumtype;
+    t(krb5_cksumtype_to_string(cksumtype, name, sizeof(name)));
+    if (enctype != 0) {
+        t(krb5_c_make_random_key(ctx, enctype, &b.keyblock));
+        t(krb5_k_create_key(ctx, &b.keyblock, &b.key));
+    }
+    t(krb5_c_checksum_length(ctx, cksumtype, &cklen));
+
+    for (i = 0; i < nsizes; i++) {
+        setup_plain(&b, sizes[i]);
+        t(krb5_k_make_checksum(ctx, cksumtype, b.key, 0, &b.plain, &b.cksum));
+        measure(&b, name, "make_checksum", sizes[i], op_make_checksum);
+        measure(&b, name, "verify_checksum", sizes[i], op_verify_checksum);
+
+        lens[0] = sizes[i];
+        lens[1] = cklen;
+        setup_iov(&b, types, lens, 2);
+        measure(&b, name, "make_checksum_iov", sizes[i],
+                op_make_checksum_iov);
+        free_iov(&b);
+
+        krb5_free_checksum_contents(ctx, &b.cksum);
+        krb5_free_data_contents(ctx, &b.plain);
+    }
+
+    krb5_k_free_key(ctx, b.key);
+    if (enctype != 0)
+        krb5_free_keyblock_contents(ctx, &b.keyblock);
+}
+
+/* Return an enctype whose keys can be used with the keyed checksum type
+ * cksumtype, or 0 if there is none. */
+static krb5_enctype
+key_enctype(krb5_cksumtype cksumtype)
+{
+    krb5_cksumtype *list;
+    unsigned int count, i;
+    krb5_enctype e, found = 0;
+
+    for (e = MIN_TYPE_NUM; e <= MAX_TYPE_NUM && found == 0; e++) {
+        if (!krb5_c_valid_enctype(e))
+            continue;
+        if (krb5_c_keyed_checksum_types(ctx, e, &count, &list) != 0)
+            continue;
+        for (i = 0; i < count; i++) {
+            if (list[i] == cksumtype)
+                found = e;
+        }
+        krb5_free_cksumtypes(ctx, list);
+    }
+    return found;
+}
+
+/* Return true if no type names were given or if one of them names enctype or
+ * cksumtype. */
+static krb5_boolean
+selected(char **names, int nnames, krb5_enctype enctype,
+         krb5_cksumtype cksumtype)
+{
+    krb5_enctype e;
+    krb5_cksumtype c;
+    int i;
+
+    if (nnames == 0)
+        return TRUE;
+    for (i = 0; i < nnames; i++) {
+        if (enctype != 0 && krb5_string_to_enctype(names[i], &e) == 0 &&
+            e == enctype)
+            return TRUE;
+        if (cksumtype != 0 && krb5_string_to_cksumtype(names[i], &c) == 0 &&
+            c == cksumtype)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: t_bench [-t msec] [-s size,...] [typename ...]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_enctype enctype;
+    krb5_cksumtype cksumtype;
+    size_t sizes[MAX_SIZES] = { 16, 64, 256, 1024, 8192 }, nsizes = 5;
+    char *p, *end;
+    long val;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:s:")) != -1) {
+        switch (c) {
+        case 't':
+            val = strtol(optarg, &end, 10);
+            if (*end != '\0' || val <= 0)
+                usage();
+            duration = val / 1000.0;
+            break;
+        case 's':
+            nsizes = 0;
+            for (p = optarg; *p != '\0'; p = end + (*end == ',')) {
+                val = strtol(p, &end, 10);
+                if (end == p || (*end != ',' && *end != '\0') || val <= 0 ||
+                    nsizes == MAX_SIZES)
+                    usage();
+                sizes[nsizes++] = val;
+            }
+            if (nsizes == 0)
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Creating a context loads the error tables, so failures are reported
+     * with a useful message. */
+    t(krb5_init_context(&ctx));
+
+    printf("Crypto implementation: %s\n", CRYPTO_IMPL);
+    for (enctype = MIN_TYPE_NUM; enctype <= MAX_TYPE_NUM; enctype++) {
+        if (krb5_c_valid_enctype(enctype) && selected(argv, argc, enctype, 0))
+            bench_enctype(enctype, sizes, nsizes);
+    }
+    for (cksumtype = MIN_TYPE_NUM; cksumtype <= MAX_TYPE_NUM; cksumtype++) {
+        if (!krb5_c_valid_cksumtype(cksumtype) ||
+            !selected(argv, argc, 0, cksumtype))
+            continue;
+        if (!krb5_c_is_keyed_cksum(cksumtype)) {
+            bench_cksumtype(cksumtype, 0, sizes, nsizes);
+        } else {
+            enctype = key_enctype(cksumtype);
+            if (enctype != 0)
+                bench_cksumtype(cksumtype, enctype, sizes, nsizes);
+        }
+    }
+    krb5_free_context(ctx);
+    return 0;
+}
@@ -104,12 +104,47 @@ static void printk(const char *descr, krb5_keyblock *k) {
     printd(descr, &d);
 }
 
+/* Return true if d contains the bytes given in hex by s. */
+static int hexmatch(const krb5_data *d, const char *s)
+{
+    unsigned int i, byte;
+
+    if (strlen(s) != d->length * 2)
+        return 0;
+    for (i = 0; i < d->length; i++) {
+        if (sscanf(s + i * 2, "%2x", &byte) != 1 ||
+            byte != (unsigned char)d->data[i])
+            return 0;
+    }
+    return 1;
+}
+
 static void test_cts()
 {
     static const char input[4*16] =
         "I would like the General Gau's Chicken, please, and wonton soup.";
     static const unsigned char aeskey[16] = "chicken teriyaki";
     static const int lengths[] = { 17, 31, 32, 47, 48, 64 };
+    /* Expected outputs and next IVs from RFC 3962 appendix B. */
+    static const char *const expected[] = {
+        "c6353568f2bf8cb4d8a580362da7ff7f97",
+        "fc00783e0efdb2c1d445d4c8eff7ed2297687268d6ecccc0c07b25e25ecfe5",
+        "39312523a78662d5be7fcbcc98ebf5a897687268d6ecccc0c07b25e25ecfe584",
+        "97687268d6ecccc0c07b25e25ecfe584b3fffd940c16a18c1b5549d2f838029e"
+        "39312523a78662d5be7fcbcc98ebf5",
+        "97687268d6ecccc0c07b25e25ecfe5849dad8bbb96c4cdc03bc103e1a194bbd8"
+        "39312523a78662d5be7fcbcc98ebf5a8",
+        "97687268d6ecccc0c07b25e25ecfe58439312523a78662d5be7fcbcc98ebf5a8"
+        "4807efe836ee89a526730dbc2f7bc8409dad8bbb96c4cdc03bc103e1a194bbd8"
+    };
+    static const char *const expected_iv[] = {
+        "c6353568f2bf8cb4d8a580362da7ff7f",
+        "fc00783e0efdb2c1d445d4c8eff7ed22",
+        "39312523a78662d5be7fcbcc98ebf5a8",
+        "b3fffd940c16a18c1b5549d2f838029e",
+        "9dad8bbb96c4cdc03bc103e1a194bbd8",
+        "4807efe836ee89a526730dbc2f7bc840"
+    };
 
     unsigned int i;
     char outbuf[64], encivbuf[16], decivbuf[16];
@@ -153,6 +188,14 @@ static void test_cts()
         printd("Input", &in);
         printd("Output", &iov.data);
         printd("Next IV", &enciv);
+        if (!hexmatch(&iov.data, expected[i])) {
+            printd("Encryption result DOESN'T MATCH", &iov.data);
+            exit(1);
+        }
+        if (!hexmatch(&enciv, expected_iv[i])) {
+            printd("Encryption IV result DOESN'T MATCH", &enciv);
+            exit(1);
+        }
         err = krb5int_aes_decrypt(key, &deciv, &iov, 1);
         if (err) {
             printf("error %ld from krb5int_aes_decrypt\n", (long)err);
@@ -170,9 +213,137 @@ static void test_cts()
     krb5_k_free_key(NULL, key);
 }
 
+/* Simple deterministic generator, so that runs are repeatable. */
+static unsigned int
+next_rand(unsigned int *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+/*
+ * Encrypt messages of many lengths with both key sizes, once in a single
+ * buffer and then split across randomly sized DATA and HEADER chunks with
+ * SIGN_ONLY chunks interleaved.  The split results must match the contiguous
+ * ones, SIGN_ONLY chunks must be untouched, and decryption must restore the
+ * input.  The contiguous ciphertexts are printed so that the output can be
+ * compared between runs using different AES implementations.
+ */
+#define MAX_LEN 200
+#define MAX_IOV (2 * MAX_LEN + 1)
+static void test_cts_iov()
+{
+    static const krb5_enctype enctypes[] = {
+        ENCTYPE_AES128_CTS_HMAC_SHA1_96, ENCTYPE_AES256_CTS_HMAC_SHA1_96
+    };
+    static krb5_crypto_iov iov[MAX_IOV];
+    unsigned char keybytes[32];
+    char input[MAX_LEN], contig[MAX_LEN], split[MAX_LEN];
+    char signbuf[MAX_IOV], ivbuf[16], contig_iv[16], split_iv[16];
+    unsigned int state = 1, e, len, trial, pos, n, chunk, nsign, i;
+    krb5_crypto_iov one;
+    krb5_data civ, siv;
+    krb5_keyblock keyblock;
+    krb5_key key;
+    krb5_error_code err;
+
+    for (i = 0; i < sizeof(signbuf); i++)
+        signbuf[i] = (char)i;
+    civ = make_data(contig_iv, 16);
+    siv = make_data(split_iv, 16);
+    for (e = 0; e < ASIZE(enctypes); e++) {
+        keyblock.enctype = enctypes[e];
+        keyblock.length = (e == 0) ? 16 : 32;
+        keyblock.contents = keybytes;
+        for (i = 0; i < keyblock.length; i++)
+            keybytes[i] = next_rand(&state);
+        err = krb5_k_create_key(NULL, &keyblock, &key);
+        if (err) {
+            printf("error %ld from krb5_k_create_key\n", (long)err);
+            exit(1);
+        }
+        for (len = 16; len <= MAX_LEN; len++) {
+            for (i = 0; i < len; i++)
+                input[i] = next_rand(&state);
+            for (i = 0; i < 16; i++)
+                ivbuf[i] = next_rand(&state);
+
+            memcpy(contig, input, len);
+            memcpy(contig_iv, ivbuf, 16);
+            one.flags = KRB5_CRYPTO_TYPE_DATA;
+            one.data = make_data(contig, len);
+            err = krb5int_aes_encrypt(key, &civ, &one, 1);
+            if (err) {
+                printf("error %ld from krb5int_aes_encrypt\n", (long)err);
+                exit(1);
+            }
+            printf("%u %u ", keyblock.length, len);
+            for (i = 0; i < len; i++)
+                printf("%02x", (unsigned char)contig[i]);
+            printf("\n");
+
+            for (trial = 0; trial < 8; trial++) {
+                /* Split the message; trial 0 uses one-byte chunks. */
+                memcpy(split, input, len);
+                n = nsign = 0;
+                for (pos = 0; pos < len; pos += chunk) {
+                    if (next_rand(&state) % 3 == 0) {
+                        iov[n].flags = KRB5_CRYPTO_TYPE_SIGN_ONLY;
+                        iov[n++].data = make_data(signbuf + nsign++, 1);
+                    }
+                    chunk = (trial == 0) ? 1 : 1 + next_rand(&state) % 40;
+                    if (chunk > len - pos)
+                        chunk = len - pos;
+                    iov[n].flags = (next_rand(&state) % 4 == 0) ?
+                        KRB5_CRYPTO_TYPE_HEADER : KRB5_CRYPTO_TYPE_DATA;
+                    iov[n++].data = make_data(split + pos, chunk);
+                }
+
+                memcpy(split_iv, ivbuf, 16);
+                err = krb5int_aes_encrypt(key, &siv, iov, n);
+                if (err) {
+                    printf("error %ld from krb5int_aes_encrypt\n",
+                           (long)err);
+                    exit(1);
+                }
+                if (memcmp(split, contig, len) != 0 ||
+                    memcmp(split_iv, contig_iv, 16) != 0) {
+                    printf("Split encryption DOESN'T MATCH (%u bytes, "
+                           "%u-byte key, trial %u)\n", len,
+                           keyblock.length, trial);
+                    exit(1);
+                }
+
+                memcpy(split_iv, ivbuf, 16);
+                err = krb5int_aes_decrypt(key, &siv, iov, n);
+                if (err) {
+                    printf("error %ld from krb5int_aes_decrypt\n",
+                           (long)err);
+                    exit(1);
+                }
+                if (memcmp(split, input, len) != 0 ||
+                    memcmp(split_iv, contig_iv, 16) != 0) {
+                    printf("Split decryption DOESN'T MATCH (%u bytes, "
+                           "%u-byte key, trial %u)\n", len,
+                           keyblock.length, trial);
+                    exit(1);
+                }
+                for (i = 0; i < nsign; i++) {
+                    if (signbuf[i] != (char)i) {
+                        printf("SIGN_ONLY data modified\n");
+                        exit(1);
+                    }
+                }
+            }
+        }
+        krb5_k_free_key(NULL, key);
+    }
+}
+
 int main (int argc, char **argv)
 {
     whoami = argv[0];
     test_cts();
+    test_cts_iov();
     return 0;
 }
@@ -282,6 +282,62 @@ main ()
     test ("Comparing", compare_results (&in, &check));
 
     krb5_free_keyblock (context, keyblock);
+
+    /*
+     * Large AES messages are hashed and encrypted in a single pass unless a
+     * cipher state is supplied.  A fresh state is all zeros, so check each
+     * method against the other.
+     */
+    for (i = 0; i < 2; i++) {
+        krb5_enctype enctype = (i == 0) ? ENCTYPE_AES128_CTS_HMAC_SHA1_96 :
+            ENCTYPE_AES256_CTS_HMAC_SHA1_96;
+        krb5_data big, bigcheck;
+
+        test ("Initializing a keyblock",
+              krb5_init_keyblock (context, enctype, 0, &keyblock));
+        test ("Generating random keyblock",
+              krb5_c_make_random_key (context, enctype, keyblock));
+        big.length = 20007;
+        big.data = malloc(big.length);
+        bigcheck.length = big.length;
+        bigcheck.data = malloc(bigcheck.length);
+        krb5_c_encrypt_length (context, enctype, big.length, &len);
+        enc_out.ciphertext.length = len;
+        enc_out.ciphertext.data = malloc(len);
+        if (big.data == NULL || bigcheck.data == NULL ||
+            enc_out.ciphertext.data == NULL)
+            abort();
+        for (j = 0; j < (int)big.length; j++)
+            big.data[j] = j % 251;
+
+        test ("Encrypting large message",
+              krb5_c_encrypt (context, keyblock, 7, 0, &big, &enc_out));
+        test ("init_state",
+              krb5_c_init_state (context, keyblock, 7, &state));
+        test ("Decrypting large message with state",
+              krb5_c_decrypt (context, keyblock, 7, &state, &enc_out,
+                              &bigcheck));
+        test ("Comparing", compare_results (&big, &bigcheck));
+        test ("free_state",
+              krb5_c_free_state (context, keyblock, &state));
+
+        test ("init_state",
+              krb5_c_init_state (context, keyblock, 7, &state));
+        test ("Encrypting large message with state",
+              krb5_c_encrypt (context, keyblock, 7, &state, &big, &enc_out));
+        bigcheck.length = big.length;
+        test ("Decrypting large message",
+              krb5_c_decrypt (context, keyblock, 7, 0, &enc_out, &bigcheck));
+        test ("Comparing", compare_results (&big, &bigcheck));
+        test ("free_state",
+              krb5_c_free_state (context, keyblock, &state));
+
+        free(big.data);
+        free(bigcheck.data);
+        free(enc_out.ciphertext.data);
+        krb5_free_keyblock (context, keyblock);
+    }
+
     free(out.data);
     free(out2.data);
     free(check.data);
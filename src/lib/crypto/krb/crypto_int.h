@@ -493,10 +493,31 @@ void krb5int_crypto_impl_cleanup(void);
  * they can be used by the t_fortuna.c test code), so even if the module
  * defines them away or doesn't work with Fortuna, the module must provide
  * stubs; see stubs.c in the openssl or nss modules for examples.
+ *
+ * Optionally, crypto_mod.h may #define K5_AES_SHA1_STITCH to enable the
+ * single-pass AES-CTS and HMAC-SHA1 code in enc_dk_hmac.c.  In that case it
+ * must also #define or prototype:
+ *
+ *   k5_sha1_ctx - Stack-allocatable type for a SHA-1 hash state
+ *   k5_sha1_init(ctxptr) - Initialize a hash state
+ *   k5_sha1_update(ctxptr, data, size) -- Hash some data
+ *   k5_sha1_final(out, ctxptr) -- Finalize a state, writing hash into out
+ *
+ * and the module's AES enc provider must implement krb5int_aes_cbc_blocks()
+ * (declared below).
  */
 
 #include <crypto_mod.h>
 
+#ifdef K5_AES_SHA1_STITCH
+/* CBC-encrypt or decrypt nblocks contiguous blocks of data in place with the
+ * AES key key, updating iv.  Uses the same key cache as the AES enc provider.
+ */
+krb5_error_code krb5int_aes_cbc_blocks(krb5_key key, krb5_boolean decrypt,
+                                       unsigned char *iv, unsigned char *data,
+                                       size_t nblocks);
+#endif
+
 /*** PRNG module declarations ***/
 
 /*
@@ -65,6 +65,226 @@ krb5int_aes_crypto_length(const struct krb5_keytypes *ktp,
     }
 }
 
+#ifdef K5_AES_SHA1_STITCH
+
+/*
+ * For large messages with the AES-SHA1 enctypes, compute the HMAC and the
+ * CBC-CTS encryption in a single pass over the data, one cache-sized chunk at
+ * a time, instead of reading the whole message once for each.
+ */
+
+#define STITCH_CHUNK 4096       /* Bytes per chunk; a multiple of 16 */
+#define STITCH_MIN STITCH_CHUNK /* Use the single-pass code above this size */
+#define AES_BLOCK 16
+#define SHA1_BLOCK 64
+#define SHA1_HASHSIZE 20
+
+/* Return true if the single-pass code can be used for this operation. */
+static krb5_boolean
+use_stitched(const struct krb5_keytypes *ktp, const krb5_data *ivec,
+             const krb5_crypto_iov *data, size_t num_data)
+{
+    size_t i, len = 0;
+
+    if (ktp->etype != ENCTYPE_AES128_CTS_HMAC_SHA1_96 &&
+        ktp->etype != ENCTYPE_AES256_CTS_HMAC_SHA1_96)
+        return FALSE;
+
+    /* Leave cipher state chaining to the enc provider. */
+    if (ivec != NULL)
+        return FALSE;
+
+    /* The HMAC and cipher inputs must be the same stream. */
+    for (i = 0; i < num_data; i++) {
+        if (data[i].flags == KRB5_CRYPTO_TYPE_SIGN_ONLY)
+            return FALSE;
+        if (ENCRYPT_IOV(&data[i]))
+            len += data[i].data.length;
+    }
+    return len >= STITCH_MIN;
+}
+
+/* Begin an HMAC-SHA1 computation with the key ki. */
+static void
+hmac_sha1_start(k5_sha1_ctx *ctx, krb5_key ki)
+{
+    unsigned char pad[SHA1_BLOCK];
+    unsigned int i;
+
+    assert(ki->keyblock.length <= SHA1_BLOCK);
+    memset(pad, 0x36, SHA1_BLOCK);
+    for (i = 0; i < ki->keyblock.length; i++)
+        pad[i] ^= ki->keyblock.contents[i];
+    k5_sha1_init(ctx);
+    k5_sha1_update(ctx, pad, SHA1_BLOCK);
+    zap(pad, sizeof(pad));
+}
+
+/* Finish an HMAC-SHA1 computation begun with hmac_sha1_start(). */
+static void
+hmac_sha1_finish(k5_sha1_ctx *ctx, krb5_key ki, unsigned char *out)
+{
+    unsigned char pad[SHA1_BLOCK], inner[SHA1_HASHSIZE];
+    unsigned int i;
+
+    k5_sha1_final(inner, ctx);
+    memset(pad, 0x5C, SHA1_BLOCK);
+    for (i = 0; i < ki->keyblock.length; i++)
+        pad[i] ^= ki->keyblock.contents[i];
+    k5_sha1_init(ctx);
+    k5_sha1_update(ctx, pad, SHA1_BLOCK);
+    k5_sha1_update(ctx, inner, SHA1_HASHSIZE);
+    k5_sha1_final(out, ctx);
+    zap(pad, sizeof(pad));
+    zap(inner, sizeof(inner));
+}
+
+/* Return the length of the encrypted part of data, and the length of the part
+ * before the last two (CTS) blocks. */
+static size_t
+stitched_lengths(const krb5_crypto_iov *data, size_t num_data,
+                 size_t *head_len)
+{
+    size_t i, len = 0;
+
+    for (i = 0; i < num_data; i++) {
+        if (ENCRYPT_IOV(&data[i]))
+            len += data[i].data.length;
+    }
+    *head_len = ((len + AES_BLOCK - 1) / AES_BLOCK - 2) * AES_BLOCK;
+    return len;
+}
+
+/* HMAC the plaintext in data with ki into cksum, and CBC-CTS encrypt it in
+ * place with ke. */
+static krb5_error_code
+stitched_encrypt(krb5_key ke, krb5_key ki, krb5_crypto_iov *data,
+                 size_t num_data, unsigned char *cksum)
+{
+    krb5_error_code ret = 0;
+    k5_sha1_ctx ctx;
+    unsigned char *buf, iv[AES_BLOCK], tail[2 * AES_BLOCK];
+    size_t len, head_len, tail_len, off, n;
+    struct iov_block_state input_pos, output_pos;
+
+    buf = malloc(STITCH_CHUNK);
+    if (buf == NULL)
+        return ENOMEM;
+
+    len = stitched_lengths(data, num_data, &head_len);
+    tail_len = len - head_len;
+    memset(iv, 0, AES_BLOCK);
+    IOV_BLOCK_STATE_INIT(&input_pos);
+    IOV_BLOCK_STATE_INIT(&output_pos);
+    hmac_sha1_start(&ctx, ki);
+
+    /* Hash and CBC-encrypt each chunk while it is in cache. */
+    for (off = 0; off < head_len; off += n) {
+        n = head_len - off;
+        if (n > STITCH_CHUNK)
+            n = STITCH_CHUNK;
+        krb5int_c_iov_get_block(buf, n, data, num_data, &input_pos);
+        k5_sha1_update(&ctx, buf, n);
+        ret = krb5int_aes_cbc_blocks(ke, FALSE, iv, buf, n / AES_BLOCK);
+        if (ret)
+            goto cleanup;
+        krb5int_c_iov_put_block(data, num_data, buf, n, &output_pos);
+    }
+
+    /* Encrypt the last two blocks (zero-padding the final one) and put them
+     * back in swapped order, truncating the final output block. */
+    memset(tail, 0, sizeof(tail));
+    krb5int_c_iov_get_block(tail, tail_len, data, num_data, &input_pos);
+    k5_sha1_update(&ctx, tail, tail_len);
+    ret = krb5int_aes_cbc_blocks(ke, FALSE, iv, tail, 2);
+    if (ret)
+        goto cleanup;
+    krb5int_c_iov_put_block(data, num_data, tail + AES_BLOCK, AES_BLOCK,
+                            &output_pos);
+    krb5int_c_iov_put_block(data, num_data, tail, tail_len - AES_BLOCK,
+                            &output_pos);
+
+    hmac_sha1_finish(&ctx, ki, cksum);
+
+cleanup:
+    zap(tail, sizeof(tail));
+    zapfree(buf, STITCH_CHUNK);
+    return ret;
+}
+
+/* CBC-CTS decrypt data in place with ke, and HMAC the resulting plaintext
+ * with ki into cksum. */
+static krb5_error_code
+stitched_decrypt(krb5_key ke, krb5_key ki, krb5_crypto_iov *data,
+                 size_t num_data, unsigned char *cksum)
+{
+    krb5_error_code ret = 0;
+    k5_sha1_ctx ctx;
+    unsigned char *buf, iv[AES_BLOCK], zero_iv[AES_BLOCK];
+    unsigned char tail[2 * AES_BLOCK], last[AES_BLOCK];
+    size_t len, head_len, tail_len, off, n, i;
+    struct iov_block_state input_pos, output_pos;
+
+    buf = malloc(STITCH_CHUNK);
+    if (buf == NULL)
+        return ENOMEM;
+
+    len = stitched_lengths(data, num_data, &head_len);
+    tail_len = len - head_len;
+    memset(iv, 0, AES_BLOCK);
+    IOV_BLOCK_STATE_INIT(&input_pos);
+    IOV_BLOCK_STATE_INIT(&output_pos);
+    hmac_sha1_start(&ctx, ki);
+
+    /* CBC-decrypt and hash each chunk while it is in cache. */
+    for (off = 0; off < head_len; off += n) {
+        n = head_len - off;
+        if (n > STITCH_CHUNK)
+            n = STITCH_CHUNK;
+        krb5int_c_iov_get_block(buf, n, data, num_data, &input_pos);
+        ret = krb5int_aes_cbc_blocks(ke, TRUE, iv, buf, n / AES_BLOCK);
+        if (ret)
+            goto cleanup;
+        k5_sha1_update(&ctx, buf, n);
+        krb5int_c_iov_put_block(data, num_data, buf, n, &output_pos);
+    }
+
+    /*
+     * The tail holds the final ciphertext block followed by the truncated
+     * second-to-last block.  Decrypting the final block yields the
+     * second-to-last ciphertext block XORed with the zero-padded final
+     * plaintext block, which gives us both the missing bytes of the
+     * second-to-last ciphertext block and the final plaintext.
+     */
+    krb5int_c_iov_get_block(tail, tail_len, data, num_data, &input_pos);
+    memcpy(last, tail, AES_BLOCK);
+    memset(zero_iv, 0, AES_BLOCK);
+    ret = krb5int_aes_cbc_blocks(ke, TRUE, zero_iv, last, 1);
+    if (ret)
+        goto cleanup;
+    for (i = 0; i < tail_len - AES_BLOCK; i++)
+        last[i] ^= tail[AES_BLOCK + i];
+    memcpy(tail, tail + AES_BLOCK, tail_len - AES_BLOCK);
+    for (i = tail_len - AES_BLOCK; i < AES_BLOCK; i++)
+        tail[i] = last[i];
+    ret = krb5int_aes_cbc_blocks(ke, TRUE, iv, tail, 1);
+    if (ret)
+        goto cleanup;
+    memcpy(tail + AES_BLOCK, last, tail_len - AES_BLOCK);
+    k5_sha1_update(&ctx, tail, tail_len);
+    krb5int_c_iov_put_block(data, num_data, tail, tail_len, &output_pos);
+
+    hmac_sha1_finish(&ctx, ki, cksum);
+
+cleanup:
+    zap(tail, sizeof(tail));
+    zap(last, sizeof(last));
+    zapfree(buf, STITCH_CHUNK);
+    return ret;
+}
+
+#endif /* K5_AES_SHA1_STITCH */
+
 krb5_error_code
 krb5int_dk_encrypt(const struct krb5_keytypes *ktp, krb5_key key,
                    krb5_keyusage usage, const krb5_data *ivec,
@@ -149,18 +369,28 @@ krb5int_dk_encrypt(const struct krb5_keytypes *ktp, krb5_key key,
     if (ret != 0)
         goto cleanup;
 
-    /* Hash the plaintext. */
     d2.length = hash->hashsize;
     d2.data = (char *)cksum;
 
-    ret = krb5int_hmac(hash, ki, data, num_data, &d2);
-    if (ret != 0)
-        goto cleanup;
-
-    /* Encrypt the plaintext (header | data | padding) */
-    ret = enc->encrypt(ke, ivec, data, num_data);
-    if (ret != 0)
-        goto cleanup;
+#ifdef K5_AES_SHA1_STITCH
+    if (use_stitched(ktp, ivec, data, num_data)) {
+        /* Hash and encrypt the plaintext in one pass. */
+        ret = stitched_encrypt(ke, ki, data, num_data, cksum);
+        if (ret != 0)
+            goto cleanup;
+    } else
+#endif
+    {
+        /* Hash the plaintext. */
+        ret = krb5int_hmac(hash, ki, data, num_data, &d2);
+        if (ret != 0)
+            goto cleanup;
+
+        /* Encrypt the plaintext (header | data | padding) */
+        ret = enc->encrypt(ke, ivec, data, num_data);
+        if (ret != 0)
+            goto cleanup;
+    }
 
     /* Possibly truncate the hash */
     assert(hmacsize <= d2.length);
@@ -242,18 +472,28 @@ krb5int_dk_decrypt(const struct krb5_keytypes *ktp, krb5_key key,
     if (ret != 0)
         goto cleanup;
 
-    /* Decrypt the plaintext (header | data | padding). */
-    ret = enc->decrypt(ke, ivec, data, num_data);
-    if (ret != 0)
-        goto cleanup;
-
-    /* Verify the hash. */
-    d1.length = hash->hashsize; /* non-truncated length */
-    d1.data = (char *)cksum;
-
-    ret = krb5int_hmac(hash, ki, data, num_data, &d1);
-    if (ret != 0)
-        goto cleanup;
+#ifdef K5_AES_SHA1_STITCH
+    if (use_stitched(ktp, ivec, data, num_data)) {
+        /* Decrypt and hash the ciphertext in one pass. */
+        ret = stitched_decrypt(ke, ki, data, num_data, cksum);
+        if (ret != 0)
+            goto cleanup;
+    } else
+#endif
+    {
+        /* Decrypt the plaintext (header | data | padding). */
+        ret = enc->decrypt(ke, ivec, data, num_data);
+        if (ret != 0)
+            goto cleanup;
+
+        /* Verify the hash. */
+        d1.length = hash->hashsize; /* non-truncated length */
+        d1.data = (char *)cksum;
+
+        ret = krb5int_hmac(hash, ki, data, num_data, &d1);
+        if (ret != 0)
+            goto cleanup;
+    }
 
     /* Compare only the possibly truncated length. */
     if (memcmp(cksum, trailer->data.data, hmacsize) != 0) {
@@ -101,12 +101,17 @@
 #define SHA256_HASHSIZE (256/8)
 
 /* Genarator - block cipher in CTR mode */
-struct fortuna_state
+struct generator_state
 {
-    /* Generator state. */
     unsigned char counter[AES256_BLOCKSIZE];
     unsigned char key[AES256_KEYSIZE];
     aes_ctx ciph;
+};
+
+struct fortuna_state
+{
+    /* Generator state. */
+    struct generator_state gen;
 
     /* Accumulator state. */
     SHA256_CTX pool[NUM_POOLS];
@@ -161,31 +166,31 @@ init_state(struct fortuna_state *st)
         shad256_init(&st->pool[i]);
 }
 
-/* Increment st->counter using least significant byte first. */
+/* Increment gen->counter using least significant byte first. */
 static void
-inc_counter(struct fortuna_state *st)
+inc_counter(struct generator_state *gen)
 {
     UINT64_TYPE val;
 
-    val = load_64_le(st->counter) + 1;
-    store_64_le(val, st->counter);
+    val = load_64_le(gen->counter) + 1;
+    store_64_le(val, gen->counter);
     if (val == 0) {
-        val = load_64_le(st->counter + 8) + 1;
-        store_64_le(val, st->counter + 8);
+        val = load_64_le(gen->counter + 8) + 1;
+        store_64_le(val, gen->counter + 8);
     }
 }
 
-/* Encrypt and increment st->counter in the current cipher context. */
+/* Encrypt and increment gen->counter in the current cipher context. */
 static void
-encrypt_counter(struct fortuna_state *st, unsigned char *dst)
+encrypt_counter(struct generator_state *gen, unsigned char *dst)
 {
-    krb5int_aes_enc_blk(st->counter, dst, &st->ciph);
-    inc_counter(st);
+    krb5int_aes_enc_blk(gen->counter, dst, &gen->ciph);
+    inc_counter(gen);
 }
 
 /* Reseed the generator based on hopefully non-guessable input. */
 static void
-generator_reseed(struct fortuna_state *st, const unsigned char *data,
+generator_reseed(struct generator_state *gen, const unsigned char *data,
                  size_t len)
 {
     SHA256_CTX ctx;
@@ -193,51 +198,55 @@ generator_reseed(struct fortuna_state *st, const unsigned char *data,
     /* Calculate SHA[d]-256(key||s) and make that the new key.  Depend on the
      * SHA-256 hash size being the AES-256 key size. */
     shad256_init(&ctx);
-    shad256_update(&ctx, st->key, AES256_KEYSIZE);
+    shad256_update(&ctx, gen->key, AES256_KEYSIZE);
     shad256_update(&ctx, data, len);
-    shad256_result(&ctx, st->key);
+    shad256_result(&ctx, gen->key);
     zap(&ctx, sizeof(ctx));
-    krb5int_aes_enc_key(st->key, AES256_KEYSIZE, &st->ciph);
+    krb5int_aes_enc_key(gen->key, AES256_KEYSIZE, &gen->ciph);
 
     /* Increment counter. */
-    inc_counter(st);
+    inc_counter(gen);
 }
 
 /* Generate two blocks in counter mode and replace the key with the result. */
 static void
-change_key(struct fortuna_state *st)
+change_key(struct generator_state *gen)
 {
-    encrypt_counter(st, st->key);
-    encrypt_counter(st, st->key + AES256_BLOCKSIZE);
-    krb5int_aes_enc_key(st->key, AES256_KEYSIZE, &st->ciph);
+    encrypt_counter(gen, gen->key);
+    encrypt_counter(gen, gen->key + AES256_BLOCKSIZE);
+    krb5int_aes_enc_key(gen->key, AES256_KEYSIZE, &gen->ciph);
 }
 
 /* Output pseudo-random data from the generator. */
 static void
-generator_output(struct fortuna_state *st, unsigned char *dst, size_t len)
+generator_output(struct generator_state *gen, unsigned char *dst, size_t len)
 {
     unsigned char result[AES256_BLOCKSIZE];
-    size_t n, count = 0;
+    size_t count = 0;
 
     while (len > 0) {
-        /* Produce bytes and copy the result into dst. */
-        encrypt_counter(st, result);
-        n = (len < AES256_BLOCKSIZE) ? len : AES256_BLOCKSIZE;
-        memcpy(dst, result, n);
-        dst += n;
-        len -= n;
+        /* Encrypt whole blocks directly into dst; copy out a partial one. */
+        if (len >= AES256_BLOCKSIZE) {
+            encrypt_counter(gen, dst);
+            dst += AES256_BLOCKSIZE;
+            len -= AES256_BLOCKSIZE;
+        } else {
+            encrypt_counter(gen, result);
+            memcpy(dst, result, len);
+            zap(result, sizeof(result));
+            len = 0;
+        }
 
         /* Each time we reach MAX_BYTES_PER_KEY bytes, change the key. */
         count += AES256_BLOCKSIZE;
         if (count >= MAX_BYTES_PER_KEY) {
-            change_key(st);
+            change_key(gen);
             count = 0;
         }
     }
-    zap(result, sizeof(result));
 
     /* Change the key after each request. */
-    change_key(st);
+    change_key(gen);
 }
 
 /* Reseed the generator using the accumulator pools. */
@@ -266,7 +275,7 @@ accumulator_reseed(struct fortuna_state *st)
         shad256_update(&ctx, hash_result, SHA256_HASHSIZE);
     }
     shad256_result(&ctx, hash_result);
-    generator_reseed(st, hash_result, SHA256_HASHSIZE);
+    generator_reseed(&st->gen, hash_result, SHA256_HASHSIZE);
     zap(hash_result, SHA256_HASHSIZE);
     zap(&ctx, sizeof(ctx));
 
@@ -330,25 +339,73 @@ enough_time_passed(struct fortuna_state *st)
     return ok;
 }
 
-static void
-accumulator_output(struct fortuna_state *st, unsigned char *dst, size_t len)
+/* Reseed the generator with data from pools if we have accumulated enough
+ * data and enough time has passed since the last accumulator reseed.  Return
+ * true if a reseed happened. */
+static krb5_boolean
+accumulator_check_reseed(struct fortuna_state *st)
 {
-    /* Reseed the generator with data from pools if we have accumulated enough
-     * data and enough time has passed since the last accumulator reseed. */
-    if (st->pool0_bytes >= MIN_POOL_LEN && enough_time_passed(st))
+    if (st->pool0_bytes >= MIN_POOL_LEN && enough_time_passed(st)) {
         accumulator_reseed(st);
-
-    generator_output(st, dst, len);
+        return TRUE;
+    }
+    return FALSE;
 }
 
-static k5_mutex_t fortuna_lock = K5_MUTEX_PARTIAL_INITIALIZER;
-static struct fortuna_state main_state;
+/*
+ * Each thread which asks for random bytes gets its own generator, keyed from
+ * the output of the shared generator, so that the common case does not need
+ * to take fortuna_lock.  A thread re-keys its generator from the shared one
+ * when the shared generator has been reseeded (tracked by main_generation),
+ * when the process has forked, and after THREAD_RESEED_BYTES bytes of output.
+ *
+ * Small accumulator events (such as the timing events the KDC adds for each
+ * request) are also buffered per thread and added to the shared pools when
+ * the thread next re-keys or its buffer fills up.
+ */
+
+/* Re-key a per-thread generator from the shared one after this many bytes. */
+#define THREAD_RESEED_BYTES (1 << 16)
+
+/* Buffer accumulator events of up to THREAD_EVENT_MAX bytes per thread, in a
+ * buffer of THREAD_EVENT_BYTES bytes. */
+#define THREAD_EVENT_MAX 32
+#define THREAD_EVENT_BYTES 512
+
 #ifdef _WIN32
-static DWORD last_pid;
+typedef DWORD prng_pid_t;
+#define get_pid() GetCurrentProcessId()
 #else
-static pid_t last_pid;
+typedef pid_t prng_pid_t;
+#define get_pid() getpid()
 #endif
+
+struct thread_state {
+    struct generator_state gen;
+    unsigned int generation;
+    size_t bytes;
+    prng_pid_t pid;
+
+    /* Buffered accumulator events, each a length byte followed by data. */
+    unsigned char events[THREAD_EVENT_BYTES];
+    size_t events_len;
+};
+
+static k5_mutex_t fortuna_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct fortuna_state main_state;
+static prng_pid_t last_pid;
 static krb5_boolean have_entropy = FALSE;
+static krb5_boolean have_thread_key = FALSE;
+
+/* Incremented (under fortuna_lock) each time main_state is reseeded. */
+static unsigned int main_generation;
+
+/* Thread-specific data destructor for per-thread generator states. */
+static void
+free_thread_state(void *ptr)
+{
+    zapfree(ptr, sizeof(struct thread_state));
+}
 
 int
 k5_prng_init(void)
@@ -361,36 +418,105 @@ k5_prng_init(void)
         return ret;
 
     init_state(&main_state);
-#ifdef _WIN32
-    last_pid = GetCurrentProcessId();
-#else
-    last_pid = getpid();
-#endif
+    last_pid = get_pid();
     if (k5_get_os_entropy(osbuf, sizeof(osbuf))) {
-        generator_reseed(&main_state, osbuf, sizeof(osbuf));
+        generator_reseed(&main_state.gen, osbuf, sizeof(osbuf));
         have_entropy = TRUE;
     }
 
+    /* If we can't get a thread-specific data key, all threads will share
+     * main_state. */
+    have_thread_key = (k5_key_register(K5_KEY_CRYPTO_PRNG_STATE,
+                                       free_thread_state) == 0);
+
     return 0;
 }
 
 void
 k5_prng_cleanup(void)
 {
+    struct thread_state *ts;
+
+    if (have_thread_key) {
+        ts = k5_getspecific(K5_KEY_CRYPTO_PRNG_STATE);
+        if (ts != NULL) {
+            k5_setspecific(K5_KEY_CRYPTO_PRNG_STATE, NULL);
+            free_thread_state(ts);
+        }
+        k5_key_delete(K5_KEY_CRYPTO_PRNG_STATE);
+        have_thread_key = FALSE;
+    }
     have_entropy = FALSE;
     zap(&main_state, sizeof(main_state));
     k5_mutex_destroy(&fortuna_lock);
 }
 
+/* Add the events buffered in ts to the shared pools, and reseed the shared
+ * generator if it is time to.  fortuna_lock must be held. */
+static void
+flush_thread_events(struct thread_state *ts)
+{
+    size_t i, len;
+
+    for (i = 0; i < ts->events_len; i += 1 + len) {
+        len = ts->events[i];
+        accumulator_add_event(&main_state, &ts->events[i + 1], len);
+    }
+    zap(ts->events, ts->events_len);
+    ts->events_len = 0;
+    if (accumulator_check_reseed(&main_state))
+        main_generation++;
+}
+
+/* Return this thread's generator state, creating it if necessary.  Return
+ * NULL if per-thread states are unavailable. */
+static struct thread_state *
+get_thread_state(void)
+{
+    struct thread_state *ts;
+
+    if (!have_thread_key)
+        return NULL;
+    ts = k5_getspecific(K5_KEY_CRYPTO_PRNG_STATE);
+    if (ts != NULL)
+        return ts;
+    ts = calloc(1, sizeof(*ts));
+    if (ts == NULL)
+        return NULL;
+    if (k5_setspecific(K5_KEY_CRYPTO_PRNG_STATE, ts) != 0) {
+        free(ts);
+        return NULL;
+    }
+    /* Force a re-key on first use. */
+    ts->generation = main_generation - 1;
+    return ts;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_c_random_add_entropy(krb5_context context, unsigned int randsource,
                           const krb5_data *indata)
 {
     krb5_error_code ret;
+    struct thread_state *ts = NULL;
+    size_t len = indata->length;
 
     ret = krb5int_crypto_init();
     if (ret)
         return ret;
+
+    /* Buffer small events for the pools without taking fortuna_lock, unless
+     * the buffer is full. */
+    if (randsource != KRB5_C_RANDSOURCE_OSRAND &&
+        randsource != KRB5_C_RANDSOURCE_TRUSTEDPARTY &&
+        len <= THREAD_EVENT_MAX)
+        ts = get_thread_state();
+    if (ts != NULL && ts->events_len + 1 + len <= sizeof(ts->events)) {
+        ts->events[ts->events_len] = len;
+        memcpy(&ts->events[ts->events_len + 1], indata->data, len);
+        ts->events_len += 1 + len;
+        return 0;
+    }
+
     ret = k5_mutex_lock(&fortuna_lock);
     if (ret)
         return ret;
@@ -398,49 +524,105 @@ krb5_c_random_add_entropy(krb5_context context, unsigned int randsource,
         randsource == KRB5_C_RANDSOURCE_TRUSTEDPARTY) {
         /* These sources contain enough entropy that we should use them
          * immediately, so that they benefit the next request. */
-        generator_reseed(&main_state, (unsigned char *)indata->data,
+        generator_reseed(&main_state.gen, (unsigned char *)indata->data,
                          indata->length);
         have_entropy = TRUE;
+        main_generation++;
     } else {
         /* Other sources should just go into the pools and be used according to
-         * the accumulator logic. */
+         * the accumulator logic.  Check for a reseed here as well as on
+         * output, since per-thread generators rarely draw from main_state. */
+        if (ts != NULL)
+            flush_thread_events(ts);
         accumulator_add_event(&main_state, (unsigned char *)indata->data,
                               indata->length);
+        if (accumulator_check_reseed(&main_state))
+            main_generation++;
     }
     k5_mutex_unlock(&fortuna_lock);
     return 0;
 }
 
-krb5_error_code KRB5_CALLCONV
-krb5_c_random_make_octets(krb5_context context, krb5_data *outdata)
+/* Produce output from main_state.  fortuna_lock must be held. */
+static krb5_error_code
+shared_output(prng_pid_t pid, unsigned char *dst, size_t len)
 {
-    krb5_error_code ret;
-#ifdef _WIN32
-    DWORD pid = GetCurrentProcessId();
-#else
-    pid_t pid = getpid();
-#endif
     unsigned char pidbuf[4];
 
-    ret = k5_mutex_lock(&fortuna_lock);
-    if (ret)
-        return ret;
-
-    if (!have_entropy) {
-        k5_mutex_unlock(&fortuna_lock);
+    if (!have_entropy)
         return KRB5_CRYPTO_INTERNAL;
-    }
 
     if (pid != last_pid) {
         /* We forked; make sure child's PRNG stream differs from parent's. */
         store_32_be(pid, pidbuf);
-        generator_reseed(&main_state, pidbuf, 4);
+        generator_reseed(&main_state.gen, pidbuf, 4);
         last_pid = pid;
+        main_generation++;
     }
 
-    accumulator_output(&main_state, (unsigned char *)outdata->data,
-                       outdata->length);
+    if (accumulator_check_reseed(&main_state))
+        main_generation++;
+    generator_output(&main_state.gen, dst, len);
+    return 0;
+}
+
+/* Add the events buffered in ts to the shared pools, and re-key its generator
+ * with output from main_state. */
+static krb5_error_code
+thread_state_reseed(struct thread_state *ts, prng_pid_t pid)
+{
+    krb5_error_code ret;
+    unsigned char seed[AES256_KEYSIZE];
+    unsigned int generation;
+
+    ret = k5_mutex_lock(&fortuna_lock);
+    if (ret)
+        return ret;
+    flush_thread_events(ts);
+    ret = shared_output(pid, seed, sizeof(seed));
+    generation = main_generation;
     k5_mutex_unlock(&fortuna_lock);
+    if (ret)
+        return ret;
+
+    generator_reseed(&ts->gen, seed, sizeof(seed));
+    zap(seed, sizeof(seed));
+    ts->generation = generation;
+    ts->bytes = 0;
+    ts->pid = pid;
+    return 0;
+}
+
+krb5_error_code KRB5_CALLCONV
+krb5_c_random_make_octets(krb5_context context, krb5_data *outdata)
+{
+    krb5_error_code ret;
+    struct thread_state *ts;
+    prng_pid_t pid = get_pid();
+
+    ts = get_thread_state();
+    if (ts == NULL) {
+        ret = k5_mutex_lock(&fortuna_lock);
+        if (ret)
+            return ret;
+        ret = shared_output(pid, (unsigned char *)outdata->data,
+                            outdata->length);
+        k5_mutex_unlock(&fortuna_lock);
+        return ret;
+    }
+
+    /* An unlocked read of main_generation may be stale, which only delays
+     * picking up a reseed until a later call. */
+    if (ts->generation != main_generation || ts->pid != pid ||
+        ts->bytes >= THREAD_RESEED_BYTES) {
+        ret = thread_state_reseed(ts, pid);
+        if (ret)
+            return ret;
+    }
+
+    generator_output(&ts->gen, (unsigned char *)outdata->data,
+                     outdata->length);
+    ts->bytes += outdata->length;
     return 0;
 }
 
@@ -43,4 +43,10 @@
 #define k5_sha256_update SHA256_Update
 #define k5_sha256_final SHA256_Final
 
+#define K5_AES_SHA1_STITCH
+#define k5_sha1_ctx SHA_CTX
+#define k5_sha1_init SHA1_Init
+#define k5_sha1_update SHA1_Update
+#define k5_sha1_final SHA1_Final
+
 #endif /* CRYPTO_MOD_H */
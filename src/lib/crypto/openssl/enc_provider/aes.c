@@ -31,12 +31,6 @@
 
 /* proto's */
 static krb5_error_code
-cbc_enc(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-        size_t num_data);
-static krb5_error_code
-cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-         size_t num_data);
-static krb5_error_code
 cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen);
 static krb5_error_code
@@ -47,79 +41,80 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 #define NUM_BITS 8
 #define IV_CTS_BUF_SIZE 16 /* 16 - hardcoded in CRYPTO_cts128_en/decrypt */
 
-static const EVP_CIPHER *
-map_mode(unsigned int len)
-{
-    if (len==16)
-        return EVP_aes_128_cbc();
-    if (len==32)
-        return EVP_aes_256_cbc();
-    else
-        return NULL;
-}
+/*
+ * Private per-key data to cache after first generation.  OpenSSL uses
+ * different schedules for encryption and decryption, so we keep one of each
+ * and use the rounds field as a flag for whether each has been initialized.
+ */
+struct aes_key_info_cache {
+    AES_KEY enck, deck;
+};
+#define CACHE(X) ((struct aes_key_info_cache *)((X)->cache))
 
-/* Encrypt one block using CBC. */
+/* Create key's cache if necessary and initialize the schedule needed for the
+ * given direction. */
 static krb5_error_code
-cbc_enc(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-        size_t num_data)
+init_key_cache(krb5_key key, krb5_boolean decrypt)
 {
-    int             ret, olen = BLOCK_SIZE;
-    unsigned char   iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
-    EVP_CIPHER_CTX  ciph_ctx;
-    struct iov_block_state input_pos, output_pos;
-
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-    ret = EVP_EncryptInit_ex(&ciph_ctx, map_mode(key->keyblock.length),
-                             NULL, key->keyblock.contents, (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (ret == 0)
-        return KRB5_CRYPTO_INTERNAL;
-
-    IOV_BLOCK_STATE_INIT(&input_pos);
-    IOV_BLOCK_STATE_INIT(&output_pos);
-    krb5int_c_iov_get_block(iblock, BLOCK_SIZE, data, num_data, &input_pos);
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-    ret = EVP_EncryptUpdate(&ciph_ctx, oblock, &olen, iblock, BLOCK_SIZE);
-    if (ret == 1) {
-        krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE,
-                                &output_pos);
+    struct aes_key_info_cache *cache;
+    int bits = NUM_BITS * key->keyblock.length;
+
+    if (key->cache == NULL) {
+        key->cache = malloc(sizeof(struct aes_key_info_cache));
+        if (key->cache == NULL)
+            return ENOMEM;
+        CACHE(key)->enck.rounds = CACHE(key)->deck.rounds = 0;
     }
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
-
-    zap(iblock, BLOCK_SIZE);
-    zap(oblock, BLOCK_SIZE);
-    return (ret == 1) ? 0 : KRB5_CRYPTO_INTERNAL;
+    cache = CACHE(key);
+    if (!decrypt && cache->enck.rounds == 0) {
+        if (AES_set_encrypt_key(key->keyblock.contents, bits,
+                                &cache->enck) != 0)
+            return KRB5_CRYPTO_INTERNAL;
+    }
+    if (decrypt && cache->deck.rounds == 0) {
+        if (AES_set_decrypt_key(key->keyblock.contents, bits,
+                                &cache->deck) != 0)
+            return KRB5_CRYPTO_INTERNAL;
+    }
+    return 0;
 }
 
-/* Decrypt one block using CBC. */
+/* Encrypt or decrypt one block using CBC.  ivec is not updated. */
 static krb5_error_code
-cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-         size_t num_data)
+cbc_crypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+          size_t num_data, krb5_boolean decrypt)
 {
-    int              ret = 0, olen = BLOCK_SIZE;
-    unsigned char    iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
-    EVP_CIPHER_CTX   ciph_ctx;
+    krb5_error_code        ret;
+    unsigned char          iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
+    unsigned char          iv[BLOCK_SIZE];
     struct iov_block_state input_pos, output_pos;
 
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-    ret = EVP_DecryptInit_ex(&ciph_ctx, map_mode(key->keyblock.length),
-                             NULL, key->keyblock.contents, (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (ret == 0)
-        return KRB5_CRYPTO_INTERNAL;
+    if (ivec != NULL && ivec->data != NULL) {
+        if (ivec->length != BLOCK_SIZE)
+            return KRB5_CRYPTO_INTERNAL;
+        memcpy(iv, ivec->data, BLOCK_SIZE);
+    } else {
+        memset(iv, 0, BLOCK_SIZE);
+    }
+
+    ret = init_key_cache(key, decrypt);
+    if (ret)
+        return ret;
 
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
     krb5int_c_iov_get_block(iblock, BLOCK_SIZE, data, num_data, &input_pos);
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-    ret = EVP_DecryptUpdate(&ciph_ctx, oblock, &olen, iblock, BLOCK_SIZE);
-    if (ret == 1) {
-        krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE,
-                                &output_pos);
-    }
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
+    if (decrypt)
+        AES_cbc_encrypt(iblock, oblock, BLOCK_SIZE, &CACHE(key)->deck, iv,
+                        AES_DECRYPT);
+    else
+        AES_cbc_encrypt(iblock, oblock, BLOCK_SIZE, &CACHE(key)->enck, iv,
+                        AES_ENCRYPT);
+    krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE, &output_pos);
 
     zap(iblock, BLOCK_SIZE);
     zap(oblock, BLOCK_SIZE);
-    return (ret == 1) ? 0 : KRB5_CRYPTO_INTERNAL;
+    return 0;
 }
 
 static krb5_error_code
@@ -131,7 +126,6 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *oblock = NULL, *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    AES_KEY                enck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -140,6 +134,10 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         memcpy(iv_cts, ivec->data,ivec->length);
     }
 
+    ret = init_key_cache(key, FALSE);
+    if (ret)
+        return ret;
+
     oblock = OPENSSL_malloc(dlen);
     if (!oblock){
         return ENOMEM;
@@ -155,11 +153,9 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
-    AES_set_encrypt_key(key->keyblock.contents,
-                        NUM_BITS * key->keyblock.length, &enck);
-
-    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen, &enck,
-                                 iv_cts, (cbc128_f)AES_cbc_encrypt);
+    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen,
+                                 &CACHE(key)->enck, iv_cts,
+                                 (cbc128_f)AES_cbc_encrypt);
     if (size <= 0) {
         ret = KRB5_CRYPTO_INTERNAL;
     } else {
@@ -188,7 +184,6 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    AES_KEY                deck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -197,6 +192,10 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         memcpy(iv_cts, ivec->data,ivec->length);
     }
 
+    ret = init_key_cache(key, TRUE);
+    if (ret)
+        return ret;
+
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
 
@@ -209,13 +208,10 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         return ENOMEM;
     }
 
-    AES_set_decrypt_key(key->keyblock.contents,
-                        NUM_BITS * key->keyblock.length, &deck);
-
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
     size = CRYPTO_cts128_decrypt((unsigned char *)dbuf, oblock,
-                                 dlen, &deck,
+                                 dlen, &CACHE(key)->deck,
                                  iv_cts, (cbc128_f)AES_cbc_encrypt);
     if (size <= 0)
         ret = KRB5_CRYPTO_INTERNAL;
@@ -234,6 +230,25 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     return ret;
 }
 
+krb5_error_code
+krb5int_aes_cbc_blocks(krb5_key key, krb5_boolean decrypt, unsigned char *iv,
+                       unsigned char *data, size_t nblocks)
+{
+    krb5_error_code ret;
+
+    ret = init_key_cache(key, decrypt);
+    if (ret)
+        return ret;
+    if (decrypt) {
+        AES_cbc_encrypt(data, data, nblocks * BLOCK_SIZE, &CACHE(key)->deck,
+                        iv, AES_DECRYPT);
+    } else {
+        AES_cbc_encrypt(data, data, nblocks * BLOCK_SIZE, &CACHE(key)->enck,
+                        iv, AES_ENCRYPT);
+    }
+    return 0;
+}
+
 krb5_error_code
 krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec,
                     krb5_crypto_iov *data, size_t num_data)
@@ -253,7 +268,7 @@ krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec,
     if (nblocks == 1) {
         if (input_length != BLOCK_SIZE)
             return KRB5_BAD_MSIZE;
-        ret = cbc_enc(key, ivec, data, num_data);
+        ret = cbc_crypt(key, ivec, data, num_data, FALSE);
     } else if (nblocks > 1) {
         ret = cts_encr(key, ivec, data, num_data, input_length);
     }
@@ -280,7 +295,7 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec,
     if (nblocks == 1) {
         if (input_length != BLOCK_SIZE)
             return KRB5_BAD_MSIZE;
-        ret = cbc_decr(key, ivec, data, num_data);
+        ret = cbc_crypt(key, ivec, data, num_data, TRUE);
     } else if (nblocks > 1) {
         ret = cts_decr(key, ivec, data, num_data, input_length);
     }
@@ -299,6 +314,13 @@ krb5int_aes_init_state (const krb5_keyblock *key, krb5_keyusage usage,
     memset(state->data, 0, state->length);
     return 0;
 }
+
+static void
+aes_key_cleanup(krb5_key key)
+{
+    zapfree(key->cache, sizeof(struct aes_key_info_cache));
+}
+
 const struct krb5_enc_provider krb5int_enc_aes128 = {
     16,
     16, 16,
@@ -306,7 +328,8 @@ const struct krb5_enc_provider krb5int_enc_aes128 = {
     krb5int_aes_decrypt,
     NULL,
     krb5int_aes_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    aes_key_cleanup
 };
 
 const struct krb5_enc_provider krb5int_enc_aes256 = {
@@ -316,5 +339,6 @@ const struct krb5_enc_provider krb5int_enc_aes256 = {
     krb5int_aes_decrypt,
     NULL,
     krb5int_aes_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    aes_key_cleanup
 };
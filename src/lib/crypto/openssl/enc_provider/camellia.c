@@ -29,12 +29,6 @@
 #include <openssl/camellia.h>
 #include <openssl/modes.h>
 
-static krb5_error_code
-cbc_enc(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-        size_t num_data);
-static krb5_error_code
-cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-         size_t num_data);
 static krb5_error_code
 cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen);
@@ -71,79 +65,67 @@ xorblock(unsigned char *out, const unsigned char *in)
     }
 }
 
-static const EVP_CIPHER *
-map_mode(unsigned int len)
-{
-    if (len==16)
-        return EVP_camellia_128_cbc();
-    if (len==32)
-        return EVP_camellia_256_cbc();
-    else
-        return NULL;
-}
+/*
+ * Private per-key data to cache after first generation.  Camellia uses the
+ * same schedule for encryption and decryption; the grand_rounds field is zero
+ * until the schedule has been computed.
+ */
+struct camellia_key_info_cache {
+    CAMELLIA_KEY sched;
+};
+#define CACHE(X) ((struct camellia_key_info_cache *)((X)->cache))
 
-/* Encrypt one block using CBC. */
+/* Create key's cache and compute its schedule if necessary. */
 static krb5_error_code
-cbc_enc(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-        size_t num_data)
+init_key_cache(krb5_key key)
 {
-    int             ret, olen = BLOCK_SIZE;
-    unsigned char   iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
-    EVP_CIPHER_CTX  ciph_ctx;
-    struct iov_block_state input_pos, output_pos;
-
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-    ret = EVP_EncryptInit_ex(&ciph_ctx, map_mode(key->keyblock.length),
-                             NULL, key->keyblock.contents, (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (ret == 0)
-        return KRB5_CRYPTO_INTERNAL;
-
-    IOV_BLOCK_STATE_INIT(&input_pos);
-    IOV_BLOCK_STATE_INIT(&output_pos);
-    krb5int_c_iov_get_block(iblock, BLOCK_SIZE, data, num_data, &input_pos);
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-    ret = EVP_EncryptUpdate(&ciph_ctx, oblock, &olen, iblock, BLOCK_SIZE);
-    if (ret == 1) {
-        krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE,
-                                &output_pos);
+    if (key->cache == NULL) {
+        key->cache = malloc(sizeof(struct camellia_key_info_cache));
+        if (key->cache == NULL)
+            return ENOMEM;
+        CACHE(key)->sched.grand_rounds = 0;
     }
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
-
-    zap(iblock, BLOCK_SIZE);
-    zap(oblock, BLOCK_SIZE);
-    return (ret == 1) ? 0 : KRB5_CRYPTO_INTERNAL;
+    if (CACHE(key)->sched.grand_rounds == 0) {
+        if (Camellia_set_key(key->keyblock.contents,
+                             NUM_BITS * key->keyblock.length,
+                             &CACHE(key)->sched) != 0)
+            return KRB5_CRYPTO_INTERNAL;
+    }
+    return 0;
 }
 
-/* Decrypt one block using CBC. */
+/* Encrypt or decrypt one block using CBC.  ivec is not updated. */
 static krb5_error_code
-cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-         size_t num_data)
+cbc_crypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+          size_t num_data, krb5_boolean decrypt)
 {
-    int              ret = 0, olen = BLOCK_SIZE;
-    unsigned char    iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
-    EVP_CIPHER_CTX   ciph_ctx;
+    krb5_error_code        ret;
+    unsigned char          iblock[BLOCK_SIZE], oblock[BLOCK_SIZE];
+    unsigned char          iv[BLOCK_SIZE];
     struct iov_block_state input_pos, output_pos;
 
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-    ret = EVP_DecryptInit_ex(&ciph_ctx, map_mode(key->keyblock.length),
-                             NULL, key->keyblock.contents, (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (ret == 0)
-        return KRB5_CRYPTO_INTERNAL;
+    if (ivec != NULL && ivec->data != NULL) {
+        if (ivec->length != BLOCK_SIZE)
+            return KRB5_CRYPTO_INTERNAL;
+        memcpy(iv, ivec->data, BLOCK_SIZE);
+    } else {
+        memset(iv, 0, BLOCK_SIZE);
+    }
+
+    ret = init_key_cache(key);
+    if (ret)
+        return ret;
 
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
     krb5int_c_iov_get_block(iblock, BLOCK_SIZE, data, num_data, &input_pos);
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-    ret = EVP_DecryptUpdate(&ciph_ctx, oblock, &olen, iblock, BLOCK_SIZE);
-    if (ret == 1) {
-        krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE,
-                                &output_pos);
-    }
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
+    Camellia_cbc_encrypt(iblock, oblock, BLOCK_SIZE, &CACHE(key)->sched, iv,
+                         decrypt ? CAMELLIA_DECRYPT : CAMELLIA_ENCRYPT);
+    krb5int_c_iov_put_block(data, num_data, oblock, BLOCK_SIZE, &output_pos);
 
     zap(iblock, BLOCK_SIZE);
     zap(oblock, BLOCK_SIZE);
-    return (ret == 1) ? 0 : KRB5_CRYPTO_INTERNAL;
+    return 0;
 }
 
 static krb5_error_code
@@ -155,7 +137,6 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *oblock = NULL, *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    CAMELLIA_KEY           enck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -164,6 +145,10 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         memcpy(iv_cts, ivec->data,ivec->length);
     }
 
+    ret = init_key_cache(key);
+    if (ret)
+        return ret;
+
     oblock = OPENSSL_malloc(dlen);
     if (!oblock){
         return ENOMEM;
@@ -179,11 +164,9 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
-    Camellia_set_key(key->keyblock.contents, NUM_BITS * key->keyblock.length,
-                     &enck);
-
-    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen, &enck,
-                                 iv_cts, (cbc128_f)Camellia_cbc_encrypt);
+    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen,
+                                 &CACHE(key)->sched, iv_cts,
+                                 (cbc128_f)Camellia_cbc_encrypt);
     if (size <= 0) {
         ret = KRB5_CRYPTO_INTERNAL;
     } else {
@@ -212,7 +195,6 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    CAMELLIA_KEY           deck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -221,6 +203,10 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         memcpy(iv_cts, ivec->data,ivec->length);
     }
 
+    ret = init_key_cache(key);
+    if (ret)
+        return ret;
+
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
 
@@ -233,13 +219,10 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         return ENOMEM;
     }
 
-    Camellia_set_key(key->keyblock.contents, NUM_BITS * key->keyblock.length,
-                     &deck);
-
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
     size = CRYPTO_cts128_decrypt((unsigned char *)dbuf, oblock,
-                                 dlen, &deck,
+                                 dlen, &CACHE(key)->sched,
                                  iv_cts, (cbc128_f)Camellia_cbc_encrypt);
     if (size <= 0)
         ret = KRB5_CRYPTO_INTERNAL;
@@ -277,7 +260,7 @@ krb5int_camellia_encrypt(krb5_key key, const krb5_data *ivec,
     if (nblocks == 1) {
         if (input_length != BLOCK_SIZE)
             return KRB5_BAD_MSIZE;
-        ret = cbc_enc(key, ivec, data, num_data);
+        ret = cbc_crypt(key, ivec, data, num_data, FALSE);
     } else if (nblocks > 1) {
         ret = cts_encr(key, ivec, data, num_data, input_length);
     }
@@ -304,7 +287,7 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
     if (nblocks == 1) {
         if (input_length != BLOCK_SIZE)
             return KRB5_BAD_MSIZE;
-        ret = cbc_decr(key, ivec, data, num_data);
+        ret = cbc_crypt(key, ivec, data, num_data, TRUE);
     } else if (nblocks > 1) {
         ret = cts_decr(key, ivec, data, num_data, input_length);
     }
@@ -317,15 +300,16 @@ krb5int_camellia_cbc_mac(krb5_key key, const krb5_crypto_iov *data,
                          size_t num_data, const krb5_data *iv,
                          krb5_data *output)
 {
-    CAMELLIA_KEY enck;
+    krb5_error_code ret;
     unsigned char blockY[CAMELLIA_BLOCK_SIZE];
     struct iov_block_state iov_state;
 
     if (output->length < CAMELLIA_BLOCK_SIZE)
         return KRB5_BAD_MSIZE;
 
-    Camellia_set_key(key->keyblock.contents,
-                     NUM_BITS * key->keyblock.length, &enck);
+    ret = init_key_cache(key);
+    if (ret)
+        return ret;
 
     if (iv != NULL)
         memcpy(blockY, iv->data, CAMELLIA_BLOCK_SIZE);
@@ -343,7 +327,7 @@ krb5int_camellia_cbc_mac(krb5_key key, const krb5_crypto_iov *data,
 
         xorblock(blockB, blockY);
 
-        Camellia_ecb_encrypt(blockB, blockY, &enck, 1);
+        Camellia_ecb_encrypt(blockB, blockY, &CACHE(key)->sched, 1);
     }
 
     output->length = CAMELLIA_BLOCK_SIZE;
@@ -363,6 +347,13 @@ krb5int_camellia_init_state (const krb5_keyblock *key, krb5_keyusage usage,
     memset(state->data, 0, state->length);
     return 0;
 }
+
+static void
+camellia_key_cleanup(krb5_key key)
+{
+    zapfree(key->cache, sizeof(struct camellia_key_info_cache));
+}
+
 const struct krb5_enc_provider krb5int_enc_camellia128 = {
     16,
     16, 16,
@@ -370,7 +361,8 @@ const struct krb5_enc_provider krb5int_enc_camellia128 = {
     krb5int_camellia_decrypt,
     krb5int_camellia_cbc_mac,
     krb5int_camellia_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    camellia_key_cleanup
 };
 
 const struct krb5_enc_provider krb5int_enc_camellia256 = {
@@ -380,5 +372,6 @@ const struct krb5_enc_provider krb5int_enc_camellia256 = {
     krb5int_camellia_decrypt,
     krb5int_camellia_cbc_mac,
     krb5int_camellia_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    camellia_key_cleanup
 };
@@ -80,6 +80,56 @@ validate(krb5_key key, const krb5_data *ivec, const krb5_crypto_iov *data,
     return 0;
 }
 
+/*
+ * Private per-key data to cache after first use.  Keying a triple-DES cipher
+ * context runs three DES key schedules, so we keep an initialized context for
+ * each direction and only reset the IV for each operation.
+ */
+struct des3_key_info_cache {
+    EVP_CIPHER_CTX enc_ctx, dec_ctx;
+    krb5_boolean enc_init, dec_init;
+};
+#define CACHE(X) ((struct des3_key_info_cache *)((X)->cache))
+
+/* Return key's cipher context for the given direction, keying it if
+ * necessary, with its IV set to ivec (or zero if ivec is NULL). */
+static krb5_error_code
+get_ctx(krb5_key key, const krb5_data *ivec, krb5_boolean decrypt,
+        EVP_CIPHER_CTX **ctx_out)
+{
+    struct des3_key_info_cache *cache;
+    EVP_CIPHER_CTX *ctx;
+    krb5_boolean *init;
+    unsigned char zero_iv[DES3_BLOCK_SIZE] = { 0 }, *iv;
+
+    *ctx_out = NULL;
+    if (key->cache == NULL) {
+        key->cache = malloc(sizeof(struct des3_key_info_cache));
+        if (key->cache == NULL)
+            return ENOMEM;
+        EVP_CIPHER_CTX_init(&CACHE(key)->enc_ctx);
+        EVP_CIPHER_CTX_init(&CACHE(key)->dec_ctx);
+        CACHE(key)->enc_init = CACHE(key)->dec_init = FALSE;
+    }
+    cache = CACHE(key);
+    ctx = decrypt ? &cache->dec_ctx : &cache->enc_ctx;
+    init = decrypt ? &cache->dec_init : &cache->enc_init;
+
+    if (!*init) {
+        if (!EVP_CipherInit_ex(ctx, EVP_des_ede3_cbc(), NULL,
+                               key->keyblock.contents, NULL, !decrypt))
+            return KRB5_CRYPTO_INTERNAL;
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+        *init = TRUE;
+    }
+
+    iv = (ivec != NULL) ? (unsigned char *)ivec->data : zero_iv;
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, !decrypt))
+        return KRB5_CRYPTO_INTERNAL;
+    *ctx_out = ctx;
+    return 0;
+}
+
 static krb5_error_code
 k5_des3_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
                 size_t num_data)
@@ -87,33 +137,27 @@ k5_des3_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     int ret, olen = DES3_BLOCK_SIZE;
     unsigned char iblock[DES3_BLOCK_SIZE], oblock[DES3_BLOCK_SIZE];
     struct iov_block_state input_pos, output_pos;
-    EVP_CIPHER_CTX ciph_ctx;
+    EVP_CIPHER_CTX *ctx;
     krb5_boolean empty;
 
     ret = validate(key, ivec, data, num_data, &empty);
     if (ret != 0 || empty)
         return ret;
 
+    ret = get_ctx(key, ivec, FALSE, &ctx);
+    if (ret)
+        return ret;
+
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
 
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-
-    ret = EVP_EncryptInit_ex(&ciph_ctx, EVP_des_ede3_cbc(), NULL,
-                             key->keyblock.contents,
-                             (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (!ret)
-        return KRB5_CRYPTO_INTERNAL;
-
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-
     for (;;) {
 
         if (!krb5int_c_iov_get_block(iblock, DES3_BLOCK_SIZE,
                                      data, num_data, &input_pos))
             break;
 
-        ret = EVP_EncryptUpdate(&ciph_ctx, oblock, &olen,
+        ret = EVP_EncryptUpdate(ctx, oblock, &olen,
                                 (unsigned char *)iblock, DES3_BLOCK_SIZE);
         if (!ret)
             break;
@@ -125,8 +169,6 @@ k5_des3_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     if (ivec != NULL)
         memcpy(ivec->data, oblock, DES3_BLOCK_SIZE);
 
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
-
     zap(iblock, sizeof(iblock));
     zap(oblock, sizeof(oblock));
 
@@ -142,33 +184,27 @@ k5_des3_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     int ret, olen = DES3_BLOCK_SIZE;
     unsigned char iblock[DES3_BLOCK_SIZE], oblock[DES3_BLOCK_SIZE];
     struct iov_block_state input_pos, output_pos;
-    EVP_CIPHER_CTX ciph_ctx;
+    EVP_CIPHER_CTX *ctx;
     krb5_boolean empty;
 
     ret = validate(key, ivec, data, num_data, &empty);
     if (ret != 0 || empty)
         return ret;
 
+    ret = get_ctx(key, ivec, TRUE, &ctx);
+    if (ret)
+        return ret;
+
     IOV_BLOCK_STATE_INIT(&input_pos);
     IOV_BLOCK_STATE_INIT(&output_pos);
 
-    EVP_CIPHER_CTX_init(&ciph_ctx);
-
-    ret = EVP_DecryptInit_ex(&ciph_ctx, EVP_des_ede3_cbc(), NULL,
-                             key->keyblock.contents,
-                             (ivec) ? (unsigned char*)ivec->data : NULL);
-    if (!ret)
-        return KRB5_CRYPTO_INTERNAL;
-
-    EVP_CIPHER_CTX_set_padding(&ciph_ctx,0);
-
     for (;;) {
 
         if (!krb5int_c_iov_get_block(iblock, DES3_BLOCK_SIZE,
                                      data, num_data, &input_pos))
             break;
 
-        ret = EVP_DecryptUpdate(&ciph_ctx, oblock, &olen,
+        ret = EVP_DecryptUpdate(ctx, oblock, &olen,
                                 (unsigned char *)iblock, DES3_BLOCK_SIZE);
         if (!ret)
             break;
@@ -180,8 +216,6 @@ k5_des3_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     if (ivec != NULL)
         memcpy(ivec->data, iblock, DES3_BLOCK_SIZE);
 
-    EVP_CIPHER_CTX_cleanup(&ciph_ctx);
-
     zap(iblock, sizeof(iblock));
     zap(oblock, sizeof(oblock));
 
@@ -190,6 +224,18 @@ k5_des3_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     return 0;
 }
 
+static void
+des3_key_cleanup(krb5_key key)
+{
+    struct des3_key_info_cache *cache = CACHE(key);
+
+    if (cache->enc_init)
+        EVP_CIPHER_CTX_cleanup(&cache->enc_ctx);
+    if (cache->dec_init)
+        EVP_CIPHER_CTX_cleanup(&cache->dec_ctx);
+    zapfree(cache, sizeof(*cache));
+}
+
 const struct krb5_enc_provider krb5int_enc_des3 = {
     DES3_BLOCK_SIZE,
     DES3_KEY_BYTES, DES3_KEY_SIZE,
@@ -197,5 +243,6 @@ const struct krb5_enc_provider krb5int_enc_des3 = {
     k5_des3_decrypt,
     NULL,
     krb5int_des_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    des3_key_cleanup
 };
@@ -165,6 +165,7 @@ typedef long            kadm5_ret_t;
 #define KADM5_CONFIG_IPROP_PORT         0x10000000
 #define KADM5_CONFIG_KVNO               0x20000000
 #define KADM5_CONFIG_IPROP_RESYNC_TIMEOUT   0x40000000
+#define KADM5_CONFIG_IPROP_SYNC_DELAY       0x80000000
 /*
  * permission bits
  */
@@ -276,6 +277,7 @@ typedef struct _kadm5_config_params {
 /*    char *            iprop_server;*/
     int                 iprop_port;
     int                 iprop_resync_timeout;
+    int                 iprop_sync_delay;
 } kadm5_config_params;
 
 /*
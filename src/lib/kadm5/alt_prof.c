@@ -792,6 +792,18 @@ krb5_error_code kadm5_get_config_params(krb5_context context,
     GET_DELTAT_PARAM(iprop_poll_time, KADM5_CONFIG_POLL_TIME,
                      KRB5_CONF_IPROP_SLAVE_POLL, 2 * 60); /* 2m */
 
+    /* Milliseconds; 0 means sync the update log after every update. */
+    hierarchy[2] = KRB5_CONF_IPROP_SYNC_DELAY;
+    params.iprop_sync_delay = 0;
+    if (params_in->mask & KADM5_CONFIG_IPROP_SYNC_DELAY) {
+        params.mask |= KADM5_CONFIG_IPROP_SYNC_DELAY;
+        params.iprop_sync_delay = params_in->iprop_sync_delay;
+    } else if (aprofile != NULL &&
+               !krb5_aprof_get_int32(aprofile, hierarchy, TRUE, &ivalue)) {
+        params.iprop_sync_delay = (ivalue > 0) ? ivalue : 0;
+        params.mask |= KADM5_CONFIG_IPROP_SYNC_DELAY;
+    }
+
     *params_out = params;
 
 cleanup:
@@ -210,6 +210,11 @@ struct kdb_fullresync_result_t {
 	update_status_t 	ret;
 };
 
+struct kdb_wait_t {
+	kdb_last_t		lastentry;
+	uint32_t		timeout;	/* Max seconds to wait */
+};
+
 program KRB5_IPROP_PROG {
 	version KRB5_IPROP_VERS {
 		/*
@@ -239,5 +244,13 @@ program KRB5_IPROP_PROG {
 		 */
 		kdb_fullresync_result_t
 		IPROP_FULL_RESYNC_EXT(uint32_t) = 3;
+
+		/*
+		 * Like IPROP_GET_UPDATES, but if there are no new
+		 * updates, wait up to timeout seconds for some to be
+		 * committed before replying.
+		 */
+		kdb_incr_result_t
+		IPROP_GET_UPDATES_WAIT(kdb_wait_t) = 4;
 	} = 1;
 } = 100423;
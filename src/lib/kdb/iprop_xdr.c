@@ -352,3 +352,15 @@ xdr_kdb_fullresync_result_t (XDR *xdrs, kdb_fullresync_result_t *objp)
         return FALSE;
     return TRUE;
 }
+
+bool_t
+xdr_kdb_wait_t (XDR *xdrs, kdb_wait_t *objp)
+{
+    register int32_t *buf;
+
+    if (!xdr_kdb_last_t (xdrs, &objp->lastentry))
+        return FALSE;
+    if (!xdr_uint32_t (xdrs, &objp->timeout))
+        return FALSE;
+    return TRUE;
+}
@@ -280,6 +280,23 @@ clean_n_exit:
     return result;
 }
 
+/*
+ * Copy a module's vtable into lib, leaving NULL any methods which are beyond
+ * the module's declared minor version.
+ */
+static void
+copy_vtable(db_library lib, const kdb_vftabl *vftabl)
+{
+    size_t len = sizeof(kdb_vftabl);
+
+    if (vftabl->min_ver < 1)
+        len = offsetof(kdb_vftabl, begin_bulk_load);
+    else if (vftabl->min_ver < 2)
+        len = offsetof(kdb_vftabl, flush_lockout);
+    memset(&lib->vftabl, 0, sizeof(kdb_vftabl));
+    memcpy(&lib->vftabl, vftabl, len);
+}
+
 static void
 kdb_setup_opt_functions(db_library lib)
 {
@@ -331,7 +348,7 @@ kdb_load_library(krb5_context kcontext, char *lib_name, db_library *libptr)
         return ENOMEM;
 
     strlcpy(lib->name, lib_name, sizeof(lib->name));
-    memcpy(&lib->vftabl, vftabl_addr, sizeof(kdb_vftabl));
+    copy_vtable(lib, vftabl_addr);
     kdb_setup_opt_functions(lib);
 
     status = lib->vftabl.init_library();
@@ -437,7 +454,7 @@ kdb_load_library(krb5_context kcontext, char *lib_name, db_library *lib)
         goto clean_n_exit;
     }
 
-    memcpy(&(*lib)->vftabl, vftabl_addrs[0], sizeof(kdb_vftabl));
+    copy_vtable(*lib, vftabl_addrs[0]);
     kdb_setup_opt_functions(*lib);
 
     if ((status = (*lib)->vftabl.init_library()))
@@ -898,7 +915,7 @@ krb5_db_put_principal(krb5_context kcontext, krb5_db_entry *entry)
     if (status)
         goto cleanup;
 
-    if (logging(kcontext)) {
+    if (logging(kcontext) && !kcontext->dal_handle->bulk_load) {
         upd = k5alloc(sizeof(*upd), &status);
         if (upd == NULL)
             goto cleanup;
@@ -2661,3 +2678,66 @@ krb5_db_check_allowed_to_delegate(krb5_context kcontext,
         return KRB5_PLUGIN_OP_NOTSUPP;
     return v->check_allowed_to_delegate(kcontext, client, server, proxy);
 }
+
+krb5_error_code
+krb5_db_begin_bulk_load(krb5_context kcontext)
+{
+    krb5_error_code ret;
+    kdb_vftabl *v;
+
+    ret = get_vftabl(kcontext, &v);
+    if (ret)
+        return ret;
+    if (kcontext->dal_handle->bulk_load)
+        return EINVAL;
+    if (v->begin_bulk_load != NULL) {
+        ret = v->begin_bulk_load(kcontext);
+        if (ret)
+            return ret;
+    }
+    kcontext->dal_handle->bulk_load = TRUE;
+    return 0;
+}
+
+krb5_error_code
+krb5_db_end_bulk_load(krb5_context kcontext)
+{
+    krb5_error_code ret, ret2;
+    kdb_vftabl *v;
+
+    ret = get_vftabl(kcontext, &v);
+    if (ret)
+        return ret;
+    if (!kcontext->dal_handle->bulk_load)
+        return EINVAL;
+    kcontext->dal_handle->bulk_load = FALSE;
+    if (v->end_bulk_load != NULL)
+        ret = v->end_bulk_load(kcontext);
+
+    /* Updates made during the load were not logged, so reset the ulog to
+     * force slaves to perform a full resync. */
+    if (logging(kcontext)) {
+        ret2 = ulog_lock(kcontext, KRB5_LOCKMODE_EXCLUSIVE);
+        if (ret2 == 0) {
+            ulog_init_header(kcontext);
+            (void) ulog_lock(kcontext, KRB5_LOCKMODE_UNLOCK);
+        }
+        if (!ret)
+            ret = ret2;
+    }
+    return ret;
+}
+
+krb5_error_code
+krb5_db_flush_lockout(krb5_context kcontext, krb5_timestamp deadline)
+{
+    krb5_error_code ret;
+    kdb_vftabl *v;
+
+    ret = get_vftabl(kcontext, &v);
+    if (ret)
+        return ret;
+    if (v->flush_lockout == NULL)
+        return 0;
+    return v->flush_lockout(kcontext, deadline);
+}
@@ -0,0 +1,241 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/kdb/kdb_lockout.c - Deferred lockout updates for database modules */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A lockout queue holds changes to the fail_auth_count, last_failed, and
+ * last_success fields of principal entries which a database module has chosen
+ * not to write yet, so that the KDC does not have to write a principal entry
+ * for every AS request.  Changes are stored relative to the database contents
+ * (a failure count increment, possibly preceded by a reset), so they can be
+ * written on top of changes made by other processes in the meantime.
+ *
+ * A queue is not thread-safe; each database context should have its own.
+ */
+
+#include "k5-int.h"
+#include "k5-queue.h"
+#include "kdb.h"
+
+#define LOCKOUT_HASH_SIZE 256
+
+/* The queue is written once this many principals have pending changes. */
+#define LOCKOUT_QUEUE_MAX 1024
+
+struct lockout_update {
+    LIST_ENTRY(lockout_update) bucket_links;
+    TAILQ_ENTRY(lockout_update) queue_links;
+    krb5_principal princ;
+    krb5_timestamp queued;      /* When the first change was queued */
+    krb5_boolean reset;         /* fail_auth_count was reset to 0 */
+    krb5_kvno nfailed;          /* Failures counted after any reset */
+    krb5_timestamp last_failed; /* New last_failed value, or 0 */
+    krb5_timestamp last_success; /* New last_success value, or 0 */
+};
+
+LIST_HEAD(lockout_update_list, lockout_update);
+TAILQ_HEAD(lockout_update_queue, lockout_update);
+
+struct _krb5_db_lockout_queue {
+    krb5_deltat max_delay;
+    int count;
+    struct lockout_update_list hash_table[LOCKOUT_HASH_SIZE];
+    struct lockout_update_queue queue;  /* Oldest first */
+};
+
+/* Return the hash bucket for princ. */
+static unsigned int
+princ_hash(krb5_const_principal princ)
+{
+    krb5_ui_4 h = 2166136261U;
+    const unsigned char *p;
+    krb5_int32 i;
+    unsigned int j;
+
+    for (i = 0; i < princ->length; i++) {
+        p = (unsigned char *)princ->data[i].data;
+        for (j = 0; j < princ->data[i].length; j++)
+            h = (h ^ p[j]) * 16777619;
+        h = (h ^ '/') * 16777619;
+    }
+    return h % LOCKOUT_HASH_SIZE;
+}
+
+static struct lockout_update *
+find_update(krb5_context context, krb5_db_lockout_queue *queue,
+            krb5_const_principal princ)
+{
+    struct lockout_update *u;
+
+    LIST_FOREACH(u, &queue->hash_table[princ_hash(princ)], bucket_links) {
+        if (krb5_principal_compare(context, u->princ, princ))
+            return u;
+    }
+    return NULL;
+}
+
+static void
+remove_update(krb5_context context, krb5_db_lockout_queue *queue,
+              struct lockout_update *u)
+{
+    LIST_REMOVE(u, bucket_links);
+    TAILQ_REMOVE(&queue->queue, u, queue_links);
+    queue->count--;
+    krb5_free_principal(context, u->princ);
+    free(u);
+}
+
+krb5_error_code
+krb5_db_lockout_queue_create(krb5_context context, krb5_deltat max_delay,
+                             krb5_db_lockout_queue **queue_out)
+{
+    krb5_db_lockout_queue *queue;
+    int i;
+
+    *queue_out = NULL;
+    queue = malloc(sizeof(*queue));
+    if (queue == NULL)
+        return ENOMEM;
+    queue->max_delay = max_delay;
+    queue->count = 0;
+    for (i = 0; i < LOCKOUT_HASH_SIZE; i++)
+        LIST_INIT(&queue->hash_table[i]);
+    TAILQ_INIT(&queue->queue);
+    *queue_out = queue;
+    return 0;
+}
+
+void
+krb5_db_lockout_queue_free(krb5_context context, krb5_db_lockout_queue *queue)
+{
+    if (queue == NULL)
+        return;
+    while (!TAILQ_EMPTY(&queue->queue))
+        remove_update(context, queue, TAILQ_FIRST(&queue->queue));
+    free(queue);
+}
+
+void
+krb5_db_lockout_queue_apply(krb5_context context,
+                            krb5_db_lockout_queue *queue,
+                            krb5_db_entry *entry)
+{
+    struct lockout_update *u;
+    krb5_timestamp unlock_time;
+
+    u = find_update(context, queue, entry->princ);
+    if (u == NULL)
+        return;
+
+    if (u->reset)
+        entry->fail_auth_count = 0;
+    /* Drop failures which preceded an administrative unlock made since they
+     * were queued. */
+    if (u->nfailed > 0 &&
+        (krb5_dbe_lookup_last_admin_unlock(context, entry,
+                                           &unlock_time) != 0 ||
+         u->last_failed > unlock_time))
+        entry->fail_auth_count += u->nfailed;
+    if (u->last_failed > entry->last_failed)
+        entry->last_failed = u->last_failed;
+    if (u->last_success > entry->last_success)
+        entry->last_success = u->last_success;
+}
+
+krb5_error_code
+krb5_db_lockout_queue_add(krb5_context context, krb5_db_lockout_queue *queue,
+                          const krb5_db_entry *before,
+                          const krb5_db_entry *after, krb5_timestamp stamp)
+{
+    krb5_error_code ret;
+    struct lockout_update *u;
+    unsigned int h;
+
+    u = find_update(context, queue, after->princ);
+    if (u == NULL) {
+        u = calloc(1, sizeof(*u));
+        if (u == NULL)
+            return ENOMEM;
+        ret = krb5_copy_principal(context, after->princ, &u->princ);
+        if (ret) {
+            free(u);
+            return ret;
+        }
+        u->queued = stamp;
+        h = princ_hash(after->princ);
+        LIST_INSERT_HEAD(&queue->hash_table[h], u, bucket_links);
+        TAILQ_INSERT_TAIL(&queue->queue, u, queue_links);
+        queue->count++;
+    }
+
+    /* A decrease in the failure count can only come from a reset. */
+    if (after->fail_auth_count < before->fail_auth_count) {
+        u->reset = TRUE;
+        u->nfailed = after->fail_auth_count;
+    } else {
+        u->nfailed += after->fail_auth_count - before->fail_auth_count;
+    }
+    if (after->last_failed != before->last_failed)
+        u->last_failed = after->last_failed;
+    if (after->last_success != before->last_success)
+        u->last_success = after->last_success;
+    return 0;
+}
+
+krb5_boolean
+krb5_db_lockout_queue_due(krb5_db_lockout_queue *queue, krb5_timestamp now)
+{
+    struct lockout_update *first = TAILQ_FIRST(&queue->queue);
+
+    if (first == NULL)
+        return FALSE;
+    return queue->count >= LOCKOUT_QUEUE_MAX ||
+        now - first->queued >= queue->max_delay;
+}
+
+krb5_error_code
+krb5_db_lockout_queue_flush(krb5_context context,
+                            krb5_db_lockout_queue *queue,
+                            krb5_db_lockout_write_fn write_fn, void *data)
+{
+    krb5_error_code ret;
+    struct lockout_update *u;
+
+    while ((u = TAILQ_FIRST(&queue->queue)) != NULL) {
+        ret = write_fn(context, u->princ, queue, data);
+        /* Discard the changes if the principal has been deleted. */
+        if (ret && ret != KRB5_KDB_NOENTRY)
+            return ret;
+        remove_update(context, queue, u);
+    }
+    return 0;
+}
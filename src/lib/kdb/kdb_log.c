@@ -35,6 +35,7 @@ static int pagesize = 0;
     assert(ulog != NULL)
 
 static int extend_file_to(int fd, unsigned int new_size);
+static void ulog_reset(kdb_hlog_t *ulog);
 
 static inline krb5_boolean
 time_equal(const kdbe_time_t *a, const kdbe_time_t *b)
@@ -64,6 +65,12 @@ ulog_lock(krb5_context ctx, int mode)
         ctx->kdblog_context->iproprole == IPROP_NULL)
         return 0;
     INIT_ULOG(ctx);
+
+    /* While syncs are deferred the log is marked unstable.  Keep a shared
+     * lock until they are flushed, so that no other process can map the log
+     * and mistake it for one left unstable by a crash. */
+    if (mode == KRB5_LOCKMODE_UNLOCK && log_ctx->sync_pending)
+        mode = KRB5_LOCKMODE_SHARED;
     return krb5_lock_file(ctx, log_ctx->ulogfd, mode);
 }
 
@@ -88,6 +95,52 @@ ulog_sync_update(kdb_hlog_t *ulog, kdb_ent_header_t *upd)
     return msync((caddr_t)start, size, MS_SYNC);
 }
 
+/* Return the number of milliseconds elapsed since *t. */
+static long
+time_elapsed_ms(const kdbe_time_t *t)
+{
+    kdbe_time_t now;
+
+    time_current(&now);
+    return ((long)now.seconds - (long)t->seconds) * 1000 +
+        ((long)now.useconds - (long)t->useconds) / 1000;
+}
+
+/* Note that the log contains entries which may not have reached the disk. */
+static void
+set_pending(kdb_log_context *log_ctx)
+{
+    if (!log_ctx->sync_pending) {
+        log_ctx->sync_pending = TRUE;
+        time_current(&log_ctx->pending_since);
+    }
+}
+
+/*
+ * Sync all update entries to disk, then mark the log as stable and sync the
+ * header.  The header is only marked stable on disk once every entry it
+ * refers to is there, so that ulog_map() can detect a crash during a batch.
+ */
+static krb5_error_code
+ulog_sync_all(kdb_log_context *log_ctx, kdb_hlog_t *ulog)
+{
+    unsigned long size;
+
+    if (!pagesize)
+        pagesize = getpagesize();
+
+    size = sizeof(kdb_hlog_t) +
+        (unsigned long)log_ctx->ulogentries * ulog->kdb_block;
+    size = (size + (pagesize - 1)) & ~(pagesize - 1);
+    if (msync((caddr_t)ulog, size, MS_SYNC) != 0)
+        return errno;
+
+    ulog->kdb_state = KDB_STABLE;
+    ulog_sync_header(ulog);
+    log_ctx->sync_pending = FALSE;
+    return 0;
+}
+
 /* Sync memory to disk for the update log header. */
 void
 ulog_sync_header(kdb_hlog_t *ulog)
@@ -180,6 +233,14 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
             return retval;
     }
 
+    /* A log which is unstable outside of a batch was left that way by a
+     * process which died during an update; its last entry may be partly
+     * written, so start over and let slaves perform a full resync. */
+    if (ulog->kdb_state != KDB_STABLE && !log_ctx->sync_pending) {
+        ulog_reset(ulog);
+        ulog_sync_header(ulog);
+    }
+
     cur_sno = ulog->kdb_last_sno;
 
     /*
@@ -205,16 +266,26 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
     indx_log->kdb_time = upd->kdb_time = ktime;
     indx_log->kdb_commit = upd->kdb_commit = FALSE;
 
+    /* With group commit, mark the header unstable on disk once at the start
+     * of each batch, before any of the batch's entries can reach the disk. */
     ulog->kdb_state = KDB_UNSTABLE;
+    if (log_ctx->sync_delay > 0 && !log_ctx->sync_pending) {
+        ulog_sync_header(ulog);
+        set_pending(log_ctx);
+    }
 
     xdrmem_create(&xdrs, (char *)indx_log->entry_data,
                   indx_log->kdb_entry_size, XDR_ENCODE);
     if (!xdr_kdb_incr_update_t(&xdrs, upd))
         return KRB5_LOG_CONV;
 
-    retval = ulog_sync_update(ulog, indx_log);
-    if (retval)
-        return retval;
+    /* With group commit, the entry is synced by ulog_finish_update() or
+     * ulog_flush() along with other updates. */
+    if (log_ctx->sync_delay == 0) {
+        retval = ulog_sync_update(ulog, indx_log);
+        if (retval)
+            return retval;
+    }
 
     if (ulog->kdb_num < ulogentries)
         ulog->kdb_num++;
@@ -234,11 +305,18 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
         ulog->kdb_first_time = indx_log->kdb_time;
     }
 
-    ulog_sync_header(ulog);
+    if (log_ctx->sync_delay == 0)
+        ulog_sync_header(ulog);
     return 0;
 }
 
-/* Mark the log entry as committed and sync the memory mapped log to file. */
+/*
+ * Mark the log entry as committed and sync the memory mapped log to file.  If
+ * a sync delay is set, leave the log marked unstable and only sync it once the
+ * oldest unsynced update is sync_delay milliseconds old, so that the msync
+ * calls for a burst of updates are coalesced.  The caller is expected to call
+ * ulog_flush() periodically to bound the delay when updates stop arriving.
+ */
 krb5_error_code
 ulog_finish_update(krb5_context context, kdb_incr_update_t *upd)
 {
@@ -257,16 +335,50 @@ ulog_finish_update(krb5_context context, kdb_incr_update_t *upd)
     indx_log = (kdb_ent_header_t *)INDEX(ulog, i);
     indx_log->kdb_commit = TRUE;
 
-    ulog->kdb_state = KDB_STABLE;
+    if (log_ctx->sync_delay > 0) {
+        set_pending(log_ctx);
+        if (time_elapsed_ms(&log_ctx->pending_since) < log_ctx->sync_delay)
+            return 0;
+    }
+    if (log_ctx->sync_pending)
+        return ulog_sync_all(log_ctx, ulog);
 
     retval = ulog_sync_update(ulog, indx_log);
     if (retval)
         return retval;
 
+    ulog->kdb_state = KDB_STABLE;
     ulog_sync_header(ulog);
     return 0;
 }
 
+/* Set the maximum time in milliseconds for which ulog_finish_update() may
+ * defer syncing updates to disk.  0 (the default) syncs every update. */
+void
+ulog_set_sync_delay(krb5_context context, int msec)
+{
+    if (context->kdblog_context != NULL)
+        context->kdblog_context->sync_delay = (msec > 0) ? msec : 0;
+}
+
+/* Sync any updates whose syncs were deferred by ulog_finish_update(). */
+krb5_error_code
+ulog_flush(krb5_context context)
+{
+    krb5_error_code retval;
+    kdb_log_context *log_ctx = context->kdblog_context;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL || !log_ctx->sync_pending)
+        return 0;
+
+    retval = ulog_lock(context, KRB5_LOCKMODE_EXCLUSIVE);
+    if (retval)
+        return retval;
+    retval = ulog_sync_all(log_ctx, log_ctx->ulog);
+    (void)ulog_lock(context, KRB5_LOCKMODE_UNLOCK);
+    return retval;
+}
+
 /* Set the header log details on the slave and sync it to file. */
 static void
 ulog_finish_update_slave(kdb_hlog_t *ulog, kdb_last_t lastentry)
@@ -389,6 +501,9 @@ ulog_init_header(krb5_context context)
     INIT_ULOG(context);
     ulog_reset(ulog);
     ulog_sync_header(ulog);
+
+    /* Any deferred entries have been discarded along with the rest. */
+    log_ctx->sync_pending = FALSE;
 }
 
 /*
@@ -522,6 +637,17 @@ ulog_map(krb5_context context, const char *logname, uint32_t ulogentries,
 
     assert(caller == FKADMIND || caller == FKCOMMAND);
 
+    /*
+     * A process deferring syncs holds a lock on the log until they are done,
+     * so an unstable log here was left by a crash during an update or a
+     * batch.  Some of its entries may be missing or partly written, so reset
+     * it and let slaves perform a full resync.
+     */
+    if (ulog->kdb_state != KDB_STABLE) {
+        ulog_reset(ulog);
+        ulog_sync_header(ulog);
+    }
+
     /* Reinit ulog if the log is being truncated or expanded after we have
      * circled. */
     if (ulog->kdb_num != ulogentries) {
@@ -565,6 +691,11 @@ ulog_get_entries(krb5_context context, kdb_last_t last,
     INIT_ULOG(context);
     ulogentries = log_ctx->ulogentries;
 
+    /* Don't give slaves updates which could still be lost in a crash. */
+    retval = ulog_flush(context);
+    if (retval)
+        return retval;
+
     retval = ulog_lock(context, KRB5_LOCKMODE_SHARED);
     if (retval)
         return retval;
@@ -1,5 +1,5 @@
 /* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
-/* plugins/kdb/db2/kdb_xdr.c */
+/* lib/kdb/kdb_xdr.c */
 /*
  * Copyright 1995 by the Massachusetts Institute of Technology.
  * All Rights Reserved.
@@ -28,22 +28,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
-#include "kdb_xdr.h"
-
-krb5_error_code
-krb5_encode_princ_dbkey(krb5_context context, krb5_data *key,
-                        krb5_const_principal principal)
-{
-    char *princ_name;
-    krb5_error_code retval;
-
-    if (!(retval = krb5_unparse_name(context, principal, &princ_name))) {
-        /* need to store the NULL for decoding */
-        key->length = strlen(princ_name)+1;
-        key->data = princ_name;
-    }
-    return(retval);
-}
+#include "kdb.h"
 
 krb5_error_code
 krb5_encode_princ_entry(krb5_context context, krb5_data *content,
@@ -310,6 +295,10 @@ krb5_decode_princ_entry(krb5_context context, krb5_data *content,
     /* Check for extra data */
     if (entry->len > KRB5_KDB_V1_BASE_LENGTH) {
         entry->e_length = entry->len - KRB5_KDB_V1_BASE_LENGTH;
+        if ((sizeleft -= entry->e_length) < 0) {
+            retval = KRB5_KDB_TRUNCATED_RECORD;
+            goto error_out;
+        }
         entry->e_data = k5alloc(entry->e_length, &retval);
         if (entry->e_data == NULL)
             goto error_out;
@@ -331,12 +320,14 @@ krb5_decode_princ_entry(krb5_context context, krb5_data *content,
     i = (int) i16;
     nextloc += 2;
 
-    if ((retval = krb5_parse_name(context, (char *)nextloc, &(entry->princ))))
-        goto error_out;
-    if (((size_t) i != (strlen((char *)nextloc) + 1)) || (sizeleft < i)) {
+    /* Make sure the name is terminated within the record before parsing. */
+    if (i <= 0 || sizeleft < i || nextloc[i - 1] != '\0' ||
+        (size_t)i != strlen((char *)nextloc) + 1) {
         retval = KRB5_KDB_TRUNCATED_RECORD;
         goto error_out;
     }
+    if ((retval = krb5_parse_name(context, (char *)nextloc, &(entry->princ))))
+        goto error_out;
     sizeleft -= i;
     nextloc += i;
 
@@ -375,7 +366,8 @@ krb5_decode_princ_entry(krb5_context context, krb5_data *content,
 
     /* key_data is an array */
     if (entry->n_key_data && ((entry->key_data = (krb5_key_data *)
-                               malloc(sizeof(krb5_key_data) * entry->n_key_data)) == NULL)) {
+                               calloc(entry->n_key_data,
+                                      sizeof(krb5_key_data))) == NULL)) {
         retval = ENOMEM;
         goto error_out;
     }
@@ -422,8 +414,10 @@ krb5_decode_princ_entry(krb5_context context, krb5_data *content,
                 }
             }
         } else {
-            /* This isn't right. I'll fix it later */
-            abort();
+            /* Don't let krb5_dbe_free() walk past the end of the arrays. */
+            key_data->key_data_ver = 0;
+            retval = KRB5_KDB_BAD_VERSION;
+            goto error_out;
         }
     }
     *entry_ptr = entry;
@@ -54,6 +54,7 @@
 #ifndef LEAN_CLIENT
 
 #include "k5-int.h"
+#include "kt-int.h"
 #include <stdio.h>
 
 /*
@@ -252,6 +253,642 @@ krb5_ktfile_close(krb5_context context, krb5_keytab id)
     return (0);
 }
 
+#ifndef _WIN32
+
+/*
+ * Looking up a key in a large keytab by reading the file sequentially can be
+ * slow, so FILE keytabs are indexed by principal name.  The index for a file
+ * is shared by all keytab handles in the process.  It holds a private copy of
+ * the file's contents, read under a shared lock, along with a hash table of
+ * the offsets of the file's records by principal name; no file descriptor is
+ * kept open.  Each lookup checks that the file has not been replaced or
+ * modified (by comparing its size and modification time) and rebuilds the
+ * index if it has.
+ *
+ * ktindex_lock protects only the list of indexes and their reference counts;
+ * each index has its own mutex, so that lookups in different files, and
+ * lookups in a file which is being indexed, do not wait for each other.
+ *
+ * A file modified within the last couple of seconds is not indexed, since a
+ * further modification might not change its size or (coarse) timestamp.
+ * Lookups in such a file, and lookups while an iterator is active, read the
+ * file sequentially as before.
+ */
+
+#define KTINDEX_MAX 8           /* Number of files to keep indexed */
+#define KTINDEX_NONE 0xFFFFFFFF /* End of a bucket chain */
+
+struct ktindex_slot {
+    uint32_t hash;
+    uint32_t next;              /* Next slot in the bucket, in file order */
+    size_t offset;              /* Offset of the record after its size */
+};
+
+struct ktindex {
+    struct ktindex *next;
+    char *name;
+    unsigned int refcount;      /* One for the list, plus one per lookup */
+    k5_mutex_t lock;            /* Protects the fields below */
+    dev_t dev;
+    ino_t ino;
+    off_t size;                 /* -1 if the file has not been read */
+    time_t mtime;
+    krb5_error_code error;      /* Why the file could not be indexed */
+    int version;
+    unsigned char *data;
+    size_t datalen;
+    struct ktindex_slot *slots;
+    size_t nslots;
+    uint32_t *buckets;
+    size_t nbuckets;
+};
+
+/* Indexed files, most recently used first. */
+static struct ktindex *ktindex_list;
+static k5_mutex_t ktindex_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+
+/* A position in a copy of a keytab file. */
+struct ktreader {
+    const unsigned char *ptr;
+    size_t len;
+    int version;
+};
+
+int
+krb5int_ktfile_initialize(void)
+{
+    return k5_mutex_finish_init(&ktindex_lock);
+}
+
+static void
+ktindex_clear(struct ktindex *ind)
+{
+    free(ind->data);
+    ind->data = NULL;
+    ind->datalen = 0;
+    ind->size = -1;
+    ind->error = 0;
+    free(ind->slots);
+    ind->slots = NULL;
+    ind->nslots = 0;
+    free(ind->buckets);
+    ind->buckets = NULL;
+    ind->nbuckets = 0;
+}
+
+static void
+ktindex_free(struct ktindex *ind)
+{
+    ktindex_clear(ind);
+    k5_mutex_destroy(&ind->lock);
+    free(ind->name);
+    free(ind);
+}
+
+/* Drop a reference to ind, freeing it if it was the last.  ktindex_lock must
+ * be held. */
+static void
+ktindex_release(struct ktindex *ind)
+{
+    if (--ind->refcount == 0)
+        ktindex_free(ind);
+}
+
+void
+krb5int_ktfile_finalize(void)
+{
+    struct ktindex *ind, *next;
+
+    k5_mutex_destroy(&ktindex_lock);
+    for (ind = ktindex_list; ind != NULL; ind = next) {
+        next = ind->next;
+        ktindex_free(ind);
+    }
+    ktindex_list = NULL;
+}
+
+/* Mix len and the len bytes at data into an FNV-1a hash value. */
+static uint32_t
+ktindex_hash(uint32_t h, const void *data, unsigned int len)
+{
+    const unsigned char *p = data;
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        h ^= (len >> (i * 8)) & 0xFF;
+        h *= 16777619;
+    }
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619;
+    }
+    return h;
+}
+
+/* Hash the fields compared by krb5_principal_compare(). */
+static uint32_t
+ktindex_hash_princ(krb5_const_principal princ)
+{
+    uint32_t h = 2166136261U;
+    krb5_int32 i;
+
+    h = ktindex_hash(h, princ->realm.data, princ->realm.length);
+    for (i = 0; i < princ->length; i++)
+        h = ktindex_hash(h, princ->data[i].data, princ->data[i].length);
+    return h;
+}
+
+/* Read integers in the byte order of the keytab version, as
+ * krb5_ktfileint_internal_read_entry() does. */
+static krb5_boolean
+ktread_16(struct ktreader *r, krb5_int16 *val)
+{
+    if (r->len < 2)
+        return FALSE;
+    if (r->version == KRB5_KT_VNO_1)
+        *val = (krb5_int16)load_16_n(r->ptr);
+    else
+        *val = (krb5_int16)load_16_be(r->ptr);
+    r->ptr += 2;
+    r->len -= 2;
+    return TRUE;
+}
+
+static krb5_boolean
+ktread_32(struct ktreader *r, krb5_int32 *val)
+{
+    if (r->len < 4)
+        return FALSE;
+    if (r->version == KRB5_KT_VNO_1)
+        *val = (krb5_int32)load_32_n(r->ptr);
+    else
+        *val = (krb5_int32)load_32_be(r->ptr);
+    r->ptr += 4;
+    r->len -= 4;
+    return TRUE;
+}
+
+/* Read a positive 16-bit length followed by that many bytes. */
+static krb5_boolean
+ktread_counted(struct ktreader *r, const unsigned char **data,
+               unsigned int *len)
+{
+    krb5_int16 size;
+
+    if (!ktread_16(r, &size) || size <= 0 || r->len < (size_t)size)
+        return FALSE;
+    *data = r->ptr;
+    *len = size;
+    r->ptr += size;
+    r->len -= size;
+    return TRUE;
+}
+
+/* Allocate a null-terminated copy of len bytes at data into *out. */
+static krb5_error_code
+ktread_copy(const unsigned char *data, unsigned int len, krb5_data *out)
+{
+    out->data = malloc(len + 1);
+    if (out->data == NULL)
+        return ENOMEM;
+    memcpy(out->data, data, len);
+    out->data[len] = '\0';
+    out->length = len;
+    return 0;
+}
+
+/*
+ * Parse the keytab record at offset in the index's data, using the same rules
+ * as krb5_ktfileint_internal_read_entry().  Set *hash_out to the hash of the
+ * principal name.  If entry is not NULL, also decode the record into it.
+ * Return KRB5_KT_END if the record is malformed.
+ */
+static krb5_error_code
+ktindex_parse(krb5_context context, struct ktindex *ind, size_t offset,
+              uint32_t *hash_out, krb5_keytab_entry *entry)
+{
+    krb5_error_code ret;
+    struct ktreader r;
+    krb5_principal princ = NULL;
+    const unsigned char *data;
+    unsigned int len;
+    krb5_int16 count, enctype;
+    krb5_int32 i, type = KRB5_NT_UNKNOWN, timestamp;
+    uint32_t h = 2166136261U;
+    krb5_octet vno;
+
+    r.ptr = ind->data + offset;
+    r.len = ind->datalen - offset;
+    r.version = ind->version;
+
+    if (!ktread_16(&r, &count))
+        return KRB5_KT_END;
+    if (ind->version == KRB5_KT_VNO_1)
+        count--;                /* V1 includes the realm in the count */
+    if (count <= 0)
+        return KRB5_KT_END;
+
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(*entry));
+        entry->magic = KV5M_KEYTAB_ENTRY;
+        princ = calloc(1, sizeof(*princ));
+        if (princ == NULL)
+            return ENOMEM;
+        princ->magic = KV5M_PRINCIPAL;
+        princ->data = calloc(count, sizeof(*princ->data));
+        if (princ->data == NULL) {
+            free(princ);
+            return ENOMEM;
+        }
+        princ->length = count;
+        entry->principal = princ;
+    }
+
+    ret = KRB5_KT_END;
+    if (!ktread_counted(&r, &data, &len))
+        goto cleanup;
+    h = ktindex_hash(h, data, len);
+    if (entry != NULL) {
+        ret = ktread_copy(data, len, &princ->realm);
+        if (ret)
+            goto cleanup;
+        ret = KRB5_KT_END;
+    }
+    for (i = 0; i < count; i++) {
+        if (!ktread_counted(&r, &data, &len))
+            goto cleanup;
+        h = ktindex_hash(h, data, len);
+        if (entry != NULL) {
+            ret = ktread_copy(data, len, &princ->data[i]);
+            if (ret)
+                goto cleanup;
+            ret = KRB5_KT_END;
+        }
+    }
+    if (ind->version != KRB5_KT_VNO_1 && !ktread_32(&r, &type))
+        goto cleanup;
+    if (!ktread_32(&r, &timestamp))
+        goto cleanup;
+    if (r.len < 1)
+        goto cleanup;
+    vno = *r.ptr;
+    r.ptr++;
+    r.len--;
+    if (!ktread_16(&r, &enctype))
+        goto cleanup;
+    if (!ktread_counted(&r, &data, &len))
+        goto cleanup;
+
+    if (entry != NULL) {
+        princ->type = type;
+        entry->timestamp = timestamp;
+        entry->vno = vno;
+        entry->key.magic = KV5M_KEYBLOCK;
+        entry->key.enctype = enctype;
+        entry->key.contents = malloc(len);
+        if (entry->key.contents == NULL) {
+            ret = ENOMEM;
+            goto cleanup;
+        }
+        memcpy(entry->key.contents, data, len);
+        entry->key.length = len;
+    }
+    *hash_out = h;
+    ret = 0;
+
+cleanup:
+    if (ret && entry != NULL) {
+        krb5_free_principal(context, entry->principal);
+        entry->principal = NULL;
+    }
+    return ret;
+}
+
+/*
+ * Read a private copy of the file name into ind under a shared lock, and
+ * record the file's identity, size and modification time.  Return EAGAIN if
+ * the file was modified at or after the time now - 1.
+ */
+static krb5_error_code
+ktindex_read(krb5_context context, struct ktindex *ind, const char *name,
+             time_t now)
+{
+    krb5_error_code ret;
+    struct stat st;
+    ssize_t nread;
+    size_t len = 0;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd == -1)
+        return errno;
+    set_cloexec_fd(fd);
+    ret = krb5_lock_file(context, fd, KRB5_LOCKMODE_SHARED);
+    if (ret) {
+        close(fd);
+        return ret;
+    }
+    if (fstat(fd, &st) != 0) {
+        ret = errno;
+        goto cleanup;
+    }
+    if (st.st_mtime >= now - 1) {
+        ret = EAGAIN;
+        goto cleanup;
+    }
+    ind->dev = st.st_dev;
+    ind->ino = st.st_ino;
+    ind->size = st.st_size;
+    ind->mtime = st.st_mtime;
+
+    /* An empty or truncated file gets the open errors from the sequential
+     * code. */
+    if (st.st_size < 2 || (uintmax_t)st.st_size > SIZE_MAX) {
+        ret = KRB5_KEYTAB_BADVNO;
+        goto cleanup;
+    }
+    ind->data = malloc(st.st_size);
+    if (ind->data == NULL) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    /* If the file is shorter than fstat said, index what we got. */
+    while (len < (size_t)st.st_size) {
+        nread = read(fd, ind->data + len, st.st_size - len);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread < 0) {
+            ret = errno;
+            goto cleanup;
+        }
+        if (nread == 0)
+            break;
+        len += nread;
+    }
+    ind->datalen = len;
+
+cleanup:
+    (void)krb5_unlock_file(context, fd);
+    close(fd);
+    return ret;
+}
+
+/* Index the records in the private copy of the file in ind. */
+static krb5_error_code
+ktindex_build(krb5_context context, struct ktindex *ind)
+{
+    krb5_error_code ret;
+    struct ktreader r;
+    struct ktindex_slot *slots = NULL, *newslots;
+    size_t nslots = 0, nalloc = 0, offset, i, b;
+    krb5_int32 size;
+    krb5_ui_4 skip;
+    uint32_t hash;
+
+    if (ind->datalen < 2)
+        return KRB5_KEYTAB_BADVNO;
+    ind->version = load_16_be(ind->data);
+    if (ind->version != KRB5_KT_VNO && ind->version != KRB5_KT_VNO_1)
+        return KRB5_KEYTAB_BADVNO;
+
+    /* Find the records, stopping where the sequential code would. */
+    r.ptr = ind->data + 2;
+    r.len = ind->datalen - 2;
+    r.version = ind->version;
+    while (ktread_32(&r, &size) && size != 0) {
+        offset = r.ptr - ind->data;
+        if (size < 0) {
+            /* Skip a deleted record. */
+            skip = (krb5_ui_4)0 - (krb5_ui_4)size;
+            if (skip > r.len)
+                break;
+            r.ptr += skip;
+            r.len -= skip;
+            continue;
+        }
+        ret = ktindex_parse(context, ind, offset, &hash, NULL);
+        if (ret)
+            break;
+        if (nslots == nalloc) {
+            nalloc = (nalloc == 0) ? 64 : nalloc * 2;
+            newslots = NULL;
+            if (nalloc < KTINDEX_NONE)
+                newslots = realloc(slots, nalloc * sizeof(*slots));
+            if (newslots == NULL) {
+                free(slots);
+                return ENOMEM;
+            }
+            slots = newslots;
+        }
+        slots[nslots].hash = hash;
+        slots[nslots].offset = offset;
+        nslots++;
+        if ((krb5_ui_4)size > r.len)
+            break;
+        r.ptr += size;
+        r.len -= size;
+    }
+
+    ind->nbuckets = 16;
+    while (ind->nbuckets < nslots)
+        ind->nbuckets *= 2;
+    ind->buckets = malloc(ind->nbuckets * sizeof(*ind->buckets));
+    if (ind->buckets == NULL) {
+        free(slots);
+        return ENOMEM;
+    }
+    for (b = 0; b < ind->nbuckets; b++)
+        ind->buckets[b] = KTINDEX_NONE;
+
+    /* Chain the slots in reverse so that each bucket is in file order. */
+    for (i = nslots; i > 0; i--) {
+        b = slots[i - 1].hash & (ind->nbuckets - 1);
+        slots[i - 1].next = ind->buckets[b];
+        ind->buckets[b] = i - 1;
+    }
+    ind->slots = slots;
+    ind->nslots = nslots;
+    return 0;
+}
+
+/* Decode the records in ind which may be for princ into a new array.  The
+ * index must be locked. */
+static krb5_error_code
+ktindex_get(krb5_context context, struct ktindex *ind,
+            krb5_const_principal princ, krb5_keytab_entry **entries_out,
+            size_t *count_out)
+{
+    krb5_error_code ret;
+    krb5_keytab_entry *entries = NULL, *newentries;
+    size_t count = 0;
+    uint32_t hash, slot, rec_hash;
+
+    *entries_out = NULL;
+    *count_out = 0;
+
+    hash = ktindex_hash_princ(princ);
+    slot = ind->buckets[hash & (ind->nbuckets - 1)];
+    for (; slot != KTINDEX_NONE; slot = ind->slots[slot].next) {
+        if (ind->slots[slot].hash != hash)
+            continue;
+        newentries = realloc(entries, (count + 1) * sizeof(*entries));
+        if (newentries == NULL) {
+            ret = ENOMEM;
+            goto cleanup;
+        }
+        entries = newentries;
+        ret = ktindex_parse(context, ind, ind->slots[slot].offset, &rec_hash,
+                            &entries[count]);
+        if (ret)
+            goto cleanup;
+        count++;
+    }
+
+    *entries_out = entries;
+    *count_out = count;
+    entries = NULL;
+    count = 0;
+    ret = 0;
+
+cleanup:
+    while (count > 0)
+        krb5_kt_free_entry(context, &entries[--count]);
+    free(entries);
+    return ret;
+}
+
+/*
+ * Look up the records for princ in the keytab file name using its index,
+ * creating or rebuilding the index if necessary.  On success, set
+ * *entries_out to the candidate entries (which may include other principals
+ * with the same hash) in file order.  On failure, the caller should read the
+ * file sequentially instead.
+ */
+static krb5_error_code
+ktindex_lookup(krb5_context context, const char *name,
+               krb5_const_principal princ, krb5_keytab_entry **entries_out,
+               size_t *count_out)
+{
+    krb5_error_code ret;
+    struct ktindex *ind, **indp;
+    struct stat st;
+    time_t now;
+    int n;
+
+    *entries_out = NULL;
+    *count_out = 0;
+
+    now = time(NULL);
+    if (stat(name, &st) != 0)
+        return errno;
+    if (st.st_mtime >= now - 1)
+        return EAGAIN;
+
+    ret = k5_mutex_lock(&ktindex_lock);
+    if (ret)
+        return ret;
+
+    /* Find the index for name or create an empty one, and move it to the
+     * front of the list. */
+    for (indp = &ktindex_list; *indp != NULL; indp = &(*indp)->next) {
+        if (strcmp((*indp)->name, name) == 0)
+            break;
+    }
+    ind = *indp;
+    if (ind != NULL) {
+        *indp = ind->next;
+    } else {
+        ind = calloc(1, sizeof(*ind));
+        if (ind == NULL) {
+            k5_mutex_unlock(&ktindex_lock);
+            return ENOMEM;
+        }
+        ind->name = strdup(name);
+        ret = (ind->name == NULL) ? ENOMEM : k5_mutex_init(&ind->lock);
+        if (ret) {
+            free(ind->name);
+            free(ind);
+            k5_mutex_unlock(&ktindex_lock);
+            return ret;
+        }
+        ind->size = -1;
+        ind->refcount = 1;
+    }
+    ind->next = ktindex_list;
+    ktindex_list = ind;
+    ind->refcount++;
+
+    /* Discard the least recently used index if there are too many. */
+    for (n = 1, indp = &ind->next; *indp != NULL; indp = &(*indp)->next) {
+        if (++n > KTINDEX_MAX) {
+            ktindex_release(*indp);
+            *indp = NULL;
+            break;
+        }
+    }
+    k5_mutex_unlock(&ktindex_lock);
+
+    ret = k5_mutex_lock(&ind->lock);
+    if (ret)
+        goto release;
+
+    /* Reread the file if it has been replaced or modified. */
+    if (ind->size != st.st_size || ind->mtime != st.st_mtime ||
+        ind->dev != st.st_dev || ind->ino != st.st_ino) {
+        ktindex_clear(ind);
+        ret = ktindex_read(context, ind, name, now);
+        if (ret == 0)
+            ret = ktindex_build(context, ind);
+        if (ret == KRB5_KEYTAB_BADVNO) {
+            /* Don't reread a malformed file until it changes. */
+            free(ind->data);
+            ind->data = NULL;
+            ind->datalen = 0;
+            ind->error = ret;
+        } else if (ret) {
+            ktindex_clear(ind);
+        }
+    }
+    if (ret == 0)
+        ret = ind->error;
+    if (ret == 0)
+        ret = ktindex_get(context, ind, princ, entries_out, count_out);
+    k5_mutex_unlock(&ind->lock);
+
+release:
+    /* If the list can't be locked, keep our reference rather than race. */
+    if (k5_mutex_lock(&ktindex_lock) == 0) {
+        ktindex_release(ind);
+        k5_mutex_unlock(&ktindex_lock);
+    }
+    return ret;
+}
+
+#else /* _WIN32 */
+
+int
+krb5int_ktfile_initialize(void)
+{
+    return 0;
+}
+
+void
+krb5int_ktfile_finalize(void)
+{
+}
+
+static krb5_error_code
+ktindex_lookup(krb5_context context, const char *name,
+               krb5_const_principal princ, krb5_keytab_entry **entries_out,
+               size_t *count_out)
+{
+    *entries_out = NULL;
+    *count_out = 0;
+    return EINVAL;
+}
+
+#endif /* _WIN32 */
+
 /*
  * This is the get_entry routine for the file based keytab implementation.
  * It opens the keytab file, and either retrieves the entry or returns
@@ -270,6 +907,9 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
     int kvno_offset = 0;
     int was_open;
     char *princname;
+    krb5_keytab_entry *indexed = NULL;
+    size_t nindexed = 0, next_indexed = 0;
+    krb5_boolean use_index = FALSE;
 
     kerror = KTLOCK(id);
     if (kerror)
@@ -282,6 +922,11 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
             KTUNLOCK(id);
             return errno;
         }
+    } else if (ktindex_lookup(context, KTFILENAME(id), principal, &indexed,
+                              &nindexed) == 0) {
+        /* Consider only the candidate entries from the index. */
+        was_open = 0;
+        use_index = TRUE;
     } else {
         was_open = 0;
 
@@ -301,8 +946,16 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
     cur_entry.key.contents = 0;
 
     while (TRUE) {
-        if ((kerror = krb5_ktfileint_read_entry(context, id, &new_entry)))
+        if (use_index) {
+            if (next_indexed == nindexed) {
+                kerror = KRB5_KT_END;
+                break;
+            }
+            new_entry = indexed[next_indexed++];
+        } else if ((kerror = krb5_ktfileint_read_entry(context, id,
+                                                       &new_entry))) {
             break;
+        }
 
         /* by the time this loop exits, it must either free cur_entry,
            and copy new_entry there, or free new_entry.  Otherwise, it
@@ -387,6 +1040,10 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
         }
     }
 
+    while (next_indexed < nindexed)
+        krb5_kt_free_entry(context, &indexed[next_indexed++]);
+    free(indexed);
+
     if (kerror == KRB5_KT_END) {
         if (cur_entry.principal)
             kerror = 0;
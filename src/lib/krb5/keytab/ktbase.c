@@ -93,6 +93,9 @@ int krb5int_kt_initialize(void)
     err = krb5int_mkt_initialize();
     if (err)
         goto done;
+    err = krb5int_ktfile_initialize();
+    if (err)
+        goto done;
 
 done:
     return(err);
@@ -110,6 +113,7 @@ krb5int_kt_finalize(void)
     }
 
     krb5int_mkt_finalize();
+    krb5int_ktfile_finalize();
 }
 
 
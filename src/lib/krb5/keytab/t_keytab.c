@@ -32,6 +32,8 @@
 #include <unistd.h>
 #endif
 #include <string.h>
+#include <fcntl.h>
+#include <utime.h>
 
 
 int debug=0;
@@ -392,6 +394,203 @@ kt_test(krb5_context context, const char *name)
 
 }
 
+/* Add an entry for name with the given kvno and enctype, whose key contents
+ * are derived from the kvno, enctype, and n. */
+static void
+index_add(krb5_context context, krb5_keytab kt, const char *name,
+          krb5_kvno kvno, krb5_enctype enctype, int n)
+{
+    krb5_error_code kret;
+    krb5_keytab_entry kent;
+    krb5_octet keybuf[16];
+
+    memset(&kent, 0, sizeof(kent));
+    kret = krb5_parse_name(context, name, &kent.principal);
+    CHECK(kret, "parsing principal");
+    memset(keybuf, n & 0xFF, sizeof(keybuf));
+    keybuf[0] = kvno;
+    keybuf[1] = enctype;
+    kent.magic = KV5M_KEYTAB_ENTRY;
+    kent.vno = kvno;
+    kent.key.magic = KV5M_KEYBLOCK;
+    kent.key.enctype = enctype;
+    kent.key.length = sizeof(keybuf);
+    kent.key.contents = keybuf;
+    kret = krb5_kt_add_entry(context, kt, &kent);
+    CHECK(kret, "adding entry");
+    krb5_free_principal(context, kent.principal);
+}
+
+/* Look up name, kvno, and enctype, and check the result against the expected
+ * error, kvno, and key contents. */
+static void
+index_check(krb5_context context, krb5_keytab kt, const char *name,
+            krb5_kvno kvno, krb5_enctype enctype, krb5_error_code err,
+            krb5_kvno expected_kvno, krb5_enctype expected_enctype, int n)
+{
+    krb5_error_code kret;
+    krb5_keytab_entry kent;
+    krb5_principal princ;
+
+    kret = krb5_parse_name(context, name, &princ);
+    CHECK(kret, "parsing principal");
+    kret = krb5_kt_get_entry(context, kt, princ, kvno, enctype, &kent);
+    CHECK_ERR(kret, err, "indexed lookup");
+    if (kret == 0) {
+        if (!krb5_principal_compare(context, princ, kent.principal) ||
+            kent.vno != expected_kvno ||
+            kent.key.contents[0] != (expected_kvno & 0xFF) ||
+            kent.key.contents[1] != expected_enctype ||
+            kent.key.contents[2] != (n & 0xFF)) {
+            fprintf(stderr, "Wrong entry found for %s\n", name);
+            exit(1);
+        }
+        krb5_free_keytab_entry_contents(context, &kent);
+    }
+    krb5_free_principal(context, princ);
+}
+
+/* Set the modification time of filename to secs seconds ago, so that FILE
+ * keytab lookups can index it. */
+static void
+set_mtime(const char *filename, int secs)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = time(NULL) - secs;
+    if (utime(filename, &times) != 0) {
+        perror("utime");
+        exit(1);
+    }
+}
+
+static void
+test_index(krb5_context context)
+{
+    krb5_error_code kret;
+    krb5_keytab kt, wkt;
+    krb5_keytab_entry kent;
+    krb5_kt_cursor cursor;
+    char *filename, *name, *wname, princname[64];
+    int i, fd, fd2;
+    const krb5_enctype aes128 = ENCTYPE_AES128_CTS_HMAC_SHA1_96;
+    const krb5_enctype aes256 = ENCTYPE_AES256_CTS_HMAC_SHA1_96;
+
+    fprintf(stderr, "Testing indexed FILE keytab lookups\n");
+
+    if (asprintf(&filename, "/tmp/ktindex.%ld", (long)getpid()) < 0 ||
+        asprintf(&name, "FILE:%s", filename) < 0 ||
+        asprintf(&wname, "WRFILE:%s", filename) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    unlink(filename);
+    kret = krb5_kt_resolve(context, name, &kt);
+    CHECK(kret, "resolve");
+    kret = krb5_kt_resolve(context, wname, &wkt);
+    CHECK(kret, "resolve writable");
+
+    for (i = 0; i < 200; i++) {
+        snprintf(princname, sizeof(princname), "svc%d/host@TEST.MIT.EDU", i);
+        index_add(context, wkt, princname, 1, aes128, i);
+        index_add(context, wkt, princname, 2, aes256, i);
+        index_add(context, wkt, princname, 2, aes128, i);
+        index_add(context, wkt, princname, 3, aes256, i);
+    }
+    set_mtime(filename, 10);
+
+    /* Check lookups by kvno and enctype, and failed lookups. */
+    for (i = 0; i < 200; i += 7) {
+        snprintf(princname, sizeof(princname), "svc%d/host@TEST.MIT.EDU", i);
+        index_check(context, kt, princname, 0, 0, 0, 3, aes256, i);
+        index_check(context, kt, princname, 0, aes128, 0, 2, aes128, i);
+        index_check(context, kt, princname, 2, 0, 0, 2, aes256, i);
+        index_check(context, kt, princname, 1, aes128, 0, 1, aes128, i);
+        index_check(context, kt, princname, 1, aes256, KRB5_KT_KVNONOTFOUND,
+                    0, 0, 0);
+        index_check(context, kt, princname, 4, 0, KRB5_KT_KVNONOTFOUND,
+                    0, 0, 0);
+    }
+    index_check(context, kt, "svc5/other@TEST.MIT.EDU", 0, 0,
+                KRB5_KT_NOTFOUND, 0, 0, 0);
+    index_check(context, kt, "svc5/host@OTHER.MIT.EDU", 0, 0,
+                KRB5_KT_NOTFOUND, 0, 0, 0);
+
+    /* A lookup while an iterator is active reads the file. */
+    kret = krb5_kt_start_seq_get(context, kt, &cursor);
+    CHECK(kret, "start_seq_get");
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 3, aes256, 9);
+    kret = krb5_kt_end_seq_get(context, kt, &cursor);
+    CHECK(kret, "end_seq_get");
+
+    /* A new entry must be found, whether or not the file is indexed. */
+    index_add(context, wkt, "svc9/host@TEST.MIT.EDU", 4, aes128, 100);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 4, aes128,
+                100);
+    set_mtime(filename, 5);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 4, aes128,
+                100);
+    index_check(context, kt, "svc10/host@TEST.MIT.EDU", 0, 0, 0, 3, aes256,
+                10);
+
+    /* Removing an entry does not change the file size. */
+    memset(&kent, 0, sizeof(kent));
+    kret = krb5_parse_name(context, "svc9/host@TEST.MIT.EDU", &kent.principal);
+    CHECK(kret, "parsing principal");
+    kent.vno = 4;
+    kent.key.enctype = aes128;
+    kret = krb5_kt_remove_entry(context, wkt, &kent);
+    CHECK(kret, "removing entry");
+    krb5_free_principal(context, kent.principal);
+    set_mtime(filename, 3);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 3, aes256, 9);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 4, 0,
+                KRB5_KT_KVNONOTFOUND, 0, 0, 0);
+
+    /* A replaced file is noticed. */
+    unlink(filename);
+    index_add(context, wkt, "svc9/host@TEST.MIT.EDU", 5, aes128, 50);
+    set_mtime(filename, 5);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 5, aes128,
+                50);
+    index_check(context, kt, "svc10/host@TEST.MIT.EDU", 0, 0,
+                KRB5_KT_NOTFOUND, 0, 0, 0);
+
+    /* The index does not keep the file open. */
+    fd = open("/dev/null", O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        exit(1);
+    }
+    close(fd);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0, 0, 5, aes128,
+                50);
+    fd2 = open("/dev/null", O_RDONLY);
+    if (fd2 != fd) {
+        fprintf(stderr, "Keytab index left a file open\n");
+        exit(1);
+    }
+    close(fd2);
+
+    /* A file truncated in place is noticed. */
+    if (truncate(filename, 2) != 0) {
+        perror("truncate");
+        exit(1);
+    }
+    set_mtime(filename, 5);
+    index_check(context, kt, "svc9/host@TEST.MIT.EDU", 0, 0,
+                KRB5_KT_NOTFOUND, 0, 0, 0);
+
+    kret = krb5_kt_close(context, wkt);
+    CHECK(kret, "close writable");
+    kret = krb5_kt_close(context, kt);
+    CHECK(kret, "close");
+    unlink(filename);
+    free(filename);
+    free(name);
+    free(wname);
+}
+
 static void
 do_test(krb5_context context, const char *prefix, krb5_boolean delete)
 {
@@ -436,6 +635,7 @@ main(void)
     test_misc(context);
     do_test(context, "WRFILE:", FALSE);
     do_test(context, "MEMORY:", TRUE);
+    test_index(context);
 
     krb5_free_context(context);
     return 0;
@@ -54,6 +54,7 @@
 #include <ctype.h>
 #include "brand.c"
 #include "../krb5_libinit.h"
+#include "prof_int.h"        /* for profile_copy and friends, not public */
 
 /* The des-mdX entries are last for now, because it's easy to
    configure KDCs to issue TGTs with des-mdX keys and then not accept
@@ -99,6 +100,205 @@ get_boolean(krb5_context ctx, const char *name, int def_val, int *boolean_out)
     return retval;
 }
 
+/*
+ * The [libdefaults] values read when a context is created are cached, along
+ * with a copy of the profile they were read from.  The copy shares the
+ * profile library's parsed file data, which also keeps that data in memory
+ * between contexts.  A new context whose profile uses the same file data,
+ * none of which has been reloaded since the values were read, copies the
+ * cached values instead of looking each one up.  Opening the new context's
+ * profile still checks the files for changes, as before.
+ */
+struct libdefaults {
+    profile_t profile;
+    unsigned long reload_count;
+    krb5_boolean allow_weak_crypto;
+    krb5_boolean ignore_acceptor_hostname;
+    krb5_deltat clockskew;
+    krb5_cksumtype kdc_req_sumtype;
+    krb5_cksumtype default_ap_req_sumtype;
+    krb5_cksumtype default_safe_sumtype;
+    krb5_flags kdc_default_options;
+    krb5_flags library_options;
+    char *plugin_base_dir;
+    int fcc_default_format;
+};
+
+static k5_mutex_t libdefaults_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct libdefaults *libdefaults_cache;
+
+static void
+free_libdefaults(struct libdefaults *ld)
+{
+    if (ld == NULL)
+        return;
+    if (ld->profile != NULL)
+        profile_release(ld->profile);
+    free(ld->plugin_base_dir);
+    free(ld);
+}
+
+int
+krb5int_libdefaults_initialize(void)
+{
+    return k5_mutex_finish_init(&libdefaults_lock);
+}
+
+void
+krb5int_libdefaults_finalize(void)
+{
+    k5_mutex_destroy(&libdefaults_lock);
+    if (libdefaults_cache == NULL)
+        return;
+    /* The profile library may already have been finalized, so leave the
+     * profile copy (like the profile library's own shared data) alone. */
+    libdefaults_cache->profile = NULL;
+    free_libdefaults(libdefaults_cache);
+    libdefaults_cache = NULL;
+}
+
+/* Read the [libdefaults] values used by every context from ctx's profile. */
+static krb5_error_code
+read_libdefaults(krb5_context ctx, struct libdefaults *ld)
+{
+    krb5_error_code retval;
+    int tmp;
+
+    retval = get_boolean(ctx, KRB5_CONF_ALLOW_WEAK_CRYPTO, 0, &tmp);
+    if (retval)
+        return retval;
+    ld->allow_weak_crypto = tmp;
+
+    retval = get_boolean(ctx, KRB5_CONF_IGNORE_ACCEPTOR_HOSTNAME, 0, &tmp);
+    if (retval)
+        return retval;
+    ld->ignore_acceptor_hostname = tmp;
+
+    get_integer(ctx, KRB5_CONF_CLOCKSKEW, DEFAULT_CLOCKSKEW, &tmp);
+    ld->clockskew = tmp;
+
+#if 0
+    /* Default ticket lifetime is currently not supported */
+    profile_get_integer(ctx->profile, KRB5_CONF_LIBDEFAULTS, "tkt_lifetime",
+                        0, 10 * 60 * 60, &tmp);
+    ctx->tkt_lifetime = tmp;
+#endif
+
+    /* DCE 1.1 and below only support CKSUMTYPE_RSA_MD4 (2)  */
+    /* DCE add kdc_req_checksum_type = 2 to krb5.conf */
+    get_integer(ctx, KRB5_CONF_KDC_REQ_CHECKSUM_TYPE, CKSUMTYPE_RSA_MD5,
+                &tmp);
+    ld->kdc_req_sumtype = tmp;
+
+    get_integer(ctx, KRB5_CONF_AP_REQ_CHECKSUM_TYPE, 0, &tmp);
+    ld->default_ap_req_sumtype = tmp;
+
+    get_integer(ctx, KRB5_CONF_SAFE_CHECKSUM_TYPE, CKSUMTYPE_RSA_MD5_DES,
+                &tmp);
+    ld->default_safe_sumtype = tmp;
+
+    get_integer(ctx, KRB5_CONF_KDC_DEFAULT_OPTIONS, KDC_OPT_RENEWABLE_OK,
+                &tmp);
+    ld->kdc_default_options = tmp;
+#define DEFAULT_KDC_TIMESYNC 1
+    get_integer(ctx, KRB5_CONF_KDC_TIMESYNC, DEFAULT_KDC_TIMESYNC, &tmp);
+    ld->library_options = tmp ? KRB5_LIBOPT_SYNC_KDCTIME : 0;
+
+    retval = profile_get_string(ctx->profile, KRB5_CONF_LIBDEFAULTS,
+                                KRB5_CONF_PLUGIN_BASE_DIR, 0,
+                                DEFAULT_PLUGIN_BASE_DIR,
+                                &ld->plugin_base_dir);
+    if (retval) {
+        TRACE_PROFILE_ERR(ctx, KRB5_CONF_PLUGIN_BASE_DIR,
+                          KRB5_CONF_LIBDEFAULTS, retval);
+        return retval;
+    }
+
+    /*
+     * We use a default file credentials cache of 3.  See
+     * lib/krb5/krb/ccache/file/fcc.h for a description of the
+     * credentials cache types.
+     *
+     * Note: DCE 1.0.3a only supports a cache type of 1
+     *      DCE 1.1 supports a cache type of 2.
+     */
+#define DEFAULT_CCACHE_TYPE 4
+    get_integer(ctx, KRB5_CONF_CCACHE_TYPE, DEFAULT_CCACHE_TYPE, &tmp);
+    ld->fcc_default_format = tmp + 0x0500;
+    return 0;
+}
+
+/* Set ctx's [libdefaults] values from ld. */
+static krb5_error_code
+apply_libdefaults(krb5_context ctx, const struct libdefaults *ld)
+{
+    ctx->plugin_base_dir = strdup(ld->plugin_base_dir);
+    if (ctx->plugin_base_dir == NULL)
+        return ENOMEM;
+    ctx->allow_weak_crypto = ld->allow_weak_crypto;
+    ctx->ignore_acceptor_hostname = ld->ignore_acceptor_hostname;
+    ctx->clockskew = ld->clockskew;
+    ctx->kdc_req_sumtype = ld->kdc_req_sumtype;
+    ctx->default_ap_req_sumtype = ld->default_ap_req_sumtype;
+    ctx->default_safe_sumtype = ld->default_safe_sumtype;
+    ctx->kdc_default_options = ld->kdc_default_options;
+    ctx->library_options = ld->library_options;
+    ctx->fcc_default_format = ld->fcc_default_format;
+    return 0;
+}
+
+/* Set ctx's [libdefaults] values, from the cache if possible. */
+static krb5_error_code
+get_libdefaults(krb5_context ctx)
+{
+    krb5_error_code retval;
+    struct libdefaults *ld, *old;
+    unsigned long reload_count;
+
+    /* Get the count before reading any values, so that a reload while we
+     * read them is noticed by the next context. */
+    reload_count = profile_reload_count();
+
+    retval = k5_mutex_lock(&libdefaults_lock);
+    if (retval)
+        return retval;
+    ld = libdefaults_cache;
+    if (ld != NULL && ld->reload_count == reload_count &&
+        profile_shares_data(ld->profile, ctx->profile)) {
+        retval = apply_libdefaults(ctx, ld);
+        k5_mutex_unlock(&libdefaults_lock);
+        return retval;
+    }
+    k5_mutex_unlock(&libdefaults_lock);
+
+    ld = calloc(1, sizeof(*ld));
+    if (ld == NULL)
+        return ENOMEM;
+    retval = read_libdefaults(ctx, ld);
+    if (retval)
+        goto cleanup;
+    retval = apply_libdefaults(ctx, ld);
+    if (retval)
+        goto cleanup;
+
+    /* Cache the values if the profile is backed by shared file data. */
+    if (!profile_shares_data(ctx->profile, ctx->profile) ||
+        profile_copy(ctx->profile, &ld->profile) != 0 ||
+        !profile_shares_data(ld->profile, ctx->profile))
+        goto cleanup;
+    ld->reload_count = reload_count;
+    if (k5_mutex_lock(&libdefaults_lock) != 0)
+        goto cleanup;
+    old = libdefaults_cache;
+    libdefaults_cache = ld;
+    ld = old;
+    k5_mutex_unlock(&libdefaults_lock);
+
+cleanup:
+    free_libdefaults(ld);
+    return retval;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_init_context(krb5_context *context)
 {
@@ -141,7 +341,6 @@ krb5_init_context_profile(profile_t profile, krb5_flags flags,
         long pid;
     } seed_data;
     krb5_data seed;
-    int tmp;
 
     /* Verify some assumptions.  If the assumptions hold and the
        compiler is optimizing, this should result in no code being
@@ -198,16 +397,6 @@ krb5_init_context_profile(profile_t profile, krb5_flags flags,
         krb5int_init_trace(ctx);
 #endif
 
-    retval = get_boolean(ctx, KRB5_CONF_ALLOW_WEAK_CRYPTO, 0, &tmp);
-    if (retval)
-        goto cleanup;
-    ctx->allow_weak_crypto = tmp;
-
-    retval = get_boolean(ctx, KRB5_CONF_IGNORE_ACCEPTOR_HOSTNAME, 0, &tmp);
-    if (retval)
-        goto cleanup;
-    ctx->ignore_acceptor_hostname = tmp;
-
     /* initialize the prng (not well, but passable) */
     if ((retval = krb5_c_random_os_entropy( ctx, 0, NULL)) !=0)
         goto cleanup;
@@ -220,57 +409,10 @@ krb5_init_context_profile(profile_t profile, krb5_flags flags,
         goto cleanup;
 
     ctx->default_realm = 0;
-    get_integer(ctx, KRB5_CONF_CLOCKSKEW, DEFAULT_CLOCKSKEW, &tmp);
-    ctx->clockskew = tmp;
-
-#if 0
-    /* Default ticket lifetime is currently not supported */
-    profile_get_integer(ctx->profile, KRB5_CONF_LIBDEFAULTS, "tkt_lifetime",
-                        0, 10 * 60 * 60, &tmp);
-    ctx->tkt_lifetime = tmp;
-#endif
-
-    /* DCE 1.1 and below only support CKSUMTYPE_RSA_MD4 (2)  */
-    /* DCE add kdc_req_checksum_type = 2 to krb5.conf */
-    get_integer(ctx, KRB5_CONF_KDC_REQ_CHECKSUM_TYPE, CKSUMTYPE_RSA_MD5,
-                &tmp);
-    ctx->kdc_req_sumtype = tmp;
-
-    get_integer(ctx, KRB5_CONF_AP_REQ_CHECKSUM_TYPE, 0, &tmp);
-    ctx->default_ap_req_sumtype = tmp;
-
-    get_integer(ctx, KRB5_CONF_SAFE_CHECKSUM_TYPE, CKSUMTYPE_RSA_MD5_DES,
-                &tmp);
-    ctx->default_safe_sumtype = tmp;
-
-    get_integer(ctx, KRB5_CONF_KDC_DEFAULT_OPTIONS, KDC_OPT_RENEWABLE_OK,
-                &tmp);
-    ctx->kdc_default_options = tmp;
-#define DEFAULT_KDC_TIMESYNC 1
-    get_integer(ctx, KRB5_CONF_KDC_TIMESYNC, DEFAULT_KDC_TIMESYNC, &tmp);
-    ctx->library_options = tmp ? KRB5_LIBOPT_SYNC_KDCTIME : 0;
-
-    retval = profile_get_string(ctx->profile, KRB5_CONF_LIBDEFAULTS,
-                                KRB5_CONF_PLUGIN_BASE_DIR, 0,
-                                DEFAULT_PLUGIN_BASE_DIR,
-                                &ctx->plugin_base_dir);
-    if (retval) {
-        TRACE_PROFILE_ERR(ctx, KRB5_CONF_PLUGIN_BASE_DIR,
-                          KRB5_CONF_LIBDEFAULTS, retval);
+    retval = get_libdefaults(ctx);
+    if (retval)
         goto cleanup;
-    }
 
-    /*
-     * We use a default file credentials cache of 3.  See
-     * lib/krb5/krb/ccache/file/fcc.h for a description of the
-     * credentials cache types.
-     *
-     * Note: DCE 1.0.3a only supports a cache type of 1
-     *      DCE 1.1 supports a cache type of 2.
-     */
-#define DEFAULT_CCACHE_TYPE 4
-    get_integer(ctx, KRB5_CONF_CCACHE_TYPE, DEFAULT_CCACHE_TYPE, &tmp);
-    ctx->fcc_default_format = tmp + 0x0500;
     ctx->prompt_types = 0;
     ctx->use_conf_ktypes = 0;
     ctx->udp_pref_limit = -1;
@@ -0,0 +1,120 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/krb/t_init_ctx.c - Test context libdefaults caching */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Check that contexts created from an unchanged configuration file get the
+ * same [libdefaults] values, and that contexts created after the file
+ * changes, or from a different file, see the new values.
+ */
+
+#include "k5-int.h"
+#include <utime.h>
+
+#define CONF1 "./t_init_ctx1.conf"
+#define CONF2 "./t_init_ctx2.conf"
+
+static void
+write_conf(const char *filename, int skew)
+{
+    FILE *f;
+
+    f = fopen(filename, "w");
+    assert(f != NULL);
+    fprintf(f, "[libdefaults]\n\tclockskew = %d\n", skew);
+    if (skew % 2)
+        fprintf(f, "\tallow_weak_crypto = true\n");
+    fclose(f);
+}
+
+/* Move filename's modification time forward, so that the profile library
+ * sees a change regardless of the file system's timestamp granularity. */
+static void
+bump_mtime(const char *filename)
+{
+    struct stat st;
+    struct utimbuf times;
+
+    assert(stat(filename, &st) == 0);
+    times.actime = st.st_atime;
+    times.modtime = st.st_mtime + 10;
+    assert(utime(filename, &times) == 0);
+}
+
+/* Wait until the clock reaches the next second.  The profile library checks
+ * a file for changes at most once a second. */
+static void
+wait_for_tick(void)
+{
+    time_t now = time(NULL);
+
+    while (time(NULL) == now)
+        usleep(10000);
+}
+
+static void
+check_skew(const char *filename, int skew)
+{
+    krb5_context ctx;
+
+    assert(setenv("KRB5_CONFIG", filename, 1) == 0);
+    assert(krb5_init_context(&ctx) == 0);
+    if (ctx->clockskew != skew ||
+        ctx->allow_weak_crypto != ((skew % 2) != 0)) {
+        fprintf(stderr, "Expected clockskew %d from %s, got %d\n", skew,
+                filename, (int)ctx->clockskew);
+        exit(1);
+    }
+    krb5_free_context(ctx);
+}
+
+int
+main()
+{
+    write_conf(CONF1, 100);
+    write_conf(CONF2, 301);
+    check_skew(CONF1, 100);
+    check_skew(CONF1, 100);
+    check_skew(CONF2, 301);
+    check_skew(CONF1, 100);
+
+    write_conf(CONF1, 201);
+    bump_mtime(CONF1);
+    wait_for_tick();
+    check_skew(CONF1, 201);
+    check_skew(CONF1, 201);
+    check_skew(CONF2, 301);
+
+    unlink(CONF1);
+    unlink(CONF2);
+    return 0;
+}
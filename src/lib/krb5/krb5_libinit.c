@@ -55,6 +55,9 @@ int krb5int_lib_init(void)
     if (err)
         return err;
     err = k5_mutex_finish_init(&krb5int_us_time_mutex);
+    if (err)
+        return err;
+    err = krb5int_libdefaults_initialize();
     if (err)
         return err;
 
@@ -85,6 +88,7 @@ void krb5int_lib_fini(void)
 #endif
 
     k5_mutex_destroy(&krb5int_us_time_mutex);
+    krb5int_libdefaults_finalize();
 
     krb5int_cc_finalize();
 #ifndef LEAN_CLIENT
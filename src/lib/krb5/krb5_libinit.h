@@ -7,4 +7,8 @@
 krb5_error_code krb5int_initialize_library (void);
 void krb5int_cleanup_library (void);
 
+/* Manage the cache of [libdefaults] values in krb/init_ctx.c. */
+int krb5int_libdefaults_initialize (void);
+void krb5int_libdefaults_finalize (void);
+
 #endif /* KRB5_LIBINIT_H */
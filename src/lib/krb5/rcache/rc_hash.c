@@ -0,0 +1,727 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/rc_hash.c - Memory-mapped hash table replay cache type */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The "hash" replay cache type stores fixed-size records in a file which is
+ * mapped into the memory of every process using the cache.  Each record holds
+ * an authenticator timestamp and a tag, which is a truncated SHA-1 hash of
+ * the client and server names, the message hash if there is one, and the
+ * timestamp.  A record whose timestamp is older than the cache lifespan is
+ * expired and its slot is simply reused, so the file never needs to be
+ * rewritten.
+ *
+ * The file consists of a header followed by a sequence of hash tables, each
+ * twice as large as the one before it.  A tag maps to one bucket of
+ * SLOTS_PER_BUCKET records in each table, and a store checks the tag's bucket
+ * in every table.  If none of those buckets has a free or expired slot, a new
+ * table is appended to the file; processes sharing the cache notice the
+ * larger table count in the header and remap the file.  Stores are
+ * serialized between processes with an exclusive lock on the file.
+ *
+ * Initializing a named cache empties the existing file in place, shrinking it
+ * back to one table, and increments the generation count in the header.
+ * Processes which have the file mapped notice the new generation the next
+ * time they lock it and remap the file, so they keep sharing the same records
+ * instead of holding on to a stale copy.
+ *
+ * By default each store is flushed to disk with msync() before it returns.
+ * If rcache_sync is set to false in [libdefaults], stores are left to the
+ * operating system to write back, which is still safe against process
+ * crashes and restarts but not against a system crash.
+ *
+ * A record with a message hash does not match a record for the same
+ * authenticator without one, as it would in the dfl type; since the message
+ * hash is always supplied by krb5_rd_req(), this does not matter in practice.
+ */
+
+#include "k5-int.h"
+#include "rc-int.h"
+#include "rc_io.h"
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+
+#define HRC_MAGIC 0x4b524843    /* "KRHC" */
+#define HRC_VERSION 1
+
+#define TAG_LENGTH 12
+#define SLOTS_PER_BUCKET 8
+#define INITIAL_BUCKETS 1024
+#define MAX_TABLES 12
+
+struct hrc_slot {
+    krb5_timestamp stamp;       /* Authenticator timestamp, or 0 if empty */
+    unsigned char tag[TAG_LENGTH];
+};
+
+#define BUCKET_SIZE (SLOTS_PER_BUCKET * sizeof(struct hrc_slot))
+
+/* The header occupies the first bucket's worth of the file, so that the
+ * tables are aligned. */
+struct hrc_header {
+    krb5_ui_4 magic;
+    krb5_ui_4 version;
+    krb5_deltat lifespan;
+    krb5_ui_4 ntables;
+    krb5_ui_4 generation;
+};
+
+#define HEADER_SIZE BUCKET_SIZE
+
+struct hash_data {
+    char *name;
+    char *fn;
+    int fd;
+    krb5_boolean sync;
+    krb5_deltat lifespan;
+    unsigned char *map;
+    size_t mapsize;
+    unsigned int ntables;       /* Number of tables covered by map */
+    krb5_ui_4 generation;       /* Generation of the file when mapped */
+};
+
+/* Return the size of a cache file containing ntables tables. */
+static size_t
+file_size(unsigned int ntables)
+{
+    return HEADER_SIZE + BUCKET_SIZE * INITIAL_BUCKETS *
+        (((size_t)1 << ntables) - 1);
+}
+
+/* Return the bucket for hashval in table i of a mapped cache file. */
+static struct hrc_slot *
+get_bucket(struct hash_data *t, unsigned int i, krb5_ui_4 hashval)
+{
+    size_t nbuckets = (size_t)INITIAL_BUCKETS << i;
+    size_t bucket = hashval & (nbuckets - 1);
+
+    return (struct hrc_slot *)(t->map + file_size(i) + bucket * BUCKET_SIZE);
+}
+
+static struct hrc_header *
+get_header(struct hash_data *t)
+{
+    return (struct hrc_header *)t->map;
+}
+
+/* Flush the pages containing len bytes at ptr in the mapped file to disk, if
+ * synchronous stores are configured. */
+static krb5_error_code
+sync_range(krb5_context context, struct hash_data *t, void *ptr, size_t len)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t start = ((unsigned char *)ptr - t->map) / pagesize * pagesize;
+    size_t end = (unsigned char *)ptr - t->map + len;
+
+    if (!t->sync)
+        return 0;
+    if (msync(t->map + start, end - start, MS_SYNC) != 0)
+        return krb5_rc_io_map_errno(context, errno, t->fn, "sync");
+    return 0;
+}
+
+/* Compute the tag and hash value for rep. */
+static krb5_error_code
+make_tag(krb5_context context, krb5_donot_replay *rep,
+         unsigned char tag[TAG_LENGTH], krb5_ui_4 *hashval_out)
+{
+    krb5_error_code ret;
+    struct k5buf buf;
+    krb5_checksum cksum;
+    krb5_data d;
+    char *msghash = (rep->msghash != NULL) ? rep->msghash : "";
+
+    krb5int_buf_init_dynamic(&buf);
+    krb5int_buf_add_len(&buf, rep->client, strlen(rep->client) + 1);
+    krb5int_buf_add_len(&buf, rep->server, strlen(rep->server) + 1);
+    krb5int_buf_add_len(&buf, msghash, strlen(msghash) + 1);
+    krb5int_buf_add_len(&buf, (char *)&rep->ctime, sizeof(rep->ctime));
+    krb5int_buf_add_len(&buf, (char *)&rep->cusec, sizeof(rep->cusec));
+    if (krb5int_buf_data(&buf) == NULL)
+        return KRB5_RC_MALLOC;
+    d = make_data(krb5int_buf_data(&buf), krb5int_buf_len(&buf));
+
+    ret = krb5_c_make_checksum(context, CKSUMTYPE_NIST_SHA, NULL, 0, &d,
+                               &cksum);
+    krb5int_free_buf(&buf);
+    if (ret)
+        return ret;
+    assert(cksum.length >= TAG_LENGTH + 4);
+    memcpy(tag, cksum.contents, TAG_LENGTH);
+    *hashval_out = load_32_le(cksum.contents + TAG_LENGTH);
+    krb5_free_checksum_contents(context, &cksum);
+    return 0;
+}
+
+static void
+unmap_file(struct hash_data *t)
+{
+    if (t->map != NULL)
+        munmap(t->map, t->mapsize);
+    t->map = NULL;
+    t->mapsize = 0;
+    t->ntables = 0;
+}
+
+static void
+close_file(struct hash_data *t)
+{
+    unmap_file(t);
+    if (t->fd != -1)
+        close(t->fd);
+    t->fd = -1;
+    free(t->fn);
+    t->fn = NULL;
+}
+
+/* Map the first ntables tables of the open cache file. */
+static krb5_error_code
+map_file(krb5_context context, struct hash_data *t, unsigned int ntables)
+{
+    void *map;
+    size_t size = file_size(ntables);
+
+    unmap_file(t);
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (map == MAP_FAILED)
+        return krb5_rc_io_map_errno(context, errno, t->fn, "map");
+    t->map = map;
+    t->mapsize = size;
+    t->ntables = ntables;
+    return 0;
+}
+
+/* Make sure that the open file is a regular file accessible only by us, as
+ * krb5_rc_io_open() does for dfl replay caches. */
+static krb5_error_code
+check_file(krb5_context context, struct hash_data *t, struct stat *sb)
+{
+    if (fstat(t->fd, sb) != 0)
+        return krb5_rc_io_map_errno(context, errno, t->fn, "fstat");
+    if (!S_ISREG(sb->st_mode)) {
+        krb5_set_error_message(context, KRB5_RC_IO_PERM,
+                               "rcache not a file %s", t->fn);
+        return KRB5_RC_IO_PERM;
+    }
+#ifndef NO_USERID
+    if (sb->st_uid != geteuid()) {
+        krb5_set_error_message(context, KRB5_RC_IO_PERM,
+                               _("rcache not owned by %d"), (int)geteuid());
+        return KRB5_RC_IO_PERM;
+    }
+#endif
+    if (sb->st_mode & 077) {
+        krb5_set_error_message(context, KRB5_RC_IO_UNKNOWN,
+                               _("Insecure file mode for replay cache file "
+                                 "%s"), t->fn);
+        return KRB5_RC_IO_UNKNOWN;
+    }
+    return 0;
+}
+
+/*
+ * Empty the open cache file in place, leaving a header and an empty first
+ * table, and map it.  Give the file a generation one greater than its current
+ * one so that other processes with the file mapped will remap it.  The file
+ * must be locked.  The file is shrunk rather than truncated to zero length, so
+ * that the header remains accessible to other processes if this fails.
+ */
+static krb5_error_code
+format_file(krb5_context context, struct hash_data *t, krb5_deltat lifespan)
+{
+    krb5_error_code ret;
+    struct hrc_header *hdr, old;
+    krb5_ui_4 generation = 1;
+
+    if (pread(t->fd, &old, sizeof(old), 0) == sizeof(old) &&
+        old.magic == HRC_MAGIC)
+        generation = old.generation + 1;
+    unmap_file(t);
+    if (ftruncate(t->fd, file_size(1)) != 0)
+        return krb5_rc_io_map_errno(context, errno, t->fn, "extend");
+    ret = map_file(context, t, 1);
+    if (ret)
+        return ret;
+    memset(t->map, 0, t->mapsize);
+    hdr = get_header(t);
+    hdr->magic = HRC_MAGIC;
+    hdr->version = HRC_VERSION;
+    hdr->lifespan = lifespan;
+    hdr->ntables = 1;
+    hdr->generation = generation;
+    t->lifespan = lifespan;
+    t->generation = generation;
+    return sync_range(context, t, t->map, t->mapsize);
+}
+
+/* Validate the header of the open cache file and map all of its tables. */
+static krb5_error_code
+load_file(krb5_context context, struct hash_data *t, struct stat *sb)
+{
+    struct hrc_header hdr;
+
+    if ((size_t)sb->st_size < HEADER_SIZE ||
+        pread(t->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != HRC_MAGIC || hdr.version != HRC_VERSION ||
+        hdr.ntables < 1 || hdr.ntables > MAX_TABLES ||
+        (size_t)sb->st_size < file_size(hdr.ntables))
+        return KRB5_RCACHE_BADVNO;
+    t->lifespan = hdr.lifespan;
+    t->generation = hdr.generation;
+    return map_file(context, t, hdr.ntables);
+}
+
+/* If another process has added tables to the cache file or reinitialized it,
+ * remap it.  The file must be locked. */
+static krb5_error_code
+refresh_map(krb5_context context, struct hash_data *t)
+{
+    struct hrc_header *hdr = get_header(t);
+    unsigned int ntables = hdr->ntables;
+
+    if (hdr->magic != HRC_MAGIC || ntables < 1 || ntables > MAX_TABLES)
+        return KRB5_RC_IO_UNKNOWN;
+    if (hdr->generation != t->generation) {
+        /* The file was emptied in place; none of our map beyond the first
+         * table may still be backed by the file. */
+        t->generation = hdr->generation;
+        t->lifespan = hdr->lifespan;
+        return map_file(context, t, ntables);
+    }
+    if (ntables == t->ntables)
+        return 0;
+    if (ntables < t->ntables)
+        return KRB5_RC_IO_UNKNOWN;
+    return map_file(context, t, ntables);
+}
+
+/* Append a table to the cache file.  The file must be locked. */
+static krb5_error_code
+add_table(krb5_context context, struct hash_data *t)
+{
+    krb5_error_code ret;
+    unsigned int ntables = t->ntables + 1;
+    struct hrc_header *hdr;
+
+    if (ntables > MAX_TABLES)
+        return KRB5_RC_IO_SPACE;
+    if (ftruncate(t->fd, file_size(ntables)) != 0)
+        return krb5_rc_io_map_errno(context, errno, t->fn, "extend");
+    ret = map_file(context, t, ntables);
+    if (ret)
+        return ret;
+    hdr = get_header(t);
+    hdr->ntables = ntables;
+    return sync_range(context, t, hdr, sizeof(*hdr));
+}
+
+static krb5_error_code
+lock_file(krb5_context context, struct hash_data *t)
+{
+    krb5_error_code ret;
+
+    ret = krb5_lock_file(context, t->fd, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret)
+        return ret;
+    ret = refresh_map(context, t);
+    if (ret)
+        (void)krb5_lock_file(context, t->fd, KRB5_LOCKMODE_UNLOCK);
+    return ret;
+}
+
+static void
+unlock_file(krb5_context context, struct hash_data *t)
+{
+    (void)krb5_lock_file(context, t->fd, KRB5_LOCKMODE_UNLOCK);
+}
+
+static krb5_error_code
+make_path(struct hash_data *t)
+{
+    free(t->fn);
+    if (asprintf(&t->fn, "%s/%s", krb5_rc_io_dir(), t->name) < 0) {
+        t->fn = NULL;
+        return KRB5_RC_IO_MALLOC;
+    }
+    return 0;
+}
+
+/* Open the named cache file, creating it if create is true. */
+static krb5_error_code
+open_file(krb5_context context, struct hash_data *t, krb5_boolean create)
+{
+    krb5_error_code ret;
+    struct stat sb;
+    int flags = O_RDWR;
+
+    close_file(t);
+    ret = make_path(t);
+    if (ret)
+        return ret;
+#ifdef O_NOFOLLOW
+    flags |= O_NOFOLLOW;
+#endif
+    if (create)
+        flags |= O_CREAT;
+    t->fd = THREEPARAMOPEN(t->fn, flags, 0600);
+    if (t->fd == -1) {
+        ret = krb5_rc_io_map_errno(context, errno, t->fn, "open");
+        close_file(t);
+        return ret;
+    }
+    set_cloexec_fd(t->fd);
+    ret = check_file(context, t, &sb);
+    if (ret)
+        close_file(t);
+    return ret;
+}
+
+/*
+ * Empty the cache file, creating it if necessary.  A named cache file is
+ * reinitialized in place under the lock, so that processes with the file
+ * mapped see the change.  If the cache has no name, create a new file with a
+ * unique name and name the cache after it.
+ */
+static krb5_error_code
+init_locked(krb5_context context, krb5_rcache id, krb5_deltat lifespan)
+{
+    krb5_error_code ret;
+    struct hash_data *t = id->data;
+    char *base;
+
+    if (lifespan == 0)
+        lifespan = context->clockskew;
+
+    if (t->name != NULL) {
+        ret = open_file(context, t, TRUE);
+        if (ret)
+            return ret;
+    } else {
+        close_file(t);
+        if (asprintf(&t->fn, "%s/krb5_RCXXXXXX", krb5_rc_io_dir()) < 0) {
+            t->fn = NULL;
+            return KRB5_RC_IO_MALLOC;
+        }
+        t->fd = mkstemp(t->fn);
+        if (t->fd == -1) {
+            ret = krb5_rc_io_map_errno(context, errno, t->fn, "create");
+            close_file(t);
+            return ret;
+        }
+        set_cloexec_fd(t->fd);
+        base = strrchr(t->fn, '/') + 1;
+        t->name = strdup(base);
+        if (t->name == NULL) {
+            (void)unlink(t->fn);
+            close_file(t);
+            return KRB5_RC_IO_MALLOC;
+        }
+    }
+
+    ret = krb5_lock_file(context, t->fd, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret)
+        goto cleanup;
+    ret = format_file(context, t, lifespan);
+    unlock_file(context, t);
+
+cleanup:
+    if (ret)
+        close_file(t);
+    return ret;
+}
+
+/* Open and map an existing cache file.  If create is true, create the file if
+ * it doesn't exist, and reinitialize it if it is not a hash replay cache. */
+static krb5_error_code
+open_locked(krb5_context context, krb5_rcache id, krb5_boolean create,
+            krb5_deltat lifespan)
+{
+    krb5_error_code ret;
+    struct hash_data *t = id->data;
+    struct stat sb;
+
+    if (t->name == NULL)
+        return create ? init_locked(context, id, lifespan) : KRB5_RC_IO_IO;
+
+    ret = open_file(context, t, create);
+    if (ret)
+        return ret;
+    ret = krb5_lock_file(context, t->fd, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret)
+        goto cleanup;
+    /* Check the size now that we hold the lock, in case another process
+     * formatted the file while we waited. */
+    if (fstat(t->fd, &sb) != 0)
+        ret = krb5_rc_io_map_errno(context, errno, t->fn, "fstat");
+    else if (sb.st_size == 0 && create)
+        ret = KRB5_RCACHE_BADVNO;
+    else
+        ret = load_file(context, t, &sb);
+    if (ret == KRB5_RCACHE_BADVNO && create) {
+        /* Empty, or perhaps a cache of another type with the same name. */
+        ret = format_file(context, t,
+                          lifespan ? lifespan : context->clockskew);
+    }
+    unlock_file(context, t);
+
+cleanup:
+    if (ret)
+        close_file(t);
+    return ret;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_init(krb5_context context, krb5_rcache id, krb5_deltat lifespan)
+{
+    krb5_error_code ret;
+
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    ret = init_locked(context, id, lifespan);
+    k5_mutex_unlock(&id->lock);
+    return ret;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_recover(krb5_context context, krb5_rcache id)
+{
+    krb5_error_code ret;
+
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    ret = open_locked(context, id, FALSE, 0);
+    k5_mutex_unlock(&id->lock);
+    return ret;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_recover_or_init(krb5_context context, krb5_rcache id,
+                             krb5_deltat lifespan)
+{
+    krb5_error_code ret;
+
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    ret = open_locked(context, id, TRUE, lifespan);
+    k5_mutex_unlock(&id->lock);
+    return ret;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_close(krb5_context context, krb5_rcache id)
+{
+    struct hash_data *t = id->data;
+
+    close_file(t);
+    free(t->name);
+    free(t);
+    k5_mutex_destroy(&id->lock);
+    free(id);
+    return 0;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_destroy(krb5_context context, krb5_rcache id)
+{
+    struct hash_data *t = id->data;
+
+    if (t->fn != NULL && unlink(t->fn) != 0)
+        return KRB5_RC_IO;
+    return krb5_rc_hash_close(context, id);
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_store(krb5_context context, krb5_rcache id,
+                   krb5_donot_replay *rep)
+{
+    krb5_error_code ret;
+    struct hash_data *t = id->data;
+    struct hrc_slot *bucket, *slot = NULL;
+    unsigned char tag[TAG_LENGTH];
+    krb5_ui_4 hashval;
+    krb5_int32 now;
+    unsigned int i, j;
+
+    ret = krb5_timeofday(context, &now);
+    if (ret)
+        return ret;
+    ret = make_tag(context, rep, tag, &hashval);
+    if (ret)
+        return ret;
+
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    if (t->map == NULL) {
+        ret = KRB5_RC_IO_IO;
+        goto unlock_mutex;
+    }
+    ret = lock_file(context, t);
+    if (ret)
+        goto unlock_mutex;
+
+    /* Look for the tag in each table, remembering the first free slot. */
+    for (i = 0; i < t->ntables; i++) {
+        bucket = get_bucket(t, i, hashval);
+        for (j = 0; j < SLOTS_PER_BUCKET; j++) {
+            if (bucket[j].stamp == 0 ||
+                bucket[j].stamp + t->lifespan < now) {
+                if (slot == NULL)
+                    slot = &bucket[j];
+            } else if (bucket[j].stamp == rep->ctime &&
+                       memcmp(bucket[j].tag, tag, TAG_LENGTH) == 0) {
+                ret = KRB5KRB_AP_ERR_REPEAT;
+                goto unlock_file;
+            }
+        }
+    }
+
+    if (slot == NULL) {
+        ret = add_table(context, t);
+        if (ret)
+            goto unlock_file;
+        slot = get_bucket(t, t->ntables - 1, hashval);
+    }
+    memcpy(slot->tag, tag, TAG_LENGTH);
+    slot->stamp = rep->ctime;
+    ret = sync_range(context, t, slot, sizeof(*slot));
+
+unlock_file:
+    unlock_file(context, t);
+unlock_mutex:
+    k5_mutex_unlock(&id->lock);
+    return ret;
+}
+
+/* Clear expired records.  Stores reuse expired slots anyway, so this is only
+ * useful to make the file contents reflect the live records. */
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_expunge(krb5_context context, krb5_rcache id)
+{
+    krb5_error_code ret;
+    struct hash_data *t = id->data;
+    struct hrc_slot *slot, *end;
+    krb5_int32 now;
+
+    ret = krb5_timeofday(context, &now);
+    if (ret)
+        return ret;
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    if (t->map == NULL) {
+        ret = KRB5_RC_IO_IO;
+        goto unlock_mutex;
+    }
+    ret = lock_file(context, t);
+    if (ret)
+        goto unlock_mutex;
+
+    slot = (struct hrc_slot *)(t->map + HEADER_SIZE);
+    end = (struct hrc_slot *)(t->map + t->mapsize);
+    for (; slot < end; slot++) {
+        if (slot->stamp != 0 && slot->stamp + t->lifespan < now)
+            memset(slot, 0, sizeof(*slot));
+    }
+    ret = sync_range(context, t, t->map, t->mapsize);
+
+    unlock_file(context, t);
+unlock_mutex:
+    k5_mutex_unlock(&id->lock);
+    return ret;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_get_span(krb5_context context, krb5_rcache id,
+                      krb5_deltat *lifespan)
+{
+    krb5_error_code ret;
+
+    ret = k5_mutex_lock(&id->lock);
+    if (ret)
+        return ret;
+    *lifespan = ((struct hash_data *)id->data)->lifespan;
+    k5_mutex_unlock(&id->lock);
+    return 0;
+}
+
+static char * KRB5_CALLCONV
+krb5_rc_hash_get_name(krb5_context context, krb5_rcache id)
+{
+    return ((struct hash_data *)id->data)->name;
+}
+
+static krb5_error_code KRB5_CALLCONV
+krb5_rc_hash_resolve(krb5_context context, krb5_rcache id, char *name)
+{
+    struct hash_data *t;
+    int sync;
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return KRB5_RC_MALLOC;
+    t->fd = -1;
+    if (name != NULL) {
+        t->name = strdup(name);
+        if (t->name == NULL) {
+            free(t);
+            return KRB5_RC_MALLOC;
+        }
+    }
+    if (profile_get_boolean(context->profile, KRB5_CONF_LIBDEFAULTS,
+                            KRB5_CONF_RCACHE_SYNC, NULL, TRUE, &sync) != 0)
+        sync = TRUE;
+    t->sync = sync;
+    id->data = t;
+    return 0;
+}
+
+const krb5_rc_ops krb5_rc_hash_ops = {
+    0,
+    "hash",
+    krb5_rc_hash_init,
+    krb5_rc_hash_recover,
+    krb5_rc_hash_recover_or_init,
+    krb5_rc_hash_destroy,
+    krb5_rc_hash_close,
+    krb5_rc_hash_store,
+    krb5_rc_hash_expunge,
+    krb5_rc_hash_get_span,
+    krb5_rc_hash_get_name,
+    krb5_rc_hash_resolve
+};
+
+#endif /* not _WIN32 */
@@ -41,10 +41,11 @@
 
 #define UNIQUE getpid() /* hopefully unique number */
 
-#define GETDIR (dir = getdir(), dirlen = strlen(dir) + sizeof(PATH_SEPARATOR) - 1)
+#define GETDIR (dir = krb5_rc_io_dir(), dirlen = strlen(dir) + sizeof(PATH_SEPARATOR) - 1)
 
-static char *
-getdir(void)
+/* Return the directory in which replay cache files are created. */
+char *
+krb5_rc_io_dir(void)
 {
     char *dir;
 
@@ -118,13 +119,11 @@ krb5_rc_io_mkstemp(krb5_context context, krb5_rc_iostuff *d, char *dir)
     return 0;
 }
 
-#if 0
-static krb5_error_code rc_map_errno (int) __attribute__((cold));
-#endif
-
-static krb5_error_code
-rc_map_errno (krb5_context context, int e, const char *fn,
-              const char *operation)
+/* Map errno value e from operation on replay cache file fn to an error code,
+ * setting an error message where appropriate. */
+krb5_error_code
+krb5_rc_io_map_errno(krb5_context context, int e, const char *fn,
+                     const char *operation)
 {
     switch (e) {
     case EFBIG:
@@ -184,7 +183,7 @@ krb5_rc_io_creat(krb5_context context, krb5_rc_iostuff *d, char **fn)
         }
     }
     if (d->fd == -1) {
-        retval = rc_map_errno(context, errno, d->fn, "create");
+        retval = krb5_rc_io_map_errno(context, errno, d->fn, "create");
         if (retval == KRB5_RC_IO_PERM)
             do_not_unlink = 1;
         goto cleanup;
@@ -237,24 +236,24 @@ krb5_rc_io_open_internal(krb5_context context, krb5_rc_iostuff *d, char *fn,
 #ifdef NO_USERID
     d->fd = THREEPARAMOPEN(d->fn, O_RDWR | O_BINARY, 0600);
     if (d->fd == -1) {
-        retval = rc_map_errno(context, errno, d->fn, "open");
+        retval = krb5_rc_io_map_errno(context, errno, d->fn, "open");
         goto cleanup;
     }
 #else
     d->fd = -1;
     retval = lstat(d->fn, &sb1);
     if (retval != 0) {
-        retval = rc_map_errno(context, errno, d->fn, "lstat");
+        retval = krb5_rc_io_map_errno(context, errno, d->fn, "lstat");
         goto cleanup;
     }
     d->fd = THREEPARAMOPEN(d->fn, O_RDWR | O_BINARY, 0600);
     if (d->fd < 0) {
-        retval = rc_map_errno(context, errno, d->fn, "open");
+        retval = krb5_rc_io_map_errno(context, errno, d->fn, "open");
         goto cleanup;
     }
     retval = fstat(d->fd, &sb2);
     if (retval < 0) {
-        retval = rc_map_errno(context, errno, d->fn, "fstat");
+        retval = krb5_rc_io_map_errno(context, errno, d->fn, "fstat");
         goto cleanup;
     }
     /* check if someone was playing with symlinks */
@@ -57,4 +57,10 @@ krb5_rc_io_sync(krb5_context, krb5_rc_iostuff *);
 
 long
 krb5_rc_io_size(krb5_context, krb5_rc_iostuff *);
+
+char *
+krb5_rc_io_dir(void);
+
+krb5_error_code
+krb5_rc_io_map_errno(krb5_context, int, const char *, const char *);
 #endif
@@ -0,0 +1,83 @@
+#!/usr/bin/python
+from k5test import *
+import time
+
+realm = K5Realm(create_kdb=False)
+now = int(time.time())
+
+# Store a replay record for the given timestamp and microseconds, using
+# the current time, and return the output of t_replay.
+def store(rcspec, msg, stamp, usec, env=None):
+    return realm.run(['./t_replay', 'store', rcspec, 'client', 'server', msg,
+                      str(stamp), str(usec), '0', '0'], env=env)
+
+def check_store(rcspec, msg, stamp, usec, env=None):
+    output = store(rcspec, msg, stamp, usec, env)
+    if 'Entry successfully stored' not in output:
+        fail('Expected record to be stored')
+
+def check_replay(rcspec, msg, stamp, usec, env=None):
+    output = store(rcspec, msg, stamp, usec, env)
+    if 'Replay' not in output:
+        fail('Expected replay to be detected')
+
+# Each store runs in a separate process, so replays must be detected
+# through the shared file.
+check_store('hash:rc1', 'msg1', now, 0)
+check_replay('hash:rc1', 'msg1', now, 0)
+check_store('hash:rc1', 'msg1', now, 1)
+check_store('hash:rc1', 'msg2', now, 0)
+check_replay('hash:rc1', 'msg2', now, 0)
+check_store('hash:rc1', '', now, 0)
+check_replay('hash:rc1', '', now, 0)
+
+# An expired record is not a replay, and its slot can be reused.
+check_store('hash:rc1', 'msg3', now - 1000, 0)
+check_store('hash:rc1', 'msg3', now - 1000, 0)
+
+# A replay cache file of another type is replaced.
+store('dfl:rc2', 'msg1', now, 0)
+check_store('hash:rc2', 'msg1', now, 0)
+check_replay('hash:rc2', 'msg1', now, 0)
+
+# Fill the first table so that the file must grow, without syncing
+# each record to disk.
+conf = {'libdefaults': {'rcache_sync': 'false'}}
+nosync = realm.special_env('nosync', False, krb5_conf=conf)
+rcfile = os.path.join(realm.testdir, 'rc3')
+args = ['./t_replay']
+for i in range(10000):
+    args += ['store', 'hash:rc3', 'client', 'server', 'msg%d' % i, str(now),
+             '0', '0', '0']
+output = realm.run(args, env=nosync)
+if output.count('Entry successfully stored') != 10000:
+    fail('Expected all records to be stored')
+if os.stat(rcfile).st_size <= 128 + 8 * 16 * 1024:
+    fail('Replay cache file did not grow')
+check_replay('hash:rc3', 'msg0', now, 0, env=nosync)
+check_replay('hash:rc3', 'msg9999', now, 0, env=nosync)
+check_store('hash:rc3', 'msg10000', now, 0)
+
+# Initializing the cache empties the file in place.  A process which
+# already had the larger file mapped notices and uses the new contents.
+ino = os.stat(rcfile).st_ino
+def rcargs(msg):
+    return ['store', 'hash:rc3', 'client', 'server', msg, str(now), '0',
+            '0', '0']
+output = realm.run(['./t_replay', 'hold', 'hash:rc3'] + rcargs('msg0') +
+                   ['init', 'hash:rc3'] + rcargs('msg0') + rcargs('msg0') +
+                   rcargs('msg9999'))
+if output != ('Replay\nCache successfully initialized\n'
+              'Entry successfully stored\nReplay\n'
+              'Entry successfully stored\n'):
+    fail('Unexpected output from hold and init')
+st = os.stat(rcfile)
+if st.st_ino != ino:
+    fail('Replay cache file was replaced')
+if st.st_size != 128 + 8 * 16 * 1024:
+    fail('Replay cache file was not shrunk')
+check_replay('hash:rc3', 'msg0', now, 0)
+check_replay('hash:rc3', 'msg9999', now, 0)
+check_store('hash:rc3', 'msg1', now, 0)
+
+success('Hash replay cache tests')
@@ -31,6 +31,10 @@
 
 #include "k5-int.h"
 
+/* A replay cache kept open by the hold command, and its name. */
+static krb5_rcache held_rc;
+static char *held_spec;
+
 static void
 usage(const char *progname)
 {
@@ -39,6 +43,8 @@ usage(const char *progname)
     fprintf(stderr, "  %s store <rc> <cli> <srv> <msg> <tstamp> <usec>"
             " <now> <now-usec>\n", progname);
     fprintf(stderr, "  %s expunge <rc> <now> <now-usec>\n", progname);
+    fprintf(stderr, "  %s init <rc>\n", progname);
+    fprintf(stderr, "  %s hold <rc>\n", progname);
     exit(1);
 }
 
@@ -117,10 +123,15 @@ store(krb5_context ctx, char *rcspec, char *client, char *server, char *msg,
 
     if (now_timestamp > 0)
         krb5_set_debugging_time(ctx, now_timestamp, now_usec);
-    if ((retval = krb5_rc_resolve_full(ctx, &rc, rcspec)))
-        goto cleanup;
-    if ((retval = krb5_rc_recover_or_initialize(ctx, rc, ctx->clockskew)))
-        goto cleanup;
+    if (held_rc != NULL && strcmp(rcspec, held_spec) == 0) {
+        rc = held_rc;
+    } else {
+        if ((retval = krb5_rc_resolve_full(ctx, &rc, rcspec)))
+            goto cleanup;
+        if ((retval = krb5_rc_recover_or_initialize(ctx, rc,
+                                                    ctx->clockskew)))
+            goto cleanup;
+    }
     if (msg) {
         d.data = msg;
         d.length = strlen(msg);
@@ -140,7 +151,7 @@ cleanup:
         printf("Entry successfully stored\n");
     else
         fprintf(stderr, "Failure: %s\n", krb5_get_error_message(ctx, retval));
-    if (rc)
+    if (rc && rc != held_rc)
         krb5_rc_close(ctx, rc);
     if (hash)
         free(hash);
@@ -169,6 +180,44 @@ cleanup:
         krb5_rc_close(ctx, rc);
 }
 
+static void
+init(krb5_context ctx, char *rcspec)
+{
+    krb5_rcache rc = NULL;
+    krb5_error_code retval = 0;
+
+    if ((retval = krb5_rc_resolve_full(ctx, &rc, rcspec)))
+        goto cleanup;
+    retval = krb5_rc_initialize(ctx, rc, ctx->clockskew);
+cleanup:
+    if (!retval)
+        printf("Cache successfully initialized\n");
+    else
+        fprintf(stderr, "Failure: %s\n", krb5_get_error_message(ctx, retval));
+    if (rc)
+        krb5_rc_close(ctx, rc);
+}
+
+/* Open a replay cache and keep it open for later stores to the same name. */
+static void
+hold(krb5_context ctx, char *rcspec)
+{
+    krb5_error_code retval;
+
+    if (held_rc != NULL)
+        krb5_rc_close(ctx, held_rc);
+    held_rc = NULL;
+    held_spec = rcspec;
+    if ((retval = krb5_rc_resolve_full(ctx, &held_rc, rcspec)) ||
+        (retval = krb5_rc_recover_or_initialize(ctx, held_rc,
+                                                ctx->clockskew))) {
+        fprintf(stderr, "Failure: %s\n", krb5_get_error_message(ctx, retval));
+        if (held_rc != NULL)
+            krb5_rc_close(ctx, held_rc);
+        held_rc = NULL;
+    }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -259,11 +308,26 @@ main(int argc, char **argv)
             if (!argc) usage(progname);
             now_usec = (krb5_int32) atol(*argv);
             expunge(ctx, rcspec, now_timestamp, now_usec);
+        } else if (strcmp(*argv, "init") == 0) {
+            /* Using the rcache interface, initialize a replay cache. */
+            argc--; argv++;
+            if (!argc) usage(progname);
+            init(ctx, *argv);
+        } else if (strcmp(*argv, "hold") == 0) {
+            /*
+             * Open a replay cache and keep it open, so that later
+             * stores with the same rcache spec use the same handle.
+             */
+            argc--; argv++;
+            if (!argc) usage(progname);
+            hold(ctx, *argv);
         } else
             usage(progname);
         argc--; argv++;
     }
 
+    if (held_rc != NULL)
+        krb5_rc_close(ctx, held_rc);
     krb5_free_context(ctx);
 
     return 0;
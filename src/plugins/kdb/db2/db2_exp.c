@@ -44,7 +44,6 @@
 #include <utime.h>
 #include "kdb5.h"
 #include "kdb_db2.h"
-#include "kdb_xdr.h"
 #include "policy_db.h"
 
 /* Quick and dirty wrapper functions to provide for thread safety
@@ -174,6 +173,12 @@ WRAP_K (krb5_db2_check_policy_as,
          krb5_data *e_data),
         (kcontext, request, client, server, kdc_time, status, e_data));
 
+WRAP_K (krb5_db2_begin_bulk_load, (krb5_context kcontext), (kcontext));
+WRAP_K (krb5_db2_end_bulk_load, (krb5_context kcontext), (kcontext));
+WRAP_K (krb5_db2_flush_lockout,
+        (krb5_context kcontext, krb5_timestamp deadline),
+        (kcontext, deadline));
+
 WRAP_VOID (krb5_db2_audit_as_req,
            (krb5_context kcontext, krb5_kdc_req *request,
             krb5_db_entry *client, krb5_db_entry *server,
@@ -206,7 +211,7 @@ hack_cleanup (void)
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_db2, kdb_function_table) = {
     KRB5_KDB_DAL_MAJOR_VERSION,             /* major version number */
-    0,                                      /* minor version number 0 */
+    2,                                      /* minor version number 2 */
     /* init_library */                  hack_init,
     /* fini_library */                  hack_cleanup,
     /* init_module */                   wrap_krb5_db2_open,
@@ -235,5 +240,8 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_db2, kdb_function_table) = {
     /* check_policy_as */               wrap_krb5_db2_check_policy_as,
     0,
     /* audit_as_req */                  wrap_krb5_db2_audit_as_req,
-    0, 0
+    0, 0,
+    /* begin_bulk_load */               wrap_krb5_db2_begin_bulk_load,
+    /* end_bulk_load */                 wrap_krb5_db2_end_bulk_load,
+    /* flush_lockout */                 wrap_krb5_db2_flush_lockout
 };
@@ -63,7 +63,6 @@
 #include <utime.h>
 #include "kdb5.h"
 #include "kdb_db2.h"
-#include "kdb_xdr.h"
 #include "policy_db.h"
 
 #define KDB_DB2_DATABASE_NAME "database_name"
@@ -73,6 +72,10 @@
 #define SUFFIX_POLICY ".kadm5"
 #define SUFFIX_POLICY_LOCK ".kadm5.lock"
 
+/* Page cache size used while bulk loading, so that interior btree pages stay
+ * in memory instead of being reread and rewritten for each insertion. */
+#define BULK_LOAD_CACHESIZE (32 * 1024 * 1024)
+
 /*
  * Locking:
  *
@@ -115,6 +118,15 @@
  * update on the master would be somewhat more serious, but this would
  * likely be noticed by an administrator, who could fix the problem and
  * retry the operation.
+ *
+ * When the database is opened by the KDC, the read-only DB handle is kept
+ * open after the last shared lock is released, so that successive principal
+ * lookups do not have to reopen the database and refill its page cache.
+ * Because every writer updates the lock file timestamp before releasing its
+ * exclusive lock, a reader which acquires a shared lock and finds the same
+ * timestamp as when the handle was opened can safely reuse the handle.  If
+ * the timestamp has changed (because of kadmin or kdb5_util load, for
+ * instance), the handle is closed and the database reopened.
  */
 
 /* Evaluate to true if the krb5_context c contains an initialized db2
@@ -203,7 +215,7 @@ configure_context(krb5_context context, char *conf_section, char **db_args)
 {
     krb5_error_code status;
     krb5_db2_context *dbc;
-    char **t_ptr, *opt = NULL, *val = NULL, *pval = NULL;
+    char **t_ptr, *opt = NULL, *val = NULL, *pval = NULL, *delay = NULL;
     profile_t profile = KRB5_DB_GET_PROFILE(context);
     int bval;
 
@@ -265,10 +277,25 @@ configure_context(krb5_context context, char *conf_section, char **db_args)
         goto cleanup;
     dbc->disable_lockout = bval;
 
+    status = profile_get_string(profile, KDB_MODULE_SECTION, conf_section,
+                                KRB5_CONF_LOCKOUT_WRITE_DELAY, NULL, &delay);
+    if (status != 0)
+        goto cleanup;
+    if (delay != NULL) {
+        status = krb5_string_to_deltat(delay, &dbc->lockout_delay);
+        if (status != 0) {
+            krb5_set_error_message(context, status,
+                                   _("Invalid %s value \"%s\""),
+                                   KRB5_CONF_LOCKOUT_WRITE_DELAY, delay);
+            goto cleanup;
+        }
+    }
+
 cleanup:
     free(opt);
     free(val);
     profile_release_string(pval);
+    profile_release_string(delay);
     return status;
 }
 
@@ -334,7 +361,7 @@ open_db(krb5_db2_context *dbc, int flags, int mode)
     BTREEINFO bti;
     HASHINFO hashi;
     bti.flags = 0;
-    bti.cachesize = 0;
+    bti.cachesize = dbc->bulk_load ? BULK_LOAD_CACHESIZE : 0;
     bti.psize = 4096;
     bti.lorder = 0;
     bti.minkeypage = 0;
@@ -347,7 +374,7 @@ open_db(krb5_db2_context *dbc, int flags, int mode)
     }
 
     hashi.bsize = 4096;
-    hashi.cachesize = 0;
+    hashi.cachesize = dbc->bulk_load ? BULK_LOAD_CACHESIZE : 0;
     hashi.ffactor = 40;
     hashi.hash = NULL;
     hashi.lorder = 0;
@@ -380,6 +407,35 @@ done:
     return db;
 }
 
+/* Return the modification time of dbc's lock file, or -1 on error. */
+static time_t
+ctx_get_age(krb5_db2_context *dbc)
+{
+    struct stat st;
+
+    if (fstat(dbc->db_lf_file, &st) != 0)
+        return -1;
+    return st.st_mtime;
+}
+
+/*
+ * Return true if dbc has a read-only DB handle retained from a previous shared
+ * lock which is still valid to use.  dbc must be at least shared-locked.  The
+ * handle is stale if the database has been modified since it was opened, or
+ * if it was opened by a parent process (in which case the file offset is
+ * shared with our siblings).
+ */
+static krb5_boolean
+ctx_handle_current(krb5_db2_context *dbc)
+{
+    time_t age;
+
+    if (dbc->db == NULL || dbc->db_open_pid != getpid())
+        return FALSE;
+    age = ctx_get_age(dbc);
+    return age != -1 && age == dbc->db_open_age;
+}
+
 static krb5_error_code
 ctx_unlock(krb5_context context, krb5_db2_context *dbc)
 {
@@ -393,8 +449,11 @@ ctx_unlock(krb5_context context, krb5_db2_context *dbc)
 
     db = dbc->db;
     if (--(dbc->db_locks_held) == 0) {
-        db->close(db);
-        dbc->db = NULL;
+        /* Retain a read-only handle for reuse by the next shared lock. */
+        if (!dbc->keep_open || dbc->db_lock_mode != KRB5_LOCKMODE_SHARED) {
+            db->close(db);
+            dbc->db = NULL;
+        }
         dbc->db_lock_mode = 0;
 
         retval2 = krb5_lock_file(context, dbc->db_lf_file,
@@ -434,20 +493,25 @@ ctx_lock(krb5_context context, krb5_db2_context *dbc, int lockmode)
         else if (retval)
             return retval;
 
-        /* Open the DB (or re-open it for read/write). */
-        if (dbc->db != NULL)
-            dbc->db->close(dbc->db);
-        dbc->db = open_db(dbc,
-                          kmode == KRB5_LOCKMODE_SHARED ? O_RDONLY : O_RDWR,
-                          0600);
-        if (dbc->db == NULL) {
-            retval = errno;
-            dbc->db_locks_held = 0;
-            dbc->db_lock_mode = 0;
-            (void) osa_adb_release_lock(dbc->policy_db);
-            (void) krb5_lock_file(context, dbc->db_lf_file,
-                                  KRB5_LOCKMODE_UNLOCK);
-            return retval;
+        /* Open the DB (or re-open it for read/write), unless we can reuse
+         * the read-only handle retained by ctx_unlock(). */
+        if (dbc->db_locks_held > 0 || kmode != KRB5_LOCKMODE_SHARED ||
+            !ctx_handle_current(dbc)) {
+            if (dbc->db != NULL)
+                dbc->db->close(dbc->db);
+            dbc->db = open_db(dbc, kmode == KRB5_LOCKMODE_SHARED ? O_RDONLY :
+                              O_RDWR, 0600);
+            if (dbc->db == NULL) {
+                retval = errno;
+                dbc->db_locks_held = 0;
+                dbc->db_lock_mode = 0;
+                (void) osa_adb_release_lock(dbc->policy_db);
+                (void) krb5_lock_file(context, dbc->db_lf_file,
+                                      KRB5_LOCKMODE_UNLOCK);
+                return retval;
+            }
+            dbc->db_open_age = ctx_get_age(dbc);
+            dbc->db_open_pid = getpid();
         }
 
         dbc->db_lock_mode = kmode;
@@ -510,6 +574,8 @@ cleanup:
 static void
 ctx_fini(krb5_db2_context *dbc)
 {
+    if (dbc->db != NULL)
+        dbc->db->close(dbc->db);
     if (dbc->db_lf_file != -1)
         (void) close(dbc->db_lf_file);
     if (dbc->policy_db)
@@ -521,8 +587,14 @@ ctx_fini(krb5_db2_context *dbc)
 krb5_error_code
 krb5_db2_fini(krb5_context context)
 {
-    if (context->dal_handle->db_context != NULL) {
-        ctx_fini(context->dal_handle->db_context);
+    krb5_db2_context *dbc = context->dal_handle->db_context;
+
+    if (dbc != NULL) {
+        if (dbc->lockout_queue != NULL) {
+            (void)krb5_db2_lockout_flush(context);
+            krb5_db_lockout_queue_free(context, dbc->lockout_queue);
+        }
+        ctx_fini(dbc);
         context->dal_handle->db_context = NULL;
     }
     return 0;
@@ -552,17 +624,9 @@ check_openable(krb5_context context)
 krb5_error_code
 krb5_db2_get_age(krb5_context context, char *db_name, time_t *age)
 {
-    krb5_db2_context *dbc;
-    struct stat st;
-
     if (!inited(context))
         return (KRB5_KDB_DBNOTINITED);
-    dbc = context->dal_handle->db_context;
-
-    if (fstat(dbc->db_lf_file, &st) < 0)
-        *age = -1;
-    else
-        *age = st.st_mtime;
+    *age = ctx_get_age(context->dal_handle->db_context);
     return 0;
 }
 
@@ -601,6 +665,67 @@ krb5_db2_unlock(krb5_context context)
     return ctx_unlock(context, context->dal_handle->db_context);
 }
 
+/*
+ * Hold an exclusive lock across a bulk load, so that the database is opened
+ * once (with a large page cache) rather than once per put_principal call.
+ */
+krb5_error_code
+krb5_db2_begin_bulk_load(krb5_context context)
+{
+    krb5_error_code retval;
+    krb5_db2_context *dbc;
+    DB *db;
+    int held;
+
+    if (!inited(context))
+        return KRB5_KDB_DBNOTINITED;
+    dbc = context->dal_handle->db_context;
+    if (dbc->bulk_load)
+        return EINVAL;
+
+    /* If the database is not already locked, ctx_lock() will (re)open it
+     * with the bulk load cache size. */
+    held = dbc->db_locks_held;
+    dbc->bulk_load = TRUE;
+    retval = ctx_lock(context, dbc, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (retval) {
+        dbc->bulk_load = FALSE;
+        return retval;
+    }
+
+    /* Otherwise (as with a temporary DB, which is locked for its lifetime)
+     * reopen it ourselves.  Keep the old handle if the reopen fails. */
+    if (held > 0 && dbc->db->sync(dbc->db, 0) == 0) {
+        db = open_db(dbc, O_RDWR, 0600);
+        if (db != NULL) {
+            dbc->db->close(dbc->db);
+            dbc->db = db;
+        }
+    }
+    return 0;
+}
+
+krb5_error_code
+krb5_db2_end_bulk_load(krb5_context context)
+{
+    krb5_error_code retval = 0;
+    krb5_db2_context *dbc;
+
+    if (!inited(context))
+        return KRB5_KDB_DBNOTINITED;
+    dbc = context->dal_handle->db_context;
+    if (!dbc->bulk_load)
+        return EINVAL;
+
+    /* Flush the cache now so that write errors are reported here. */
+    if (dbc->db != NULL && dbc->db->sync(dbc->db, 0) != 0)
+        retval = errno;
+    ctx_update_age(dbc);
+    dbc->bulk_load = FALSE;
+    (void) ctx_unlock(context, dbc);
+    return retval;
+}
+
 /* Zero out and unlink filename. */
 static krb5_error_code
 destroy_file(char *filename)
@@ -741,6 +866,21 @@ cleanup:
     return retval;
 }
 
+static krb5_error_code
+krb5_encode_princ_dbkey(krb5_context context, krb5_data *key,
+                        krb5_const_principal principal)
+{
+    char *princ_name;
+    krb5_error_code retval;
+
+    if (!(retval = krb5_unparse_name(context, principal, &princ_name))) {
+        /* need to store the NULL for decoding */
+        key->length = strlen(princ_name)+1;
+        key->data = princ_name;
+    }
+    return(retval);
+}
+
 krb5_error_code
 krb5_db2_get_principal(krb5_context context, krb5_const_principal searchfor,
                        unsigned int flags, krb5_db_entry **entry)
@@ -847,7 +987,9 @@ krb5_db2_put_principal(krb5_context context, krb5_db_entry *entry,
     krb5_free_data_contents(context, &contdata);
 
 cleanup:
-    ctx_update_age(dbc);
+    /* During a bulk load, the age is updated once at the end. */
+    if (!dbc->bulk_load)
+        ctx_update_age(dbc);
     (void) krb5_db2_unlock(context); /* unlock database */
     return (retval);
 }
@@ -1023,6 +1165,7 @@ krb5_db2_open(krb5_context context, char *conf_section, char **db_args,
               int mode)
 {
     krb5_error_code status = 0;
+    krb5_db2_context *dbc;
 
     krb5_clear_error_message(context);
     if (inited(context))
@@ -1036,7 +1179,14 @@ krb5_db2_open(krb5_context context, char *conf_section, char **db_args,
     if (status != 0)
         return status;
 
-    return ctx_init(context->dal_handle->db_context);
+    dbc = context->dal_handle->db_context;
+    status = ctx_init(dbc);
+    if (status != 0)
+        return status;
+
+    /* The KDC mostly reads, so keep its read handle open between lookups. */
+    dbc->keep_open = ((mode & KRB5_KDB_SRV_TYPE_KDC) != 0);
+    return 0;
 }
 
 krb5_error_code
@@ -47,6 +47,12 @@ typedef struct _krb5_db2_context {
     krb5_boolean        tempdb;
     krb5_boolean        disable_last_success;
     krb5_boolean        disable_lockout;
+    krb5_deltat         lockout_delay;  /* Max delay of lockout writes  */
+    krb5_db_lockout_queue *lockout_queue; /* Unwritten lockout changes */
+    krb5_boolean        keep_open;      /* Keep read handle across locks */
+    time_t              db_open_age;    /* Lock file mtime at open time */
+    pid_t               db_open_pid;    /* Process which opened db      */
+    krb5_boolean        bulk_load;      /* Bulk load in progress        */
 } krb5_db2_context;
 
 krb5_error_code krb5_db2_init(krb5_context);
@@ -81,6 +87,9 @@ krb5_db2_promote_db(krb5_context kcontext, char *conf_section, char **db_args);
 krb5_error_code
 krb5_db2_lock(krb5_context context, int in_mode);
 
+krb5_error_code krb5_db2_begin_bulk_load(krb5_context context);
+krb5_error_code krb5_db2_end_bulk_load(krb5_context context);
+
 krb5_error_code
 krb5_db2_open(krb5_context kcontext, char *conf_section, char **db_args,
               int mode);
@@ -129,6 +138,12 @@ krb5_db2_lockout_audit(krb5_context context,
                        krb5_timestamp stamp,
                        krb5_error_code status);
 
+krb5_error_code
+krb5_db2_lockout_flush(krb5_context context);
+
+krb5_error_code
+krb5_db2_flush_lockout(krb5_context context, krb5_timestamp deadline);
+
 krb5_error_code
 krb5_db2_check_policy_as(krb5_context kcontext, krb5_kdc_req *request,
                          krb5_db_entry *client, krb5_db_entry *server,
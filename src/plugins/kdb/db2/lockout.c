@@ -122,6 +122,7 @@ krb5_db2_lockout_check_policy(krb5_context context,
     krb5_deltat failcnt_interval = 0;
     krb5_deltat lockout_duration = 0;
     krb5_db2_context *db_ctx = context->dal_handle->db_context;
+    krb5_db_entry tmp;
 
     if (db_ctx->disable_lockout)
         return 0;
@@ -132,12 +133,89 @@ krb5_db2_lockout_check_policy(krb5_context context,
     if (code != 0)
         return code;
 
+    if (db_ctx->lockout_queue != NULL) {
+        /* Check the entry with our unwritten changes applied. */
+        tmp = *entry;
+        krb5_db_lockout_queue_apply(context, db_ctx->lockout_queue, &tmp);
+        entry = &tmp;
+    }
+
     if (locked_check_p(context, stamp, max_fail, lockout_duration, entry))
         return KRB5KDC_ERR_CLIENT_REVOKED;
 
     return 0;
 }
 
+/* Read the entry for princ, apply the queued changes, and write it back. */
+static krb5_error_code
+write_queued_lockout(krb5_context context, krb5_const_principal princ,
+                     krb5_db_lockout_queue *queue, void *data)
+{
+    krb5_error_code code;
+    krb5_db_entry *entry;
+
+    code = krb5_db2_get_principal(context, princ, 0, &entry);
+    if (code != 0)
+        return code;
+    krb5_db_lockout_queue_apply(context, queue, entry);
+    code = krb5_db2_put_principal(context, entry, NULL);
+    krb5_db2_free_principal(context, entry);
+    return code;
+}
+
+/* Write all queued lockout changes while holding one exclusive lock. */
+krb5_error_code
+krb5_db2_lockout_flush(krb5_context context)
+{
+    krb5_error_code code;
+    krb5_db2_context *db_ctx = context->dal_handle->db_context;
+
+    if (db_ctx->lockout_queue == NULL)
+        return 0;
+    code = krb5_db2_lock(context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (code != 0)
+        return code;
+    code = krb5_db_lockout_queue_flush(context, db_ctx->lockout_queue,
+                                       write_queued_lockout, NULL);
+    (void)krb5_db2_unlock(context);
+    return code;
+}
+
+/* Write the queued lockout changes if the oldest of them would exceed the
+ * configured delay by deadline. */
+krb5_error_code
+krb5_db2_flush_lockout(krb5_context context, krb5_timestamp deadline)
+{
+    krb5_db2_context *db_ctx = context->dal_handle->db_context;
+
+    if (db_ctx == NULL || db_ctx->lockout_queue == NULL ||
+        !krb5_db_lockout_queue_due(db_ctx->lockout_queue, deadline))
+        return 0;
+    return krb5_db2_lockout_flush(context);
+}
+
+/*
+ * Queue the changes from orig to entry instead of writing them, unless they
+ * lock the principal out (so that other KDC processes see the lockout
+ * promptly) or the queue is due to be written.
+ */
+static krb5_error_code
+queue_lockout_update(krb5_context context, krb5_db_entry *orig,
+                     krb5_db_entry *entry, krb5_timestamp stamp,
+                     krb5_boolean locked)
+{
+    krb5_error_code code;
+    krb5_db2_context *db_ctx = context->dal_handle->db_context;
+
+    code = krb5_db_lockout_queue_add(context, db_ctx->lockout_queue, orig,
+                                     entry, stamp);
+    if (code != 0)
+        return code;
+    if (locked || krb5_db_lockout_queue_due(db_ctx->lockout_queue, stamp))
+        return krb5_db2_lockout_flush(context);
+    return 0;
+}
+
 krb5_error_code
 krb5_db2_lockout_audit(krb5_context context,
                        krb5_db_entry *entry,
@@ -151,6 +229,7 @@ krb5_db2_lockout_audit(krb5_context context,
     krb5_db2_context *db_ctx = context->dal_handle->db_context;
     krb5_boolean need_update = FALSE;
     krb5_timestamp unlock_time;
+    krb5_db_entry tmp, orig;
 
     switch (status) {
     case 0:
@@ -168,6 +247,21 @@ krb5_db2_lockout_audit(krb5_context context,
     if (entry == NULL)
         return 0;
 
+    if (db_ctx->lockout_delay > 0) {
+        if (db_ctx->lockout_queue == NULL) {
+            code = krb5_db_lockout_queue_create(context, db_ctx->lockout_delay,
+                                                &db_ctx->lockout_queue);
+            if (code != 0)
+                return code;
+        }
+        /* Work on a shallow copy of the entry with our unwritten changes
+         * applied, and remember its state so we can queue the difference. */
+        tmp = *entry;
+        krb5_db_lockout_queue_apply(context, db_ctx->lockout_queue, &tmp);
+        entry = &tmp;
+        orig = tmp;
+    }
+
     if (!db_ctx->disable_lockout) {
         code = lookup_lockout_policy(context, entry, &max_fail,
                                      &failcnt_interval, &lockout_duration);
@@ -216,7 +310,13 @@ krb5_db2_lockout_audit(krb5_context context,
         need_update = TRUE;
     }
 
-    if (need_update) {
+    if (need_update && db_ctx->lockout_queue != NULL) {
+        code = queue_lockout_update(context, &orig, entry, stamp,
+                                    locked_check_p(context, stamp, max_fail,
+                                                   lockout_duration, entry));
+        if (code != 0)
+            return code;
+    } else if (need_update) {
         code = krb5_db2_put_principal(context, entry, NULL);
         if (code != 0)
             return code;
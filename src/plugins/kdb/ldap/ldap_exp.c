@@ -47,7 +47,7 @@
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_ldap, kdb_function_table) = {
     KRB5_KDB_DAL_MAJOR_VERSION,             /* major version number */
-    0,                                      /* minor version number 0 */
+    2,                                      /* minor version number 2 */
     /* init_library */                      krb5_ldap_lib_init,
     /* fini_library */                      krb5_ldap_lib_cleanup,
     /* init_module */                       krb5_ldap_open,
@@ -85,6 +85,8 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_ldap, kdb_function_table) = {
     /* check_policy_tgs */                  NULL,
     /* audit_as_req */                      krb5_ldap_audit_as_req,
     /* refresh_config */                    NULL,
-    /* check_allowed_to_delegate */         krb5_ldap_check_allowed_to_delegate
-
+    /* check_allowed_to_delegate */         krb5_ldap_check_allowed_to_delegate,
+    /* begin_bulk_load */                   NULL,
+    /* end_bulk_load */                     NULL,
+    /* flush_lockout */                     krb5_ldap_flush_lockout
 };
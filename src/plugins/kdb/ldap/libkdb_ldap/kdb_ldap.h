@@ -213,6 +213,8 @@ typedef struct _krb5_ldap_context {
     krb5_ldap_realm_params        *lrparams;
     krb5_boolean                  disable_last_success;
     krb5_boolean                  disable_lockout;
+    krb5_deltat                   lockout_delay;
+    krb5_db_lockout_queue         *lockout_queue;
     int                           ldap_debug;
     krb5_context                  kcontext;   /* to set the error code and message */
 } krb5_ldap_context;
@@ -326,4 +328,10 @@ krb5_ldap_lockout_audit(krb5_context context,
                         krb5_timestamp stamp,
                         krb5_error_code status);
 
+krb5_error_code
+krb5_ldap_lockout_flush(krb5_context context);
+
+krb5_error_code
+krb5_ldap_flush_lockout(krb5_context context, krb5_timestamp deadline);
+
 #endif
@@ -294,6 +294,10 @@ krb5_ldap_close(krb5_context context)
 
     dal_handle = context->dal_handle;
     ldap_context = (krb5_ldap_context *) dal_handle->db_context;
+    if (ldap_context->lockout_queue != NULL) {
+        (void) krb5_ldap_lockout_flush(context);
+        krb5_db_lockout_queue_free(context, ldap_context->lockout_queue);
+    }
     dal_handle->db_context = NULL;
 
     krb5_ldap_free_ldap_context(ldap_context);
@@ -437,6 +437,20 @@ krb5_ldap_read_server_params(krb5_context context, char *conf_section,
                                    &ldap_context->disable_lockout)))
         goto cleanup;
 
+    if ((st = prof_get_string_def(context, conf_section,
+                                  KRB5_CONF_LOCKOUT_WRITE_DELAY, &tempval)))
+        goto cleanup;
+    if (tempval != NULL) {
+        st = krb5_string_to_deltat(tempval, &ldap_context->lockout_delay);
+        if (st) {
+            krb5_set_error_message(context, st, _("Invalid %s value \"%s\""),
+                                   KRB5_CONF_LOCKOUT_WRITE_DELAY, tempval);
+        }
+        profile_release_string(tempval);
+        if (st)
+            goto cleanup;
+    }
+
 cleanup:
     return(st);
 }
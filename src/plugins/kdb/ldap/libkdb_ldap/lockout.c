@@ -119,6 +119,7 @@ krb5_ldap_lockout_check_policy(krb5_context context,
     krb5_kvno max_fail = 0;
     krb5_deltat failcnt_interval = 0;
     krb5_deltat lockout_duration = 0;
+    krb5_db_entry tmp;
 
     SETUP_CONTEXT();
     if (ldap_context->disable_lockout)
@@ -130,12 +131,68 @@ krb5_ldap_lockout_check_policy(krb5_context context,
     if (code != 0)
         return code;
 
+    if (ldap_context->lockout_queue != NULL) {
+        /* Check the entry with our unwritten changes applied. */
+        tmp = *entry;
+        krb5_db_lockout_queue_apply(context, ldap_context->lockout_queue,
+                                    &tmp);
+        entry = &tmp;
+    }
+
     if (locked_check_p(context, stamp, max_fail, lockout_duration, entry))
         return KRB5KDC_ERR_CLIENT_REVOKED;
 
     return 0;
 }
 
+/* Read the entry for princ, apply the queued changes, and write it back. */
+static krb5_error_code
+write_queued_lockout(krb5_context context, krb5_const_principal princ,
+                     krb5_db_lockout_queue *queue, void *data)
+{
+    krb5_error_code code;
+    krb5_db_entry *entry;
+
+    code = krb5_ldap_get_principal(context, princ, 0, &entry);
+    if (code != 0)
+        return code;
+    krb5_db_lockout_queue_apply(context, queue, entry);
+    entry->mask = KADM5_FAIL_AUTH_COUNT | KADM5_LAST_FAILED |
+        KADM5_LAST_SUCCESS;
+    code = krb5_ldap_put_principal(context, entry, NULL);
+    krb5_ldap_free_principal(context, entry);
+    return code;
+}
+
+/* Write all queued lockout changes. */
+krb5_error_code
+krb5_ldap_lockout_flush(krb5_context context)
+{
+    kdb5_dal_handle *dal_handle;
+    krb5_ldap_context *ldap_context;
+
+    SETUP_CONTEXT();
+    if (ldap_context->lockout_queue == NULL)
+        return 0;
+    return krb5_db_lockout_queue_flush(context, ldap_context->lockout_queue,
+                                       write_queued_lockout, NULL);
+}
+
+/* Write the queued lockout changes if the oldest of them would exceed the
+ * configured delay by deadline. */
+krb5_error_code
+krb5_ldap_flush_lockout(krb5_context context, krb5_timestamp deadline)
+{
+    kdb5_dal_handle *dal_handle;
+    krb5_ldap_context *ldap_context;
+
+    SETUP_CONTEXT();
+    if (ldap_context->lockout_queue == NULL ||
+        !krb5_db_lockout_queue_due(ldap_context->lockout_queue, deadline))
+        return 0;
+    return krb5_ldap_lockout_flush(context);
+}
+
 krb5_error_code
 krb5_ldap_lockout_audit(krb5_context context,
                         krb5_db_entry *entry,
@@ -149,6 +206,8 @@ krb5_ldap_lockout_audit(krb5_context context,
     krb5_deltat failcnt_interval = 0;
     krb5_deltat lockout_duration = 0;
     krb5_timestamp unlock_time;
+    krb5_db_entry tmp, orig;
+    krb5_db_lockout_queue *queue;
 
     SETUP_CONTEXT();
 
@@ -164,6 +223,24 @@ krb5_ldap_lockout_audit(krb5_context context,
     if (entry == NULL)
         return 0;
 
+    queue = ldap_context->lockout_queue;
+    if (queue == NULL && ldap_context->lockout_delay > 0) {
+        code = krb5_db_lockout_queue_create(context,
+                                            ldap_context->lockout_delay,
+                                            &queue);
+        if (code != 0)
+            return code;
+        ldap_context->lockout_queue = queue;
+    }
+    if (queue != NULL) {
+        /* Work on a shallow copy of the entry with our unwritten changes
+         * applied, and remember its state so we can queue the difference. */
+        tmp = *entry;
+        krb5_db_lockout_queue_apply(context, queue, &tmp);
+        entry = &tmp;
+        orig = tmp;
+    }
+
     if (!ldap_context->disable_lockout) {
         code = lookup_lockout_policy(context, entry, &max_fail,
                                      &failcnt_interval,
@@ -216,7 +293,21 @@ krb5_ldap_lockout_audit(krb5_context context,
         entry->mask |= KADM5_LAST_FAILED | KADM5_FAIL_AUTH_COUNT_INCREMENT;
     }
 
-    if (entry->mask) {
+    if (entry->mask && queue != NULL) {
+        if (entry->mask & KADM5_FAIL_AUTH_COUNT_INCREMENT)
+            entry->fail_auth_count++;
+        code = krb5_db_lockout_queue_add(context, queue, &orig, entry, stamp);
+        if (code != 0)
+            return code;
+        /* Write a lockout immediately, so that other KDCs see it. */
+        if (locked_check_p(context, stamp, max_fail, lockout_duration,
+                           entry) ||
+            krb5_db_lockout_queue_due(queue, stamp)) {
+            code = krb5_ldap_lockout_flush(context);
+            if (code != 0)
+                return code;
+        }
+    } else if (entry->mask) {
         code = krb5_ldap_put_principal(context, entry, NULL);
         if (code != 0)
             return code;
@@ -35,6 +35,7 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <sys/param.h>
 #include <netdb.h>
@@ -55,6 +56,8 @@ char    *progname = 0;
 int     debug = 0;
 char    *srvtab = 0;
 char    *slave_host;
+char    **slave_hosts;          /* All slaves named on the command line */
+int     num_slave_hosts;
 char    *realm = 0;
 char    *file = KPROP_DEFAULT_FILE;
 
@@ -79,11 +82,13 @@ void    xmit_database(krb5_context, krb5_auth_context, krb5_creds *,
                       int, int, int);
 void    send_error(krb5_context, krb5_creds *, int, char *, krb5_error_code);
 void    update_last_prop_file(char *, char *);
+static void propagate(krb5_context);
+static int propagate_all(krb5_context);
 
 static void usage()
 {
     fprintf(stderr, _("\nUsage: %s [-r realm] [-f file] [-d] [-P port] "
-                      "[-s srvtab] slave_host\n\n"), progname);
+                      "[-s srvtab] slave_host ...\n\n"), progname);
     exit(1);
 }
 
@@ -92,11 +97,8 @@ main(argc, argv)
     int     argc;
     char    **argv;
 {
-    int     fd, database_fd, database_size;
     krb5_error_code retval;
     krb5_context context;
-    krb5_creds *my_creds;
-    krb5_auth_context auth_context;
 
     setlocale(LC_ALL, "");
     retval = krb5_init_context(&context);
@@ -105,6 +107,22 @@ main(argc, argv)
         exit(1);
     }
     PRS(argc, argv);
+    if (num_slave_hosts == 1) {
+        slave_host = slave_hosts[0];
+        propagate(context);
+        exit(0);
+    }
+    exit(propagate_all(context) ? 1 : 0);
+}
+
+/* Send the database to slave_host, exiting on failure. */
+static void
+propagate(krb5_context context)
+{
+    int     fd, database_fd, database_size;
+    krb5_creds *my_creds;
+    krb5_auth_context auth_context;
+
     get_tickets(context);
 
     database_fd = open_database(context, file, &database_size);
@@ -117,7 +135,50 @@ main(argc, argv)
     printf(_("Database propagation to %s: SUCCEEDED\n"), slave_host);
     krb5_free_cred_contents(context, my_creds);
     close_database(context, database_fd);
-    exit(0);
+}
+
+/*
+ * Send the database to all of the slaves at once, using a child process for
+ * each one.  Return the number of slaves to which propagation failed.
+ */
+static int
+propagate_all(krb5_context context)
+{
+    pid_t *pids, pid;
+    int i, status, nfailed = 0;
+
+    pids = calloc(num_slave_hosts, sizeof(*pids));
+    if (pids == NULL) {
+        com_err(progname, ENOMEM, _("while allocating child process list"));
+        exit(1);
+    }
+
+    /* Don't let the children inherit buffered output. */
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < num_slave_hosts; i++) {
+        pid = fork();
+        if (pid == 0) {
+            slave_host = slave_hosts[i];
+            propagate(context);
+            exit(0);
+        }
+        pids[i] = pid;
+        if (pid < 0)
+            com_err(progname, errno, _("while forking for %s"),
+                    slave_hosts[i]);
+    }
+
+    for (i = 0; i < num_slave_hosts; i++) {
+        if (pids[i] < 0 || waitpid(pids[i], &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, _("Database propagation to %s: FAILED\n"),
+                    slave_hosts[i]);
+            nfailed++;
+        }
+    }
+    free(pids);
+    return nfailed;
 }
 
 void PRS(argc, argv)
@@ -174,13 +235,16 @@ void PRS(argc, argv)
 
             }
         } else {
-            if (slave_host)
-                usage();
-            else
-                slave_host = word;
+            slave_hosts = realloc(slave_hosts, (num_slave_hosts + 1) *
+                                  sizeof(*slave_hosts));
+            if (slave_hosts == NULL) {
+                com_err(progname, ENOMEM, _("while parsing arguments"));
+                exit(1);
+            }
+            slave_hosts[num_slave_hosts++] = word;
         }
     }
-    if (!slave_host)
+    if (num_slave_hosts == 0)
         usage();
 }
 
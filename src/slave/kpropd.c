@@ -126,6 +126,7 @@ char    *srvtab = 0;
 int     standalone = 0;
 
 pid_t fullprop_child = (pid_t)-1;
+pid_t load_child = (pid_t)-1;
 
 krb5_principal  server;         /* This is our server principal name */
 krb5_principal  client;         /* This is who we're talking to */
@@ -152,8 +153,9 @@ krb5_error_code do_iprop(kdb_log_context *log_ctx);
 void    kerberos_authenticate(krb5_context, int, krb5_principal *,
                               krb5_enctype *, struct sockaddr_storage *);
 krb5_boolean authorized_principal(krb5_context, krb5_principal, krb5_enctype);
-void    recv_database(krb5_context, int, int, krb5_data *);
-void    load_database(krb5_context, char *, char *);
+void    recv_database(krb5_context, int, int, int, krb5_data *);
+pid_t   start_load(krb5_context, char *, char *, int);
+void    finish_load(char *, pid_t);
 void    send_error(krb5_context, int, krb5_error_code, char *);
 void    recv_error(krb5_context, krb5_data *);
 unsigned int backoff_from_master(int *);
@@ -197,10 +199,13 @@ alarm_handler(int sig)
     exit(1);
 }
 
+static volatile sig_atomic_t usr1_received;
+
 static void
 usr1_handler(int sig)
 {
-    /* Nothing to do, just let the signal interrupt sleep(). */
+    /* Interrupt sleep(), and tell get_updates() to stop waiting. */
+    usr1_received = 1;
 }
 
 static void
@@ -225,6 +230,18 @@ atexit_kill_do_standalone(void)
         kill(fullprop_child, SIGHUP);
 }
 
+/*
+ * Kill a streaming load if we exit before the whole database has arrived.
+ * kdb5_util would not make the partial database live anyway, since it has not
+ * seen the end record, but there is no point letting it finish.
+ */
+static void
+atexit_kill_load(void)
+{
+    if (load_child > 0)
+        kill(load_child, SIGKILL);
+}
+
 int
 main(argc, argv)
     int     argc;
@@ -296,8 +313,8 @@ main(argc, argv)
     /*
      * This is the iprop case.  We'll fork a child to run do_standalone().  The
      * parent will run do_iprop().  We try to kill the child if we get killed.
-     * Catch SIGUSR1 so tests can use it to interrupt the sleep timer and force
-     * an iprop request.
+     * Catch SIGUSR1 so tests can use it to interrupt the sleep timer or a
+     * held request and force an iprop request.
      */
     signal_wrapper(SIGHUP, kill_do_standalone);
     signal_wrapper(SIGINT, kill_do_standalone);
@@ -458,6 +475,8 @@ void doit(fd)
     mode_t omask;
     krb5_enctype etype;
     int database_fd;
+    int load_pipe[2];
+    pid_t load_pid;
     char host[INET6_ADDRSTRLEN+1];
 
     signal_wrapper(SIGALRM, alarm_handler);
@@ -532,7 +551,23 @@ void doit(fd)
                 temp_file_name);
         exit(1);
     }
-    recv_database(kpropd_context, fd, database_fd, &confmsg);
+
+    /*
+     * Start loading the database while it is still arriving, by feeding
+     * kdb5_util the received blocks through a pipe.  We still write the
+     * dump file, for use by cascaded propagation.
+     */
+    if (pipe(load_pipe) < 0) {
+        com_err(progname, errno, _("while creating pipe for %s"), kdb5_util);
+        exit(1);
+    }
+    /* Don't let kdb5_util hold the write end open. */
+    (void)fcntl(load_pipe[1], F_SETFD, FD_CLOEXEC);
+    atexit(atexit_kill_load);
+    load_child = start_load(kpropd_context, kdb5_util, "-", load_pipe[0]);
+    close(load_pipe[0]);
+
+    recv_database(kpropd_context, fd, database_fd, load_pipe[1], &confmsg);
     if (rename(temp_file_name, file)) {
         com_err(progname, errno, _("while renaming %s to %s"),
                 temp_file_name, file);
@@ -544,7 +579,21 @@ void doit(fd)
                 temp_file_name);
         exit(1);
     }
-    load_database(kpropd_context, kdb5_util, file);
+
+    /*
+     * The whole dump has arrived, so send kdb5_util an end record.  kdb5_util
+     * refuses to make a database live without one, so a partial database is
+     * never used even if we are killed mid-transfer.  A binary dump has its
+     * own end record, after which kdb5_util may already have exited; any
+     * write error is reflected in its exit status.
+     */
+    (void)krb5_net_write(kpropd_context, load_pipe[1], "End\n", 4);
+
+    /* Let kdb5_util see the end of its input and wait for it to finish. */
+    close(load_pipe[1]);
+    load_pid = load_child;
+    load_child = -1;
+    finish_load(kdb5_util, load_pid);
     retval = krb5_lock_file(kpropd_context, lock_fd, KRB5_LOCKMODE_UNLOCK);
     if (retval) {
         com_err(progname, retval, _("while unlocking '%s'"), temp_file_name);
@@ -602,6 +651,62 @@ full_resync(CLIENT *clnt)
     return (status == RPC_SUCCESS) ? &clnt_res : NULL;
 }
 
+/* How long to wait for a held request before sending it again. */
+#define WAIT_SLICE 5
+
+/*
+ * Ask the master for updates after last.  If wait_time is nonzero and
+ * *master_waits is true, ask the master to hold the request for up to
+ * wait_time seconds until there are updates to send; set *master_waits to
+ * false if the master does not support that.
+ *
+ * The RPC layer does not return when a signal arrives, so we only wait
+ * WAIT_SLICE seconds for each held request and then send it again; the
+ * master replaces the old request with the new one.  If SIGUSR1 has been
+ * received by then, return NULL with *interrupted set instead, so that the
+ * caller can check the ulog again before asking.
+ */
+static kdb_incr_result_t *
+get_updates(CLIENT *clnt, kdb_last_t *last, unsigned int wait_time,
+            krb5_boolean *master_waits, krb5_boolean *interrupted)
+{
+    static kdb_incr_result_t clnt_res;
+    kdb_wait_t arg;
+    struct timeval timeout;
+    enum clnt_stat status;
+    time_t now, deadline;
+
+    *interrupted = FALSE;
+    if (wait_time > 0 && *master_waits) {
+        arg.lastentry = *last;
+        deadline = time(NULL) + wait_time;
+        while ((now = time(NULL)) < deadline) {
+            memset(&clnt_res, 0, sizeof(clnt_res));
+            arg.timeout = deadline - now;
+            timeout.tv_sec = (arg.timeout > WAIT_SLICE) ? WAIT_SLICE :
+                arg.timeout + full_resync_timeout.tv_sec;
+            timeout.tv_usec = 0;
+            status = clnt_call(clnt, IPROP_GET_UPDATES_WAIT,
+                               (xdrproc_t)xdr_kdb_wait_t, (caddr_t)&arg,
+                               (xdrproc_t)xdr_kdb_incr_result_t,
+                               (caddr_t)&clnt_res, timeout);
+            if (status == RPC_TIMEDOUT && arg.timeout > WAIT_SLICE) {
+                if (usr1_received) {
+                    *interrupted = TRUE;
+                    return NULL;
+                }
+                continue;
+            }
+            if (status != RPC_PROCUNAVAIL)
+                return (status == RPC_SUCCESS) ? &clnt_res : NULL;
+            /* The master is too old to wait for updates; poll it instead. */
+            *master_waits = FALSE;
+            break;
+        }
+    }
+    return iprop_get_updates_1(last, clnt);
+}
+
 /*
  * Beg for incrementals from the KDC.
  *
@@ -624,6 +729,8 @@ do_iprop(kdb_log_context *log_ctx)
     unsigned long usec;
     time_t frrequested = 0;
     time_t now;
+    unsigned int wait_time;
+    krb5_boolean synced = FALSE, master_waits, held, interrupted;
 
     kdb_incr_result_t *incr_ret;
     kdb_last_t mylast;
@@ -779,6 +886,7 @@ reinit:
      * Reset re-initialization count to zero now.
      */
     reinit_cnt = backoff_time = 0;
+    master_waits = TRUE;
 
     /*
      * Reset the handle to the correct type for the RPC call
@@ -793,6 +901,7 @@ reinit:
          * Get the most recent ulog entry sno + ts, which
          * we package in the request to the master KDC
          */
+        usr1_received = 0;
         mylast.last_sno = ulog->kdb_last_sno;
         mylast.last_time = ulog->kdb_last_time;
 
@@ -800,12 +909,30 @@ reinit:
          * Loop continuously on an iprop_get_updates_1(),
          * so that we can keep probing the master for updates
          * or (if needed) do a full resync of the krb5 db.
+         * Once we are in sync, ask the master to hold each
+         * request until it has new updates for us.
          */
 
         if (debug)
             fprintf(stderr, _("Calling iprop_get_updates_1()\n"));
+        wait_time = (synced && !runonce) ? pollin : 0;
         gettimeofday(&iprop_start, NULL);
-        incr_ret = iprop_get_updates_1(&mylast, handle->clnt);
+        incr_ret = get_updates(handle->clnt, &mylast, wait_time,
+                               &master_waits, &interrupted);
+        if (interrupted) {
+            /* SIGUSR1 was received; ask again with our current ulog. */
+            if (debug)
+                fprintf(stderr, _("Stopped waiting for updates\n"));
+            continue;
+        }
+        held = FALSE;
+        if (wait_time > 0) {
+            /* Don't count the time spent waiting for updates. */
+            gettimeofday(&iprop_end, NULL);
+            held = (iprop_end.tv_sec - iprop_start.tv_sec >= 1);
+            iprop_start = iprop_end;
+        }
+        synced = FALSE;
         if (incr_ret == (kdb_incr_result_t *)NULL) {
             clnt_perror(handle->clnt,
                         _("iprop_get_updates call failed"));
@@ -927,6 +1054,7 @@ reinit:
                 krb5_free_error_message(kpropd_context, msg);
                 break;
             }
+            synced = TRUE;
 
             gettimeofday(&iprop_end, NULL);
             usec = (iprop_end.tv_sec - iprop_start.tv_sec) * 1000000 +
@@ -969,6 +1097,7 @@ reinit:
                 fprintf(stderr, _("KDC is synchronized with master.\n"));
             backoff_cnt = 0;
             frrequested = 0;
+            synced = TRUE;
             break;
 
         default:
@@ -995,6 +1124,13 @@ reinit:
                         backoff_time);
             }
             (void) sleep(backoff_time);
+        } else if (synced && master_waits &&
+                   !(wait_time > 0 && incr_ret->ret == UPDATE_NIL && !held)) {
+            /*
+             * The master holds our next request until it has updates for
+             * us, so ask again right away (unless it answered a held
+             * request with no updates without waiting).
+             */
         } else {
             if (debug) {
                 fprintf(stderr, _("Waiting for %d seconds before checking "
@@ -1434,11 +1570,16 @@ authorized_principal(context, p, auth_etype)
     return FALSE;
 }
 
+/*
+ * Receive the database from the master, writing it to database_fd and
+ * load_fd.
+ */
 void
-recv_database(context, fd, database_fd, confmsg)
+recv_database(context, fd, database_fd, load_fd, confmsg)
     krb5_context context;
     int fd;
     int database_fd;
+    int load_fd;
     krb5_data *confmsg;
 {
     krb5_ui_4       database_size, received_size;
@@ -1515,8 +1656,6 @@ recv_database(context, fd, database_fd, confmsg)
             exit(1);
         }
         n = write(database_fd, outbuf.data, outbuf.length);
-        krb5_free_data_contents(context, &inbuf);
-        krb5_free_data_contents(context, &outbuf);
         if (n < 0) {
             snprintf(buf, sizeof(buf),
                      "while writing database block starting at offset %d",
@@ -1528,7 +1667,19 @@ recv_database(context, fd, database_fd, confmsg)
                      received_size, n, outbuf.length);
             send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
         }
+        if (krb5_net_write(context, load_fd, outbuf.data,
+                           outbuf.length) < 0) {
+            retval = errno;
+            snprintf(buf, sizeof(buf),
+                     "while passing database block starting at offset %d "
+                     "to %s", received_size, kdb5_util);
+            com_err(progname, retval, "%s", buf);
+            send_error(context, fd, retval, buf);
+            exit(1);
+        }
         received_size += outbuf.length;
+        krb5_free_data_contents(context, &inbuf);
+        krb5_free_data_contents(context, &outbuf);
     }
     /*
      * OK, we've seen the entire file.  Did we get too many bytes?
@@ -1633,27 +1784,20 @@ recv_error(context, inbuf)
     exit(1);
 }
 
-void
-load_database(context, kdb_util, database_file_name)
+/*
+ * Start kdb5_util to load database_file_name into the database, reading
+ * standard input from in_fd.  Return the process ID of kdb5_util.
+ */
+pid_t
+start_load(context, kdb_util, database_file_name, in_fd)
     krb5_context context;
     char *kdb_util;
     char *database_file_name;
+    int in_fd;
 {
     static char     *edit_av[10];
-    int     error_ret;
-    int     child_pid;
+    pid_t   child_pid;
     int     count;
-
-    /* <sys/param.h> has been included, so BSD will be defined on
-       BSD systems */
-#if BSD > 0 && BSD <= 43
-#ifndef WEXITSTATUS
-#define WEXITSTATUS(w) (w).w_retcode
-#endif
-    union wait      waitb;
-#else
-    int     waitb;
-#endif
     kdb_log_context *log_ctx;
 
     if (debug)
@@ -1683,17 +1827,37 @@ load_database(context, kdb_util, database_file_name)
         com_err(progname, errno, _("while trying to fork %s"), kdb_util);
         exit(1);
     case 0:
+        if (dup2(in_fd, STDIN_FILENO) < 0) {
+            com_err(progname, errno, _("while redirecting input of %s"),
+                    kdb_util);
+            _exit(1);
+        }
+        if (in_fd != STDIN_FILENO)
+            close(in_fd);
         execv(kdb_util, edit_av);
         com_err(progname, errno, _("while trying to exec %s"), kdb_util);
         _exit(1);
         /*NOTREACHED*/
     default:
         if (debug)
-            fprintf(stderr, "Load PID is %d\n", child_pid);
-        if (wait(&waitb) < 0) {
-            com_err(progname, errno, _("while waiting for %s"), kdb_util);
-            exit(1);
-        }
+            fprintf(stderr, "Load PID is %d\n", (int)child_pid);
+    }
+    return child_pid;
+}
+
+/* Wait for the kdb5_util process child_pid to finish loading the database,
+ * and exit if it fails. */
+void
+finish_load(kdb_util, child_pid)
+    char *kdb_util;
+    pid_t child_pid;
+{
+    int     error_ret;
+    int     waitb;
+
+    if (waitpid(child_pid, &waitb, 0) < 0) {
+        com_err(progname, errno, _("while waiting for %s"), kdb_util);
+        exit(1);
     }
 
     if (!WIFEXITED(waitb)) {
@@ -0,0 +1,507 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/hammer/kdc_bench.c - KDC throughput and latency benchmark */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This program drives a KDC with a weighted mix of request types from a
+ * number of concurrent client threads, each with its own krb5 context and
+ * sockets, so that many requests are in flight at once.  It reports the
+ * request rate and the median and tail latencies for each request type.
+ * The request types are:
+ *
+ *   as      AS request for a principal which does not require preauth
+ *   as-pa   AS request for a principal which requires preauth (an
+ *           encrypted timestamp, after the KDC asks for it)
+ *   tgs     TGS request for a service ticket
+ *   cross   TGS request for a cross-realm TGT
+ *   s4u     S4U2Self TGS request
+ *
+ * TGS, cross-realm, and S4U requests use a TGT for the -c principal, which
+ * each thread obtains before the measurement starts.  Service tickets are
+ * never cached, so every request reaches the KDC.  t_kdc_bench.py shows how
+ * to run this program against a test realm.
+ */
+
+#include "k5-int.h"
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+enum kind { AS, AS_PA, TGS, CROSS, S4U, NKINDS };
+
+static const char *kind_names[NKINDS] = {
+    "as", "as-pa", "tgs", "cross", "s4u"
+};
+
+/* A growable array of request latencies, in seconds. */
+struct samples {
+    double *vals;
+    size_t n;
+    size_t max;
+};
+
+struct thread_info {
+    pthread_t tid;
+    unsigned int seed;
+    krb5_context ctx;
+    krb5_ccache cc;
+    krb5_principal client;
+    krb5_principal princs[NKINDS];
+    struct samples lat[NKINDS];
+    unsigned long errors[NKINDS];
+};
+
+static const char *prog;
+static int n_threads = 8;
+static long n_requests = 1000;
+static double duration;
+static const char *password;
+static const char *client_name;
+static const char *names[NKINDS];
+static int weights[NKINDS];
+static int total_weight;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static long requests_started;
+static int error_reported[NKINDS];
+static double start_time;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-n requests | -d seconds] [-m mix]\n"
+            "\t[-p password] [-a as_princ] [-e as_pa_princ] [-c client]\n"
+            "\t[-s service] [-x realm] [-u s4u_user]\n"
+            "mix is a list of request types with weights, such as\n"
+            "\"as:1,as-pa:1,tgs:8,cross:1,s4u:1\"; by default, each type\n"
+            "whose principal is given has weight 1.\n", prog);
+    exit(1);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        perror("gettimeofday");
+        exit(1);
+    }
+    return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+static void
+check(krb5_context ctx, krb5_error_code code, const char *what)
+{
+    const char *msg;
+
+    if (code == 0)
+        return;
+    msg = krb5_get_error_message(ctx, code);
+    fprintf(stderr, "%s: %s: %s\n", prog, what, msg);
+    krb5_free_error_message(ctx, msg);
+    exit(1);
+}
+
+static void
+add_sample(struct samples *s, double val)
+{
+    size_t newmax;
+    double *newvals;
+
+    if (s->n == s->max) {
+        newmax = (s->max == 0) ? 1024 : s->max * 2;
+        newvals = realloc(s->vals, newmax * sizeof(*s->vals));
+        if (newvals == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        s->vals = newvals;
+        s->max = newmax;
+    }
+    s->vals[s->n++] = val;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return the latency at fraction q of the sorted samples s, in
+ * milliseconds. */
+static double
+quantile(const struct samples *s, double q)
+{
+    size_t i;
+
+    if (s->n == 0)
+        return 0;
+    i = (size_t)(q * s->n);
+    if (i >= s->n)
+        i = s->n - 1;
+    return s->vals[i] * 1000;
+}
+
+/* Parse a mix specification such as "as:1,tgs:8" into weights. */
+static void
+parse_mix(char *spec)
+{
+    char *tok, *save = NULL, *colon;
+    int k, w;
+
+    memset(weights, 0, sizeof(weights));
+    for (tok = strtok_r(spec, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        colon = strchr(tok, ':');
+        w = 1;
+        if (colon != NULL) {
+            *colon = '\0';
+            w = atoi(colon + 1);
+        }
+        for (k = 0; k < NKINDS; k++) {
+            if (strcmp(tok, kind_names[k]) == 0)
+                break;
+        }
+        if (k == NKINDS || w < 0) {
+            fprintf(stderr, "%s: bad mix element \"%s\"\n", prog, tok);
+            usage();
+        }
+        weights[k] = w;
+    }
+}
+
+/* Return true if there is another request to make, and count it. */
+static int
+next_request(void)
+{
+    int more;
+
+    if (duration > 0)
+        return now() - start_time < duration;
+    pthread_mutex_lock(&lock);
+    more = (requests_started < n_requests);
+    if (more)
+        requests_started++;
+    pthread_mutex_unlock(&lock);
+    return more;
+}
+
+static enum kind
+pick_kind(struct thread_info *t)
+{
+    int r = rand_r(&t->seed) % total_weight, k;
+
+    for (k = 0; k < NKINDS - 1; k++) {
+        r -= weights[k];
+        if (r < 0)
+            break;
+    }
+    return k;
+}
+
+/* Make one request of type k and return the result. */
+static krb5_error_code
+make_request(struct thread_info *t, enum kind k)
+{
+    krb5_error_code ret;
+    krb5_creds creds, *out = NULL;
+    krb5_flags options = KRB5_GC_NO_STORE;
+
+    memset(&creds, 0, sizeof(creds));
+    switch (k) {
+    case AS:
+    case AS_PA:
+        ret = krb5_get_init_creds_password(t->ctx, &creds, t->princs[k],
+                                           password, NULL, NULL, 0, NULL,
+                                           NULL);
+        krb5_free_cred_contents(t->ctx, &creds);
+        return ret;
+    case TGS:
+    case CROSS:
+        creds.client = t->client;
+        creds.server = t->princs[k];
+        ret = krb5_get_credentials(t->ctx, options, t->cc, &creds, &out);
+        break;
+    case S4U:
+        creds.client = t->princs[k];
+        creds.server = t->client;
+        ret = krb5_get_credentials_for_user(t->ctx, options, t->cc, &creds,
+                                            NULL, &out);
+        break;
+    default:
+        abort();
+    }
+    krb5_free_creds(t->ctx, out);
+    return ret;
+}
+
+static void *
+thread_proc(void *arg)
+{
+    struct thread_info *t = arg;
+    krb5_error_code ret;
+    enum kind k;
+    double start;
+    const char *msg;
+
+    while (next_request()) {
+        k = pick_kind(t);
+        start = now();
+        ret = make_request(t, k);
+        if (ret) {
+            t->errors[k]++;
+            pthread_mutex_lock(&lock);
+            if (!error_reported[k]) {
+                error_reported[k] = 1;
+                msg = krb5_get_error_message(t->ctx, ret);
+                fprintf(stderr, "%s: %s request failed: %s\n", prog,
+                        kind_names[k], msg);
+                krb5_free_error_message(t->ctx, msg);
+            }
+            pthread_mutex_unlock(&lock);
+            continue;
+        }
+        add_sample(&t->lat[k], now() - start);
+    }
+    return NULL;
+}
+
+/* Create a context for t, parse the principal names it needs, and get a TGT
+ * if any of the selected request types uses one. */
+static void
+setup_thread(struct thread_info *t, int index)
+{
+    krb5_creds creds;
+    krb5_principal tgs;
+    const krb5_data *realm;
+    int k;
+
+    t->seed = index + 1;
+    check(NULL, krb5_init_context(&t->ctx), "initializing context");
+    for (k = 0; k < NKINDS; k++) {
+        if (weights[k] == 0 || k == CROSS)
+            continue;
+        check(t->ctx, krb5_parse_name(t->ctx, names[k], &t->princs[k]),
+              "parsing principal name");
+    }
+    if (weights[TGS] == 0 && weights[CROSS] == 0 && weights[S4U] == 0)
+        return;
+
+    check(t->ctx, krb5_parse_name(t->ctx, client_name, &t->client),
+          "parsing client principal name");
+    if (weights[CROSS] > 0) {
+        realm = krb5_princ_realm(t->ctx, t->client);
+        check(t->ctx, krb5_build_principal(t->ctx, &tgs, realm->length,
+                                           realm->data, KRB5_TGS_NAME,
+                                           names[CROSS], (char *)NULL),
+              "building cross-realm TGS principal");
+        t->princs[CROSS] = tgs;
+    }
+    check(t->ctx, krb5_cc_new_unique(t->ctx, "MEMORY", NULL, &t->cc),
+          "creating credential cache");
+    check(t->ctx, krb5_cc_initialize(t->ctx, t->cc, t->client),
+          "initializing credential cache");
+    check(t->ctx, krb5_get_init_creds_password(t->ctx, &creds, t->client,
+                                               password, NULL, NULL, 0, NULL,
+                                               NULL),
+          "getting initial credentials");
+    check(t->ctx, krb5_cc_store_cred(t->ctx, t->cc, &creds),
+          "storing initial credentials");
+    krb5_free_cred_contents(t->ctx, &creds);
+}
+
+static void
+free_thread(struct thread_info *t)
+{
+    int k;
+
+    for (k = 0; k < NKINDS; k++) {
+        krb5_free_principal(t->ctx, t->princs[k]);
+        free(t->lat[k].vals);
+    }
+    krb5_free_principal(t->ctx, t->client);
+    if (t->cc != NULL)
+        krb5_cc_destroy(t->ctx, t->cc);
+    krb5_free_context(t->ctx);
+}
+
+/* Merge the samples of type k from all threads into s and sort them. */
+static void
+merge_samples(struct thread_info *tinfo, int k, struct samples *s)
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < n_threads; i++) {
+        for (j = 0; j < tinfo[i].lat[k].n; j++)
+            add_sample(s, tinfo[i].lat[k].vals[j]);
+    }
+    if (s->n > 0)
+        qsort(s->vals, s->n, sizeof(*s->vals), compare_doubles);
+}
+
+static void
+print_line(const char *name, const struct samples *s, unsigned long errors)
+{
+    printf("%-8s %9lu %7lu %9.3f %9.3f %9.3f %9.3f\n", name,
+           (unsigned long)s->n, errors, quantile(s, 0.5), quantile(s, 0.99),
+           quantile(s, 0.999), (s->n > 0) ? s->vals[s->n - 1] * 1000 : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct thread_info *tinfo;
+    struct samples all = { NULL, 0, 0 }, s;
+    unsigned long errors, total_errors = 0;
+    char *mix = NULL;
+    double elapsed;
+    int c, i, k, ret;
+
+    prog = strrchr(argv[0], '/');
+    prog = (prog == NULL) ? argv[0] : prog + 1;
+    while ((c = getopt(argc, argv, "t:n:d:m:p:a:e:c:s:x:u:")) != -1) {
+        switch (c) {
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+        case 'n':
+            n_requests = atol(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'm':
+            mix = optarg;
+            break;
+        case 'p':
+            password = optarg;
+            break;
+        case 'a':
+            names[AS] = optarg;
+            break;
+        case 'e':
+            names[AS_PA] = optarg;
+            break;
+        case 'c':
+            client_name = optarg;
+            break;
+        case 's':
+            names[TGS] = optarg;
+            break;
+        case 'x':
+            names[CROSS] = optarg;
+            break;
+        case 'u':
+            names[S4U] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || n_threads < 1 || n_requests < 1 || duration < 0)
+        usage();
+
+    if (mix != NULL) {
+        parse_mix(mix);
+    } else {
+        for (k = 0; k < NKINDS; k++)
+            weights[k] = (names[k] != NULL);
+    }
+    for (k = 0; k < NKINDS; k++) {
+        if (weights[k] > 0 && names[k] == NULL) {
+            fprintf(stderr, "%s: no principal given for %s requests\n", prog,
+                    kind_names[k]);
+            usage();
+        }
+        total_weight += weights[k];
+    }
+    if (total_weight == 0 || password == NULL)
+        usage();
+    if ((weights[TGS] > 0 || weights[CROSS] > 0 || weights[S4U] > 0) &&
+        client_name == NULL) {
+        fprintf(stderr, "%s: -c is required for tgs, cross, and s4u\n", prog);
+        usage();
+    }
+
+    tinfo = calloc(n_threads, sizeof(*tinfo));
+    if (tinfo == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (i = 0; i < n_threads; i++)
+        setup_thread(&tinfo[i], i);
+
+    start_time = now();
+    for (i = 0; i < n_threads; i++) {
+        ret = pthread_create(&tinfo[i].tid, NULL, thread_proc, &tinfo[i]);
+        if (ret) {
+            fprintf(stderr, "%s: pthread_create: %s\n", prog, strerror(ret));
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_threads; i++)
+        pthread_join(tinfo[i].tid, NULL);
+    elapsed = now() - start_time;
+
+    printf("%-8s %9s %7s %9s %9s %9s %9s\n", "type", "requests", "errors",
+           "p50(ms)", "p99(ms)", "p99.9(ms)", "max(ms)");
+    for (k = 0; k < NKINDS; k++) {
+        if (weights[k] == 0)
+            continue;
+        memset(&s, 0, sizeof(s));
+        merge_samples(tinfo, k, &s);
+        errors = 0;
+        for (i = 0; i < n_threads; i++)
+            errors += tinfo[i].errors[k];
+        total_errors += errors;
+        print_line(kind_names[k], &s, errors);
+        for (i = 0; (size_t)i < s.n; i++)
+            add_sample(&all, s.vals[i]);
+        free(s.vals);
+    }
+    if (all.n > 0)
+        qsort(all.vals, all.n, sizeof(*all.vals), compare_doubles);
+    print_line("total", &all, total_errors);
+    printf("%lu requests in %.3f seconds with %d threads: %.1f requests/sec\n",
+           (unsigned long)all.n, elapsed, n_threads,
+           (elapsed > 0) ? all.n / elapsed : 0);
+
+    free(all.vals);
+    for (i = 0; i < n_threads; i++)
+        free_thread(&tinfo[i]);
+    free(tinfo);
+    return (total_errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#!/usr/bin/python
+from k5test import *
+
+# Run a short kdc_bench load against a test realm, covering each request
+# type.  This script is run by "make bench", not by make check.  For real
+# measurements, use larger values of KDC_BENCH_THREADS and KDC_BENCH_REQUESTS
+# (or tune the KDC being tested) and run with -v to see the report.
+nthreads = os.environ.get('KDC_BENCH_THREADS', '4')
+nrequests = os.environ.get('KDC_BENCH_REQUESTS', '200')
+
+realm = K5Realm(create_user=False, create_host=False)
+pw = password('bench')
+realm.addprinc('user', pw)
+realm.addprinc('pauser', pw)
+realm.run_kadminl('modprinc +requires_preauth pauser')
+realm.addprinc('service', pw)
+realm.addprinc('krbtgt/FOREIGN')
+
+args = ['./kdc_bench', '-t', nthreads, '-n', nrequests, '-p', pw,
+        '-a', 'user', '-e', 'pauser', '-c', 'user', '-s', 'service',
+        '-x', 'FOREIGN', '-u', 'pauser']
+output = realm.run(args)
+for kind in ('as', 'as-pa', 'tgs', 'cross', 's4u', 'total'):
+    if kind + ' ' not in output:
+        fail('kdc_bench output missing %s line' % kind)
+if nrequests + ' requests in' not in output:
+    fail('kdc_bench did not complete all requests')
+
+# Exercise a weighted mix and a time-limited run.
+realm.run(['./kdc_bench', '-t', nthreads, '-d', '0.5', '-p', pw, '-c', 'user',
+           '-s', 'service', '-a', 'user', '-m', 'tgs:4,as:1'])
+
+success('KDC benchmark')
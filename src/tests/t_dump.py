@@ -98,4 +98,97 @@ out = realm.run_kadminl('getprinc user')
 if 'Policy: testpol' not in out:
     fail('Loading ov dump did not add user policy reference')
 
+# Round-trip the source dump through the binary format, and make sure
+# the resulting text dump is unchanged.
+bindump = os.path.join(realm.testdir, 'dump.bin')
+realm.run([kdb5_util, 'destroy', '-f'])
+realm.run([kdb5_util, 'load', srcdump])
+realm.run([kdb5_util, 'dump', '-binary', bindump])
+realm.run([kdb5_util, 'destroy', '-f'])
+realm.run([kdb5_util, 'load', bindump])
+dump_compare(realm, [], srcdump)
+
+# A truncated binary dump must not be loaded.
+f = open(bindump, 'rb')
+contents = f.read()
+f.close()
+f = open(bindump, 'wb')
+f.write(contents[:-20])
+f.close()
+realm.run([kdb5_util, 'load', bindump], expected_code=1)
+
+# A binary record with an absurd length must be rejected before the
+# loader tries to allocate space for it.
+pos = contents.index(b'\n') + 1 + 4
+f = open(bindump, 'wb')
+f.write(contents[:pos] + b'\xff\xff\xff\xf0' + contents[pos + 4:])
+f.close()
+out = realm.run([kdb5_util, 'load', bindump], expected_code=1)
+if 'record length is too large' not in out:
+    fail('Oversized binary record was not rejected')
+
+# Build a larger dump from the source dump, with policies interleaved
+# among the principal records, to exercise the -threads job ring and
+# the policy handoff in a pipelined load.
+f = open(srcdump, 'r')
+lines = f.readlines()
+f.close()
+princ_template = [l for l in lines if '\tuser/admin@KRBTEST.COM\t' in l][0]
+policy_template = [l for l in lines if l.startswith('policy\ttestpol\t')][0]
+bigdump = os.path.join(realm.testdir, 'dump.big')
+f = open(bigdump, 'w')
+f.writelines(lines)
+for i in range(1000):
+    name = 'load%04d@KRBTEST.COM' % i
+    fields = princ_template.split('\t')
+    fields[2] = str(len(name))
+    fields[6] = name
+    f.write('\t'.join(fields))
+    if i % 100 == 50:
+        f.write(policy_template.replace('testpol', 'pol%d' % i))
+f.close()
+
+def read_file(filename):
+    f = open(filename, 'r')
+    contents = f.read()
+    f.close()
+    return contents
+
+# A threaded dump must be byte-identical to a serial dump.
+realm.run([kdb5_util, 'destroy', '-f'])
+realm.run([kdb5_util, 'load', bigdump])
+realm.run([kdb5_util, 'dump', dumpfile])
+serial = read_file(dumpfile)
+if 'load0999@' not in serial or 'policy\tpol950\t' not in serial:
+    fail('Large dump is missing records')
+realm.run([kdb5_util, 'dump', '-threads', '3', dumpfile])
+if read_file(dumpfile) != serial:
+    fail('Threaded dump does not match serial dump')
+realm.run([kdb5_util, 'dump', '-r18', dumpfile])
+serial_r18 = read_file(dumpfile)
+realm.run([kdb5_util, 'dump', '-r18', '-threads', '2', dumpfile])
+if read_file(dumpfile) != serial_r18:
+    fail('Threaded r18 dump does not match serial dump')
+
+# A pipelined load must store the same principals and policies as a
+# serial one.
+realm.run([kdb5_util, 'destroy', '-f'])
+realm.run([kdb5_util, 'load', '-threads', '3', bigdump])
+realm.run([kdb5_util, 'dump', dumpfile])
+if read_file(dumpfile) != serial:
+    fail('Pipelined load does not round-trip')
+
+# A dump truncated in the middle of a key must be rejected by both
+# load paths, leaving the existing database alone.
+contents = read_file(bigdump)
+truncdump = os.path.join(realm.testdir, 'dump.trunc')
+f = open(truncdump, 'w')
+f.write(contents[:contents.index('\tload0500@') + 300])
+f.close()
+for opt in ([], ['-threads', '3']):
+    realm.run([kdb5_util, 'load'] + opt + [truncdump], expected_code=1)
+    realm.run([kdb5_util, 'dump', dumpfile])
+    if read_file(dumpfile) != serial:
+        fail('Database changed by failed load of truncated dump')
+
 success('Dump/load tests')
@@ -54,6 +54,16 @@ def check_serial(realm, expected, env=None):
         fail('Unexpected serial number')
 
 
+# Verify the number of entries and the last serial number in the iprop
+# log, on either the master or slave.
+def check_ulog(realm, num, last_serial, env=None):
+    out = realm.run([kproplog, '-h'], env=env)
+    if ('Number of entries : %d\n' % num) not in out:
+        fail('Unexpected number of ulog entries')
+    if ('Last serial # : %s\n' % last_serial) not in out:
+        fail('Unexpected last serial number')
+
+
 conf = {
     'realms': {'$realm': {
             'iprop_enable': 'true',
@@ -103,7 +113,10 @@ acl = open(acl_file, 'w')
 acl.write(realm.host_princ + '\n')
 acl.close()
 
-# Start kpropd and get a full dump from master.
+# Start kpropd and get a full dump from master.  Once it is in sync,
+# kpropd's requests are held by kadmind until there are updates, so
+# changes propagate without signalling kpropd (whose poll interval is
+# 600 seconds).  Signalling it makes it check its ulog and ask again.
 kpropd = realm.start_kpropd(slave, ['-d'])
 wait_for_prop(kpropd, True)
 out = realm.run_kadminl('listprincs', slave)
@@ -186,4 +199,93 @@ kpropd.send_signal(signal.SIGUSR1)
 wait_for_prop(kpropd, True)
 check_serial(realm, 'None', slave)
 
+# Make a change so the master ulog has an entry.  The slave's log is
+# empty after the last resync, so this propagates via full resync.
+realm.run_kadminl('modprinc -allow_tix w')
+check_ulog(realm, 1, '1')
+wait_for_prop(kpropd, True)
+
+# Load an iprop dump into the master with -update.  The loaded
+# principals should not be logged one by one; instead the ulog should
+# be reset once at the end of the load, forcing a full resync.
+realm.run([kdb5_util, 'dump', '-i', dumpfile])
+realm.run([kdb5_util, 'load', '-i', '-update', dumpfile])
+check_ulog(realm, 0, 'None')
+wait_for_prop(kpropd, True)
+check_ulog(realm, 0, 'None', slave)
+
+# Changes after the load are logged starting from serial number 1.
+realm.run_kadminl('modprinc +allow_tix w')
+check_ulog(realm, 1, '1')
+wait_for_prop(kpropd, True)
+check_ulog(realm, 0, '1', slave)
+out = realm.run_kadminl('getprinc w', slave)
+if 'Attributes:\n' not in out:
+    fail('Slave does not have modification from master after load')
+
+# Restart kadmind with group commit of update log syncs.  Changes made
+# through kadmind should still propagate incrementally, and the log
+# should be stable once they have been sent.
+realm.addprinc(realm.admin_princ, password('admin'))
+check_ulog(realm, 2, '2')
+wait_for_prop(kpropd, False)
+realm.stop_kpropd(kpropd)
+realm.stop_kadmind()
+gc_env = realm.special_env('gc', True, kdc_conf={
+        'realms': {'$realm': {'iprop_sync_delay': '100'}}})
+realm.start_kadmind(gc_env)
+kpropd = realm.start_kpropd(slave, ['-d'])
+wait_for_prop(kpropd, False)
+realm.prep_kadmin()
+realm.run_kadmin('modprinc -allow_tix w')
+wait_for_prop(kpropd, False)
+check_ulog(realm, 3, '3')
+check_ulog(realm, 2, '3', slave)
+out = realm.run([kproplog, '-h'])
+if 'Log state : Stable\n' not in out:
+    fail('Update log not stable after group commit')
+out = realm.run_kadminl('getprinc w', slave)
+if 'Attributes: DISALLOW_ALL_TIX' not in out:
+    fail('Slave does not have modification from group commit')
+
+# Simulate a crash while kadmind is deferring syncs, using a delay
+# long enough that nothing flushes the change first.  The log is left
+# unstable, so the next program to map it resets it, and the slave
+# performs a full resync.
+realm.stop_kpropd(kpropd)
+realm.stop_kadmind()
+slow_env = realm.special_env('slow', True, kdc_conf={
+        'realms': {'$realm': {'iprop_sync_delay': '600000'}}})
+realm.start_kadmind(slow_env)
+realm.run_kadmin('modprinc +allow_tix w')
+realm.stop_kadmind(signal.SIGKILL)
+out = realm.run([kproplog, '-h'])
+if 'Log state : Unstable\n' not in out:
+    fail('Update log not unstable after crash during group commit')
+realm.run_kadminl('getprinc w')
+check_ulog(realm, 0, 'None')
+realm.start_kadmind()
+kpropd = realm.start_kpropd(slave, ['-d'])
+wait_for_prop(kpropd, True)
+out = realm.run_kadminl('getprinc w', slave)
+if 'Attributes:\n' not in out:
+    fail('Slave does not have modification made before crash')
+
+# Check that a one-shot kpropd, which never asks the master to hold its
+# request, still picks up a change incrementally.  The first change
+# after the log reset propagates via full resync.
+realm.run_kadminl('modprinc -allow_tix w')
+check_ulog(realm, 1, '1')
+wait_for_prop(kpropd, True)
+realm.stop_kpropd(kpropd)
+realm.run_kadminl('modprinc +allow_tix w')
+out = realm.run([kpropd, '-d', '-t', '-P', str(realm.portbase + 3),
+                 '-f', os.path.join(realm.testdir, 'incoming-slave-datatrans'),
+                 '-p', kdb5_util, '-a', acl_file], slave)
+if 'Incremental updates:' not in out:
+    fail('One-shot kpropd did not get incremental updates')
+out = realm.run_kadminl('getprinc w', slave)
+if 'Attributes:\n' not in out:
+    fail('Slave does not have modification from one-shot kpropd')
+
 success('iprop tests')
@@ -32,4 +32,18 @@ output = realm.run_kadminl('modprinc -allow_tix ' + p)
 if 'Cannot lock database' in output:
     fail('krb5kdc still holds a lock on the principal db')
 
+# The KDC keeps its read handle open between lookups.  Make sure it
+# notices changes made by kadmin.local and by a full database load.
+realm.run_kadminl('modprinc +allow_tix ' + p)
+realm.run_kadminl('cpw -pw bar ' + p)
+realm.kinit(p, 'bar')
+dumpfile = os.path.join(realm.testdir, 'dump')
+realm.run([kdb5_util, 'dump', dumpfile])
+realm.run_kadminl('cpw -pw baz ' + p)
+realm.kinit(p, 'baz')
+realm.kinit(p, 'bar', expected_code=1)
+realm.run([kdb5_util, 'load', dumpfile])
+realm.kinit(p, 'bar')
+realm.kinit(p, 'baz', expected_code=1)
+
 success('KDB locking tests')
@@ -0,0 +1,80 @@
+#!/usr/bin/python
+
+import os
+
+from k5test import *
+
+conf_slave = {'dbmodules': {'db': {'database_name': '$testdir/db.slave'}}}
+
+realm = K5Realm(create_user=False)
+slave = realm.special_env('slave', True, kdc_conf=conf_slave)
+
+# Set up the kpropd acl file.
+acl_file = os.path.join(realm.testdir, 'kpropd-acl')
+acl = open(acl_file, 'w')
+acl.write(realm.host_princ + '\n')
+acl.close()
+
+realm.addprinc('wakawaka')
+dumpfile = os.path.join(realm.testdir, 'dump')
+realm.run([kdb5_util, 'dump', dumpfile])
+kprop_args = [kprop, '-f', dumpfile, '-P', str(realm.portbase + 3)]
+
+# Propagate the dump to a kpropd, which streams it into kdb5_util load
+# as it arrives.  The load is complete by the time kprop reports success.
+kpropd = realm.start_kpropd(slave, ['-d'])
+out = realm.run(kprop_args + [hostname])
+if 'Database propagation to %s: SUCCEEDED' % hostname not in out:
+    fail('Unexpected kprop output')
+realm.run([kdb5_util, 'stash', '-P', 'master'], slave)
+out = realm.run_kadminl('listprincs', slave)
+if 'wakawaka@' not in out:
+    fail('Slave does not have all principals from master')
+
+# kpropd still keeps the dump it received, for cascaded propagation.
+slavedump = os.path.join(realm.testdir, 'incoming-slave-datatrans')
+if open(slavedump).read() != open(dumpfile).read():
+    fail('Received dump file differs from the master dump')
+
+# Propagate to more than one slave in a single kprop run.  Both are
+# served by the same kpropd, one connection after the other.
+realm.addprinc('w')
+realm.run([kdb5_util, 'dump', dumpfile])
+out = realm.run(kprop_args + [hostname, hostname])
+if out.count('Database propagation to %s: SUCCEEDED' % hostname) != 2:
+    fail('kprop did not propagate to both slaves')
+out = realm.run_kadminl('getprinc w', slave)
+if 'Principal: w@' not in out:
+    fail('Slave does not have principal added before second propagation')
+
+# A slave which cannot be reached makes kprop fail, but does not stop
+# propagation to the others.
+realm.addprinc('x')
+realm.run([kdb5_util, 'dump', dumpfile])
+out = realm.run(kprop_args + ['nonexistent.invalid', hostname],
+                expected_code=1)
+if 'Database propagation to %s: SUCCEEDED' % hostname not in out:
+    fail('kprop did not propagate to the reachable slave')
+out = realm.run_kadminl('getprinc x', slave)
+if 'Principal: x@' not in out:
+    fail('Slave does not have principal added before third propagation')
+realm.stop_kpropd(kpropd)
+
+# A dump read from standard input is only made live if it ends with an
+# end record, so a stream which is cut short (as when kpropd is killed
+# mid-transfer) leaves the existing database alone.
+realm.addprinc('y')
+realm.run([kdb5_util, 'dump', dumpfile])
+dump = open(dumpfile).read()
+out = realm.run([kdb5_util, 'load', '-'], slave, input=dump, expected_code=1)
+if 'ended without an end record' not in out:
+    fail('Unexpected kdb5_util load output for unterminated stream')
+out = realm.run_kadminl('getprinc y', slave)
+if 'Principal does not exist' not in out:
+    fail('Unterminated stream was made live')
+realm.run([kdb5_util, 'load', '-'], slave, input=dump + 'End\n')
+out = realm.run_kadminl('getprinc y', slave)
+if 'Principal: y@' not in out:
+    fail('Terminated stream was not loaded')
+
+success('kprop tests')
@@ -1,6 +1,7 @@
 #!/usr/bin/python
 from k5test import *
 import re
+import time
 
 realm = K5Realm(create_host=False)
 
@@ -100,6 +101,50 @@ if 'Clients credentials have been revoked while getting initial credentials' \
 output = realm.run_kadminl('modprinc -unlock user')
 realm.kinit(realm.user_princ, password('user'))
 
+# With lockout_write_delay, the KDC queues lockout changes instead of
+# writing them for each request, except when they lock out the account.
+realm.run_kadminl('modpol -maxfailure 3 lockout')
+realm.run_kadminl('addprinc -pw pw +requires_preauth -policy lockout lockuser')
+conf = {'dbmodules': {'db': {'lockout_write_delay': '1h'}}}
+delay_env = realm.special_env('lockout_delay', True, kdc_conf=conf)
+realm.stop_kdc()
+realm.start_kdc(env=delay_env)
+realm.run([kinit, 'lockuser'], input='wrong\n', expected_code=1)
+realm.run([kinit, 'lockuser'], input='wrong\n', expected_code=1)
+if 'Failed password attempts: 0' not in realm.run_kadminl('getprinc lockuser'):
+    fail('Failure count written without delay')
+realm.run([kinit, 'lockuser'], input='wrong\n', expected_code=1)
+if 'Failed password attempts: 3' not in realm.run_kadminl('getprinc lockuser'):
+    fail('Lockout not written immediately')
+output = realm.run([kinit, 'lockuser'], input='pw\n', expected_code=1)
+if 'Clients credentials have been revoked' not in output:
+    fail('Expected lockout error message not seen with lockout_write_delay')
+
+# Queued changes are written when the KDC exits.
+realm.run_kadminl('modprinc -unlock lockuser')
+realm.run([kinit, 'lockuser'], input='pw\n')
+output = realm.run_kadminl('getprinc lockuser')
+if 'Last successful authentication: [never]' not in output:
+    fail('Last successful authentication written without delay')
+realm.stop_kdc()
+output = realm.run_kadminl('getprinc lockuser')
+if 'Last successful authentication: [never]' in output:
+    fail('Queued last successful authentication not written at exit')
+
+# Queued changes are written within the delay even if the KDC receives no
+# further requests, including by worker processes.
+conf = {'dbmodules': {'db': {'lockout_write_delay': '5s'}}}
+short_env = realm.special_env('lockout_short', True, kdc_conf=conf)
+realm.start_kdc(['-w', '2'], env=short_env)
+realm.run([kinit, 'lockuser'], input='wrong\n', expected_code=1)
+if 'Failed password attempts: 0' not in realm.run_kadminl('getprinc lockuser'):
+    fail('Failure count written without delay')
+time.sleep(6)
+if 'Failed password attempts: 1' not in realm.run_kadminl('getprinc lockuser'):
+    fail('Queued failure not written within the delay by an idle KDC')
+realm.stop_kdc()
+realm.start_kdc()
+
 # Make sure a nonexistent policy reference doesn't prevent authentication.
 realm.run_kadminl('delpol -force lockout')
 realm.kinit(realm.user_princ, password('user'))
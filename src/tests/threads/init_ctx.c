@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <krb5.h>
+#include <profile.h>
 /* for SIZE_MAX: */
 #include "k5-platform.h"
 
@@ -59,6 +60,9 @@ static char *prog;
 static unsigned int n_threads = N_THREADS;
 static int iter_count = ITER_COUNT;
 static int do_pause;
+static int use_profile;
+static int get_realm;
+static profile_t shared_profile;
 
 static void usage (void) __attribute__((noreturn));
 
@@ -73,6 +77,8 @@ usage ()
              ITER_COUNT);
     fprintf (stderr, "\t-K\tinitialize a krb5_context for the duration\n");
     fprintf (stderr, "\t-P\tpause briefly after starting, to allow attaching dtrace/strace/etc\n");
+    fprintf (stderr, "\t-p\tcreate contexts from a profile obtained once\n");
+    fprintf (stderr, "\t-r\tlook up the default realm in each context\n");
     exit (1);
 }
 
@@ -94,7 +100,7 @@ numarg (char *arg)
     usage ();
 }
 
-static char optstring[] = "t:i:KP";
+static char optstring[] = "t:i:KPpr";
 
 static void
 process_options (int argc, char *argv[])
@@ -132,6 +138,14 @@ process_options (int argc, char *argv[])
         case 'P':
             do_pause = 1;
             break;
+
+        case 'p':
+            use_profile = 1;
+            break;
+
+        case 'r':
+            get_realm = 1;
+            break;
         }
     }
     if (argc != optind)
@@ -162,14 +176,26 @@ static void run_iterations (struct resource_info *r)
     int i;
     krb5_error_code err;
     krb5_context ctx;
+    char *realm;
 
     r->start_time = now ();
     for (i = 0; i < iter_count; i++) {
-        err = krb5_init_context(&ctx);
+        if (use_profile)
+            err = krb5_init_context_profile(shared_profile, 0, &ctx);
+        else
+            err = krb5_init_context(&ctx);
         if (err) {
             com_err(prog, err, "initializing krb5 context");
             exit(1);
         }
+        if (get_realm) {
+            err = krb5_get_default_realm(ctx, &realm);
+            if (err) {
+                com_err(prog, err, "getting default realm");
+                exit(1);
+            }
+            krb5_free_default_realm(ctx, realm);
+        }
         krb5_free_context(ctx);
     }
     r->end_time = now ();
@@ -204,6 +230,16 @@ main (int argc, char *argv[])
         fprintf (stderr, "krb5_init_context error\n");
         exit (1);
     }
+    if (use_profile) {
+        krb5_context pctx;
+
+        if (krb5_init_context (&pctx) != 0 ||
+            krb5_get_profile (pctx, &shared_profile) != 0) {
+            fprintf (stderr, "error getting profile\n");
+            exit (1);
+        }
+        krb5_free_context (pctx);
+    }
     tinfo = calloc (n_threads, sizeof (*tinfo));
     if (tinfo == NULL) {
         perror ("calloc");
@@ -248,6 +284,8 @@ main (int argc, char *argv[])
     }
     if (init_krb5_first)
         krb5_free_context (kctx);
+    if (use_profile)
+        profile_release (shared_profile);
     foreach_thread (i) {
         printf ("Thread %2d: elapsed time %Lfs\n", i,
                 tvsub (tinfo[i].r.end_time, tinfo[i].r.start_time));
@@ -0,0 +1,198 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/threads/prng-perf.c - PRNG contention benchmark */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure how well krb5_c_random_make_octets scales across threads.  Each
+ * thread repeatedly generates random bytes of the requested size, optionally
+ * adding a little entropy first the way the KDC does for each request.
+ *
+ * usage: prng-perf [-t threads] [-i iterations] [-s size] [-e]
+ */
+
+#include "k5-int.h"
+#include <pthread.h>
+
+#define DEFAULT_N_THREADS 4
+#define DEFAULT_ITER_COUNT 100000
+#define DEFAULT_SIZE 32
+
+struct thread_info {
+    pthread_t tid;
+    int idx;
+    struct timeval start, end;
+};
+
+static const char *prog;
+static krb5_context ctx;
+static int n_threads = DEFAULT_N_THREADS;
+static int iter_count = DEFAULT_ITER_COUNT;
+static int req_size = DEFAULT_SIZE;
+static int add_entropy;
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-i iterations] [-s size] [-e]\n",
+            prog);
+    exit(1);
+}
+
+static int
+numarg(const char *arg)
+{
+    char *end;
+    long val;
+
+    val = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || val < 1 || val > INT_MAX)
+        usage();
+    return val;
+}
+
+static double
+tvsub(struct timeval t1, struct timeval t2)
+{
+    return (t1.tv_sec - t2.tv_sec) + 1.0e-6 * (t1.tv_usec - t2.tv_usec);
+}
+
+static void *
+thread_proc(void *ptr)
+{
+    struct thread_info *ti = ptr;
+    krb5_error_code ret;
+    krb5_data out, entropy;
+    struct timeval tv;
+    char *buf;
+    int i;
+
+    buf = malloc(req_size);
+    if (buf == NULL)
+        abort();
+    out = make_data(buf, req_size);
+    entropy = make_data(&tv, sizeof(tv));
+    gettimeofday(&ti->start, NULL);
+    for (i = 0; i < iter_count; i++) {
+        if (add_entropy) {
+            gettimeofday(&tv, NULL);
+            ret = krb5_c_random_add_entropy(ctx,
+                                            KRB5_C_RANDSOURCE_EXTERNAL_PROTOCOL,
+                                            &entropy);
+            if (ret) {
+                com_err(prog, ret, "adding entropy");
+                exit(1);
+            }
+        }
+        ret = krb5_c_random_make_octets(ctx, &out);
+        if (ret) {
+            com_err(prog, ret, "generating random bytes");
+            exit(1);
+        }
+    }
+    gettimeofday(&ti->end, NULL);
+    free(buf);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_error_code ret;
+    struct thread_info *tinfo;
+    struct timeval start, end;
+    double elapsed, total_ops;
+    int c, i, err;
+
+    prog = strrchr(argv[0], '/');
+    prog = (prog == NULL) ? argv[0] : prog + 1;
+    while ((c = getopt(argc, argv, "t:i:s:e")) != -1) {
+        switch (c) {
+        case 't':
+            n_threads = numarg(optarg);
+            break;
+        case 'i':
+            iter_count = numarg(optarg);
+            break;
+        case 's':
+            req_size = numarg(optarg);
+            break;
+        case 'e':
+            add_entropy = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc)
+        usage();
+
+    ret = krb5_init_context(&ctx);
+    if (ret) {
+        com_err(prog, ret, "initializing krb5 context");
+        exit(1);
+    }
+    tinfo = calloc(n_threads, sizeof(*tinfo));
+    if (tinfo == NULL)
+        abort();
+
+    printf("Threads: %d  iterations: %d  request size: %d%s\n", n_threads,
+           iter_count, req_size, add_entropy ? "  (adding entropy)" : "");
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_threads; i++) {
+        tinfo[i].idx = i;
+        err = pthread_create(&tinfo[i].tid, NULL, thread_proc, &tinfo[i]);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_threads; i++) {
+        err = pthread_join(tinfo[i].tid, NULL);
+        if (err) {
+            fprintf(stderr, "pthread_join: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < n_threads; i++) {
+        printf("Thread %2d: elapsed time %.3fs\n", tinfo[i].idx,
+               tvsub(tinfo[i].end, tinfo[i].start));
+    }
+    elapsed = tvsub(end, start);
+    total_ops = (double)n_threads * iter_count;
+    printf("Overall: %.3fs, %.0f requests/s, %.3fus per request\n", elapsed,
+           total_ops / elapsed, 1.0e6 * elapsed / total_ops);
+
+    free(tinfo);
+    krb5_free_context(ctx);
+    return 0;
+}
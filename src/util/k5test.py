@@ -237,8 +237,8 @@ Scripts may use the following realm methods and attributes:
 * realm.start_kadmind(env=None): Start a kadmind process.  Errors if a
   kadmind is already running.
 
-* realm.stop_kadmind(): Stop the kadmind process.  Errors if no
-  kadmind is running.
+* realm.stop_kadmind(sig=signal.SIGTERM): Stop the kadmind process by
+  sending it the signal sig.  Errors if no kadmind is running.
 
 * realm.stop(): Stop any daemon processes running on behalf of the
   realm.
@@ -683,9 +683,9 @@ def _start_daemon(args, env, sentinel):
     return proc
 
 
-def stop_daemon(proc):
+def stop_daemon(proc, sig=signal.SIGTERM):
     output('*** Terminating process %d\n' % proc.pid)
-    os.kill(proc.pid, signal.SIGTERM)
+    os.kill(proc.pid, sig)
     proc.wait()
     _daemons.remove(proc)
 
@@ -876,9 +876,9 @@ class K5Realm(object):
                                             '-F', dump_path], env,
                                            'starting...')
 
-    def stop_kadmind(self):
+    def stop_kadmind(self, sig=signal.SIGTERM):
         assert(self._kadmind_proc is not None)
-        stop_daemon(self._kadmind_proc)
+        stop_daemon(self._kadmind_proc, sig)
         self._kadmind_proc = None
 
     def start_kpropd(self, env, args=[]):
@@ -891,6 +891,10 @@ class K5Realm(object):
         self._kpropd_procs.append(proc)
         return proc
 
+    def stop_kpropd(self, proc):
+        stop_daemon(proc)
+        self._kpropd_procs.remove(proc)
+
     def stop(self):
         if self._kdc_proc:
             self.stop_kdc()
@@ -45,6 +45,11 @@ static struct global_shared_profile_data krb5int_profile_shared_data = {
     K5_MUTEX_PARTIAL_INITIALIZER
 };
 
+/* Number of times any file data has been (re)loaded, so that callers can
+ * cache values derived from a profile until its files change. */
+static unsigned long g_reload_count;
+static k5_mutex_t g_reload_count_mutex = K5_MUTEX_PARTIAL_INITIALIZER;
+
 MAKE_INIT_FUNCTION(profile_library_initializer);
 MAKE_FINI_FUNCTION(profile_library_finalizer);
 
@@ -53,8 +58,13 @@ int profile_library_initializer(void)
 #ifdef SHOW_INITFINI_FUNCS
     printf("profile_library_initializer\n");
 #endif
+    int err;
+
     add_error_table(&et_prof_error_table);
 
+    err = k5_mutex_finish_init(&g_reload_count_mutex);
+    if (err)
+        return err;
     return k5_mutex_finish_init(&g_shared_trees_mutex);
 }
 void profile_library_finalizer(void)
@@ -69,6 +79,7 @@ void profile_library_finalizer(void)
     printf("profile_library_finalizer\n");
 #endif
     k5_mutex_destroy(&g_shared_trees_mutex);
+    k5_mutex_destroy(&g_reload_count_mutex);
 
     remove_error_table(&et_prof_error_table);
 }
@@ -365,6 +376,10 @@ errcode_t profile_update_file_data_locked(prf_data_t data, char **ret_modspec)
     }
     set_cloexec_file(f);
     data->upd_serial++;
+    if (k5_mutex_lock(&g_reload_count_mutex) == 0) {
+        g_reload_count++;
+        k5_mutex_unlock(&g_reload_count_mutex);
+    }
     data->flags &= PROFILE_FILE_SHARED;  /* FIXME same as '=' operator */
     retval = profile_parse_file(f, &data->root, ret_modspec);
     fclose(f);
@@ -379,6 +394,24 @@ errcode_t profile_update_file_data_locked(prf_data_t data, char **ret_modspec)
     return 0;
 }
 
+/*
+ * Return a count which changes whenever any profile file data is loaded or
+ * reloaded.  Values derived from a profile remain valid while the count is
+ * unchanged, unless the profile itself is modified.
+ */
+unsigned long profile_reload_count(void)
+{
+    unsigned long count;
+
+    if (CALL_INIT_FUNCTION(profile_library_initializer) != 0)
+        return 0;
+    if (k5_mutex_lock(&g_reload_count_mutex) != 0)
+        return 0;
+    count = g_reload_count;
+    k5_mutex_unlock(&g_reload_count_mutex);
+    return count;
+}
+
 errcode_t profile_update_file_data(prf_data_t data, char **ret_modspec)
 {
     errcode_t retval, retval2;
@@ -304,6 +304,32 @@ copy_vtable_profile(profile_t profile, profile_t *ret_new_profile)
         (COUNT) = cll_counter;                          \
     }
 
+/*
+ * Return nonzero if a and b are file-based profiles which use the same shared
+ * file data, in the same order, and neither has been modified.  With
+ * profile_reload_count(), this lets a caller recognize a profile whose values
+ * it has already read.
+ */
+int
+profile_shares_data(profile_t a, profile_t b)
+{
+    prf_file_t fa, fb;
+
+    if (a == NULL || b == NULL || a->vt != NULL || b->vt != NULL)
+        return 0;
+    if (a->first_file == NULL)
+        return 0;
+    for (fa = a->first_file, fb = b->first_file; fa != NULL && fb != NULL;
+         fa = fa->next, fb = fb->next) {
+        if (fa->data != fb->data)
+            return 0;
+        if (!(fa->data->flags & PROFILE_FILE_SHARED) ||
+            (fa->data->flags & PROFILE_FILE_DIRTY))
+            return 0;
+    }
+    return fa == NULL && fb == NULL;
+}
+
 errcode_t KRB5_CALLCONV
 profile_copy(profile_t old_profile, profile_t *new_profile)
 {
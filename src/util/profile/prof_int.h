@@ -247,6 +247,11 @@ void profile_dereference_data_locked (prf_data_t);
 int profile_lock_global (void);
 int profile_unlock_global (void);
 
+unsigned long profile_reload_count (void);
+
+/* prof_init.c */
+int profile_shares_data (profile_t a, profile_t b);
+
 /* prof_init.c -- included from profile.h */
 errcode_t profile_ser_size
         (const char *, profile_t, size_t *);
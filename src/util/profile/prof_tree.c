@@ -15,6 +15,12 @@
  * A relation has as its value a pointer to allocated memory
  * containing a string.  Its first_child pointer must be null.
  *
+ * The children of a section are kept sorted by name, so nodes with the
+ * same name are adjacent; we call each such group a run.  To make lookups
+ * in large sections fast, each node caches a hash of its name, and a
+ * section with at least INDEX_MIN runs has a hash table of the first node
+ * of each run.  The table is maintained as nodes are added (by the parser
+ * or by profile updates) and renamed.
  */
 
 
@@ -35,15 +41,156 @@ struct profile_node {
     int group_level;
     unsigned int final:1;           /* Indicate don't search next file */
     unsigned int deleted:1;
+    unsigned int name_hash;
     struct profile_node *first_child;
     struct profile_node *parent;
     struct profile_node *next, *prev;
+    struct profile_node *hash_next; /* Next run in index bucket */
+    struct profile_node **index;    /* Run index of a section, or NULL */
+    unsigned int index_size;        /* Number of buckets in index */
+    unsigned int nruns;             /* Number of runs among children */
 };
 
 #define CHECK_MAGIC(node)                       \
     if ((node)->magic != PROF_MAGIC_NODE)       \
         return PROF_MAGIC_NODE;
 
+/* Sections with fewer runs than this are searched linearly. */
+#define INDEX_MIN 8
+
+#define SAME_NAME(node, str, hash)                                       \
+    ((node)->name_hash == (hash) && strcmp((node)->name, (str)) == 0)
+
+static unsigned int
+name_hash(const char *name)
+{
+    unsigned int h = 2166136261U;
+
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619;
+    }
+    return h;
+}
+
+/* Return true if node is the first node of its run. */
+static int
+is_run_head(struct profile_node *node)
+{
+    return node->prev == NULL ||
+        !SAME_NAME(node->prev, node->name, node->name_hash);
+}
+
+/* (Re)build the run index of section with room for at least its current
+ * runs.  On allocation failure the section is left unindexed. */
+static void
+build_index(struct profile_node *section)
+{
+    struct profile_node *p, **bucket;
+    unsigned int size = 16;
+
+    free(section->index);
+    section->index = NULL;
+    section->index_size = 0;
+    while (size < section->nruns)
+        size *= 2;
+    section->index = calloc(size, sizeof(*section->index));
+    if (section->index == NULL)
+        return;
+    section->index_size = size;
+    for (p = section->first_child; p != NULL; p = p->next) {
+        if (!is_run_head(p))
+            continue;
+        bucket = &section->index[p->name_hash & (size - 1)];
+        p->hash_next = *bucket;
+        *bucket = p;
+    }
+}
+
+/* Account for node, which has just been linked into its parent's children,
+ * in the parent's run index. */
+static void
+index_add(struct profile_node *node)
+{
+    struct profile_node *section = node->parent, **pp;
+
+    if (!is_run_head(node))
+        return;
+    if (node->next != NULL &&
+        SAME_NAME(node->next, node->name, node->name_hash)) {
+        /* node now leads an existing run; replace the old head. */
+        if (section->index == NULL)
+            return;
+        pp = &section->index[node->name_hash & (section->index_size - 1)];
+        while (*pp != node->next)
+            pp = &(*pp)->hash_next;
+        node->hash_next = node->next->hash_next;
+        *pp = node;
+        return;
+    }
+    section->nruns++;
+    if (section->nruns >= INDEX_MIN &&
+        (section->index == NULL || section->nruns > section->index_size)) {
+        build_index(section);
+        return;
+    }
+    if (section->index == NULL)
+        return;
+    pp = &section->index[node->name_hash & (section->index_size - 1)];
+    node->hash_next = *pp;
+    *pp = node;
+}
+
+/* Remove node, which is about to be unlinked from its parent's children or
+ * renamed, from the parent's run index. */
+static void
+index_remove(struct profile_node *node)
+{
+    struct profile_node *section = node->parent, **pp;
+    struct profile_node *next = node->next;
+    int run_continues;
+
+    if (!is_run_head(node))
+        return;
+    run_continues = (next != NULL &&
+                     SAME_NAME(next, node->name, node->name_hash));
+    if (!run_continues)
+        section->nruns--;
+    if (section->index == NULL)
+        return;
+    pp = &section->index[node->name_hash & (section->index_size - 1)];
+    while (*pp != node)
+        pp = &(*pp)->hash_next;
+    if (run_continues) {
+        next->hash_next = node->hash_next;
+        *pp = next;
+    } else {
+        *pp = node->hash_next;
+    }
+    node->hash_next = NULL;
+}
+
+/* Return the first child of section named name, or NULL if there is none. */
+static struct profile_node *
+find_run(struct profile_node *section, const char *name, unsigned int hash)
+{
+    struct profile_node *p;
+
+    if (section->index != NULL) {
+        p = section->index[hash & (section->index_size - 1)];
+        for (; p != NULL; p = p->hash_next) {
+            if (SAME_NAME(p, name, hash))
+                return p;
+        }
+        return NULL;
+    }
+    for (p = section->first_child; p != NULL; p = p->next) {
+        if (SAME_NAME(p, name, hash))
+            return p;
+    }
+    return NULL;
+}
+
 /*
  * Free a node, and any children
  */
@@ -58,6 +205,7 @@ void profile_free_node(struct profile_node *node)
         free(node->name);
     if (node->value)
         free(node->value);
+    free(node->index);
 
     for (child=node->first_child; child; child = next) {
         next = child->next;
@@ -100,6 +248,7 @@ errcode_t profile_create_node(const char *name, const char *value,
         profile_free_node(new);
         return ENOMEM;
     }
+    new->name_hash = name_hash(name);
     if (value) {
         new->value = strdup(value);
         if (new->value == 0) {
@@ -121,6 +270,7 @@ errcode_t profile_verify_node(struct profile_node *node)
 {
     struct profile_node *p, *last;
     errcode_t       retval;
+    unsigned int    nruns = 0;
 
     CHECK_MAGIC(node);
 
@@ -133,6 +283,13 @@ errcode_t profile_verify_node(struct profile_node *node)
             return PROF_BAD_LINK_LIST;
         if (last && (last->next != p))
             return PROF_BAD_LINK_LIST;
+        if (last && strcmp(last->name, p->name) > 0)
+            return PROF_BAD_LINK_LIST;
+        if (is_run_head(p)) {
+            nruns++;
+            if (find_run(node, p->name, p->name_hash) != p)
+                return PROF_BAD_LINK_LIST;
+        }
         if (node->group_level+1 != p->group_level)
             return PROF_BAD_GROUP_LVL;
         if (p->parent != node)
@@ -141,6 +298,8 @@ errcode_t profile_verify_node(struct profile_node *node)
         if (retval)
             return retval;
     }
+    if (nruns != node->nruns)
+        return PROF_BAD_LINK_LIST;
     return 0;
 }
 
@@ -158,20 +317,30 @@ errcode_t profile_add_node(struct profile_node *section, const char *name,
     if (section->value)
         return PROF_ADD_NOT_SECTION;
 
+    retval = profile_create_node(name, value, &new);
+    if (retval)
+        return retval;
+
     /*
      * Find the place to insert the new node.  We look for the
      * place *after* the last match of the node name, since
-     * order matters.
+     * order matters.  If there is already a run of nodes with
+     * this name, we only need to find its end.
      */
-    for (p=section->first_child, last = 0; p; last = p, p = p->next) {
-        int cmp;
-        cmp = strcmp(p->name, name);
-        if (cmp > 0)
-            break;
+    p = find_run(section, name, new->name_hash);
+    if (p) {
+        while (p->next && SAME_NAME(p->next, name, new->name_hash))
+            p = p->next;
+        last = p;
+        p = p->next;
+    } else {
+        for (p=section->first_child, last = 0; p; last = p, p = p->next) {
+            int cmp;
+            cmp = strcmp(p->name, name);
+            if (cmp > 0)
+                break;
+        }
     }
-    retval = profile_create_node(name, value, &new);
-    if (retval)
-        return retval;
     new->group_level = section->group_level+1;
     new->deleted = 0;
     new->parent = section;
@@ -183,6 +352,7 @@ errcode_t profile_add_node(struct profile_node *section, const char *name,
         last->next = new;
     else
         section->first_child = new;
+    index_add(new);
     if (ret_node)
         *ret_node = new;
     return 0;
@@ -246,17 +416,25 @@ errcode_t profile_find_node(struct profile_node *section, const char *name,
                             struct profile_node **node)
 {
     struct profile_node *p;
+    unsigned int hash = 0;
 
     CHECK_MAGIC(section);
+    if (name)
+        hash = name_hash(name);
     p = *state;
     if (p) {
         CHECK_MAGIC(p);
-    } else
+    } else if (name)
+        p = find_run(section, name, hash);
+    else
         p = section->first_child;
 
+    /* Matching nodes are adjacent, so stop at the end of the run. */
     for (; p; p = p->next) {
-        if (name && (strcmp(p->name, name)))
-            continue;
+        if (name && !SAME_NAME(p, name, hash)) {
+            p = NULL;
+            break;
+        }
         if (section_flag) {
             if (p->value)
                 continue;
@@ -283,8 +461,10 @@ errcode_t profile_find_node(struct profile_node *section, const char *name,
      * there's guaranteed to be another match that's returned.
      */
     for (p = p->next; p; p = p->next) {
-        if (name && (strcmp(p->name, name)))
-            continue;
+        if (name && !SAME_NAME(p, name, hash)) {
+            p = NULL;
+            break;
+        }
         if (section_flag) {
             if (p->value)
                 continue;
@@ -387,6 +567,7 @@ struct profile_node_iterator {
     int                     flags;
     const char              *const *names;
     const char              *name;
+    unsigned int            name_hash;
     prf_file_t              file;
     int                     file_serial;
     int                     done_idx;
@@ -457,6 +638,7 @@ errcode_t profile_node_iterator(void **iter_p,
     const char                      *const *cpp;
     errcode_t                       retval;
     int                             skip_num = 0;
+    unsigned int                    hash;
 
     if (!iter || iter->magic != PROF_MAGIC_NODE_ITERATOR)
         return PROF_MAGIC_NODE_ITERATOR;
@@ -526,9 +708,12 @@ get_new_file:
         section = iter->file->data->root;
         assert(section != NULL);
         for (cpp = iter->names; cpp[iter->done_idx]; cpp++) {
-            for (p=section->first_child; p; p = p->next) {
-                if (!strcmp(p->name, *cpp) && !p->value)
-                    break;
+            hash = name_hash(*cpp);
+            p = find_run(section, *cpp, hash);
+            while (p && p->value) {
+                p = p->next;
+                if (p && !SAME_NAME(p, *cpp, hash))
+                    p = NULL;
             }
             if (!p) {
                 section = 0;
@@ -552,15 +737,22 @@ get_new_file:
             goto get_new_file;
         }
         iter->name = *cpp;
-        iter->node = section->first_child;
+        if (iter->name) {
+            iter->name_hash = name_hash(iter->name);
+            iter->node = find_run(section, iter->name, iter->name_hash);
+        } else {
+            iter->node = section->first_child;
+        }
     }
     /*
      * OK, now we know iter->node is set up correctly.  Let's do
      * the search.
      */
     for (p = iter->node; p; p = p->next) {
-        if (iter->name && strcmp(p->name, iter->name))
-            continue;
+        if (iter->name && !SAME_NAME(p, iter->name, iter->name_hash)) {
+            p = NULL;
+            break;
+        }
         if ((iter->flags & PROFILE_ITER_SECTIONS_ONLY) &&
             p->value)
             continue;
@@ -666,6 +858,8 @@ errcode_t profile_rename_node(struct profile_node *node, const char *new_name)
     if (!new_string)
         return ENOMEM;
 
+    index_remove(node);
+
     /*
      * Find the place to where the new node should go.  We look
      * for the place *after* the last match of the node name,
@@ -705,5 +899,7 @@ errcode_t profile_rename_node(struct profile_node *node, const char *new_name)
 
     free(node->name);
     node->name = new_string;
+    node->name_hash = name_hash(new_string);
+    index_add(node);
     return 0;
 }
@@ -0,0 +1,161 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* util/profile/test_index.c - Test lookups in large profile sections */
+/*
+ * Copyright (C) 2013 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Parse a profile with large sections whose entries are not in sorted order,
+ * and check that lookups and updates work and leave the tree consistent.
+ */
+
+#include "k5-platform.h"
+#include "profile.h"
+#include "prof_int.h"
+
+#define NREALMS 300
+#define NDOMAINS 1000
+#define FILENAME "./test_index.ini"
+
+static void
+check_tree(profile_t pr)
+{
+    assert(profile_verify_node(pr->first_file->data->root) == 0);
+}
+
+static void
+check_string(profile_t pr, const char *section, const char *subsection,
+             const char *name, const char *expected)
+{
+    char *val;
+
+    assert(profile_get_string(pr, section, subsection, name, NULL,
+                              &val) == 0);
+    if (expected == NULL) {
+        assert(val == NULL);
+    } else {
+        assert(val != NULL && strcmp(val, expected) == 0);
+        profile_release_string(val);
+    }
+}
+
+static void
+check_kdcs(profile_t pr, const char *realm, int n)
+{
+    const char *names[4];
+    char **values, buf[64];
+
+    names[0] = "realms";
+    names[1] = realm;
+    names[2] = "kdc";
+    names[3] = NULL;
+    assert(profile_get_values(pr, names, &values) == 0);
+    snprintf(buf, sizeof(buf), "kdc%d-b", n);
+    assert(values[0] != NULL && strcmp(values[0], buf) == 0);
+    snprintf(buf, sizeof(buf), "kdc%d-a", n);
+    assert(values[1] != NULL && strcmp(values[1], buf) == 0);
+    assert(values[2] == NULL);
+    profile_free_list(values);
+}
+
+int
+main()
+{
+    profile_t pr;
+    FILE *f;
+    const char *names[4];
+    char realm[32], domain[32], expected[32];
+    int i, n;
+
+    /* Write the sections in a scrambled order. */
+    f = fopen(FILENAME, "w");
+    assert(f != NULL);
+    fprintf(f, "[realms]\n");
+    for (i = 0; i < NREALMS; i++) {
+        n = (i * 7) % NREALMS;
+        fprintf(f, "\tR%d = {\n\t\tkdc = kdc%d-b\n\t\tadmin_server = a%d\n"
+                "\t\tkdc = kdc%d-a\n\t}\n", n, n, n, n);
+    }
+    fprintf(f, "[domain_realm]\n");
+    for (i = 0; i < NDOMAINS; i++) {
+        n = (i * 13) % NDOMAINS;
+        fprintf(f, "\t.dom%d.example = R%d\n", n, n % NREALMS);
+        fprintf(f, "\tdom%d.example = R%d\n", n, n % NREALMS);
+    }
+    fprintf(f, "[libdefaults]\n\tdefault_realm = R0\n");
+    fclose(f);
+
+    assert(profile_init_path(FILENAME, &pr) == 0);
+    check_tree(pr);
+
+    for (i = 0; i < NDOMAINS; i++) {
+        snprintf(domain, sizeof(domain), ".dom%d.example", i);
+        snprintf(expected, sizeof(expected), "R%d", i % NREALMS);
+        check_string(pr, "domain_realm", domain, NULL, expected);
+        check_string(pr, "domain_realm", domain + 1, NULL, expected);
+    }
+    check_string(pr, "domain_realm", ".nodom.example", NULL, NULL);
+    check_string(pr, "libdefaults", "default_realm", NULL, "R0");
+    for (i = 0; i < NREALMS; i++) {
+        snprintf(realm, sizeof(realm), "R%d", i);
+        check_kdcs(pr, realm, i);
+        snprintf(expected, sizeof(expected), "a%d", i);
+        check_string(pr, "realms", realm, "admin_server", expected);
+    }
+    check_string(pr, "realms", "R1000", "kdc", NULL);
+
+    /* Rename a realm section and add and remove relations. */
+    names[0] = "realms";
+    names[1] = "R5";
+    names[2] = NULL;
+    assert(profile_rename_section(pr, names, "R5000") == 0);
+    check_tree(pr);
+    check_string(pr, "realms", "R5", "kdc", NULL);
+    check_kdcs(pr, "R5000", 5);
+    names[1] = "R6";
+    assert(profile_rename_section(pr, names, "R7") == 0);
+    check_tree(pr);
+    check_string(pr, "realms", "R6", "kdc", NULL);
+    check_string(pr, "realms", "R7", "admin_server", "a7");
+    names[0] = "domain_realm";
+    names[1] = "new.example";
+    assert(profile_add_relation(pr, names, "R1") == 0);
+    names[1] = "dom3.example";
+    assert(profile_add_relation(pr, names, "R2") == 0);
+    assert(profile_clear_relation(pr, names) == 0);
+    check_tree(pr);
+    check_string(pr, "domain_realm", "new.example", NULL, "R1");
+    check_string(pr, "domain_realm", "dom3.example", NULL, NULL);
+    check_string(pr, "domain_realm", ".dom3.example", NULL, "R3");
+
+    profile_abandon(pr);
+    remove(FILENAME);
+    return 0;
+}